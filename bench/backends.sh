@@ -0,0 +1,20 @@
+#!/bin/sh
+# Compares the event backends on kept-alive and churning connections
+# Usage: bench/backends.sh [requests] [concurrency]
+
+SERVER=./web-server-$(uname -s)-$(uname -p)
+CLIENT=bench/ws-bench
+PORT=${PORT:-28080}
+TOTAL=${1:-50000}
+CONCURRENCY=${2:-64}
+
+for backend in select epoll io_uring; do
+    $SERVER root -p $PORT -e $backend $SERVER_FLAGS > /dev/null 2>&1 &
+    PID=$!
+    sleep 0.5
+
+    $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY -k -u /index.html | sed "s/^/backend=$backend scenario=keep_alive /"
+    $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY -u /index.html | sed "s/^/backend=$backend scenario=churn /"
+    kill -INT $PID
+    wait $PID
+done
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Requests a small page over and over while a few connections download a
+# large file that has been dropped from the page cache, with file work on
+# the event loop (-j 0) and on the disk pool. Prints the small requests'
+# latency and the downloads' throughput for each, from the same run
+# Usage: bench/disk.sh [small-requests] [downloads]
+
+SERVER=$(pwd)/web-server-$(uname -s)-$(uname -p)
+CLIENT=bench/ws-bench
+PORT=${PORT:-28080}
+SMALL=${1:-50000}
+DOWNLOADS=${2:-16}
+BULK_CLIENTS=${BULK_CLIENTS:-4}
+BULK_SIZE=${BULK_SIZE:-256}
+
+# A copy of the bundled root with the large file in it
+SITE=$(mktemp -d)
+cp -r root/. $SITE
+head -c $((BULK_SIZE * 1024 * 1024)) /dev/urandom > $SITE/bulk.bin
+
+# mode name, then server flags
+run() {
+    mode=$1
+    shift
+    # Cold reads, as far as the filesystem lets a file be dropped
+    dd if=$SITE/bulk.bin iflag=nocache count=0 2> /dev/null
+    $SERVER $SITE -p $PORT -l warn "$@" $SERVER_FLAGS > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    $CLIENT -p $PORT -n $DOWNLOADS -c $BULK_CLIENTS -k -u /bulk.bin \
+        | sed "s/^/mode=$mode scenario=cold_bulk /" > $SITE/bulk.out &
+    bulk=$!
+    sleep 0.2
+    $CLIENT -p $PORT -n $SMALL -c 16 -k -u /index.html | sed "s/^/mode=$mode scenario=small_under_cold_bulk /"
+    wait $bulk
+    cat $SITE/bulk.out
+    curl -s http://127.0.0.1:$PORT/__stats | grep "^ws_disk_[a-z_]*{" | sed "s/^/mode=$mode /"
+    kill -INT $pid
+    wait $pid
+}
+
+run loop -j 0
+run pool
+run pool_wide -j 8
+
+rm -rf $SITE
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Requests a small page over and over while a few kept-alive connections
+# download a large file, with sends unscheduled (-q 0, every client sends
+# until its socket is full), with the default send budget, and with the
+# budget and a per-connection rate limit. Prints the small requests'
+# latency and the downloads' throughput for each, from the same run
+# Usage: bench/fair.sh [small-requests] [downloads]
+
+SERVER=$(pwd)/web-server-$(uname -s)-$(uname -p)
+CLIENT=bench/ws-bench
+PORT=${PORT:-28080}
+SMALL=${1:-50000}
+DOWNLOADS=${2:-400}
+BULK_CLIENTS=${BULK_CLIENTS:-4}
+BULK_SIZE=${BULK_SIZE:-16}
+LIMIT=${LIMIT:-64M}
+
+# A copy of the bundled root with the large file in it
+SITE=$(mktemp -d)
+cp -r root/. $SITE
+head -c $((BULK_SIZE * 1024 * 1024)) /dev/urandom > $SITE/bulk.bin
+
+# mode name, then server flags
+run() {
+    mode=$1
+    shift
+    $SERVER $SITE -p $PORT -l warn "$@" $SERVER_FLAGS > /dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+    $CLIENT -p $PORT -n $DOWNLOADS -c $BULK_CLIENTS -k -u /bulk.bin \
+        | sed "s/^/mode=$mode scenario=bulk /" > $SITE/bulk.out &
+    bulk=$!
+    sleep 0.2
+    $CLIENT -p $PORT -n $SMALL -c 16 -k -u /index.html | sed "s/^/mode=$mode scenario=small_under_bulk /"
+    wait $bulk
+    cat $SITE/bulk.out
+    curl -s http://127.0.0.1:$PORT/__stats | grep "^ws_send_[a-z_]* " | sed "s/^/mode=$mode /"
+    kill -INT $pid
+    wait $pid
+}
+
+run unscheduled -q 0
+run budget
+run budget_limited -L $LIMIT
+
+rm -rf $SITE
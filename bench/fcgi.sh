@@ -0,0 +1,35 @@
+#!/bin/sh
+# Compares a static page against the same size of dynamic page from the
+# FastCGI echo backend (multiplexing, and one request per connection), and
+# reports what forking and execing it as a CGI program costs per request
+# Usage: bench/fcgi.sh [requests] [concurrency]
+
+SERVER=./web-server-$(uname -s)-$(uname -p)
+CLIENT=bench/ws-bench
+ECHO=$(pwd)/bench/ws-fcgi-echo
+PORT=${PORT:-28080}
+TOTAL=${1:-50000}
+CONCURRENCY=${2:-64}
+SIZE=$(wc -c < root/index.html)
+
+for mode in mpx single; do
+    case $mode in
+        mpx) backend="$ECHO" ;;
+        single) backend="$ECHO -1" ;;
+    esac
+    $SERVER root -p $PORT -F "/app=$backend" $SERVER_FLAGS > /dev/null 2>&1 &
+    PID=$!
+    sleep 0.5
+
+    if [ $mode = mpx ]; then
+        $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY -k -u /index.html | sed "s/^/mode=static scenario=small_html /"
+    fi
+    $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY -k -u "/app/echo?size=$SIZE" | sed "s/^/mode=fcgi_$mode scenario=chunked /"
+    $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY -k -u "/app/echo?size=$SIZE&length=1" | sed "s/^/mode=fcgi_$mode scenario=content_length /"
+    $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY -u "/app/echo?size=$SIZE&length=1" | sed "s/^/mode=fcgi_$mode scenario=churn /"
+    kill -INT $PID
+    wait $PID
+done
+
+# A CGI server pays at least this for every request, before any I/O
+$ECHO -b $((TOTAL / 10)) | sed "s/^/mode=cgi scenario=fork_exec /"
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Loads testbigimg.html and the assets it pulls, over and over: each asset
+# on a connection of its own (HTTP/1.0), one after another on a kept-alive
+# connection (HTTP/1.1), and all at once on one HTTP/2 connection (the page
+# upgrading it to h2c, the assets in parallel). One curl run per page load
+# in every mode, so its start-up cost is the same everywhere
+# Usage: bench/h2.sh [loads]
+
+SERVER=./web-server-$(uname -s)-$(uname -p)
+CURL=${CURL:-curl}
+PORT=${PORT:-28080}
+LOADS=${1:-500}
+BASE=http://127.0.0.1:$PORT
+PAGE="$BASE/testbigimg.html $BASE/images/sansfast.gif $BASE/images/big.jpg $BASE/styles.css"
+
+$SERVER root -p $PORT $SERVER_FLAGS > /dev/null 2>&1 &
+PID=$!
+sleep 0.5
+
+# name, then curl flags; prints page loads per second and bytes per load
+run() {
+    name=$1
+    shift
+    bytes=$($CURL -s "$@" $PAGE 2>/dev/null | wc -c)
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt $LOADS ]; do
+        $CURL -s "$@" $PAGE > /dev/null 2>&1 || echo "$name: load failed" >&2
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    awk -v name="$name" -v n=$LOADS -v ns=$((end - start)) -v bytes=$bytes \
+        'BEGIN { printf "%s loads=%d loads_per_sec=%.0f ms_per_load=%.2f bytes_per_load=%d\n", name, n, n/(ns/1e9), ns/1e6/n, bytes }'
+}
+
+run "mode=http1.0 scenario=page_assets" --http1.0
+run "mode=http1.1 scenario=page_assets" --http1.1
+run "mode=h2c scenario=page_assets" --http2 -Z
+
+# Connections the server switched
+$CURL -s $BASE/__stats | grep "^ws_h2_connections_total"
+kill -INT $PID
+wait $PID
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Compares serving from the response cache against a site pack built at
+# startup (--pack) and one mapped from a file (--pack-file)
+# Usage: bench/pack.sh [requests] [concurrency]
+
+SERVER=./web-server-$(uname -s)-$(uname -p)
+CLIENT=bench/ws-bench
+PORT=${PORT:-28080}
+TOTAL=${1:-50000}
+CONCURRENCY=${2:-64}
+PACK=${PACK:-/tmp/ws-bench.pack}
+
+$SERVER root --pack-build $PACK $SERVER_FLAGS || exit 1
+
+for mode in cache pack pack_file; do
+    case $mode in
+        cache) flags= ;;
+        pack) flags=--pack ;;
+        pack_file) flags="--pack-file $PACK" ;;
+    esac
+    $SERVER root -p $PORT $flags $SERVER_FLAGS > /dev/null 2>&1 &
+    PID=$!
+    sleep 0.5
+
+    $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY -k -u /index.html | sed "s/^/mode=$mode scenario=small_html /"
+    $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY -k -u /images/big.jpg | sed "s/^/mode=$mode scenario=large_image /"
+    $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY -k -u /missing.html | sed "s/^/mode=$mode scenario=not_found /"
+    kill -INT $PID
+    wait $PID
+done
+rm -f $PACK
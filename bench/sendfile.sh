@@ -0,0 +1,22 @@
+#!/bin/sh
+# Compares sendfile() against buffered sends for the large files in root
+# Usage: bench/sendfile.sh [connections] [concurrency]
+
+SERVER=./web-server-$(uname -s)-$(uname -p)
+CLIENT=bench/ws-bench
+PORT=${PORT:-28080}
+TOTAL=${1:-2000}
+CONCURRENCY=${2:-8}
+
+for mode in sendfile buffered; do
+    if [ "$mode" = "buffered" ]; then FLAGS=-b; else FLAGS=; fi
+    $SERVER root -p $PORT $FLAGS > /dev/null 2>&1 &
+    PID=$!
+    sleep 0.5
+    for url in /images/big.jpg /Webserver.zip; do
+        printf "mode=%s url=%s " $mode $url
+        $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY -u $url
+    done
+    kill -INT $PID
+    wait $PID
+done
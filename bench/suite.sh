@@ -0,0 +1,33 @@
+#!/bin/sh
+# Runs the benchmark scenarios against a server on the bundled root folder
+# Usage: bench/suite.sh [requests] [concurrency]
+# Prints one key=value line per scenario; set OUT to also append them to a file
+
+SERVER=./web-server-$(uname -s)-$(uname -p)
+CLIENT=bench/ws-bench
+PORT=${PORT:-28080}
+TOTAL=${1:-20000}
+CONCURRENCY=${2:-16}
+IDLE=${IDLE:-1000}
+
+$SERVER root -p $PORT $SERVER_FLAGS > /dev/null 2>&1 &
+PID=$!
+sleep 0.5
+
+# name, then client flags
+run() {
+    name=$1
+    shift
+    $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY "$@" | sed "s/^/scenario=$name /" | tee -a ${OUT:-/dev/null}
+}
+
+STATUS=0
+run small_html -k -u /index.html || STATUS=1
+run large_image -k -u /images/big.jpg || STATUS=1
+run not_found -k -u /missing.html || STATUS=1
+run churn -u /index.html || STATUS=1
+run churn_idle -i $IDLE -u /index.html || STATUS=1
+
+kill -INT $PID
+wait $PID
+exit $STATUS
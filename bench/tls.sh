@@ -0,0 +1,51 @@
+#!/bin/sh
+# Compares full and resumed TLS handshakes, and large files over HTTPS with
+# kTLS (when the kernel has the tls module) against userspace encryption,
+# with plain HTTP as the baseline. Uses a self-signed certificate made for
+# the run and openssl s_time, one connection per request
+# Usage: bench/tls.sh [seconds]
+
+SERVER=./web-server-$(uname -s)-$(uname -p)
+OPENSSL=${OPENSSL:-openssl}
+PORT=${PORT:-28080}
+TLS_PORT=${TLS_PORT:-28443}
+TIME=${1:-5}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+$OPENSSL req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 1 \
+    -subj /CN=localhost -keyout "$DIR/key.pem" -out "$DIR/cert.pem" > /dev/null 2>&1 || exit 1
+
+# name and port, then s_time flags; prints connections per second of wall
+# time (s_time only reports whole seconds) and bytes read per connection
+run() {
+    name=$1
+    port=$2
+    shift 2
+    start=$(date +%s%N)
+    $OPENSSL s_time -connect 127.0.0.1:$port -time $TIME "$@" 2>/dev/null > "$DIR/out"
+    end=$(date +%s%N)
+    awk -v name="$name" -v ns=$((end - start)) '/real seconds/ { conns=$1; bytes=$7 }
+        END { printf "%s connections=%d conns_per_sec=%.0f bytes_per_conn=%s\n", name, conns, conns/(ns/1e9), bytes }' "$DIR/out"
+}
+
+for mode in ktls userspace; do
+    if [ "$mode" = "userspace" ]; then FLAGS=--no-ktls; else FLAGS=; fi
+    $SERVER root -p $PORT -P $TLS_PORT --cert "$DIR/cert.pem" --key "$DIR/key.pem" $FLAGS > /dev/null 2>&1 &
+    PID=$!
+    sleep 0.5
+
+    if [ $mode = ktls ]; then
+        # s_time only speaks TLS, so the baseline is the same requests in the clear
+        bench/ws-bench -p $PORT -n 5000 -c 1 -u /index.html | sed "s/^/mode=plain scenario=small_html /"
+        run "mode=tls scenario=full_handshake" $TLS_PORT -new -www /index.html
+        run "mode=tls scenario=resumed" $TLS_PORT -reuse -www /index.html
+    fi
+    run "mode=$mode scenario=large_image" $TLS_PORT -reuse -www /images/big.jpg
+
+    # Whether the kernel actually took the keys
+    printf 'GET /__stats HTTP/1.0\r\n\r\n' | $OPENSSL s_client -quiet -connect 127.0.0.1:$TLS_PORT 2>/dev/null \
+        | grep "^ws_tls_ktls_total" | sed "s/^/mode=$mode /"
+    kill -INT $PID
+    wait $PID
+done
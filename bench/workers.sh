@@ -0,0 +1,30 @@
+#!/bin/sh
+# Measures how connections per second scale with the number of workers
+# Usage: bench/workers.sh [max-workers] [connections] [concurrency]
+
+SERVER=./web-server-$(uname -s)-$(uname -p)
+CLIENT=bench/ws-bench
+PORT=${PORT:-28080}
+MAX=${1:-$(nproc)}
+TOTAL=${2:-50000}
+CONCURRENCY=${3:-16}
+
+workers=1
+while [ $workers -le $MAX ]; do
+    $SERVER root -p $PORT -w $workers -A > /dev/null 2>&1 &
+    PID=$!
+    sleep 0.5
+
+    # One client process per worker, so the client isn't the bottleneck
+    i=0
+    CLIENTS=
+    while [ $i -lt $workers ]; do
+        $CLIENT -p $PORT -n $TOTAL -c $CONCURRENCY | sed "s/^/workers=$workers client=$i /" &
+        CLIENTS="$CLIENTS $!"
+        i=$((i+1))
+    done
+    wait $CLIENTS
+    kill -INT $PID
+    wait $PID
+    workers=$((workers*2))
+done
@@ -0,0 +1,398 @@
+/* Simple HTML web server benchmark client */
+
+/*
+Load generator:
+ -  Optionally opens a number of idle connections first, so the server has
+    to manage many clients while the load is running
+ -  Keeps a fixed number of requests in flight, one per connection. By
+    default each connection sends one HTTP/1.0 GET and reads the response
+    until the server closes it (connection churn); with -k connections are
+    kept alive and send their next request as soon as a response is complete
+ -  Times every request, from connecting (or sending, when kept alive) to the
+    last byte of its response
+ -  Reports one line of key=value pairs once the total has been reached:
+    requests per second, throughput, and p50/p99/p999/max latency
+*/
+
+#define _GNU_SOURCE         /* memmem */
+#include <stdio.h>          /* High level read and write */
+#include <stdlib.h>         /* Memory management */
+#include <unistd.h>         /* Lower level read and write */
+#include <string.h>         /* String parsing */
+#include <strings.h>        /* Case-insensitive compares */
+#include <stdint.h>         /* Fixed width latencies */
+#include <errno.h>          /* Error handling */
+#include <fcntl.h>          /* Non-blocking sockets */
+#include <time.h>           /* Monotonic clock */
+#include <sys/epoll.h>      /* Epoll */
+#include <sys/socket.h>     /* Low level sockets */
+#include <sys/resource.h>   /* Open file limit */
+#include <netinet/in.h>     /* Address structs */
+#include <arpa/inet.h>      /* String to address conversions */
+
+/* Define connection stages */
+#define WB_STAGE_CONNECTING 0
+#define WB_STAGE_READING    1
+
+/* Define misc */
+#define WB_MAX_EVENTS       256
+#define WB_BUF_SIZE         (1<<16)
+#define WB_HEADER_SIZE      4096
+#define USAGE_STR           "Usage: %s -p port [-a ip-address] [-n total] [-c concurrency] [-i idle] [-u url] [-k]\n"
+
+/* A benchmark connection */
+struct wb_conn_t {
+    int socket;                 /* FD of the socket */
+    int stage;                  /* WB_STAGE_* */
+    double start;               /* When the current request began */
+    int status;                 /* Status of the current response, 0 until read */
+    int closing;                /* Server will close after this response */
+    long long remaining;        /* Body bytes still to read, -1 until the header ends */
+    int chunked;                /* Body is sent in chunks, framed by their sizes */
+    int last_chunk;             /* The empty last chunk has been read */
+    int size_len;               /* Bytes of the chunk size line buffered */
+    char size_line[32];         /* Chunk size line being read */
+    int header_len;             /* Header bytes buffered */
+    char header[WB_HEADER_SIZE]; /* Start of the current response */
+};
+typedef struct wb_conn_t wb_conn_t;
+
+/* Globals */
+static struct sockaddr_in address; /* Server address */
+static char request[512]; /* Request sent on each connection */
+static int request_len = 0; /* Length of request */
+static int keep_alive = 0; /* Reuse connections for the next request */
+static int epfd = -1; /* Epoll instance */
+static long total = 100000; /* Requests to make */
+static long started = 0; /* Requests begun */
+static long completed = 0; /* Requests answered in full */
+static long failed = 0; /* Requests that errored */
+static long non_2xx = 0; /* Answered with another status */
+static long connections = 0; /* Connections opened */
+static long long bytes = 0; /* Response bytes read */
+static uint32_t *latencies = NULL; /* Microseconds taken by each completed request */
+
+/* Returns the monotonic time in seconds */
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Opens a non-blocking connection, returns the socket or -1 */
+int open_conn() {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock == -1) return -1;
+    if (connect(sock, (struct sockaddr *)&address, sizeof(address)) == -1
+            && errno != EINPROGRESS) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Resets a connection for a new request */
+void begin_request(wb_conn_t *conn) {
+    started++;
+    conn->start = now();
+    conn->status = 0;
+    conn->closing = !keep_alive;
+    conn->remaining = -1;
+    conn->chunked = 0;
+    conn->last_chunk = 0;
+    conn->size_len = 0;
+    conn->header_len = 0;
+}
+
+/* Starts a new connection with its first request */
+void start_conn() {
+    wb_conn_t *conn = malloc(sizeof(wb_conn_t));
+    begin_request(conn);
+    conn->socket = open_conn();
+    conn->stage = WB_STAGE_CONNECTING;
+    if (conn->socket == -1) {
+        failed++;
+        free(conn);
+        return;
+    }
+    connections++;
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = conn;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, conn->socket, &ev);
+}
+
+/* Closes a connection */
+void end_conn(wb_conn_t *conn) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->socket, NULL);
+    close(conn->socket);
+    free(conn);
+}
+
+/* Records the current request as answered */
+void complete_request(wb_conn_t *conn) {
+    double us = (now() - conn->start) * 1e6;
+    latencies[completed++] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    if (conn->status < 200 || conn->status > 299) non_2xx++;
+}
+
+/* Reads the status, length and connection from a complete header,
+   returns -1 if it is malformed */
+int parse_header(wb_conn_t *conn, int len) {
+    conn->header[len-1] = '\0';
+    if (sscanf(conn->header, "HTTP/%*d.%*d %d", &conn->status) != 1) return -1;
+
+    /* Walk the header lines for the fields that frame the body */
+    for (char *line = strstr(conn->header, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            conn->remaining = atoll(line + 15);
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            char *value = line + 11;
+            while (*value == ' ') value++;
+            if (strncasecmp(value, "close", 5) == 0) conn->closing = 1;
+        } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+            conn->chunked = strstr(line + 18, "chunked") != NULL;
+        }
+    }
+    if (conn->chunked) {
+        conn->remaining = 0;
+    } else if (conn->remaining < 0 && !conn->closing) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Takes n bytes of response, returns 1 when the response is complete,
+   0 if more is needed, and -1 if it is malformed */
+int take_response(wb_conn_t *conn, const char *data, int n) {
+    if (conn->status == 0) {
+        /* Buffer the header until its blank line arrives */
+        int old_len = conn->header_len;
+        int copy = n < WB_HEADER_SIZE - old_len ? n : WB_HEADER_SIZE - old_len;
+        memcpy(conn->header + old_len, data, copy);
+        conn->header_len += copy;
+        char *end = memmem(conn->header, conn->header_len, "\r\n\r\n", 4);
+        if (end == NULL) return conn->header_len == WB_HEADER_SIZE ? -1 : 0;
+
+        int header_len = end + 4 - conn->header;
+        if (parse_header(conn, header_len) == -1) return -1;
+        data += header_len - old_len;
+        n -= header_len - old_len;
+    }
+
+    /* Chunked bodies alternate size lines and chunks, each with its CRLF,
+       and end after the empty last chunk's CRLF */
+    while (conn->chunked && n > 0) {
+        if (conn->remaining > 0) {
+            int take = n < conn->remaining ? n : (int)conn->remaining;
+            conn->remaining -= take;
+            data += take;
+            n -= take;
+            if (conn->remaining == 0 && conn->last_chunk) return n == 0 ? 1 : -1;
+            continue;
+        }
+        if (conn->size_len == (int)sizeof(conn->size_line) - 1) return -1;
+        char c = *data++;
+        n--;
+        conn->size_line[conn->size_len++] = c;
+        if (c == '\n') {
+            conn->size_line[conn->size_len] = '\0';
+            conn->size_len = 0;
+            conn->remaining = strtoll(conn->size_line, NULL, 16) + 2;
+            conn->last_chunk = conn->remaining == 2;
+        }
+    }
+    if (conn->chunked) return 0;
+
+    /* Responses without a length run until the server closes */
+    if (conn->remaining < 0) return 0;
+    conn->remaining -= n;
+    return conn->remaining <= 0;
+}
+
+/* Advances a connection, returns TRUE when it has been closed */
+int step_conn(wb_conn_t *conn) {
+    static char buf[WB_BUF_SIZE];
+
+    if (conn->stage == WB_STAGE_CONNECTING) {
+        /* Connected, send the whole request */
+        if (send(conn->socket, request, request_len, MSG_NOSIGNAL) != request_len) {
+            failed++;
+            end_conn(conn);
+            return 1;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, conn->socket, &ev);
+        conn->stage = WB_STAGE_READING;
+        return 0;
+    }
+
+    /* Read until the response ends, or the server closes */
+    int n = read(conn->socket, buf, sizeof(buf));
+    if (n > 0) {
+        bytes += n;
+        int done = take_response(conn, buf, n);
+        if (done == -1) {
+            failed++;
+            end_conn(conn);
+            return 1;
+        } else if (done && !conn->closing) {
+            /* Kept alive, send the next request straight away */
+            complete_request(conn);
+            if (started == total) {
+                end_conn(conn);
+                return 1;
+            }
+            begin_request(conn);
+            if (send(conn->socket, request, request_len, MSG_NOSIGNAL) != request_len) {
+                failed++;
+                end_conn(conn);
+                return 1;
+            }
+        }
+        return 0;
+    } else if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return 0;
+    }
+
+    /* Closed, which completes a response read to the end */
+    if (n == 0 && conn->status != 0 && conn->remaining <= 0) {
+        complete_request(conn);
+    } else {
+        failed++;
+    }
+    end_conn(conn);
+    return 1;
+}
+
+/* Orders latencies for qsort */
+int compare_latency(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Returns the latency below which a fraction of the sorted requests fall */
+uint32_t percentile(double fraction) {
+    if (completed == 0) return 0;
+    long i = (long)(fraction * completed + 0.5);
+    if (i < 1) i = 1;
+    if (i > completed) i = completed;
+    return latencies[i-1];
+}
+
+/* Running logic */
+int main(int argc, char *argv[]) {
+    char *addr_str = "127.0.0.1";
+    char *url = "/index.html";
+    int port = -1;
+    int concurrency = 64;
+    int idle = 0;
+
+    /* Parse args */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-k") == 0) {
+            keep_alive = 1;
+        } else if (i+1 == argc) {
+            printf(USAGE_STR, argv[0]);
+            return 1;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-a") == 0) {
+            addr_str = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0) {
+            total = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0) {
+            concurrency = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0) {
+            idle = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-u") == 0) {
+            url = argv[++i];
+        } else {
+            printf(USAGE_STR, argv[0]);
+            return 1;
+        }
+    }
+    if (port <= 0 || concurrency <= 0 || total <= 0) {
+        printf(USAGE_STR, argv[0]);
+        return 1;
+    }
+
+    /* Setup address and request */
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr_str, &address.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", addr_str);
+        return 1;
+    }
+    if (keep_alive) {
+        request_len = snprintf(request, sizeof(request),
+            "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", url, addr_str);
+    } else {
+        request_len = snprintf(request, sizeof(request),
+            "GET %s HTTP/1.0\r\n\r\n", url);
+    }
+    latencies = malloc(total * sizeof(uint32_t));
+    if (latencies == NULL) {
+        perror("Couldn't allocate latencies");
+        return 1;
+    }
+
+    /* Allow as many sockets as possible */
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    /* Open idle connections, they stay open for the whole run */
+    int *idle_socks = calloc(idle ? idle : 1, sizeof(int));
+    for (int i = 0; i < idle; i++) {
+        idle_socks[i] = open_conn();
+        if (idle_socks[i] == -1) {
+            perror("Couldn't open idle connection");
+            return 1;
+        }
+    }
+
+    epfd = epoll_create1(0);
+    struct epoll_event events[WB_MAX_EVENTS];
+    double start = now();
+
+    /* Keep the pipeline full until every request has been started */
+    while (started < total && started - completed - failed < concurrency) {
+        start_conn();
+    }
+    while (completed + failed < total) {
+        int n = epoll_wait(epfd, events, WB_MAX_EVENTS, 1000);
+        for (int i = 0; i < n; i++) {
+            if (step_conn(events[i].data.ptr) && started < total) {
+                start_conn();
+            }
+        }
+        if (n == 0) {
+            fprintf(stderr, "Stalled with %ld requests in flight\n",
+                started - completed - failed);
+        }
+    }
+    double elapsed = now() - start;
+
+    /* Report */
+    qsort(latencies, completed, sizeof(uint32_t), compare_latency);
+    printf("requests=%ld failed=%ld non_2xx=%ld connections=%ld keep_alive=%d idle=%d concurrency=%d "
+        "seconds=%.3f req_per_sec=%.0f bytes=%lld mb_per_sec=%.1f "
+        "p50_us=%u p99_us=%u p999_us=%u max_us=%u\n",
+        completed, failed, non_2xx, connections, keep_alive, idle, concurrency,
+        elapsed, completed / elapsed, bytes, bytes / elapsed / (1<<20),
+        percentile(0.50), percentile(0.99), percentile(0.999),
+        completed ? latencies[completed-1] : 0);
+
+    for (int i = 0; i < idle; i++) close(idle_socks[i]);
+    free(idle_socks);
+    free(latencies);
+    close(epfd);
+    return failed != 0;
+}
@@ -0,0 +1,99 @@
+/* Simple HTML web server compression benchmark */
+
+/*
+Compression benchmark:
+ -  Compresses each file given with every coding the server was built with,
+    at a range of levels
+ -  Reports the bytes saved against the CPU time it took, which is what a
+    page costs the first time it is compressed (later requests are cached)
+*/
+
+#include <stdio.h>          /* High level read and write */
+#include <stdlib.h>         /* Memory management */
+#include <string.h>         /* String parsing */
+#include <time.h>           /* Monotonic clock */
+#include "../ws-compress.h" /* Codings under test */
+
+/* Define misc */
+#define USAGE_STR           "Usage: %s [-n repeats] file...\n"
+
+/* Levels tried for each coding */
+static const int levels[WS_CODINGS][5] = {
+    { 0 },
+    { 1, 6, 9, 0 },
+    { 1, 5, 9, 11, 0 },
+};
+
+/* Returns the monotonic time in seconds */
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reads a whole file, returns it or NULL */
+char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = malloc(*size ? *size : 1);
+    if (data && fread(data, 1, *size, file) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    return data;
+}
+
+/* Running logic */
+int main(int argc, char *argv[]) {
+    int repeats = 20;
+    int first = 1;
+
+    /* Parse args */
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        repeats = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc || repeats <= 0) {
+        printf(USAGE_STR, argv[0]);
+        return 1;
+    }
+
+    for (int f = first; f < argc; f++) {
+        size_t size;
+        char *data = read_file(argv[f], &size);
+        if (data == NULL) {
+            perror(argv[f]);
+            return 1;
+        }
+
+        for (int coding = WS_CODING_GZIP; coding < WS_CODINGS; coding++) {
+            if (!ws_compress_supported(coding)) continue;
+            size_t bound = ws_compress_bound(coding, size);
+            char *out = malloc(bound);
+
+            for (int l = 0; levels[coding][l]; l++) {
+                size_t out_len = bound;
+                double start = now();
+                for (int r = 0; r < repeats; r++) {
+                    out_len = bound;
+                    if (ws_compress(coding, levels[coding][l], data, size, out, &out_len) == -1) {
+                        fprintf(stderr, "Compressing %s failed\n", argv[f]);
+                        return 1;
+                    }
+                }
+                double ms = (now() - start) * 1e3 / repeats;
+                printf("file=%s coding=%s level=%d bytes=%zu compressed=%zu saved_pct=%.1f ms=%.3f mb_per_sec=%.1f\n",
+                    argv[f], ws_compress_name(coding), levels[coding][l], size, out_len,
+                    size ? 100.0 * ((double)size - out_len) / size : 0.0, ms,
+                    size / (ms / 1e3) / (1<<20));
+            }
+            free(out);
+        }
+        free(data);
+    }
+    return 0;
+}
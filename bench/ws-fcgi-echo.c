@@ -0,0 +1,430 @@
+/* Simple HTML web server FastCGI echo backend */
+
+/*
+FastCGI echo backend:
+ -  Answers every request with its method, target and query as text/plain,
+    padded with x's to ?size=N bytes; ?length=1 sends a Content-Length
+    (else the server chunks the body), ?status=N a Status header, and
+    ?stderr=1 a line on FCGI_STDERR
+ -  As a FastCGI backend it takes its listening socket as fd 0 (how -F
+    starts it) or binds -s path, multiplexes requests on each connection
+    unless -1 is given, and never blocks on one connection
+ -  Started with GATEWAY_INTERFACE set and no socket, it answers one request
+    as a CGI program; -b N forks and execs itself that way N times and
+    reports the cost, which is what a fork-per-request server pays
+*/
+
+#include <stdio.h>          /* High level read and write */
+#include <stdlib.h>         /* Memory management */
+#include <string.h>         /* String parsing */
+#include <unistd.h>         /* Lower level read and write */
+#include <errno.h>          /* Error handling */
+#include <fcntl.h>          /* Non-blocking sockets */
+#include <poll.h>           /* Waiting on connections */
+#include <signal.h>         /* Ignoring SIGPIPE */
+#include <time.h>           /* Monotonic clock */
+#include <sys/socket.h>     /* Unix sockets */
+#include <sys/un.h>         /* Socket paths */
+#include <sys/wait.h>       /* Reaping CGI runs */
+
+#define USAGE_STR   "Usage: %s [-s socket-path] [-1] | -b count\n"
+#define MAX_CONNS   64
+#define MAX_IDS     256  /* Request ids tracked per connection */
+#define IN_SIZE     (8 + 65535 + 255)
+#define CHUNK       32768 /* Bytes of output per STDOUT record */
+#define MAX_PARAMS  8192 /* Bytes of parameters kept per request */
+
+/* A request being received */
+struct request_t {
+    int active;                 /* TRUE between BEGIN_REQUEST and the reply */
+    int keep_conn;              /* FCGI_KEEP_CONN was set */
+    char params[MAX_PARAMS];    /* Encoded name-value pairs */
+    int params_len;
+};
+typedef struct request_t request_t;
+
+/* A connection from the server */
+struct conn_t {
+    int fd;
+    char in[IN_SIZE];
+    int in_len;
+    char *out;
+    size_t out_len, out_offset, out_cap;
+    int closing;                /* Close once out is written */
+    request_t *reqs[MAX_IDS];
+};
+typedef struct conn_t conn_t;
+
+static int multiplex = 1;
+
+/* Returns the monotonic time in us */
+static long monotonic_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+/* Appends bytes to a connection's output */
+static void append(conn_t *conn, const void *data, size_t len) {
+    if (conn->out_len + len > conn->out_cap) {
+        size_t cap = conn->out_cap ? conn->out_cap : 65536;
+        while (cap < conn->out_len + len) cap *= 2;
+        conn->out = realloc(conn->out, cap);
+        if (conn->out == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        conn->out_cap = cap;
+    }
+    memcpy(conn->out + conn->out_len, data, len);
+    conn->out_len += len;
+}
+
+/* Appends a record */
+static void record(conn_t *conn, int type, int id, const char *data, size_t len) {
+    unsigned char header[8] = { 1, type, id >> 8, id & 0xff, len >> 8, len & 0xff, 0, 0 };
+    append(conn, header, 8);
+    if (len > 0) append(conn, data, len);
+}
+
+/* Appends a stream as records, ended by an empty one */
+static void stream(conn_t *conn, int type, int id, const char *data, size_t len) {
+    while (len > 0) {
+        size_t n = len < CHUNK ? len : CHUNK;
+        record(conn, type, id, data, n);
+        data += n;
+        len -= n;
+    }
+    record(conn, type, id, NULL, 0);
+}
+
+/* Reads a name or value length, returns its size or -1 */
+static int get_length(const unsigned char *buf, const unsigned char *end, int *len) {
+    if (buf >= end) return -1;
+    if (buf[0] < 128) {
+        *len = buf[0];
+        return 1;
+    }
+    if (end - buf < 4) return -1;
+    *len = ((buf[0] & 0x7f) << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+    return 4;
+}
+
+/* Appends a name-value pair with short lengths */
+static int put_pair(char *buf, const char *name, const char *value) {
+    int name_len = strlen(name), value_len = strlen(value);
+    buf[0] = name_len;
+    buf[1] = value_len;
+    memcpy(buf+2, name, name_len);
+    memcpy(buf+2+name_len, value, value_len);
+    return 2 + name_len + value_len;
+}
+
+/* Copies a parameter's value into buf, returns FALSE if it wasn't sent */
+static int get_param(request_t *req, const char *name, char *buf, size_t size) {
+    const unsigned char *p = (const unsigned char *)req->params;
+    const unsigned char *end = p + req->params_len;
+    int name_len, value_len, n;
+    while (p < end) {
+        if ((n = get_length(p, end, &name_len)) == -1) break;
+        p += n;
+        if ((n = get_length(p, end, &value_len)) == -1) break;
+        p += n;
+        if (end - p < name_len + value_len) break;
+        if (name_len == (int)strlen(name) && memcmp(p, name, name_len) == 0) {
+            size_t copy = (size_t)value_len < size-1 ? (size_t)value_len : size-1;
+            memcpy(buf, p + name_len, copy);
+            buf[copy] = '\0';
+            return 1;
+        }
+        p += name_len + value_len;
+    }
+    buf[0] = '\0';
+    return 0;
+}
+
+/* Returns a numeric query argument, or 0 */
+static long query_arg(const char *query, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = query; p != NULL && *p; p = strchr(p, '&'), p = p ? p+1 : NULL) {
+        if (strncmp(p, name, len) == 0 && p[len] == '=') return atol(p+len+1);
+    }
+    return 0;
+}
+
+/* Builds the response to a request from its method, target and query.
+   Returns it malloc'd, with its length in len */
+static char *build_response(const char *method, const char *uri, const char *query, size_t *len) {
+    long size = query_arg(query, "size");
+    long status = query_arg(query, "status");
+    char line[8192];
+    int line_len = snprintf(line, sizeof(line), "%s %s %s\n", method, uri, query);
+    if (line_len >= (int)sizeof(line)) line_len = sizeof(line)-1;
+    size_t body = size > line_len ? (size_t)size : (size_t)line_len;
+
+    char header[256];
+    int header_len = 0;
+    if (status > 0) header_len += sprintf(header+header_len, "Status: %ld Echo\r\n", status);
+    header_len += sprintf(header+header_len, "Content-Type: text/plain\r\n");
+    if (query_arg(query, "length")) {
+        header_len += sprintf(header+header_len, "Content-Length: %zu\r\n", body);
+    }
+    header_len += sprintf(header+header_len, "\r\n");
+
+    char *out = malloc(header_len + body);
+    if (out == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(out, header, header_len);
+    memcpy(out+header_len, line, line_len);
+    memset(out+header_len+line_len, 'x', body - line_len);
+    *len = header_len + body;
+    return out;
+}
+
+/* Answers a request whose parameters and body have all arrived */
+static void respond(conn_t *conn, int id) {
+    request_t *req = conn->reqs[id];
+    char method[16], uri[4096], query[4096];
+    get_param(req, "REQUEST_METHOD", method, sizeof(method));
+    get_param(req, "REQUEST_URI", uri, sizeof(uri));
+    get_param(req, "QUERY_STRING", query, sizeof(query));
+
+    size_t len;
+    char *out = build_response(method, uri, query, &len);
+    if (query_arg(query, "stderr")) {
+        const char *note = "echo backend was asked to write to stderr";
+        stream(conn, 7, id, note, strlen(note));
+    }
+    stream(conn, 6, id, out, len);
+    free(out);
+
+    /* FCGI_REQUEST_COMPLETE */
+    char end[8] = { 0 };
+    record(conn, 3, id, end, 8);
+    if (!req->keep_conn) conn->closing = 1;
+    req->active = 0;
+}
+
+/* Answers FCGI_GET_VALUES */
+static void get_values(conn_t *conn) {
+    char buf[256];
+    int len = 0;
+    len += put_pair(buf+len, "FCGI_MAX_CONNS", "64");
+    len += put_pair(buf+len, "FCGI_MAX_REQS", multiplex ? "16" : "1");
+    len += put_pair(buf+len, "FCGI_MPXS_CONNS", multiplex ? "1" : "0");
+    record(conn, 10, 0, buf, len);
+}
+
+/* Handles every whole record read on a connection */
+static void handle_records(conn_t *conn) {
+    int offset = 0;
+    while (conn->in_len - offset >= 8) {
+        unsigned char *h = (unsigned char *)conn->in + offset;
+        int type = h[1], id = (h[2] << 8) | h[3];
+        int len = (h[4] << 8) | h[5], size = 8 + len + h[6];
+        if (conn->in_len - offset < size) break;
+        const char *content = conn->in + offset + 8;
+        request_t *req = id < MAX_IDS ? conn->reqs[id] : NULL;
+
+        if (type == 9) {
+            get_values(conn);
+        } else if (type == 1 && id > 0 && id < MAX_IDS) {
+            if (req == NULL) {
+                req = conn->reqs[id] = calloc(1, sizeof(request_t));
+            }
+            req->active = 1;
+            req->keep_conn = len >= 3 && (content[2] & 1);
+            req->params_len = 0;
+        } else if (type == 4 && req != NULL && req->active) {
+            int copy = len < MAX_PARAMS - req->params_len ? len : MAX_PARAMS - req->params_len;
+            memcpy(req->params + req->params_len, content, copy);
+            req->params_len += copy;
+        } else if (type == 5 && req != NULL && req->active && len == 0) {
+            respond(conn, id);
+        } else if (type == 2 && req != NULL && req->active) {
+            /* Aborted before its body ended, FCGI_REQUEST_COMPLETE anyway */
+            char end[8] = { 0 };
+            record(conn, 3, id, end, 8);
+            req->active = 0;
+        }
+        offset += size;
+    }
+    conn->in_len -= offset;
+    memmove(conn->in, conn->in + offset, conn->in_len);
+}
+
+/* Frees a connection */
+static void close_conn(conn_t *conn) {
+    close(conn->fd);
+    for (int id = 0; id < MAX_IDS; id++) free(conn->reqs[id]);
+    free(conn->out);
+    free(conn);
+}
+
+/* Serves FastCGI on a listening socket until killed */
+static void serve(int listener) {
+    conn_t *conns[MAX_CONNS] = { NULL };
+    struct pollfd fds[MAX_CONNS+1];
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+    for (;;) {
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (int c = 0; c < MAX_CONNS; c++) {
+            fds[c+1].fd = conns[c] ? conns[c]->fd : -1;
+            fds[c+1].events = POLLIN | (conns[c] && conns[c]->out_offset < conns[c]->out_len ? POLLOUT : 0);
+        }
+        if (poll(fds, MAX_CONNS+1, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            exit(1);
+        }
+
+        /* New connections, while there is room for them */
+        if (fds[0].revents & POLLIN) {
+            for (int c = 0; c < MAX_CONNS; c++) {
+                if (conns[c] != NULL) continue;
+                int fd = accept(listener, NULL, NULL);
+                if (fd == -1) break;
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                conns[c] = calloc(1, sizeof(conn_t));
+                conns[c]->fd = fd;
+            }
+        }
+
+        for (int c = 0; c < MAX_CONNS; c++) {
+            conn_t *conn = conns[c];
+            if (conn == NULL || fds[c+1].fd != conn->fd || fds[c+1].revents == 0) continue;
+            int dead = 0;
+            if (fds[c+1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n = read(conn->fd, conn->in + conn->in_len, IN_SIZE - conn->in_len);
+                if (n > 0) {
+                    conn->in_len += n;
+                    handle_records(conn);
+                } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    dead = 1;
+                }
+            }
+            while (!dead && conn->out_offset < conn->out_len) {
+                ssize_t n = write(conn->fd, conn->out + conn->out_offset, conn->out_len - conn->out_offset);
+                if (n == -1) {
+                    if (errno != EAGAIN && errno != EINTR) dead = 1;
+                    break;
+                }
+                conn->out_offset += n;
+            }
+            if (conn->out_offset == conn->out_len) {
+                conn->out_offset = conn->out_len = 0;
+                if (conn->closing) dead = 1;
+            }
+            if (dead) {
+                close_conn(conn);
+                conns[c] = NULL;
+            }
+        }
+    }
+}
+
+/* Answers the request in the environment as a CGI program */
+static int cgi(void) {
+    const char *method = getenv("REQUEST_METHOD");
+    const char *uri = getenv("REQUEST_URI");
+    const char *query = getenv("QUERY_STRING");
+    size_t len;
+    char *out = build_response(method ? method : "GET", uri ? uri : "/", query ? query : "", &len);
+    for (size_t sent = 0; sent < len; ) {
+        ssize_t n = write(STDOUT_FILENO, out + sent, len - sent);
+        if (n <= 0) return 1;
+        sent += n;
+    }
+    free(out);
+    return 0;
+}
+
+/* Runs this program as a CGI request count times, reading all it writes,
+   and reports the cost of each */
+static int bench_cgi(const char *self, long count) {
+    char buf[65536];
+    long bytes = 0, start = monotonic_us();
+    for (long i = 0; i < count; i++) {
+        int fds[2];
+        if (pipe(fds) == -1) {
+            perror("pipe");
+            return 1;
+        }
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            return 1;
+        } else if (pid == 0) {
+            dup2(fds[1], STDOUT_FILENO);
+            close(fds[0]);
+            close(fds[1]);
+            int devnull = open("/dev/null", O_RDONLY);
+            dup2(devnull, STDIN_FILENO);
+            setenv("GATEWAY_INTERFACE", "CGI/1.1", 1);
+            setenv("REQUEST_METHOD", "GET", 1);
+            setenv("REQUEST_URI", "/cgi/echo", 1);
+            setenv("QUERY_STRING", "", 1);
+            execl(self, self, (char *)NULL);
+            _exit(127);
+        }
+        close(fds[1]);
+        ssize_t n;
+        while ((n = read(fds[0], buf, sizeof(buf))) > 0) bytes += n;
+        close(fds[0]);
+        waitpid(pid, NULL, 0);
+    }
+    long us = monotonic_us() - start;
+    printf("CGI runs=%ld bytes=%ld seconds=%.3f runs/s=%.0f us/run=%.1f\n",
+        count, bytes, us / 1e6, count * 1e6 / (us ? us : 1), (double)us / count);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    long bench = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i+1 < argc) {
+            path = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i+1 < argc) {
+            bench = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-1") == 0) {
+            multiplex = 0;
+        } else {
+            fprintf(stderr, USAGE_STR, argv[0]);
+            return 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (bench > 0) {
+        return bench_cgi("/proc/self/exe", bench);
+    }
+
+    /* A socket path binds its own listener, else fd 0 is one or it's CGI */
+    if (path != NULL) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+        unlink(path);
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener == -1 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1
+                || listen(listener, SOMAXCONN) == -1) {
+            perror("Couldn't listen on socket");
+            return 1;
+        }
+        serve(listener);
+    }
+    struct sockaddr_un addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(STDIN_FILENO, (struct sockaddr *)&addr, &addr_len) == 0) {
+        serve(STDIN_FILENO);
+    }
+    if (getenv("GATEWAY_INTERFACE") != NULL) {
+        return cgi();
+    }
+    fprintf(stderr, USAGE_STR, argv[0]);
+    return 1;
+}
@@ -0,0 +1,122 @@
+/* Simple HTML web server request parser benchmark */
+
+/*
+Parser microbenchmark:
+ -  Parses a few typical requests over and over with every line scanner the
+    CPU supports, and reports the time taken per request
+ -  Each request is parsed both whole, as when it arrives in one read, and
+    fed in small pieces, as when it trickles in over many reads
+*/
+
+#include <stdio.h>          /* High level read and write */
+#include <stdlib.h>         /* Memory management */
+#include <string.h>         /* String parsing */
+#include <time.h>           /* Monotonic clock */
+#include "../ws-http.h"     /* Parser under test */
+
+/* Define misc */
+#define WB_PIECE            16 /* Bytes per read when fed in pieces */
+#define USAGE_STR           "Usage: %s [-n iterations]\n"
+
+/* A request to parse */
+struct wb_sample_t {
+    const char *name;           /* Name in the report */
+    const char *data;           /* The request */
+};
+typedef struct wb_sample_t wb_sample_t;
+
+static const wb_sample_t samples[] = {
+    { "curl",
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "User-Agent: curl/8.5.0\r\n"
+        "Accept: */*\r\n"
+        "\r\n" },
+    { "browser",
+        "GET /images/big.jpg HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Dest: image\r\n"
+        "Referer: https://www.example.com/index.html\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Accept-Language: en-US,en;q=0.9\r\n"
+        "If-None-Match: \"5f1e-62a1b3c4\"\r\n"
+        "If-Modified-Since: Tue, 14 May 2024 10:21:33 GMT\r\n"
+        "\r\n" },
+};
+#define WB_SAMPLES (int)(sizeof(samples) / sizeof(samples[0]))
+
+/* Returns the monotonic time in seconds */
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Parses a request iterations times, fed piece bytes at a time (0 for
+   whole), and returns the ns per request */
+double run(const char *data, int len, int piece, long iterations) {
+    ws_http_request_t req;
+    long checksum = 0;
+    double start = now();
+    for (long i = 0; i < iterations; i++) {
+        ws_http_init(&req);
+        int done = 0;
+        if (piece == 0) {
+            done = ws_http_parse(&req, data, len);
+        } else {
+            for (int size = piece; done == 0; size += piece) {
+                done = ws_http_parse(&req, data, size < len ? size : len);
+            }
+        }
+        if (done != len) {
+            fprintf(stderr, "Parse failed with %d\n", done);
+            exit(1);
+        }
+        checksum += req.nheaders;
+    }
+    double elapsed = now() - start;
+    if (checksum == 0) printf(" "); /* Keep the loop from being dropped */
+    return elapsed * 1e9 / iterations;
+}
+
+/* Running logic */
+int main(int argc, char *argv[]) {
+    long iterations = 1000000;
+
+    /* Parse args */
+    for (int i = 1; i < argc; i++) {
+        if (i+1 < argc && strcmp(argv[i], "-n") == 0) {
+            iterations = atol(argv[++i]);
+        } else {
+            printf(USAGE_STR, argv[0]);
+            return 1;
+        }
+    }
+    if (iterations <= 0) {
+        printf(USAGE_STR, argv[0]);
+        return 1;
+    }
+
+    /* Try every scanner, skipping ones that fall back to another */
+    for (int scanner = WS_HTTP_SCAN_SCALAR; scanner <= WS_HTTP_SCAN_AVX2; scanner++) {
+        if (ws_http_use_scanner(scanner) != scanner) continue;
+        for (int s = 0; s < WB_SAMPLES; s++) {
+            int len = strlen(samples[s].data);
+            for (int piece = 0; piece <= WB_PIECE; piece += WB_PIECE) {
+                double ns = run(samples[s].data, len, piece, iterations);
+                printf("scanner=%s request=%s bytes=%d feed=%s ns_per_req=%.1f mb_per_sec=%.0f\n",
+                    ws_http_scanner_name(scanner), samples[s].name, len,
+                    piece ? "pieces" : "whole", ns, len / ns * 1e9 / (1<<20));
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+/* Simple HTML web server path resolution benchmark */
+
+/*
+Path resolution microbenchmark:
+ -  Opens and stats a few pages of a site over and over, the way a request
+    that misses the cache does, and reports the time taken per page
+ -  "absolute" is how pages used to be found: root and the target copied
+    into one path, checked for "..", and opened from /, so the kernel walks
+    every folder above root on each open
+ -  "beneath" decodes the target and opens it beneath root's fd with
+    openat2() (or a walk where it is missing), and "kept" does the same
+    from the page's folder kept open, as a worker with notifications does
+*/
+
+#include <stdio.h>          /* High level read and write */
+#include <stdlib.h>         /* Memory management */
+#include <string.h>         /* String parsing */
+#include <limits.h>         /* PATH_MAX */
+#include <unistd.h>         /* close */
+#include <fcntl.h>          /* open */
+#include <time.h>           /* Monotonic clock */
+#include <sys/stat.h>       /* fstat */
+#include "../ws-path.h"     /* Resolution under test */
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+/* Define misc */
+#define WB_MAX_PATH         4096 /* Room for a path, as the server has */
+#define USAGE_STR           "Usage: %s [-n iterations] [root]\n"
+
+/* Request targets, pages of the site in root/ */
+static const char *targets[] = {
+    "/index.html",
+    "/images/big.jpg?v=3",
+    "/testing/test2.html",
+};
+#define WB_TARGETS (int)(sizeof(targets) / sizeof(targets[0]))
+
+/* Returns the monotonic time in seconds */
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Opens a target the old way, returns the fd or -1 */
+int open_absolute(const char *root, const char *target) {
+    char url[WB_MAX_PATH];
+    char tail[WB_MAX_PATH];
+    strcpy(tail, target);
+    char *query = strchr(tail, '?');
+    if (query) *query = '\0';
+    if (strstr(tail, "..")) return -1;
+    strcpy(url, root);
+    strcpy(url+strlen(root), tail);
+    return open(url, O_RDONLY);
+}
+
+/* Opens a target beneath root, returns the fd or -1 */
+int open_beneath(ws_path_cache_p paths, const char *target) {
+    char path[WB_MAX_PATH];
+    if (ws_path_decode(target, strlen(target), path, sizeof(path)) == -1) return -1;
+    return ws_path_open(paths, path, O_RDONLY);
+}
+
+/* Opens and stats a target iterations times with one of the ways, and
+   returns the ns per page */
+double run(const char *root, ws_path_cache_p paths, const char *target, long iterations) {
+    struct stat info;
+    long checksum = 0;
+    double start = now();
+    for (long i = 0; i < iterations; i++) {
+        int fd = paths ? open_beneath(paths, target) : open_absolute(root, target);
+        if (fd == -1 || fstat(fd, &info) == -1) {
+            perror(target);
+            exit(1);
+        }
+        checksum += info.st_size;
+        close(fd);
+    }
+    double elapsed = now() - start;
+    if (checksum == 0) printf(" "); /* Keep the loop from being dropped */
+    return elapsed * 1e9 / iterations;
+}
+
+/* Running logic */
+int main(int argc, char *argv[]) {
+    long iterations = 200000;
+    const char *dir = "root";
+
+    /* Parse args */
+    for (int i = 1; i < argc; i++) {
+        if (i+1 < argc && strcmp(argv[i], "-n") == 0) {
+            iterations = atol(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            dir = argv[i];
+        } else {
+            printf(USAGE_STR, argv[0]);
+            return 1;
+        }
+    }
+    if (iterations <= 0) {
+        printf(USAGE_STR, argv[0]);
+        return 1;
+    }
+
+    /* Servers are mostly given a full path to their root */
+    char root[PATH_MAX];
+    int root_fd = -1;
+    if (realpath(dir, root) == NULL || (root_fd = ws_path_root(root)) == -1) {
+        perror(dir);
+        return 1;
+    }
+    int depth = 0;
+    for (char *c = root; *c; c++) {
+        depth += *c == '/';
+    }
+    ws_path_cache_t beneath, kept;
+    ws_path_init(&beneath, root_fd, FALSE);
+    ws_path_init(&kept, root_fd, TRUE);
+
+    for (int t = 0; t < WB_TARGETS; t++) {
+        double ns[3];
+        ns[0] = run(root, NULL, targets[t], iterations);
+        ns[1] = run(root, &beneath, targets[t], iterations);
+        ns[2] = run(root, &kept, targets[t], iterations);
+        printf("target=%s root_depth=%d absolute_ns=%.0f beneath_ns=%.0f kept_ns=%.0f speedup=%.2f\n",
+            targets[t], depth, ns[0], ns[1], ns[2], ns[0] / ns[2]);
+    }
+    ws_path_destroy(&kept);
+    close(root_fd);
+    return 0;
+}
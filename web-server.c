@@ -1,539 +1,4414 @@
-/* Jenna Whilden (jpwolf101@gmail.com) 11-22-2021 */
-/* Simple HTML web server */
-#include <stdio.h>          /* High level read and write */
-#include <stdlib.h>         /* Memory management */
-#include <unistd.h>         /* Lower level read and write */
-#include <string.h>         /* String parsing */
-#include <errno.h>          /* Error handling */
-#include <signal.h>         /* Interupt handling */
-#include <dirent.h>         /* For testing directories */
-#include <sys/select.h>     /* Select */
-#include <sys/time.h>       /* CPU / User time */
-#include <sys/types.h>      /* Type definitions */
-#include <sys/socket.h>     /* Low level sockets */
-#include <sys/resource.h>   /* System usage stats */
-#include <netinet/in.h>     /* Address structs */
-#include <arpa/inet.h>      /* String to address conversions */
-#include "web-server.h"     /* JSON server consts and structs */
-
-/* Globals */
-static char alive = 1; /* 0 if server is being killed */
-static long client_count = 0; /* Total number of clients */
-static long req_count = 0; /* Total number of requests */
-static long err_count = 0; /* Total number of errors */
-static fd_set client_rdset; /* List of clients to read from for select */
-static fd_set client_wrset; /* List of clients to write to for select */
-static int max_socket = -1; /* Largest socket value */
-static client_node_t _client_head; /* Head of list of clients */
-static char* root = NULL; /* Where html pages are stored */
-static char ctoabuf[512]; /* Used in pc function */
-static int ctoa_level = WS_CTOA_SIMPLE; /* Amount of output from ctoa() */
-static char verbose = FALSE; /* Used to determine level of output */
-
-/* Aliases */
-#define client_head (&_client_head) /* Alias, useful to have pointer */
-#define server _client_head /* Alias, as head will always be listener */
-#define ctoa(CLIENT) ctoa_l((CLIENT),ctoa_level)
-#define vprint(...) if (verbose) printf(__VA_ARGS__)
-
-/* Intr handler, mostly ftom GT */
-void intr_handler(int sig) {
-    /* If intr is sigint, exit fish main, else ignore */
-    if (sig == SIGINT) {
-        alive = 0;
-    }
-}
-
-/* Returns a string of data from a client struct */
-char *ctoa_l(client_node_p client, int ctoa_level) {
-    switch (ctoa_level) {
-        default:
-        case WS_CTOA_SIMPLE:
-            sprintf(ctoabuf,"id = %ld", 
-                client->id);
-            break;
-        case WS_CTOA_SOCKET:
-            sprintf(ctoabuf,"id = %ld, socket = %d", 
-                client->id, client->socket);
-            break;
-        case WS_CTOA_DATA:
-            sprintf(ctoabuf,"id=%ld, socket=%d, offset=%d, data_size=%d", 
-                client->id, client->socket, client->offset, client->data_size);
-            break;
-        case WS_CTOA_FULL:
-            sprintf(ctoabuf,"addr=%p, id=%ld, socket=%d, pipe=%p, offset=%d, data_size=%d, next=%p", 
-                client, client->id, client->socket, client->pipe, client->offset, client->data_size, client->next);
-            break;
-    }
-    return ctoabuf;
-}
-
-/* Add a new client to the system */
-void add_client(int socket) {
-    /* Update max socket */
-    if (socket > max_socket) max_socket = socket;
-
-    /* If server, then done */
-    if (socket == server.socket) return;
-
-    /* Allocate node */
-    client_node_p node = malloc(sizeof(client_node_t));
-    node->id = ++client_count;
-    node->socket = socket;
-    node->pipe = NULL;
-    node->stage = WS_STAGE_READING;
-    node->offset = 0;
-    node->data_size = 0;
-    node->next = NULL;
-
-    /* Add to linked list */
-    client_node_p curr = client_head;
-    while (curr->next) {curr = curr->next;}
-    curr->next = node;
-
-    /* Print and return */
-    printf("Added new client{%s}\n",ctoa(node));
-}
-
-/* Remove a client from the system. Returns previous node */
-client_node_p rm_client(int socket) {
-    /* Shutdown client */
-    shutdown(socket, SHUT_RDWR);
-    close(socket);
-
-    /* Safety check */
-    if (socket == server.socket) return NULL;
-
-    /* Remove from linked list */
-    client_node_p prev = client_head;
-    client_node_p node = NULL;
-    while (prev->next->socket != socket) {prev = prev->next;}
-    node = prev->next;
-    prev->next = node->next;
-
-    /* Close pipe if needed */
-    if (node->pipe != NULL) {
-        fclose(node->pipe);
-    }
-
-    /* Find new max socket */
-    client_node_p curr = NULL;
-    if (max_socket == socket) {
-        max_socket = server.socket;
-        curr = client_head;
-        while (curr != NULL) {
-            if (curr->socket > max_socket) 
-                max_socket = curr->socket;
-            curr = curr->next;
-        }
-    }
-
-    /* Print removal notice */
-    printf("Removed client{%s}\n",ctoa(node));
-
-    /* Free node */
-    free(node);
-
-    return prev;
-}
-
-/* Re-add all clients to client set */
-void refresh_client_set() {
-    /* Clear lists */
-    FD_ZERO(&client_rdset);
-    FD_ZERO(&client_wrset);
-
-    /* Add all clients to needed set */
-    client_node_p curr = client_head;
-    while (curr) {
-        //fprintf(stderr,"Refreshed socket %d\n",curr->socket);
-        if (curr->stage == WS_STAGE_READING) {
-            FD_SET(curr->socket, &client_rdset);
-        } else if (curr->stage == WS_STAGE_SENDING) {
-            FD_SET(curr->socket, &client_wrset);
-        }
-        curr = curr->next;
-    }
-}
-
-// Returns the total size of the virtual address space for the running linux process (jbellardo)
-long get_memory_usage_linux() {
-    // Variables to store all the contents of the stat file
-    int pid, ppid, pgrp, session, tty_nr, tpgid;
-    char comm[2048], state;
-    unsigned int flags;
-    unsigned long minflt, cminflt, majflt, cmajflt, vsize;
-    unsigned long utime, stime;
-    long cutime, cstime, priority, nice, num_threads, itrealvalue, rss;
-    unsigned long long starttime;
-    // Open the file
-    FILE *stat = fopen("/proc/self/stat", "r");
-    if (!stat) {
-        perror("Failed to open /proc/self/stat");
-        return 0;
-    }
-    // Read the statistics out of the file
-    fscanf(stat, "%d%s%c%d%d%d%d%d%u%lu%lu%lu%lu"
-    "%ld%ld%ld%ld%ld%ld%ld%ld%llu%lu%ld",
-    &pid, comm, &state, &ppid, &pgrp, &session, &tty_nr,
-    &tpgid, &flags, &minflt, &cminflt, &majflt, &cmajflt,
-    &utime, &stime, &cutime, &cstime, &priority, &nice,
-    &num_threads, &itrealvalue, &starttime, &vsize, &rss);
-    fclose(stat);
-    return vsize;
-}
-
-/* Puts a correct url path into buf */
-void build_url(char *buf, char *tail) {
-    int root_len = strlen(root);
-    strcpy(buf, root);
-    strcpy(buf+root_len, tail);
-    if (strchr(tail, '.') == NULL) {
-        strcat(buf, ".html");
-    }
-    vprint("Built url %s from %s\n",buf,tail);
-}
-
-/* Parses a client's data and writes the correct response to its data */
-void parse_data(client_node_p client) {
-    vprint("Parse started for client{%s}\n", ctoa(client));
-    /* Setup vars */
-    int parse_type = WS_STATUS_INVALID;
-    char *data = client->data;
-    char *url_tail = WS_URL_500;
-    char url[WS_MAX_DATA];
-
-    /* Safety cutoff */
-    data[WS_MAX_DATA-1] = '\n';
-
-    /* Determine type of output */
-    if (client->data_size < WS_PREFIX_LEN+1 
-            || memcmp(data,"GET /",WS_PREFIX_LEN+1) != 0) {
-        /* Check for invalid start */
-        url_tail = WS_URL_500;
-    } else {
-        /* Find end of URL */
-        url_tail = data+WS_PREFIX_LEN;
-        int len = strcspn(data+WS_PREFIX_LEN, " \n\r");
-        
-        /* Cut-off string */
-        data[WS_PREFIX_LEN + len] = '\0';
-        vprint("Parsed url: %s\n",url_tail);
-        /* Rest of string is garbage */
-
-        /* Simple malicious url handling */
-        if (strstr(url_tail,"..")) {
-            url_tail = WS_URL_500;
-            vprint("URL was dangerous, 500 sent\n");
-        }
-
-        /* Handle index */
-        if (strcmp(url_tail,"/") == 0) {
-            url_tail = WS_URL_INDEX;
-        }
-        parse_type = WS_STATUS_OK;
-    }
-
-    /* Try and open page's file */
-    build_url(url, url_tail);
-    FILE *page = fopen(url,"r");
-    if (!page) {
-        vprint("Page %s is missing!\n", url);
-        perror("Open failed");
-        build_url(url, WS_URL_404);
-        page = fopen(url,"r");
-        parse_type = WS_STATUS_MISSING;
-    }
-    client->pipe = page;
-
-    /* Write file into intermediate buffer */
-    char content[WS_MAX_DATA-WS_MAX_HEADER+1]; /* Enough for initial read + null term */
-    long unsigned int page_size = fread(content, sizeof(char), WS_MAX_DATA-WS_MAX_HEADER, page);
-    vprint("PAGE_SIZE=%ld\n",page_size);
-    /* End string */
-    content[page_size] = '\0';
-
-    /* Get header status text */
-    char *header_status = NULL;
-    if (parse_type == WS_STATUS_INVALID) {
-        header_status = "500 OK";
-        err_count++;
-    } else if (parse_type == WS_STATUS_MISSING) {
-        header_status = "404 Not Found";
-        err_count++;
-    } else {
-        header_status = "200 OK";
-    }
-    
-    /* Get content type text */
-    char *ext = strchr(url,'.');
-    char *content_type;
-    if (strstr(ext,WS_EXT_HTML) == ext ||
-            strstr(ext,WS_EXT_HTM) == ext) {
-        content_type = WS_TYPE_HTML;
-    } else if (strstr(ext,WS_EXT_CSS) == ext) {
-        content_type = WS_TYPE_CSS;
-    } else if (strstr(ext,WS_EXT_JS) == ext) {
-        content_type = WS_TYPE_JS;
-    } else if (strstr(ext,WS_EXT_GIF) == ext) {
-        content_type = WS_TYPE_GIF;
-    } else if (strstr(ext,WS_EXT_JPG) == ext ||
-            strstr(ext,WS_EXT_JPEG) == ext) {
-        content_type = WS_TYPE_JPEG;
-    } else if (strstr(ext,WS_EXT_PNG) == ext) {
-        content_type = WS_TYPE_PNG;
-    } else if (strstr(ext,WS_EXT_SVG) == ext ||
-            strstr(ext,WS_EXT_XML) == ext) {
-        content_type = WS_TYPE_SVG;
-    } else {
-        content_type = WS_TYPE_UNKNOWN;
-    }
-
-    /* Determine file size */
-    long int bookmark = ftell(page);
-    fseek(page, 0L, SEEK_END);
-    unsigned long int content_size = ftell(page);
-    fseek(page, bookmark, SEEK_SET);
-
-    /* Assemble header */
-    sprintf(data, WS_STR_CONTENT_HEADER, header_status, 
-        content_type, content_size);
-    
-    /* Write start of content after that */
-    int dlen = strlen(data);
-    memcpy(data+strlen(data), content, page_size);
-
-    /* Update data size and rst offset*/
-    client->data_size = page_size+dlen;
-    client->offset = 0;
-
-    printf("Client{%s} accessed url %s, with size of %lu bytes\n",ctoa(client),url,content_size);
-}
-
-/* Running logic */
-int main(int argc, char *argv[]) {
-    /* Setup main vars */
-    struct sockaddr *address;
-    struct sockaddr_in address4;
-    struct sockaddr_in6 address6;
-    socklen_t addr_len;
-    char *addr_str = NULL;
-    char addr_ver = AF_INET;
-    int port = WS_DEFAULT_PORT;
-
-    /* Parse args */
-    if (argc < 2 || argc > 7) {
-        printf(USAGE_STR,argv[0]);
-        return 0;
-    } else {
-        /* Get root */
-        root = argv[1];
-
-        /* Check for help */
-        if (strcmp(root,"--help") == 0) {
-            printf(HELP_STR,argv[0]);
-            return 0;
-        }
-
-        for (int i=2; i < argc; i++) {
-            if (strcmp(argv[i],"-a") == 0) {
-                /* Ensure value was given */
-                if (argc == i+1) {
-                    printf(USAGE_STR,argv[0]);
-                    return 0;
-                }
-                addr_str = argv[i+1];
-                i++;
-            } else if (strcmp(argv[i],"-p") == 0) {
-                /* Ensure value was given */
-                if (argc == i+1) {
-                    printf(USAGE_STR,argv[0]);
-                    return 0;
-                }
-                port = atoi(argv[i+1]);
-                i++;
-            } else if (strcmp(argv[i],"-v") == 0) {
-                verbose = TRUE;
-                ctoa_level = WS_CTOA_SOCKET;
-            } else {
-                printf(USAGE_STR,argv[0]);
-                return 0;
-            }
-        }
-    }
-
-    /* Check for root folder access */
-    DIR *rootdir = opendir(root);
-    if (rootdir == NULL) {
-        perror("Couldn't access root folder");
-        return errno;
-    } else {
-        closedir(rootdir);
-    }
-
-    /* Install intrupt handler */
-    struct sigaction sig; /* For setting up intr handler */
-    sig.sa_handler = intr_handler;
-    sigfillset(&sig.sa_mask);
-    sig.sa_flags = 0;
-    if (sigaction(SIGINT, &sig, NULL)) {
-        perror("Couldn't set signal handler for SIGINT");
-        return errno;
-    }
-
-    /* Configure server address and port, accounting for IPv6 */
-    if (addr_str) {
-        if (inet_pton(AF_INET, addr_str, &(address4.sin_addr))) {
-            addr_ver = AF_INET;
-            address4.sin_family = AF_INET;
-            address4.sin_port = htons( port );
-            address = (struct sockaddr *)&address4;
-            addr_len = sizeof(address4);
-        } else if (inet_pton(AF_INET6, addr_str, &(address6.sin6_addr))) {
-            addr_ver = AF_INET6;
-            address6.sin6_family = AF_INET6;
-            address6.sin6_port = htons( port );
-            address = (struct sockaddr *)&address6;
-            addr_len = sizeof(address6);
-        } else {
-            fprintf(stderr,"Error binding TCP socket: Cannot assign requested address\n");
-            return 1;
-        }
-    } else {
-        addr_ver = AF_INET;
-        address4.sin_family = AF_INET;
-        address4.sin_addr.s_addr = INADDR_ANY;
-        address4.sin_port = htons( port );
-        address = (struct sockaddr *)(&address4);
-        addr_len = sizeof(address4);
-    }
-
-    /* Create and configure socket */
-    server.socket = socket(addr_ver, SOCK_STREAM | SOCK_NONBLOCK, 0);
-    if (server.socket == -1) {
-        perror("Server socket creation error");
-        return errno;
-    }
-    // Do something to enable simultaneous v6?
-
-    /* Bind the server to the port */
-    if (bind(server.socket, address, addr_len) < 0) {
-        perror("Server binding error");
-        return errno;
-    }
-
-    /* Enable listening mode on the server */
-    if (listen(server.socket, 10) < 0) {
-        perror("Server listening error");
-        return errno;
-    }
-
-    /* Print and flush socket info */
-    getsockname(server.socket, address, &addr_len);
-    if (addr_ver == AF_INET6) {
-        port = ((struct sockaddr_in6 *) address)->sin6_port;
-    } else {
-        port = ((struct sockaddr_in *) address)->sin_port;
-    }
-    fprintf(stdout,"HTTP server is using TCP port %d\nHTTPS server is using TCP port -1\n", ntohs(port));
-    fflush(stdout);
-
-    /* Setup initial client set */
-    add_client(server.socket);
-    server.stage = WS_STAGE_READING;
-    vprint("Listener with socket %d ready\n",server.socket);
-
-    /* Main event loop */
-    while (alive) {
-        //vprint("EVENT LOOP TOP REACHED\n");
-        /* Setup for select */
-        //struct timeval timeout = { 1, 0 }; /* 1s timeout */
-        refresh_client_set();
-
-        /* Wait for clients */
-        int i = select(max_socket+1, &client_rdset, &client_wrset, NULL, NULL);
-
-        /* Check for timeout */
-        if (i == 0) {
-            vprint("EVENT LOOP TIMEOUT\n");
-            continue;
-        }
-        //vprint("%d ready descriptor(s)\n",i);
-
-        /* Serve current clients */
-        client_node_p curr = client_head->next;
-        while (curr != NULL && i > 0 && alive) {
-            /* Determine client needs */
-            if (FD_ISSET(curr->socket, &client_rdset)) {
-                /* Mark that a socket was used */
-                i--;
-                /* Read in a chunk of data */
-                vprint("Client{%s} started read\n",ctoa(curr));
-                int diff = read(curr->socket, 
-                    curr->data+curr->data_size, WS_MAX_DATA-curr->data_size);
-                curr->data_size += diff;
-                vprint("Client{%s} read %d bytes\n",ctoa(curr),diff);
-
-                /* Check if empty read (socket closed) */
-                if (diff == 0) {
-                    printf("Client{%s} closed remotly\n",ctoa(curr));
-                    curr = rm_client(curr->socket);
-                } else if (curr->data[curr->data_size-1] == '\n' /* Check if read completed */
-                        || curr->data_size == WS_MAX_DATA) {
-                    /* Parse the read data */
-                    req_count++;
-                    parse_data(curr);
-
-                    /* Set stage to sending */
-                    curr->stage = WS_STAGE_SENDING;
-                }
-            } else if (FD_ISSET(curr->socket, &client_wrset)) {
-                /* Mark that a socket was used */
-                i--;
-                /* Check if all current data has been written */
-                if (curr->offset >= curr->data_size) {
-                    curr->offset = 0;
-                    curr->data_size = fread(curr->data, sizeof(char), 
-                        WS_MAX_DATA, curr->pipe);
-                }
-
-                /* Send as much of the remaining data as possible */
-                int bytes_sent = send(curr->socket, curr->data+curr->offset, 
-                    curr->data_size-curr->offset, 0);
-                curr->offset += bytes_sent;
-                vprint("Client{%s} sent %d bytes\n",ctoa(curr),bytes_sent);
-                
-                /* If EOF reached, close connection and clean up */
-                if (feof(curr->pipe)) {
-                    curr = rm_client(curr->socket); /* Allows accessing next */
-                }
-            }
-
-            /* Move on to next client */
-            curr = curr->next;
-        }
-
-        /* Accept new clients */
-        if (i > 0 && FD_ISSET(server.socket, &client_rdset)) {
-            int new_socket = accept(server.socket, address, &addr_len);
-            if (new_socket != -1) {
-                add_client(new_socket);
-            } else {
-                perror("Client failed to connect\n");
-                err_count++;
-            }
-        }
-    }
-    
-    /* Cleanup and shutdown everything */
-    client_node_p curr = client_head;
-    client_node_p next = NULL;
-    while (curr) {
-        next = curr->next;
-        rm_client(curr->socket);
-        curr = next;
-    }
-
-    printf("Server exiting cleanly.\n");
-    return 0;
-}
\ No newline at end of file
+/* Jenna Whilden (jpwolf101@gmail.com) 11-22-2021 */
+/* Simple HTML web server */
+#ifdef LINUX
+#define _GNU_SOURCE         /* CPU affinity */
+#endif
+#include <stdio.h>          /* High level read and write */
+#include <stdlib.h>         /* Memory management */
+#include <unistd.h>         /* Lower level read and write */
+#include <string.h>         /* String parsing */
+#include <strings.h>        /* Case-insensitive compares */
+#include <time.h>           /* Monotonic clock */
+#include <errno.h>          /* Error handling */
+#include <signal.h>         /* Interupt handling */
+#include <fcntl.h>          /* Non-blocking sockets */
+#include <dirent.h>         /* For testing directories */
+#include <limits.h>         /* PATH_MAX */
+#include <stdint.h>         /* SIZE_MAX */
+#include <sys/stat.h>       /* File sizes */
+#include <sys/time.h>       /* CPU / User time */
+#include <sys/types.h>      /* Type definitions */
+#include <sys/socket.h>     /* Low level sockets */
+#include <sys/uio.h>        /* Gathered writes */
+#include <sys/resource.h>   /* System usage stats */
+#include <netinet/in.h>     /* Address structs */
+#include <netinet/tcp.h>    /* TCP_NODELAY */
+#include <arpa/inet.h>      /* String to address conversions */
+#include "web-server.h"     /* JSON server consts and structs */
+#include "ws-event.h"       /* Event backends */
+#include "ws-cache.h"       /* Response cache */
+#include "ws-http.h"        /* Request parser */
+#include "ws-compress.h"    /* Content encoding */
+#include "ws-stats.h"       /* Counters and latency histograms */
+#include "ws-log.h"         /* Access and debug log */
+#include "ws-mime.h"        /* Content types */
+#include "ws-fcgi.h"        /* FastCGI backends */
+#include "ws-tls.h"         /* HTTPS */
+#include "ws-h2.h"          /* HTTP/2 */
+#include "ws-path.h"        /* Root-anchored lookups */
+#include "ws-disk.h"        /* Disk thread pool */
+#ifdef WS_HAVE_SENDFILE
+#include <sys/sendfile.h>   /* Zero-copy file sending */
+#endif
+
+/* Globals, shared read-only by every worker once they start */
+static volatile sig_atomic_t alive = 1; /* 0 if server is being killed */
+static long client_ids = 0; /* Last client id handed out, atomic */
+static ws_worker_p workers = NULL; /* Every worker's context */
+static int worker_count = 1; /* Number of workers */
+static int pin_workers = FALSE; /* Pin each worker to a CPU */
+static int backend = WS_BACKEND_DEFAULT; /* Event backend of each worker */
+static long cache_max = WS_CACHE_DEFAULT_MAX; /* Memory cap of all caches */
+static long idle_timeout = WS_DEFAULT_IDLE_TIMEOUT * 1000L; /* ms before idle clients close */
+static long header_timeout = WS_DEFAULT_HEADER_TIMEOUT * 1000L; /* ms a request may take to arrive */
+static long min_rate = WS_DEFAULT_MIN_RATE; /* Bytes per second responses must be read at, 0 for any */
+static int max_requests = WS_DEFAULT_MAX_REQUESTS; /* Requests per connection */
+static int backlog = WS_DEFAULT_BACKLOG; /* Connections queued for each listener */
+static long max_connections = 0; /* Open clients of all workers before accepting pauses, 0 for none */
+static long send_budget = WS_DEFAULT_SEND_BUDGET; /* Bytes a bulk response sends per turn, 0 for any */
+static long rate_limit = 0; /* Bytes per second each connection is sent, 0 for no limit */
+static int disk_threads = WS_DEFAULT_DISK_THREADS; /* Threads doing file work off the loops, 0 for none */
+static char* root = NULL; /* Where html pages are stored */
+static int root_fd = -1; /* root opened, every page is resolved beneath it */
+static __thread char ctoabuf[512]; /* Used in pc function, one per worker */
+static char use_sendfile = FALSE; /* Send file bodies without copying */
+static ws_max_age_t max_ages[WS_MAX_AGES]; /* max-age of each configured extension */
+static int max_age_count = 0; /* Number of configured extensions */
+static long default_max_age = -1; /* max-age of other files, -1 for none */
+static long min_compress = WS_DEFAULT_MIN_COMPRESS; /* Smaller pages aren't compressed */
+static long stats_interval = 0; /* ms between stats dumps to stdout, 0 for none */
+static ws_pack_t pack; /* Site pack every page is served from, base is NULL without one */
+static int use_pack = FALSE; /* Serve only from the site pack */
+static char *pack_file = NULL; /* File the site pack is mapped from, NULL to build it */
+static char *pack_out = NULL; /* File a site pack is written to instead of serving */
+static char *mime_file = NULL; /* mime.types file adding to the built-in types */
+static char *tls_cert = NULL; /* Certificate of the HTTPS listener, NULL for none */
+static char *tls_key = NULL; /* Its key, NULL if it is in the certificate's file */
+static int use_ktls = TRUE; /* Let the kernel encrypt HTTPS responses when it can */
+static __thread char tlsbuf[WS_TLS_RECORD]; /* Pieces gathered into one record, one per worker */
+static int use_h2 = TRUE; /* Take HTTP/2 connections, by prior knowledge, upgrade or ALPN */
+
+/* Aliases */
+#define ctoa(CLIENT) ctoa_l((CLIENT),ws_log_level >= WS_LOG_TRACE ? WS_CTOA_SOCKET : WS_CTOA_SIMPLE)
+
+/* Intr handler, mostly ftom GT */
+void intr_handler(int sig) {
+    /* If intr is sigint, exit fish main, else ignore */
+    if (sig == SIGINT) {
+        int saved = errno;
+        alive = 0;
+
+        /* Only one thread gets the signal, so wake every worker */
+        for (int w = 0; workers && w < worker_count; w++) {
+            if (workers[w].wake_fd != -1 && write(workers[w].wake_fd, "", 1) == -1) {
+                /* Pipe already holds a wakeup */
+            }
+        }
+        errno = saved;
+    }
+}
+
+/* Returns a string of data from a client struct */
+char *ctoa_l(client_node_p client, int ctoa_level) {
+    switch (ctoa_level) {
+        default:
+        case WS_CTOA_SIMPLE:
+            sprintf(ctoabuf,"id = %ld", 
+                client->id);
+            break;
+        case WS_CTOA_SOCKET:
+            sprintf(ctoabuf,"id = %ld, socket = %d", 
+                client->id, client->socket);
+            break;
+        case WS_CTOA_DATA:
+            sprintf(ctoabuf,"id=%ld, socket=%d, requests=%d, data_size=%d, out_offset=%d, out_size=%d", 
+                client->id, client->socket, client->requests, client->data_size, 
+                client->out_offset, client->out_size);
+            break;
+        case WS_CTOA_FULL:
+            sprintf(ctoabuf,"addr=%p, id=%ld, socket=%d, stage=%d, requests=%d, file=%d, file_offset=%lld, file_size=%lld, entry=%p, data_size=%d, out_offset=%d, out_size=%d", 
+                client, client->id, client->socket, client->stage, client->requests, client->file, 
+                (long long)client->file_offset, (long long)client->file_size, client->entry, 
+                client->data_size, client->out_offset, client->out_size);
+            break;
+    }
+    return ctoabuf;
+}
+
+/* Takes a node from the pool, allocating a new slab if it is empty */
+client_node_p pool_alloc(client_table_p table) {
+    if (table->free == NULL) {
+        client_slab_p slab = malloc(sizeof(client_slab_t));
+        if (slab == NULL) return NULL;
+        slab->next = table->slabs;
+        table->slabs = slab;
+
+        /* Thread the new nodes onto the free list */
+        for (int i = 0; i < WS_POOL_SLAB; i++) {
+            slab->nodes[i].next = table->free;
+            table->free = &slab->nodes[i];
+        }
+    }
+    client_node_p node = table->free;
+    table->free = node->next;
+    return node;
+}
+
+/* Returns a node to the pool */
+void pool_free(client_table_p table, client_node_p node) {
+    node->next = table->free;
+    table->free = node;
+}
+
+/* Releases every slab of the pool and the table itself */
+void table_destroy(client_table_p table) {
+    while (table->slabs) {
+        client_slab_p next = table->slabs->next;
+        free(table->slabs);
+        table->slabs = next;
+    }
+    free(table->nodes);
+    table->nodes = NULL;
+    table->size = 0;
+    table->count = 0;
+    table->free = NULL;
+}
+
+/* Stores a node at its socket's slot, growing the table if needed */
+int table_put(client_table_p table, client_node_p node) {
+    if (node->socket >= table->size) {
+        int size = table->size ? table->size : WS_POOL_SLAB;
+        while (size <= node->socket) size *= 2;
+        client_node_p *nodes = realloc(table->nodes, size * sizeof(client_node_p));
+        if (nodes == NULL) return -1;
+        memset(nodes + table->size, 0, (size - table->size) * sizeof(client_node_p));
+        table->nodes = nodes;
+        table->size = size;
+    }
+    table->nodes[node->socket] = node;
+    table->count++;
+    return 0;
+}
+
+/* Returns the client using a socket, or NULL */
+client_node_p table_get(client_table_p table, int socket) {
+    if (socket < 0 || socket >= table->size) return NULL;
+    return table->nodes[socket];
+}
+
+/* Returns the monotonic time in ms */
+long monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Returns the monotonic time in us, for request latencies */
+long monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000L;
+}
+
+/* Takes a client's deadline off its worker's wheel */
+void clear_deadline(client_node_p client) {
+    ws_worker_p worker = client->worker;
+    if (client->deadline == WS_DEADLINE_IDLE) {
+        WS_STATS_ADD(worker->stats.idle, -1);
+    }
+    ws_timer_cancel(&worker->timers, &client->timer);
+    client->deadline = -1;
+}
+
+/* Replaces a client's deadline with one of a kind, starting from now */
+void set_deadline(client_node_p client, int kind) {
+    ws_worker_p worker = client->worker;
+    clear_deadline(client);
+    client->deadline = kind;
+    switch (kind) {
+        case WS_DEADLINE_IDLE:
+            WS_STATS_ADD(worker->stats.idle, 1);
+            ws_timer_set(&worker->timers, &client->timer, worker->now_ms + idle_timeout);
+            break;
+        case WS_DEADLINE_HEADER:
+            ws_timer_set(&worker->timers, &client->timer, worker->now_ms + header_timeout);
+            break;
+        case WS_DEADLINE_SEND:
+            client->send_mark = client->sent;
+            if (min_rate > 0) {
+                ws_timer_set(&worker->timers, &client->timer, 
+                    worker->now_ms + WS_SEND_WINDOW * 1000L);
+            }
+            break;
+    }
+}
+
+/* Borrows a client's data buffer and parse state for a new request.
+   Returns FALSE if they couldn't be allocated */
+int borrow_request(client_node_p client) {
+    ws_buf_pool_p pool = &client->worker->buffers;
+    client->data = ws_buf_get(pool, WS_FIRST_DATA);
+    client->req = ws_buf_get(pool, sizeof(ws_http_request_t));
+    if (client->data == NULL || client->req == NULL) {
+        ws_buf_put(pool, client->data, WS_FIRST_DATA);
+        ws_buf_put(pool, client->req, sizeof(ws_http_request_t));
+        client->data = NULL;
+        client->req = NULL;
+        return FALSE;
+    }
+    client->data_cap = ws_buf_fit(WS_FIRST_DATA);
+    ws_http_init(client->req);
+    return TRUE;
+}
+
+/* Returns a client's data buffer and parse state, once no data is left */
+void release_request(client_node_p client) {
+    ws_buf_pool_p pool = &client->worker->buffers;
+    if (client->data == NULL || client->data_size > 0) return;
+    ws_buf_put(pool, client->data, client->data_cap);
+    ws_buf_put(pool, client->req, sizeof(ws_http_request_t));
+    client->data = NULL;
+    client->data_cap = 0;
+    client->req = NULL;
+}
+
+/* Moves a client's data to a buffer twice the size, up to WS_MAX_DATA.
+   Slices into the old buffer are lost, so the request is parsed again.
+   Returns FALSE if it is already as large as it gets */
+int grow_data(client_node_p client) {
+    ws_buf_pool_p pool = &client->worker->buffers;
+    if (client->data_cap >= WS_MAX_DATA) return FALSE;
+    char *data = ws_buf_get(pool, client->data_cap * 2);
+    if (data == NULL) return FALSE;
+    memcpy(data, client->data, client->data_size);
+    ws_buf_put(pool, client->data, client->data_cap);
+    client->data = data;
+    client->data_cap *= 2;
+    ws_http_init(client->req);
+    return TRUE;
+}
+
+/* Returns the buffers a client borrowed to send a response */
+void release_response(client_node_p client) {
+    ws_buf_pool_p pool = &client->worker->buffers;
+    ws_buf_put(pool, client->out, WS_MAX_DATA);
+    ws_buf_put(pool, client->ranges, WS_HTTP_MAX_RANGES * sizeof(ws_http_range_t));
+    client->out = NULL;
+    client->ranges = NULL;
+}
+
+/* Returns TRUE if errno means a non-blocking call would block */
+static int would_block() {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+/* Returns TRUE if what is written to a client's socket goes out as it is,
+   so sendfile() and MSG_MORE can be used on it */
+static int plain_writes(client_node_p client) {
+    return client->tls == NULL || client->ktls;
+}
+
+/* Reads from a client, decrypting when it is on HTTPS */
+static ssize_t client_read(client_node_p client, char *buf, size_t len) {
+    if (client->tls == NULL) {
+        return read(client->socket, buf, len);
+    }
+    int want;
+    return ws_tls_read(client->tls, buf, len, &want);
+}
+
+/* Writes gathered pieces to a client. Userspace TLS copies up to a record
+   of them together, so a small response goes out as one record */
+static ssize_t client_send(client_node_p client, struct msghdr *msg, int flags) {
+    if (plain_writes(client)) {
+        return sendmsg(client->socket, msg, flags);
+    }
+    size_t len = 0;
+    for (int i = 0; i < msg->msg_iovlen && len < WS_TLS_RECORD; i++) {
+        size_t n = msg->msg_iov[i].iov_len;
+        if (n > WS_TLS_RECORD - len) {
+            n = WS_TLS_RECORD - len;
+        }
+        memcpy(tlsbuf+len, msg->msg_iov[i].iov_base, n);
+        len += n;
+    }
+    int want;
+    return ws_tls_write(client->tls, tlsbuf, len, &want);
+}
+
+/* Writes what a backend connection has queued until its socket is full,
+   and watches it for writing while anything is left. Errors are left for
+   the connection's next event to find */
+void fcgi_flush(ws_worker_p worker, ws_fcgi_conn_p conn) {
+    while (conn->ready & WS_EV_WRITE) {
+        ssize_t n = ws_fcgi_flush(conn);
+        if (n == 0) break;
+        if (n == -1) {
+            if (would_block()) {
+                conn->ready &= ~WS_EV_WRITE;
+            } else if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+    }
+    ws_event_mod(&worker->loop, conn->fd, conn->out_offset < conn->out_len 
+        ? WS_EV_READ | WS_EV_WRITE : WS_EV_READ, conn);
+}
+
+/* Frees a client's dynamic response state, once it is done or dropped */
+void fcgi_release(client_node_p client) {
+    free(client->stream);
+    client->stream = NULL;
+    client->stream_offset = 0;
+    client->stream_len = 0;
+    client->stream_cap = 0;
+    client->chunked = FALSE;
+    client->fcgi = NULL;
+    client->fcgi_id = 0;
+    client->fcgi_backend = -1;
+    client->fcgi_state = WS_FCGI_STATE_NONE;
+}
+
+/* Lets go of a client's dynamic response: a queued request leaves its
+   queue, and one a backend is answering is aborted, its id staying busy
+   until the backend ends it */
+void fcgi_detach(client_node_p client) {
+    ws_worker_p worker = client->worker;
+    if (client->fcgi_state == WS_FCGI_STATE_QUEUED) {
+        int backend = client->fcgi_backend;
+        client_node_p prev = NULL, *link = &worker->fcgi_queue[backend];
+        while (*link != client) {
+            prev = *link;
+            link = &prev->fcgi_next;
+        }
+        *link = client->fcgi_next;
+        if (worker->fcgi_queue_tail[backend] == client) {
+            worker->fcgi_queue_tail[backend] = prev;
+        }
+    } else if (client->fcgi != NULL) {
+        /* The connection owns the id until its END_REQUEST */
+        ws_fcgi_conn_p conn = client->fcgi;
+        conn->reqs[client->fcgi_id] = conn;
+        if (ws_fcgi_abort(conn, client->fcgi_id) == 0) {
+            fcgi_flush(worker, conn);
+        }
+        if (conn->paused) {
+            conn->paused = FALSE;
+            worker->fcgi_pending = TRUE;
+        }
+    }
+    fcgi_release(client);
+}
+
+/* Sets up a node taken from the pool for a client on a socket */
+void init_client(client_node_p node, ws_worker_p worker, int socket) {
+    node->id = __atomic_add_fetch(&client_ids, 1, __ATOMIC_RELAXED);
+    node->worker = worker;
+    node->socket = socket;
+    node->sent = 0;
+    node->file = -1;
+    node->file_offset = 0;
+    node->file_size = 0;
+    node->entry = NULL;
+    node->entry_offset = 0;
+    node->entry_end = 0;
+    node->range_count = 0;
+    node->range_index = 0;
+    node->stage = WS_STAGE_READING;
+    node->status = 0;
+    node->req_start = -1;
+    node->sent_first = FALSE;
+    node->ready = 0;
+    node->keep_alive = FALSE;
+    node->requests = 0;
+    node->req_len = 0;
+    node->req = NULL;
+    node->ranges = NULL;
+    node->data_size = 0;
+    node->data_cap = 0;
+    node->data = NULL;
+    node->out_offset = 0;
+    node->out_size = 0;
+    node->out = NULL;
+    node->deadline = -1;
+    node->send_mark = 0;
+    ws_timer_setup(&node->timer, node);
+    node->send_queue = WS_SEND_NONE;
+    node->send_prev = NULL;
+    node->send_next = NULL;
+    node->tokens = rate_limit;
+    node->tokens_ms = worker->now_ms;
+    ws_timer_setup(&node->throttle, node);
+    node->disk = NULL;
+    node->disk_start = 0;
+    node->disk_end = 0;
+    node->fcgi_state = WS_FCGI_STATE_NONE;
+    node->fcgi_backend = -1;
+    node->fcgi = NULL;
+    node->fcgi_id = 0;
+    node->chunked = FALSE;
+    node->stream = NULL;
+    node->stream_offset = 0;
+    node->stream_len = 0;
+    node->stream_cap = 0;
+    node->fcgi_next = NULL;
+    node->tls = NULL;
+    node->ktls = FALSE;
+    node->h2 = NULL;
+    node->h2_parent = NULL;
+    node->h2_stream = NULL;
+    node->next = NULL;
+}
+
+/* Add a new client, connected from addr, to a worker */
+void add_client(ws_worker_p worker, int socket, struct sockaddr *addr, socklen_t addr_len, int tls) {
+    /* Take node from the pool */
+    client_node_p node = pool_alloc(&worker->clients);
+    if (node == NULL) {
+        perror("Couldn't allocate client");
+        WS_STATS_ADD(worker->err_count, 1);
+        WS_STATS_ADD(worker->stats.rejected, 1);
+        close(socket);
+        return;
+    }
+    WS_STATS_ADD(worker->client_count, 1);
+    init_client(node, worker, socket);
+    memset(&node->addr, 0, sizeof(node->addr));
+    memcpy(&node->addr, addr, addr_len < sizeof(node->addr) ? addr_len : sizeof(node->addr));
+
+    /* HTTPS clients shake hands before anything is read */
+    if (tls) {
+        node->tls = ws_tls_accept(socket);
+        if (node->tls == NULL) {
+            perror("Couldn't start client TLS");
+            WS_STATS_ADD(worker->err_count, 1);
+            WS_STATS_ADD(worker->stats.rejected, 1);
+            close(socket);
+            pool_free(&worker->clients, node);
+            return;
+        }
+        node->stage = WS_STAGE_HANDSHAKE;
+    }
+
+    /* Register interest once, the event backend keeps it from now on */
+    client_table_p clients = &worker->clients;
+    if (table_put(clients, node) == -1 
+            || ws_event_add(&worker->loop, socket, WS_EV_READ, node) == -1) {
+        perror("Couldn't watch client socket");
+        WS_STATS_ADD(worker->err_count, 1);
+        WS_STATS_ADD(worker->stats.rejected, 1);
+        if (table_get(clients, socket) == node) {
+            clients->nodes[socket] = NULL;
+            clients->count--;
+        }
+        if (node->tls != NULL) {
+            ws_tls_close(node->tls);
+        }
+        close(socket);
+        pool_free(clients, node);
+        return;
+    }
+
+    /* Clients that never send anything time out too, and the handshake
+       must be done in the time a request has */
+    WS_STATS_ADD(worker->stats.open, 1);
+    set_deadline(node, tls ? WS_DEADLINE_HEADER : WS_DEADLINE_IDLE);
+
+    /* Print and return */
+    ws_log(WS_LOG_DEBUG, "Added new client{%s}\n",ctoa(node));
+}
+
+/* Returns TRUE if a client's response is short: what it has sent and what
+   is left of it (or of its current part) fit in WS_SHORT_RESPONSE.
+   HTTP/2 connections never are */
+int short_response(client_node_p client) {
+    if (client->stage != WS_STAGE_SENDING) return FALSE;
+    long left = (client->out_size - client->out_offset) 
+        + (client->entry ? (long)(client->entry_end - client->entry_offset) : 0)
+        + (long)(client->stream_len - client->stream_offset)
+        + (long)(client->file_size - client->file_offset);
+    return client->sent + left <= WS_SHORT_RESPONSE;
+}
+
+/* Appends a client to one of its worker's send queues */
+static void send_enqueue(client_node_p client, int queue) {
+    ws_worker_p worker = client->worker;
+    client->send_queue = queue;
+    client->send_next = NULL;
+    client->send_prev = worker->send_tail[queue];
+    if (client->send_prev != NULL) {
+        client->send_prev->send_next = client;
+    } else {
+        worker->send_head[queue] = client;
+    }
+    worker->send_tail[queue] = client;
+}
+
+/* Takes a client off whichever send queue it waits in, or off the wheel
+   if it is throttled */
+void cancel_send(client_node_p client) {
+    ws_worker_p worker = client->worker;
+    int queue = client->send_queue;
+    if (queue == WS_SEND_THROTTLED) {
+        ws_timer_cancel(&worker->timers, &client->throttle);
+    } else if (queue != WS_SEND_NONE) {
+        if (client->send_prev != NULL) {
+            client->send_prev->send_next = client->send_next;
+        } else {
+            worker->send_head[queue] = client->send_next;
+        }
+        if (client->send_next != NULL) {
+            client->send_next->send_prev = client->send_prev;
+        } else {
+            worker->send_tail[queue] = client->send_prev;
+        }
+        client->send_prev = client->send_next = NULL;
+    }
+    client->send_queue = WS_SEND_NONE;
+}
+
+/* Queues a client with more to send for its next turn, short responses
+   ahead of bulk ones */
+void defer_send(client_node_p client) {
+    if (client->send_queue != WS_SEND_NONE) return;
+    send_enqueue(client, short_response(client) ? WS_SEND_SHORT : WS_SEND_BULK);
+}
+
+/* Returns the most a client may send now: what is left of its turn's
+   budget after sending turn bytes, and of its tokens. When that is nothing
+   it is queued for its next turn, or throttled until tokens come in, and 0
+   is returned */
+size_t send_allowance(client_node_p client, long turn) {
+    ws_worker_p worker = client->worker;
+    size_t allowed = SIZE_MAX;
+    if (send_budget > 0 && !short_response(client)) {
+        if (turn >= send_budget) {
+            WS_STATS_ADD(worker->stats.send_deferred, 1);
+            defer_send(client);
+            return 0;
+        }
+        allowed = send_budget - turn;
+    }
+    if (rate_limit > 0) {
+        /* Top up the bucket, it holds a second's worth */
+        long elapsed = worker->now_ms - client->tokens_ms;
+        if (elapsed > 0) {
+            client->tokens += elapsed * rate_limit / 1000;
+            if (client->tokens > rate_limit) {
+                client->tokens = rate_limit;
+            }
+            client->tokens_ms = worker->now_ms;
+        }
+        if (client->tokens <= 0) {
+            /* Wait for a tick's worth, so it isn't woken for a few bytes */
+            long need = rate_limit * WS_TIMER_TICK_MS / 1000 + 1 - client->tokens;
+            WS_STATS_ADD(worker->stats.throttled, 1);
+            client->send_queue = WS_SEND_THROTTLED;
+            ws_event_mod(&worker->loop, client->socket, 0, client);
+            ws_timer_set(&worker->timers, &client->throttle, 
+                worker->now_ms + (need * 1000 + rate_limit - 1) / rate_limit);
+            return 0;
+        }
+        if ((size_t)client->tokens < allowed) {
+            allowed = client->tokens;
+        }
+    }
+
+    /* A TLS record written in user space must be retried whole, so it can
+       go into debt for one */
+    if (!plain_writes(client) && allowed < WS_TLS_RECORD) {
+        allowed = WS_TLS_RECORD;
+    }
+    return allowed;
+}
+
+/* Takes what a client sent from its tokens */
+void spend_tokens(client_node_p client, ssize_t sent) {
+    if (rate_limit > 0) {
+        client->tokens -= sent;
+    }
+}
+
+/* Moves a client through the FSM, defined below */
+void serve_client(client_node_p curr);
+
+/* Gives the clients queued in the last loop turn their next one, short
+   responses first. Clients queued again wait for the turn after */
+void run_sends(ws_worker_p worker) {
+    for (int queue = WS_SEND_SHORT; queue <= WS_SEND_BULK && alive; queue++) {
+        /* Move the queue aside, clients closing while others are served
+           take themselves off it */
+        client_node_p client = worker->send_head[queue];
+        worker->send_head[WS_SEND_TURN] = client;
+        worker->send_tail[WS_SEND_TURN] = worker->send_tail[queue];
+        worker->send_head[queue] = worker->send_tail[queue] = NULL;
+        for (; client != NULL; client = client->send_next) {
+            client->send_queue = WS_SEND_TURN;
+        }
+        while ((client = worker->send_head[WS_SEND_TURN]) != NULL && alive) {
+            cancel_send(client);
+            serve_client(client);
+        }
+    }
+}
+
+/* Returns TRUE if clients are waiting for their turn to send */
+int sends_pending(ws_worker_p worker) {
+    return worker->send_head[WS_SEND_SHORT] != NULL || worker->send_head[WS_SEND_BULK] != NULL;
+}
+
+/* Frees the node of an HTTP/2 stream, defined with HTTP/2 below */
+void h2_end_stream(client_node_p node);
+
+/* Lets go of a client's disk job, defined with the disk pool below */
+void disk_detach(client_node_p client);
+
+/* Remove a client from a worker */
+void rm_client(ws_worker_p worker, int socket) {
+    /* Say goodbye over TLS while the socket is still open */
+    client_table_p clients = &worker->clients;
+    client_node_p node = table_get(clients, socket);
+    if (node != NULL && node->tls != NULL) {
+        ws_tls_close(node->tls);
+        node->tls = NULL;
+    }
+
+    /* Shutdown client */
+    ws_event_del(&worker->loop, socket);
+    shutdown(socket, SHUT_RDWR);
+    close(socket);
+
+    /* Safety check */
+    if (socket == worker->server.socket || socket == worker->tls_server.socket 
+            || node == NULL) return;
+
+    /* Remove from table */
+    clients->nodes[socket] = NULL;
+    clients->count--;
+    clear_deadline(node);
+    cancel_send(node);
+    WS_STATS_ADD(worker->stats.open, -1);
+
+    /* A slot is free, so take the next waiting connection */
+    if (worker->accept_paused && (worker->conn_limit == 0 
+            || WS_STATS_GET(worker->stats.open) < worker->conn_limit)) {
+        worker->accept_pending = TRUE;
+    }
+    if (node->stage == WS_STAGE_SENDING) {
+        WS_STATS_ADD(worker->stats.sending, -1);
+    } else if (node->stage == WS_STAGE_DISK) {
+        WS_STATS_ADD(worker->stats.disk, -1);
+    }
+
+    /* Close file and release cached response if needed */
+    if (node->file != -1) {
+        close(node->file);
+    }
+    if (node->entry != NULL) {
+        ws_cache_release(node->entry);
+    }
+    fcgi_detach(node);
+    disk_detach(node);
+    release_response(node);
+    node->data_size = 0;
+    release_request(node);
+
+    /* An HTTP/2 connection takes its streams with it */
+    if (node->h2 != NULL) {
+        for (int i = 0; i < WS_H2_MAX_STREAMS; i++) {
+            if (node->h2->streams[i].data != NULL) {
+                h2_end_stream(node->h2->streams[i].data);
+            }
+        }
+        ws_h2_free(node->h2);
+        node->h2 = NULL;
+    }
+
+    /* Print removal notice */
+    ws_log(WS_LOG_DEBUG, "Removed client{%s}\n",ctoa(node));
+
+    /* Clients woken by a backend can close before their own events are
+       reached in the same batch */
+    node->stage = WS_STAGE_CLOSED;
+
+    /* Return node to the pool */
+    pool_free(clients, node);
+}
+
+/* Closes a client whose deadline passed, unless it is sending fast enough */
+void client_timeout(ws_timer_p timer) {
+    client_node_p client = timer->data;
+    ws_worker_p worker = client->worker;
+    if (client == &worker->server) {
+        worker->accept_pending = TRUE; /* Time to retry after running out of fds */
+        return;
+    }
+    if (timer == &client->throttle) {
+        /* Tokens came in, it sends on the next turn */
+        client->send_queue = WS_SEND_NONE;
+        ws_event_mod(&worker->loop, client->socket, 
+            client->stage == WS_STAGE_H2 ? WS_EV_READ | WS_EV_WRITE : WS_EV_WRITE, client);
+        defer_send(client);
+        return;
+    }
+
+    /* Clients waiting on the disk pool aren't the ones holding it up */
+    if (client->deadline == WS_DEADLINE_SEND && client->stage == WS_STAGE_DISK) {
+        set_deadline(client, WS_DEADLINE_SEND);
+        return;
+    }
+
+    /* Clients held back by -L only have to keep up with half of it */
+    long rate = rate_limit > 0 && rate_limit < 2 * min_rate ? rate_limit / 2 : min_rate;
+    if (client->deadline == WS_DEADLINE_SEND 
+            && client->sent - client->send_mark >= rate * WS_SEND_WINDOW) {
+        set_deadline(client, WS_DEADLINE_SEND);
+        return;
+    }
+    ws_log(WS_LOG_DEBUG, "Client{%s} timed out (%s)\n", ctoa(client),
+        client->deadline == WS_DEADLINE_IDLE ? "idle" 
+        : client->deadline == WS_DEADLINE_HEADER ? "request" : "send");
+    WS_STATS_ADD(worker->stats.timeouts[client->deadline], 1);
+    rm_client(worker, client->socket);
+}
+
+// Gets the virtual address space size (bytes) and resident set (pages) of the running linux process (jbellardo)
+int get_memory_usage_linux(unsigned long *vsize, long *rss) {
+    // Variables to store all the contents of the stat file
+    int ppid, pgrp, session, tty_nr, tpgid;
+    char line[2048], state, *fields;
+    unsigned int flags;
+    unsigned long minflt, cminflt, majflt, cmajflt;
+    unsigned long utime, stime;
+    long cutime, cstime, priority, nice, num_threads, itrealvalue;
+    unsigned long long starttime;
+    // Open the file
+    FILE *stat = fopen("/proc/self/stat", "r");
+    if (!stat) {
+        perror("Failed to open /proc/self/stat");
+        return -1;
+    }
+    // The command name may hold spaces, so the fields start after its ')'
+    if (fgets(line, sizeof(line), stat) == NULL || (fields = strrchr(line, ')')) == NULL) {
+        fclose(stat);
+        return -1;
+    }
+    fclose(stat);
+    // Read the statistics out of the line
+    if (sscanf(fields+1, " %c%d%d%d%d%d%u%lu%lu%lu%lu"
+    "%lu%lu%ld%ld%ld%ld%ld%ld%llu%lu%ld",
+    &state, &ppid, &pgrp, &session, &tty_nr,
+    &tpgid, &flags, &minflt, &cminflt, &majflt, &cmajflt,
+    &utime, &stime, &cutime, &cstime, &priority, &nice,
+    &num_threads, &itrealvalue, &starttime, vsize, rss) != 22) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns TRUE if the file name at the end of a path has an extension */
+int has_extension(char *path) {
+    char *name = strrchr(path, '/');
+    return strchr(name ? name : path, '.') != NULL;
+}
+
+/* Puts a correct url path (under root) into buf */
+void build_url(char *buf, char *tail) {
+    snprintf(buf, WS_MAX_DATA, "%s%s", tail, has_extension(tail) ? "" : ".html");
+    ws_log(WS_LOG_TRACE, "Built url %s from %s\n",buf,tail);
+}
+
+/* Opens a regular file under root for reading, returns its fd or -1 */
+int open_page(ws_path_cache_p paths, char *url, struct stat *info) {
+    int page = ws_path_open(paths, url, O_RDONLY);
+    if (page == -1) return -1;
+    if (fstat(page, info) == -1 || !S_ISREG(info->st_mode)) {
+        close(page);
+        errno = ENOENT;
+        return -1;
+    }
+    return page;
+}
+
+/* Returns the content type of a page */
+const char *get_content_type(char *url) {
+    return ws_mime_find(url)->type;
+}
+
+/* Returns the Cache-Control max-age of a page, or -1 to send none */
+long get_max_age(char *url) {
+    char *name = strrchr(url, '/');
+    char *ext = strrchr(name ? name : url, '.');
+    if (ext != NULL) {
+        for (int i = 0; i < max_age_count; i++) {
+            if (strcasecmp(ext+1, max_ages[i].ext) == 0) {
+                return max_ages[i].seconds;
+            }
+        }
+    }
+    return default_max_age;
+}
+
+/* Returns TRUE if a page's content type is worth compressing */
+int is_compressible(char *url) {
+    return ws_mime_find(url)->compressible;
+}
+
+/* Writes the ETag of a coding of a page into buf, from the plain ETag */
+void variant_etag(char *buf, const char *etag, int coding) {
+    if (coding == WS_CODING_IDENTITY) {
+        snprintf(buf, WS_CACHE_ETAG_LEN, "%s", etag);
+    } else {
+        /* Each coding is a different representation, so its tag differs */
+        snprintf(buf, WS_CACHE_ETAG_LEN, "%.*s-%s\"", (int)strlen(etag)-1, etag,
+            ws_compress_name(coding));
+    }
+}
+
+/* Writes the strong ETag of a file sent in a coding, quotes included, into buf */
+void make_etag(char *buf, struct stat *info, int coding) {
+    char etag[WS_CACHE_ETAG_LEN];
+    unsigned long nsec = 0;
+#ifdef LINUX
+    nsec = info->st_mtim.tv_nsec;
+#endif
+    snprintf(etag, WS_CACHE_ETAG_LEN, "\"%lx-%lx-%lx.%lx\"",
+        (unsigned long)info->st_ino, (unsigned long)info->st_size,
+        (unsigned long)info->st_mtime, nsec);
+    variant_etag(buf, etag, coding);
+}
+
+/* Writes the validator, Vary and Cache-Control lines of a page into buf,
+   returns their length */
+int build_validators(char *buf, char *url, char *etag, time_t mtime) {
+    char date[WS_HTTP_DATE_LEN];
+    ws_http_format_date(date, sizeof(date), mtime);
+    int len = sprintf(buf, WS_STR_VALIDATORS, etag, date);
+    if (is_compressible(url)) {
+        len += sprintf(buf+len, WS_STR_VARY);
+    }
+    long max_age = get_max_age(url);
+    if (max_age >= 0) {
+        len += sprintf(buf+len, WS_STR_CACHE_CONTROL, max_age);
+    }
+    return len;
+}
+
+/* Writes the header for a page sent in a coding into buf, returns its
+   length. Pages that are found get validators when etag isn't NULL */
+int build_header(char *buf, int status, char *url, unsigned long int content_size,
+        char *etag, time_t mtime, int coding) {
+    /* Get header status text */
+    char *header_status = NULL;
+    if (status == WS_STATUS_INVALID) {
+        header_status = "500 OK";
+    } else if (status == WS_STATUS_MISSING) {
+        header_status = "404 Not Found";
+    } else {
+        header_status = "200 OK";
+    }
+
+    int len = sprintf(buf, WS_STR_CONTENT_HEADER, header_status, 
+        get_content_type(url), content_size);
+    if (coding != WS_CODING_IDENTITY) {
+        len += sprintf(buf+len, WS_STR_CONTENT_ENCODING, ws_compress_name(coding));
+    }
+    if (status == WS_STATUS_OK && etag != NULL) {
+        len += sprintf(buf+len, WS_STR_ACCEPT_RANGES);
+        len += build_validators(buf+len, url, etag, mtime);
+    }
+    return len;
+}
+
+/* Reads a whole file into a new unlisted entry for a page in a coding (the
+   file is a precompressed sibling for other codings). Returns it, or NULL
+   if it can't be read */
+ws_cache_entry_p read_page(char *url, int status, int coding, int page, struct stat *info) {
+    char header[WS_MAX_HEADER];
+    char etag[WS_CACHE_ETAG_LEN];
+    make_etag(etag, info, coding);
+    int header_len = build_header(header, status, url, info->st_size,
+        etag, info->st_mtime, coding);
+    ws_cache_entry_p entry = ws_cache_new(url, status, coding,
+        header_len, info->st_size);
+    if (entry == NULL) return NULL;
+    memcpy(entry->data, header, header_len);
+    strcpy(entry->etag, etag);
+
+    /* Read in the body */
+    off_t done = 0;
+    while (done < info->st_size) {
+        ssize_t n = pread(page, entry->data+header_len+done, 
+            info->st_size-done, done);
+        if (n <= 0) {
+            ws_cache_release(entry);
+            return NULL;
+        }
+        done += n;
+    }
+
+    entry->mtime = info->st_mtime;
+    entry->file_size = info->st_size;
+    return entry;
+}
+
+/* Reads a whole file into a new cache entry for a page in a coding, and
+   adds it to the cache. Returns a referenced entry, or NULL if the page
+   can't be cached */
+ws_cache_entry_p cache_page(ws_worker_p worker, char *url, int status, int coding,
+        int page, struct stat *info) {
+    ws_cache_p cache = &worker->cache;
+    if (!ws_cache_fits(cache, info->st_size)) return NULL;
+
+    ws_cache_entry_p entry = read_page(url, status, coding, page, info);
+    if (entry == NULL) return NULL;
+    entry->pinned = status != WS_STATUS_OK; /* Error pages stay prebuilt */
+    ws_cache_put(cache, entry);
+    ws_log(WS_LOG_TRACE, "Cached %s for status %d in %s\n",url,status,ws_compress_name(coding));
+    return entry;
+}
+
+/* Caches that a page isn't sent in a coding, so it isn't tried again until
+   the page changes */
+void cache_plain_only(ws_worker_p worker, char *url, int coding, time_t mtime, off_t size) {
+    ws_cache_entry_p entry = ws_cache_new(url, WS_STATUS_OK, coding, 0, 0);
+    if (entry == NULL) return;
+    entry->mtime = mtime;
+    entry->file_size = size;
+    ws_cache_put(&worker->cache, entry);
+    ws_cache_release(entry);
+}
+
+/* Compresses a page's plain entry into a new unlisted entry for a coding.
+   Returns it, or NULL if it isn't worth compressing */
+ws_cache_entry_p compress_entry(char *url, ws_cache_entry_p plain, int coding) {
+    ws_cache_entry_p entry = NULL;
+    char *body = plain->data + plain->header_len;
+    size_t body_len = plain->size - plain->header_len;
+    if (!ws_compress_supported(coding) || (long)body_len < min_compress) return NULL;
+
+    size_t out_len = ws_compress_bound(coding, body_len);
+    char *out = malloc(out_len);
+    if (out && ws_compress(coding, 0, body, body_len, out, &out_len) == 0 
+            && out_len < body_len) {
+        char header[WS_MAX_HEADER];
+        char etag[WS_CACHE_ETAG_LEN];
+        variant_etag(etag, plain->etag, coding);
+        int header_len = build_header(header, WS_STATUS_OK, url, out_len,
+            etag, plain->mtime, coding);
+        entry = ws_cache_new(url, WS_STATUS_OK, coding, header_len, out_len);
+        if (entry != NULL) {
+            memcpy(entry->data, header, header_len);
+            memcpy(entry->data+header_len, out, out_len);
+            strcpy(entry->etag, etag);
+            entry->mtime = plain->mtime;
+            entry->file_size = plain->file_size;
+            ws_log(WS_LOG_TRACE, "Compressed %s from %zu to %zu bytes with %s\n",
+                url, body_len, out_len, ws_compress_name(coding));
+        }
+    }
+    free(out);
+    return entry;
+}
+
+/* Frees a disk job, with whatever it read that no client took */
+void disk_free(disk_job_p job) {
+    for (int i = 0; i < job->entry_count; i++) {
+        ws_cache_release(job->entries[i]);
+    }
+    if (job->file != -1) {
+        close(job->file);
+    }
+    free(job);
+}
+
+/* Lets go of a client's disk job, freed once the pool is done with it */
+void disk_detach(client_node_p client) {
+    if (client->disk != NULL) {
+        client->disk->client = NULL;
+        client->disk = NULL;
+    }
+}
+
+/* Sets a client's stage to DISK until its job completes */
+void wait_on_disk(client_node_p client) {
+    ws_stats_p stats = &client->worker->stats;
+    if (client->h2_parent == NULL) {
+        if (client->stage == WS_STAGE_SENDING) {
+            WS_STATS_ADD(stats->sending, -1);
+        }
+        WS_STATS_ADD(stats->disk, 1);
+    }
+    client->stage = WS_STAGE_DISK;
+}
+
+/* Takes a file a load found for a coding of its page: reads it into an
+   entry if the cache would take it, or else keeps it open to be sent.
+   Returns TRUE if it was read into an entry */
+int load_found(disk_job_p job, char *path, int coding, int page, struct stat *info) {
+    if (ws_cache_fits(job->cache, info->st_size)) {
+        ws_cache_entry_p entry = read_page(job->path, job->status, coding, page, info);
+        close(page);
+        if (entry == NULL) return FALSE;
+        job->entries[job->entry_count++] = entry;
+        return TRUE;
+    }
+    if (job->file != -1) {
+        close(job->file);
+    }
+    job->file = page;
+    job->info = *info;
+    snprintf(job->file_path, sizeof(job->file_path), "%s", path);
+    return FALSE;
+}
+
+/* Loads what serve_page() looks for on disk, on a pool thread: for each
+   coding asked for, best first, a precompressed sibling, or else a copy
+   compressed from the page, and the page itself. Small files are read into
+   entries for the cache, a large one is kept open and its first window
+   read ahead */
+void load_run(ws_disk_job_p pool_job, ws_path_cache_p paths) {
+    disk_job_p job = (disk_job_p)pool_job;
+    ws_cache_entry_p plain = NULL;
+    int page, plain_tried = FALSE;
+    struct stat info, plain_info;
+    char path[WS_MAX_DATA+8];
+    for (int c = WS_CODINGS-1; c >= WS_CODING_IDENTITY; c--) {
+        if (c != WS_CODING_IDENTITY && !(job->codings & (1 << c))) continue;
+        if (c != WS_CODING_IDENTITY) {
+            snprintf(path, sizeof(path), "%s%s", job->path, ws_compress_ext(c));
+            page = open_page(paths, path, &info);
+            if (page != -1) {
+                if (load_found(job, path, c, page, &info)) {
+                    /* Without notifications, cache hits are checked against the page itself */
+                    ws_cache_entry_p entry = job->entries[job->entry_count-1];
+                    if (ws_path_stat(paths, job->path, &info) == 0) {
+                        entry->mtime = info.st_mtime;
+                        entry->file_size = info.st_size;
+                    }
+                }
+                break;
+            }
+            job->missing |= 1 << c;
+        } else if (plain_tried) {
+            break; /* Only needed if no coding is worth sending */
+        }
+
+        if (!plain_tried) {
+            plain_tried = TRUE;
+            page = open_page(paths, job->path, &plain_info);
+            if (page == -1) {
+                job->missing |= 1 << WS_CODING_IDENTITY;
+                break;
+            }
+            if (load_found(job, job->path, WS_CODING_IDENTITY, page, &plain_info)) {
+                plain = job->entries[job->entry_count-1];
+            }
+        }
+        if (c == WS_CODING_IDENTITY) break;
+
+        /* As compress_page() does, with what is known to be sent plain cached too */
+        ws_cache_entry_p entry = plain ? compress_entry(job->path, plain, c) : NULL;
+        if (entry == NULL) {
+            entry = ws_cache_new(job->path, WS_STATUS_OK, c, 0, 0);
+            if (entry == NULL) continue;
+            entry->mtime = plain_info.st_mtime;
+            entry->file_size = plain_info.st_size;
+        }
+        job->entries[job->entry_count++] = entry;
+        if (entry->size > 0) break;
+    }
+
+    /* A file sent from disk is read front to back */
+    if (job->file != -1) {
+        ws_disk_sequential(job->file);
+        if (job->len > 0) {
+            ssize_t n = ws_disk_warm(job->file, 0, job->len);
+            job->len = n > 0 ? n : 0;
+        }
+    }
+}
+
+/* Reads a window of a file being sent ahead, on a pool thread */
+void read_run(ws_disk_job_p pool_job, ws_path_cache_p paths) {
+    disk_job_p job = (disk_job_p)pool_job;
+    (void)paths;
+    job->len = ws_disk_warm(job->file, job->offset, job->len);
+}
+
+/* Starts reading the window of a client's file at offset ahead.
+   Returns FALSE if it couldn't be handed to the pool */
+int read_ahead(client_node_p client, off_t offset) {
+    disk_job_p job = malloc(sizeof(disk_job_t));
+    if (job == NULL) return FALSE;
+    job->file = dup(client->file);
+    if (job->file == -1) {
+        free(job);
+        return FALSE;
+    }
+    job->client = client;
+    job->kind = WS_DISK_READ;
+    job->entry_count = 0;
+    job->offset = offset;
+    job->len = client->file_size - offset < WS_DISK_WINDOW ? client->file_size - offset : WS_DISK_WINDOW;
+    client->disk = job;
+    WS_STATS_ADD(client->worker->stats.disk_reads, 1);
+    ws_disk_submit(&job->job, read_run, &client->worker->disk);
+    return TRUE;
+}
+
+/* Returns how many of the file bytes a client sends next are known to be
+   read ahead, all of them without the pool */
+off_t file_cached(client_node_p client) {
+    off_t remaining = client->file_size - client->file_offset;
+    if (disk_threads == 0) return remaining;
+    if (client->file_offset < client->disk_start || client->file_offset >= client->disk_end) {
+        return 0;
+    }
+    off_t cached = client->disk_end - client->file_offset;
+    return cached < remaining ? cached : remaining;
+}
+
+/* Returns how many file bytes a client may send without waiting on disk,
+   reading the next window ahead once half of the last is sent. Returns 0
+   if it has to wait, its stage then being DISK */
+off_t file_ready(client_node_p client) {
+    off_t ready = file_cached(client);
+    if (disk_threads == 0) return ready;
+    if (ready > 0) {
+        if (client->disk == NULL && client->disk_end < client->file_size
+                && client->disk_end - client->file_offset <= WS_DISK_WINDOW / 2) {
+            read_ahead(client, client->disk_end);
+        }
+        return ready;
+    }
+
+    /* Outran the pool, or jumped to a part that wasn't read ahead */
+    if (client->disk == NULL && !read_ahead(client, client->file_offset)) {
+        return client->file_size - client->file_offset;
+    }
+    wait_on_disk(client);
+    return 0;
+}
+
+/* Opens a page for a client: from what its load found once it has been
+   loaded, or else beneath root. Returns its fd or -1 */
+int client_open(client_node_p client, char *path, struct stat *info) {
+    disk_job_p job = client->disk;
+    if (job != NULL && job->kind == WS_DISK_LOAD) {
+        if (job->file != -1 && strcmp(path, job->file_path) == 0) {
+            /* Its first window has already been read */
+            *info = job->info;
+            client->disk_start = 0;
+            client->disk_end = job->len;
+            return dup(job->file);
+        }
+        for (int c = WS_CODING_IDENTITY; c < WS_CODINGS; c++) {
+            int len = strlen(job->path);
+            if ((job->missing & (1 << c)) && strncmp(path, job->path, len) == 0 
+                    && strcmp(path+len, ws_compress_ext(c)) == 0) {
+                errno = ENOENT;
+                return -1;
+            }
+        }
+    }
+    return open_page(&client->worker->paths, path, info);
+}
+
+/* Hands a page the cache doesn't have to the disk pool, to look for it in
+   the codings the client takes from top down, unless there is no pool or
+   it has just been loaded. Returns TRUE if the client now waits on disk */
+int load_page(client_node_p client, char *url, int status, int top) {
+    ws_worker_p worker = client->worker;
+    ws_http_request_p req = client->req;
+    if (disk_threads == 0 || client->disk != NULL) return FALSE;
+    disk_job_p job = malloc(sizeof(disk_job_t));
+    if (job == NULL) return FALSE; /* Loaded on the loop instead */
+    job->client = client;
+    job->kind = WS_DISK_LOAD;
+    snprintf(job->path, sizeof(job->path), "%s", url);
+    job->status = status;
+    job->codings = 0;
+    for (int c = top; c > WS_CODING_IDENTITY; c--) {
+        if (ws_http_accepts(&req->accept_encoding, ws_compress_name(c))) {
+            job->codings |= 1 << c;
+        }
+    }
+    job->missing = 0;
+    job->cache = &worker->cache;
+    job->entry_count = 0;
+    job->file = -1;
+    job->offset = 0;
+
+    /* Only whole responses start at the front of the file */
+    job->len = req->range.ptr == NULL && req->if_none_match.ptr == NULL 
+        && req->if_modified_since.ptr == NULL ? WS_DISK_WINDOW : 0;
+    client->disk = job;
+    wait_on_disk(client);
+    if (client->h2_parent == NULL) {
+        /* The request is in, the rest is up to the server */
+        set_deadline(client, WS_DEADLINE_SEND);
+    }
+    WS_STATS_ADD(worker->stats.disk_loads, 1);
+    ws_disk_submit(&job->job, load_run, &worker->disk);
+    return TRUE;
+}
+
+/* Compresses a cached page into a new cache entry for a coding.
+   Returns a referenced entry, or NULL if it isn't worth compressing */
+ws_cache_entry_p compress_page(client_node_p client, char *url, int coding) {
+    ws_worker_p worker = client->worker;
+    ws_cache_p cache = &worker->cache;
+    ws_cache_entry_p plain = ws_cache_get(cache, url, WS_STATUS_OK, 
+        WS_CODING_IDENTITY);
+    if (plain == NULL) {
+        struct stat info;
+        int page = client_open(client, url, &info);
+        if (page == -1) return NULL;
+        plain = cache_page(worker, url, WS_STATUS_OK, WS_CODING_IDENTITY, page, &info);
+        close(page);
+        if (plain == NULL) {
+            /* Too big to keep, only precompressed siblings are sent */
+            cache_plain_only(worker, url, coding, info.st_mtime, info.st_size);
+            return NULL;
+        }
+    }
+
+    ws_cache_entry_p entry = compress_entry(url, plain, coding);
+    if (entry != NULL) {
+        ws_cache_put(cache, entry);
+    } else {
+        cache_plain_only(worker, url, coding, plain->mtime, plain->file_size);
+    }
+    ws_cache_release(plain);
+    return entry;
+}
+
+/* Looks up a response in the site pack, returns a referenced entry or NULL */
+ws_cache_entry_p pack_get(ws_worker_p worker, char *url, int status, int coding) {
+    int record = ws_pack_find(&pack, url, status, coding);
+    if (record == -1) return NULL;
+    ws_cache_entry_p entry = &worker->pack_entries[record];
+    entry->refs++;
+    return entry;
+}
+
+/* Points a client's response at a page in a coding, either a precompressed
+   sibling or a copy compressed once and cached. info is filled in when the
+   sibling is sent from its file. Returns FALSE if it can't be sent that way,
+   or -1 if it has to be loaded from disk first */
+int encode_page(client_node_p client, char *url, int coding, struct stat *info) {
+    ws_worker_p worker = client->worker;
+    if (worker->pack_entries != NULL) {
+        /* Packs hold every coding worth sending */
+        client->entry = pack_get(worker, url, WS_STATUS_OK, coding);
+        return client->entry != NULL;
+    }
+    client->entry = ws_cache_get(&worker->cache, url, WS_STATUS_OK, coding);
+    if (client->entry != NULL) {
+        if (client->entry->size > 0) return TRUE;
+        ws_cache_release(client->entry); /* Known to be sent plain */
+        client->entry = NULL;
+        return FALSE;
+    }
+    if (load_page(client, url, WS_STATUS_OK, coding)) return -1;
+
+    /* A precompressed sibling wins over compressing here */
+    char path[WS_MAX_DATA+8];
+    snprintf(path, sizeof(path), "%s%s", url, ws_compress_ext(coding));
+    int page = client_open(client, path, info);
+    if (page == -1) {
+        client->entry = compress_page(client, url, coding);
+        return client->entry != NULL;
+    }
+    client->entry = cache_page(worker, url, WS_STATUS_OK, coding, page, info);
+    if (client->entry == NULL) {
+        client->file = page;
+        client->file_offset = 0;
+        client->file_size = info->st_size;
+        return TRUE;
+    }
+    close(page);
+
+    /* Without notifications, cache hits are checked against the page itself */
+    struct stat plain;
+    if (ws_path_stat(&worker->paths, url, &plain) == 0) {
+        client->entry->mtime = plain.st_mtime;
+        client->entry->file_size = plain.st_size;
+    }
+    return TRUE;
+}
+
+/* Returns TRUE if a conditional request's copy of a page is still current.
+   If-None-Match wins over If-Modified-Since when both are sent */
+int not_modified(ws_http_request_p req, char *etag, time_t mtime) {
+    if (req->if_none_match.ptr) {
+        return ws_http_etag_match(&req->if_none_match, etag);
+    }
+    if (req->if_modified_since.ptr) {
+        time_t since = ws_http_parse_date(&req->if_modified_since);
+        return since != -1 && mtime <= since;
+    }
+    return FALSE;
+}
+
+/* Drops the body of a client's response, for bodyless replies */
+void drop_body(client_node_p client) {
+    if (client->entry != NULL) {
+        ws_cache_release(client->entry);
+        client->entry = NULL;
+    }
+    if (client->file != -1) {
+        close(client->file);
+        client->file = -1;
+    }
+    client->file_offset = 0;
+    client->file_size = 0;
+}
+
+/* Points a client's response at a bodyless 304 for a page */
+void serve_not_modified(client_node_p client, char *url, char *etag, time_t mtime) {
+    client->status = WS_STATUS_NOT_MODIFIED;
+    client->out_size = sprintf(client->out, WS_STR_NOT_MODIFIED);
+    client->out_size += build_validators(client->out+client->out_size, url, etag, mtime);
+    drop_body(client);
+}
+
+/* Points the body being sent at one range of the page */
+void send_range(client_node_p client, ws_http_range_t *range) {
+    if (client->entry != NULL) {
+        client->entry_offset = client->entry->header_len + range->first;
+        client->entry_end = client->entry->header_len + range->last + 1;
+    } else {
+        client->file_offset = range->first;
+        client->file_size = range->last + 1;
+    }
+}
+
+/* Queues the next part header (or closing boundary) of a multipart response
+   in out. Returns FALSE once the whole response has been queued */
+int next_part(client_node_p client) {
+    if (client->range_index > client->range_count || client->range_count == 0) {
+        return FALSE;
+    }
+    client->out_offset = 0;
+    if (client->range_index == client->range_count) {
+        client->out_size = sprintf(client->out, WS_STR_PART_END, client->boundary);
+    } else {
+        ws_http_range_t *range = &client->ranges[client->range_index];
+        client->out_size = sprintf(client->out, WS_STR_PART_HEADER, client->boundary,
+            client->range_type, (long long)range->first, (long long)range->last,
+            (long long)client->range_total);
+        send_range(client, range);
+    }
+    client->range_index++;
+    return TRUE;
+}
+
+/* Returns TRUE if an If-Range value still matches the page */
+int range_current(const ws_http_slice_t *if_range, char *etag, time_t mtime) {
+    if (if_range->len > 0 && if_range->ptr[0] == '"') {
+        /* Strong comparison, weak tags never match */
+        return if_range->len == (int)strlen(etag) 
+            && memcmp(if_range->ptr, etag, if_range->len) == 0;
+    }
+    return ws_http_parse_date(if_range) == mtime;
+}
+
+/* Points a client's response at the ranges it asked for, as a 206, or a
+   416 if none are in the page. Returns FALSE if the whole page should be
+   sent instead */
+int serve_ranges(client_node_p client, char *url, off_t size, char *etag, time_t mtime,
+        int coding) {
+    ws_http_request_p req = client->req;
+    const ws_http_slice_t *if_range = ws_http_header(req, "If-Range");
+    if (if_range != NULL && !range_current(if_range, etag, mtime)) return FALSE;
+
+    ws_http_range_t ranges[WS_HTTP_MAX_RANGES];
+    int count = ws_http_parse_ranges(&req->range, size, ranges, WS_HTTP_MAX_RANGES);
+    if (count == 0) {
+        return FALSE;
+    } else if (count == -1) {
+        client->status = WS_STATUS_NOT_SATISFIABLE;
+        client->out_size = sprintf(client->out, WS_STR_NOT_SATISFIABLE, (long long)size);
+        drop_body(client);
+        return TRUE;
+    }
+
+    const char *type = get_content_type(url);
+    if (count == 1) {
+        /* A single range is sent as is */
+        ws_http_range_t *range = &ranges[0];
+        client->out_size = sprintf(client->out, WS_STR_PARTIAL_HEADER, type,
+            (long long)(range->last - range->first + 1), (long long)range->first,
+            (long long)range->last, (long long)size);
+        send_range(client, range);
+    } else {
+        /* Several go in parts, queued one by one as the previous is sent,
+           so they are kept in a borrowed buffer until then */
+        client->ranges = ws_buf_get(&client->worker->buffers, sizeof(ranges));
+        if (client->ranges == NULL) return FALSE;
+        memcpy(client->ranges, ranges, count * sizeof(ws_http_range_t));
+        client->range_count = count;
+        client->range_index = 0;
+        client->range_type = type;
+        client->range_total = size;
+        client->boundary = (unsigned long)client->id * 2654435761UL ^ (unsigned long)mtime;
+        long long length = snprintf(NULL, 0, WS_STR_PART_END, client->boundary);
+        for (int i = 0; i < count; i++) {
+            ws_http_range_t *range = &ranges[i];
+            length += snprintf(NULL, 0, WS_STR_PART_HEADER, client->boundary, type,
+                (long long)range->first, (long long)range->last, (long long)size);
+            length += range->last - range->first + 1;
+        }
+        client->out_size = sprintf(client->out, WS_STR_MULTIPART_HEADER, 
+            client->boundary, length);
+
+        /* Nothing of the body until the first part header is queued */
+        ws_http_range_t none = { 0, -1 };
+        send_range(client, &none);
+    }
+    /* Set once nothing can fail, or the whole page goes out as a 200 */
+    client->status = WS_STATUS_PARTIAL;
+    if (coding != WS_CODING_IDENTITY) {
+        client->out_size += sprintf(client->out+client->out_size, WS_STR_CONTENT_ENCODING,
+            ws_compress_name(coding));
+    }
+    client->out_size += build_validators(client->out+client->out_size, url, etag, mtime);
+    return TRUE;
+}
+
+/* Points a client's response at a page, from the cache when possible.
+   The header is left in out without its Connection line.
+   Returns FALSE if the page doesn't exist, or -1 if the client waits for it
+   to be loaded from disk (see respond()) */
+int serve_page(client_node_p client, char *url, int status) {
+    ws_worker_p worker = client->worker;
+    struct stat info;
+    char file_etag[WS_CACHE_ETAG_LEN];
+    char *etag;
+    time_t mtime;
+    off_t size;
+    int coding = WS_CODING_IDENTITY;
+    client->status = status;
+    client->out_offset = 0;
+    client->out_size = 0;
+
+    /* Compressible pages go in the best coding the client takes */
+    if (status == WS_STATUS_OK && client->req->accept_encoding.ptr != NULL 
+            && is_compressible(url)) {
+        for (int c = WS_CODINGS-1; c > WS_CODING_IDENTITY && coding == WS_CODING_IDENTITY; c--) {
+            if (ws_http_accepts(&client->req->accept_encoding, ws_compress_name(c))) {
+                int encoded = encode_page(client, url, c, &info);
+                if (encoded == -1) return -1;
+                if (encoded) coding = c;
+            }
+        }
+    }
+
+    /* Cache hits are already assembled, and packs hold every page */
+    if (coding == WS_CODING_IDENTITY && worker->pack_entries != NULL) {
+        client->entry = pack_get(worker, url, status, coding);
+        if (client->entry == NULL) return FALSE;
+    } else if (coding == WS_CODING_IDENTITY) {
+        client->entry = ws_cache_get(&worker->cache, url, status, coding);
+    }
+    if (coding == WS_CODING_IDENTITY && client->entry == NULL) {
+        if (load_page(client, url, status, WS_CODING_IDENTITY)) return -1;
+        int page = client_open(client, url, &info);
+        if (page == -1) return FALSE;
+
+        /* Small pages are read whole into the cache, others are sent
+           straight from the file */
+        client->entry = cache_page(worker, url, status, coding, page, &info);
+        if (client->entry == NULL) {
+            client->file = page;
+            client->file_offset = 0;
+            client->file_size = info.st_size;
+        } else {
+            close(page);
+        }
+    }
+    if (client->entry != NULL) {
+        etag = client->entry->etag;
+        mtime = client->entry->mtime;
+        size = client->entry->size - client->entry->header_len;
+        client->entry_offset = client->entry->header_len;
+        client->entry_end = client->entry->size;
+    } else {
+        make_etag(file_etag, &info, coding);
+        etag = file_etag;
+        mtime = info.st_mtime;
+        size = info.st_size;
+    }
+
+    /* Conditional and range requests get their own header */
+    if (status == WS_STATUS_OK) {
+        if (not_modified(client->req, etag, mtime)) {
+            serve_not_modified(client, url, etag, mtime);
+            return TRUE;
+        }
+        if (client->req->range.ptr != NULL && serve_ranges(client, url, size, etag, mtime, coding)) {
+            return TRUE;
+        }
+    }
+
+    /* Otherwise the whole page, with the cached header if there is one */
+    if (client->entry != NULL) {
+        memcpy(client->out, client->entry->data, client->entry->header_len);
+        client->out_size = client->entry->header_len;
+    } else {
+        client->out_size = build_header(client->out, status, url, size, etag, mtime, coding);
+    }
+    return TRUE;
+}
+
+/* Ends the header in out with the Connection line, and starts the body
+   there too when it is buffered */
+void finish_header(client_node_p client) {
+    char *line = client->keep_alive ? WS_STR_KEEP_ALIVE : WS_STR_CLOSE;
+    int len = strlen(line);
+    memcpy(client->out+client->out_size, line, len);
+    client->out_size += len;
+
+    /* Without sendfile, start the content in the same send as the header,
+       if it has been read ahead */
+    off_t remaining = file_cached(client);
+    if ((!use_sendfile || !plain_writes(client)) && client->file != -1 && remaining > 0) {
+        size_t room = WS_MAX_DATA - client->out_size;
+        ssize_t page_size = pread(client->file, client->out+client->out_size, 
+            remaining < (off_t)room ? (size_t)remaining : room, client->file_offset);
+        if (page_size > 0) {
+            client->out_size += page_size;
+            client->file_offset += page_size;
+        }
+    }
+}
+
+/* Writes the stats of every worker, summed, in the Prometheus text format */
+void write_stats(FILE *out) {
+    unsigned long statuses[WS_STATS_STATUSES] = { 0 };
+    unsigned long sent = 0, received = 0, timeouts[WS_STATS_DEADLINES] = { 0 };
+    unsigned long deferred = 0, rejected = 0;
+    unsigned long handshakes = 0, resumed = 0, ktls = 0, handshake_errors = 0;
+    unsigned long h2_connections = 0;
+    unsigned long send_deferred = 0, throttled = 0;
+    unsigned long disk_loads = 0, disk_reads = 0;
+    long streams = 0;
+    long clients = 0, errors = 0, open = 0, sending = 0, idle = 0, disk = 0;
+    long hits = 0, misses = 0, evictions = 0, invalidations = 0;
+    size_t entries = 0, bytes = 0;
+    long buffers[WS_BUF_CLASSES] = { 0 }, spare[WS_BUF_CLASSES] = { 0 };
+    ws_histogram_t ttfb, total;
+    memset(&ttfb, 0, sizeof(ttfb));
+    memset(&total, 0, sizeof(total));
+
+    /* Each worker only writes its own stats, so they are read as they are */
+    for (int w = 0; w < worker_count; w++) {
+        ws_worker_p worker = &workers[w];
+        ws_stats_p stats = &worker->stats;
+        for (int i = 0; i < WS_STATS_STATUSES; i++) {
+            statuses[i] += WS_STATS_GET(stats->statuses[i]);
+        }
+        sent += WS_STATS_GET(stats->bytes_sent);
+        received += WS_STATS_GET(stats->bytes_received);
+        for (int i = 0; i < WS_STATS_DEADLINES; i++) {
+            timeouts[i] += WS_STATS_GET(stats->timeouts[i]);
+        }
+        deferred += WS_STATS_GET(stats->deferred);
+        rejected += WS_STATS_GET(stats->rejected);
+        handshakes += WS_STATS_GET(stats->handshakes);
+        resumed += WS_STATS_GET(stats->resumed);
+        ktls += WS_STATS_GET(stats->ktls);
+        handshake_errors += WS_STATS_GET(stats->handshake_errors);
+        h2_connections += WS_STATS_GET(stats->h2_connections);
+        send_deferred += WS_STATS_GET(stats->send_deferred);
+        throttled += WS_STATS_GET(stats->throttled);
+        disk_loads += WS_STATS_GET(stats->disk_loads);
+        disk_reads += WS_STATS_GET(stats->disk_reads);
+        streams += WS_STATS_GET(stats->streams);
+        open += WS_STATS_GET(stats->open);
+        sending += WS_STATS_GET(stats->sending);
+        idle += WS_STATS_GET(stats->idle);
+        disk += WS_STATS_GET(stats->disk);
+        clients += WS_STATS_GET(worker->client_count);
+        errors += WS_STATS_GET(worker->err_count);
+        hits += WS_STATS_GET(worker->cache.hits);
+        misses += WS_STATS_GET(worker->cache.misses);
+        evictions += WS_STATS_GET(worker->cache.evictions);
+        invalidations += WS_STATS_GET(worker->cache.invalidations);
+        entries += WS_STATS_GET(worker->cache.count);
+        bytes += WS_STATS_GET(worker->cache.bytes);
+        for (int i = 0; i < WS_BUF_CLASSES; i++) {
+            buffers[i] += WS_STATS_GET(worker->buffers.classes[i].in_use);
+            spare[i] += WS_STATS_GET(worker->buffers.classes[i].free_count);
+        }
+        ws_stats_merge(&ttfb, &stats->ttfb);
+        ws_stats_merge(&total, &stats->total);
+    }
+
+    ws_stats_write_meta(out, "ws_requests_total", "counter", "Responses started, by status.");
+    for (int i = 0; i < WS_STATS_STATUSES; i++) {
+        int status = ws_stats_status(i);
+        if (status) {
+            fprintf(out, "ws_requests_total{status=\"%d\"} %lu\n", status, statuses[i]);
+        } else {
+            fprintf(out, "ws_requests_total{status=\"other\"} %lu\n", statuses[i]);
+        }
+    }
+    ws_stats_write_meta(out, "ws_errors_total", "counter", "Failed requests and connections.");
+    fprintf(out, "ws_errors_total %ld\n", errors);
+    ws_stats_write_meta(out, "ws_connections_total", "counter", "Connections accepted.");
+    fprintf(out, "ws_connections_total %ld\n", clients);
+    ws_stats_write_meta(out, "ws_connections_deferred_total", "counter", 
+        "Connections left waiting in the backlog while accepting was paused.");
+    fprintf(out, "ws_connections_deferred_total %lu\n", deferred);
+    ws_stats_write_meta(out, "ws_connections_rejected_total", "counter", 
+        "Connections closed as soon as they were accepted.");
+    fprintf(out, "ws_connections_rejected_total %lu\n", rejected);
+    if (tls_cert != NULL) {
+        ws_stats_write_meta(out, "ws_tls_handshakes_total", "counter", 
+            "TLS handshakes, by whether they resumed a session.");
+        fprintf(out, "ws_tls_handshakes_total{session=\"new\"} %lu\n", handshakes - resumed);
+        fprintf(out, "ws_tls_handshakes_total{session=\"resumed\"} %lu\n", resumed);
+        ws_stats_write_meta(out, "ws_tls_handshake_errors_total", "counter", "TLS handshakes that failed.");
+        fprintf(out, "ws_tls_handshake_errors_total %lu\n", handshake_errors);
+        ws_stats_write_meta(out, "ws_tls_ktls_total", "counter", 
+            "TLS connections whose responses the kernel encrypts.");
+        fprintf(out, "ws_tls_ktls_total %lu\n", ktls);
+    }
+    if (use_h2) {
+        ws_stats_write_meta(out, "ws_h2_connections_total", "counter", "Connections switched to HTTP/2.");
+        fprintf(out, "ws_h2_connections_total %lu\n", h2_connections);
+        ws_stats_write_meta(out, "ws_h2_streams", "gauge", "HTTP/2 streams being answered.");
+        fprintf(out, "ws_h2_streams %ld\n", streams);
+    }
+    ws_stats_write_meta(out, "ws_send_turns_deferred_total", "counter", 
+        "Loop turns a bulk response ended with its send budget spent.");
+    fprintf(out, "ws_send_turns_deferred_total %lu\n", send_deferred);
+    if (rate_limit > 0) {
+        ws_stats_write_meta(out, "ws_send_throttled_total", "counter", 
+            "Times a connection waited for its rate limit.");
+        fprintf(out, "ws_send_throttled_total %lu\n", throttled);
+    }
+    if (disk_threads > 0) {
+        ws_stats_write_meta(out, "ws_disk_jobs_total", "counter", 
+            "File work done on the disk pool, by kind.");
+        fprintf(out, "ws_disk_jobs_total{kind=\"load\"} %lu\n", disk_loads);
+        fprintf(out, "ws_disk_jobs_total{kind=\"read\"} %lu\n", disk_reads);
+    }
+    ws_stats_write_meta(out, "ws_timeouts_total", "counter", "Connections closed at a deadline, by kind.");
+    fprintf(out, "ws_timeouts_total{deadline=\"idle\"} %lu\n", timeouts[WS_DEADLINE_IDLE]);
+    fprintf(out, "ws_timeouts_total{deadline=\"request\"} %lu\n", timeouts[WS_DEADLINE_HEADER]);
+    fprintf(out, "ws_timeouts_total{deadline=\"send\"} %lu\n", timeouts[WS_DEADLINE_SEND]);
+
+    /* A snapshot can catch a client between stages, so keep it at 0 or more */
+    long reading = open - sending - idle - disk;
+    ws_stats_write_meta(out, "ws_connections", "gauge", "Open connections, by stage.");
+    fprintf(out, "ws_connections{stage=\"reading\"} %ld\n", reading > 0 ? reading : 0);
+    fprintf(out, "ws_connections{stage=\"sending\"} %ld\n", sending);
+    fprintf(out, "ws_connections{stage=\"idle\"} %ld\n", idle);
+    if (disk_threads > 0) {
+        fprintf(out, "ws_connections{stage=\"disk\"} %ld\n", disk);
+    }
+
+    /* Connections hold their node, plus buffers only while data is in flight */
+    long lent = 0, kept = 0;
+    ws_stats_write_meta(out, "ws_buffers", "gauge", "Pooled buffers lent to connections, by size.");
+    for (int i = 0; i < WS_BUF_CLASSES; i++) {
+        fprintf(out, "ws_buffers{size=\"%zu\"} %ld\n", ws_buf_class_size(i), buffers[i]);
+        lent += buffers[i] * ws_buf_class_size(i);
+        kept += spare[i] * ws_buf_class_size(i);
+    }
+    ws_stats_write_meta(out, "ws_buffer_bytes", "gauge", "Memory of pooled buffers, lent or kept free.");
+    fprintf(out, "ws_buffer_bytes{state=\"lent\"} %ld\n", lent);
+    fprintf(out, "ws_buffer_bytes{state=\"free\"} %ld\n", kept);
+    ws_stats_write_meta(out, "ws_connection_node_bytes", "gauge", "Memory every connection holds for its lifetime.");
+    fprintf(out, "ws_connection_node_bytes %zu\n", sizeof(client_node_t));
+    ws_stats_write_meta(out, "ws_connection_bytes", "gauge", "Memory per open connection, its node and lent buffers, on average.");
+    fprintf(out, "ws_connection_bytes %ld\n", open > 0 ? (long)sizeof(client_node_t) + lent / open : 0);
+    ws_stats_write_meta(out, "ws_log_dropped_total", "counter", "Log records dropped because the log ring was full.");
+    fprintf(out, "ws_log_dropped_total %lu\n", ws_log_dropped());
+    ws_stats_write_meta(out, "ws_sent_bytes_total", "counter", "Bytes sent to clients.");
+    fprintf(out, "ws_sent_bytes_total %lu\n", sent);
+    ws_stats_write_meta(out, "ws_received_bytes_total", "counter", "Bytes read from clients.");
+    fprintf(out, "ws_received_bytes_total %lu\n", received);
+
+    ws_stats_write_meta(out, "ws_cache_hits_total", "counter", "Cache lookups that found a response.");
+    fprintf(out, "ws_cache_hits_total %ld\n", hits);
+    ws_stats_write_meta(out, "ws_cache_misses_total", "counter", "Cache lookups that didn't.");
+    fprintf(out, "ws_cache_misses_total %ld\n", misses);
+    ws_stats_write_meta(out, "ws_cache_evictions_total", "counter", "Cached responses dropped to stay under the cap.");
+    fprintf(out, "ws_cache_evictions_total %ld\n", evictions);
+    ws_stats_write_meta(out, "ws_cache_invalidations_total", "counter", "Cached responses dropped as their file changed.");
+    fprintf(out, "ws_cache_invalidations_total %ld\n", invalidations);
+    ws_stats_write_meta(out, "ws_cache_entries", "gauge", "Cached responses.");
+    fprintf(out, "ws_cache_entries %zu\n", entries);
+    ws_stats_write_meta(out, "ws_cache_bytes", "gauge", "Memory used by cached responses.");
+    fprintf(out, "ws_cache_bytes %zu\n", bytes);
+    if (pack.base != NULL) {
+        ws_stats_write_meta(out, "ws_pack_responses", "gauge", "Responses in the site pack.");
+        fprintf(out, "ws_pack_responses %u\n", pack.header->nrecords);
+        ws_stats_write_meta(out, "ws_pack_bytes", "gauge", "Size of the site pack.");
+        fprintf(out, "ws_pack_bytes %zu\n", pack.size);
+    }
+
+#ifdef LINUX
+    unsigned long vsize;
+    long rss;
+    if (get_memory_usage_linux(&vsize, &rss) == 0) {
+        ws_stats_write_meta(out, "process_resident_memory_bytes", "gauge", "Resident memory size in bytes.");
+        fprintf(out, "process_resident_memory_bytes %ld\n", rss * sysconf(_SC_PAGESIZE));
+        ws_stats_write_meta(out, "process_virtual_memory_bytes", "gauge", "Virtual memory size in bytes.");
+        fprintf(out, "process_virtual_memory_bytes %lu\n", vsize);
+    }
+#endif
+
+    ws_stats_write_histogram(out, "ws_time_to_first_byte_seconds",
+        "Time from a request arriving to the first byte of its response.", &ttfb);
+    ws_stats_write_histogram(out, "ws_request_duration_seconds",
+        "Time from a request arriving to the last byte of its response.", &total);
+}
+
+/* Points a client's response at a snapshot of the stats, built for it.
+   Returns FALSE if it couldn't be built */
+int serve_stats(client_node_p client) {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    if (out == NULL) return FALSE;
+    write_stats(out);
+    fclose(out);
+
+    /* The body goes in an entry that isn't cached, freed once sent */
+    client->entry = ws_cache_new(WS_URL_STATS, WS_STATUS_OK, WS_CODING_IDENTITY, 0, size);
+    if (client->entry != NULL) {
+        memcpy(client->entry->data, text, size);
+        client->entry_offset = 0;
+        client->entry_end = size;
+        client->status = WS_STATUS_OK;
+        client->out_offset = 0;
+        client->out_size = sprintf(client->out, WS_STR_CONTENT_HEADER, "200 OK",
+            WS_TYPE_STATS, (unsigned long)size);
+        client->out_size += sprintf(client->out+client->out_size, WS_STR_NO_STORE);
+    }
+    free(text);
+    return client->entry != NULL;
+}
+
+/* Writes the stats to stdout when a dump is due.
+   Returns the ms until the next one, or -1 if they aren't dumped */
+int dump_stats(ws_worker_p worker) {
+    if (stats_interval == 0) return -1;
+    if (worker->stats_due == 0) {
+        worker->stats_due = worker->now_ms + stats_interval;
+    } else if (worker->stats_due <= worker->now_ms) {
+        write_stats(stdout);
+        fflush(stdout);
+        worker->stats_due = worker->now_ms + stats_interval;
+    }
+    return (int)(worker->stats_due - worker->now_ms);
+}
+
+/* Moves a client through the FSM, defined with the FSM below */
+void serve_client(client_node_p curr);
+
+/* Appends bytes to the output waiting for a client.
+   Returns FALSE if there was no memory for them */
+int fcgi_append(client_node_p client, const char *data, size_t len) {
+    if (client->stream_offset > 0 && client->stream_len + len > client->stream_cap) {
+        /* Drop what was sent before growing */
+        client->stream_len -= client->stream_offset;
+        memmove(client->stream, client->stream+client->stream_offset, client->stream_len);
+        client->stream_offset = 0;
+    }
+    if (client->stream_len + len > client->stream_cap) {
+        size_t cap = client->stream_cap ? client->stream_cap : WS_MAX_DATA;
+        while (cap < client->stream_len + len) cap *= 2;
+        char *stream = realloc(client->stream, cap);
+        if (stream == NULL) return FALSE;
+        client->stream = stream;
+        client->stream_cap = cap;
+    }
+    memcpy(client->stream+client->stream_len, data, len);
+    client->stream_len += len;
+    return TRUE;
+}
+
+/* Appends body bytes for a client, as a chunk if its body is chunked.
+   Returns FALSE if there was no memory for them */
+int fcgi_append_body(client_node_p client, const char *data, size_t len) {
+    if (!client->chunked) {
+        return fcgi_append(client, data, len);
+    }
+    char size[24];
+    int size_len = sprintf(size, WS_STR_CHUNK_SIZE, len);
+    return fcgi_append(client, size, size_len) && fcgi_append(client, data, len)
+        && fcgi_append(client, "\r\n", 2);
+}
+
+/* Points a client's response at a 502, for a backend that failed before
+   sending its header */
+void fcgi_bad_gateway(client_node_p client) {
+    ws_worker_p worker = client->worker;
+    client->fcgi_state = WS_FCGI_STATE_DONE;
+    client->fcgi = NULL;
+    client->stream_offset = 0;
+    client->stream_len = 0;
+    client->chunked = FALSE;
+    client->status = WS_STATUS_BAD_GATEWAY;
+    client->out_offset = 0;
+    client->out_size = sprintf(client->out, WS_STR_BAD_GATEWAY);
+    finish_header(client);
+    WS_STATS_ADD(worker->err_count, 1);
+    WS_STATS_ADD(worker->stats.statuses[ws_stats_status_index(client->status)], 1);
+}
+
+/* Returns TRUE if a CGI header line's name (a token) or value (no control
+   bytes but tabs) can be passed on as is */
+static int fcgi_field_ok(const char *s, int len, int name) {
+    if (name && len == 0) return FALSE;
+    for (int i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        int token = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+            || (c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != NULL);
+        if (name ? !token : (c < 0x20 && c != '\t') || c == 0x7f) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Turns the CGI header at the start of a client's stream into the
+   response header, once all of it has arrived, leaving the body after it.
+   Returns 1 once it has, 0 if more is needed, or -1 if it is malformed
+   or too big */
+int fcgi_header(client_node_p client) {
+    /* The header ends at the first empty line, with or without CRs */
+    char *header = client->stream;
+    size_t len = client->stream_len, end = 0, body = 0;
+    for (size_t i = 0; i+1 < len && body == 0; i++) {
+        if (header[i] != '\n') continue;
+        if (header[i+1] == '\n') {
+            end = i+1;
+            body = i+2;
+        } else if (header[i+1] == '\r' && i+2 < len && header[i+2] == '\n') {
+            end = i+1;
+            body = i+3;
+        }
+    }
+    if (body == 0) {
+        return len >= WS_MAX_DATA ? -1 : 0;
+    }
+
+    /* Status picks the status line, the server frames the body and
+       decides the connection, and the other lines are passed on */
+    char lines[WS_MAX_DATA];
+    int lines_len = 0, has_length = FALSE, has_location = FALSE;
+    const char *status = NULL;
+    int status_len = 0;
+    for (size_t line = 0; line < end; ) {
+        char *eol = memchr(header+line, '\n', end-line);
+        size_t next = eol - header + 1;
+        size_t line_end = next - 1;
+        if (line_end > line && header[line_end-1] == '\r') line_end--;
+        char *colon = memchr(header+line, ':', line_end-line);
+        if (colon == NULL) return -1;
+        int name_len = colon - (header+line);
+        char *value = colon+1;
+        while (value < header+line_end && (*value == ' ' || *value == '\t')) value++;
+        int value_len = header+line_end - value;
+
+        const char *name = header+line;
+
+        /* A stray CR or other control byte could end the line early for the
+           client, and HTTP/2 would take what follows as another field */
+        if (!fcgi_field_ok(name, name_len, TRUE) || !fcgi_field_ok(value, value_len, FALSE)) {
+            return -1;
+        }
+        if (name_len == 6 && strncasecmp(name, "Status", 6) == 0) {
+            if (value_len < 3 || atoi(value) < 100 || atoi(value) > 999) return -1;
+            status = value;
+            status_len = value_len;
+        } else if ((name_len == 10 && strncasecmp(name, "Connection", 10) == 0)
+                || (name_len == 10 && strncasecmp(name, "Keep-Alive", 10) == 0)
+                || (name_len == 17 && strncasecmp(name, "Transfer-Encoding", 17) == 0)) {
+            /* Only hold for the backend's own connection */
+        } else {
+            if (name_len == 14 && strncasecmp(name, "Content-Length", 14) == 0) {
+                has_length = TRUE;
+            } else if (name_len == 8 && strncasecmp(name, "Location", 8) == 0) {
+                has_location = TRUE;
+            }
+            /* ": ", "\r\n" and sprintf()'s terminator */
+            if (lines_len + name_len + value_len + 5 > (int)sizeof(lines)) return -1;
+            lines_len += sprintf(lines+lines_len, "%.*s: %.*s\r\n", name_len, name,
+                value_len, value);
+        }
+        line = next;
+    }
+    if (status == NULL) {
+        status = has_location ? "302 Found" : "200 OK";
+        status_len = strlen(status);
+    }
+    if (status_len + lines_len + 64 + (int)strlen(WS_STR_CHUNKED) 
+            + (int)strlen(WS_STR_KEEP_ALIVE) > WS_MAX_DATA) {
+        return -1;
+    }
+    client->status = atoi(status);
+    client->out_offset = 0;
+    client->out_size = sprintf(client->out, WS_STR_STATUS_LINE, status_len, status);
+    memcpy(client->out+client->out_size, lines, lines_len);
+    client->out_size += lines_len;
+
+    /* Bodies of unknown length are chunked, or end the connection before
+       HTTP/1.1, unless the status has no body */
+    if (!has_length && client->status != 204 && client->status != 304) {
+        if (client->h2_parent != NULL) {
+            /* HTTP/2 frames the body itself */
+        } else if (client->req->minor >= 1) {
+            client->chunked = TRUE;
+            client->out_size += sprintf(client->out+client->out_size, WS_STR_CHUNKED);
+        } else {
+            client->keep_alive = FALSE;
+        }
+    }
+    finish_header(client);
+    WS_STATS_ADD(client->worker->stats.statuses[ws_stats_status_index(client->status)], 1);
+
+    /* What came after the header is the start of the body */
+    client->fcgi_state = WS_FCGI_STATE_BODY;
+    client->stream_len = 0;
+    if (body < len) {
+        size_t rest = len - body;
+        char *copy = malloc(rest);
+        if (copy == NULL) return -1;
+        memcpy(copy, header+body, rest);
+        int ok = fcgi_append_body(client, copy, rest);
+        free(copy);
+        if (!ok) return -1;
+    }
+    return 1;
+}
+
+/* Adds a parameter to a request's list */
+static void add_param(ws_fcgi_param_t *params, int *count, const char *name,
+        const char *value, int value_len) {
+    params[*count].name = name;
+    params[*count].name_len = strlen(name);
+    params[*count].value = value;
+    params[*count].value_len = value_len;
+    (*count)++;
+}
+
+/* Fills in the CGI/1.1 parameters of a client's request, pointing into the
+   request or into buf, which holds WS_MAX_DATA bytes. Returns how many */
+int fcgi_params(client_node_p client, ws_fcgi_param_t *params, char *buf) {
+    ws_http_request_p req = client->req;
+    ws_fcgi_backend_p backend = &ws_fcgi_backends[client->fcgi_backend];
+    const char *target = req->target.ptr;
+    const char *query = memchr(target, '?', req->target.len);
+    int path_len = query != NULL ? query - target : req->target.len;
+    int count = 0, used = 0;
+
+    add_param(params, &count, "GATEWAY_INTERFACE", "CGI/1.1", 7);
+    add_param(params, &count, "SERVER_SOFTWARE", "web-server", 10);
+    add_param(params, &count, "REQUEST_METHOD", req->method.ptr, req->method.len);
+    add_param(params, &count, "REQUEST_URI", target, req->target.len);
+    add_param(params, &count, "SCRIPT_NAME", backend->prefix, backend->prefix_len);
+    add_param(params, &count, "PATH_INFO", target + backend->prefix_len, 
+        path_len - backend->prefix_len);
+    add_param(params, &count, "QUERY_STRING", query != NULL ? query+1 : "",
+        query != NULL ? req->target.len - path_len - 1 : 0);
+    if (req->version.ptr != NULL) {
+        add_param(params, &count, "SERVER_PROTOCOL", req->version.ptr, req->version.len);
+    } else {
+        add_param(params, &count, "SERVER_PROTOCOL", "HTTP/0.9", 8);
+    }
+    if (req->host.ptr != NULL) {
+        add_param(params, &count, "SERVER_NAME", req->host.ptr, req->host.len);
+    }
+    if (client->tls != NULL || (client->h2_parent != NULL && client->h2_parent->tls != NULL)) {
+        add_param(params, &count, "HTTPS", "on", 2);
+    }
+
+    /* The client's address and port */
+    unsigned short port = 0;
+    if (client->addr.ss_family == AF_INET) {
+        struct sockaddr_in *in = (struct sockaddr_in *)&client->addr;
+        inet_ntop(AF_INET, &in->sin_addr, buf, INET6_ADDRSTRLEN);
+        port = ntohs(in->sin_port);
+    } else if (client->addr.ss_family == AF_INET6) {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&client->addr;
+        inet_ntop(AF_INET6, &in6->sin6_addr, buf, INET6_ADDRSTRLEN);
+        port = ntohs(in6->sin6_port);
+    } else {
+        strcpy(buf, "-");
+    }
+    add_param(params, &count, "REMOTE_ADDR", buf, strlen(buf));
+    used = strlen(buf) + 1;
+    int port_len = sprintf(buf+used, "%u", port);
+    add_param(params, &count, "REMOTE_PORT", buf+used, port_len);
+    used += port_len + 1;
+
+    /* Each header as HTTP_NAME, but Proxy, which CGI programs take for
+       their proxy setting (httpoxy) */
+    for (int h = 0; h < req->nheaders; h++) {
+        ws_http_slice_t *name = &req->headers[h].name;
+        if ((name->len == 5 && strncasecmp(name->ptr, "Proxy", 5) == 0)
+                || used + name->len + 6 > WS_MAX_DATA) {
+            continue;
+        }
+        char *param = buf+used;
+        memcpy(param, "HTTP_", 5);
+        for (int i = 0; i < name->len; i++) {
+            char c = name->ptr[i];
+            param[5+i] = c >= 'a' && c <= 'z' ? c - 'a' + 'A' 
+                : (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ? c : '_';
+        }
+        param[5+name->len] = '\0';
+        used += name->len + 6;
+        add_param(params, &count, param, req->headers[h].value.ptr, req->headers[h].value.len);
+    }
+    return count;
+}
+
+/* Sends a client's request on a connection to its backend with a free id,
+   opening one if none has. Returns 1 once sent, 0 if every connection is
+   busy, or -1 if the backend can't be reached */
+int fcgi_assign(client_node_p client) {
+    ws_worker_p worker = client->worker;
+    int backend = client->fcgi_backend;
+    ws_fcgi_conn_p conns = worker->fcgi_conns + backend * WS_FCGI_CONNS;
+    ws_fcgi_conn_p conn = NULL, unused = NULL;
+    int id = 0, open = 0;
+    for (int c = 0; c < WS_FCGI_CONNS && conn == NULL; c++) {
+        if (conns[c].fd == -1) {
+            if (unused == NULL) unused = &conns[c];
+        } else if ((id = ws_fcgi_free_id(&conns[c])) != 0) {
+            conn = &conns[c];
+        } else {
+            open++;
+        }
+    }
+
+    /* Open another connection while the pool has room */
+    if (conn == NULL && unused != NULL) {
+        if (ws_fcgi_connect(unused, backend) == -1 
+                || ws_event_add(&worker->loop, unused->fd, WS_EV_READ | WS_EV_WRITE, unused) == -1) {
+            ws_log(WS_LOG_WARN, "Couldn't connect to FastCGI backend %s: %s\n",
+                ws_fcgi_backends[backend].path, strerror(errno));
+            if (unused->fd != -1) {
+                ws_fcgi_close(unused);
+            }
+            return open > 0 ? 0 : -1;
+        }
+        ws_log(WS_LOG_DEBUG, "Worker %d connected to FastCGI backend %s\n",
+            worker->index, ws_fcgi_backends[backend].path);
+        unused->ready = WS_EV_WRITE;
+        conn = unused;
+        id = ws_fcgi_free_id(conn);
+    }
+    if (conn == NULL) return 0;
+
+    ws_fcgi_param_t params[16 + WS_HTTP_MAX_HEADERS];
+    char buf[WS_MAX_DATA];
+    int count = fcgi_params(client, params, buf);
+    if (ws_fcgi_request(conn, id, params, count) == -1) return -1;
+    conn->reqs[id] = client;
+    conn->active++;
+    client->fcgi = conn;
+    client->fcgi_id = id;
+    client->fcgi_state = WS_FCGI_STATE_HEADER;
+    fcgi_flush(worker, conn);
+    return 1;
+}
+
+/* Wakes a client with new output to send */
+void wake_client(client_node_p client) {
+    /* Streams are sent by their connection */
+    if (client->h2_parent != NULL) {
+        client->h2_parent->ready |= WS_EV_WRITE;
+        serve_client(client->h2_parent);
+        return;
+    }
+    client->ready |= WS_EV_WRITE;
+    ws_event_mod(&client->worker->loop, client->socket, WS_EV_WRITE, client);
+    serve_client(client);
+}
+
+/* Resets an HTTP/2 stream whose response can't be finished, and frees it.
+   Returns its connection, which must be served to send the reset */
+client_node_p h2_drop(client_node_p node) {
+    client_node_p client = node->h2_parent;
+    ws_h2_reset(client->h2, node->h2_stream, WS_H2_INTERNAL_ERROR);
+    h2_end_stream(node);
+    return client;
+}
+
+/* Closes a client whose response can't be finished, or only resets it if
+   it is a stream of an HTTP/2 connection */
+void drop_client(client_node_p client) {
+    if (client->h2_parent != NULL) {
+        client_node_p parent = h2_drop(client);
+        parent->ready |= WS_EV_WRITE;
+        serve_client(parent);
+        return;
+    }
+    rm_client(client->worker, client->socket);
+}
+
+/* Hands the requests queued for a backend to connections with a free id,
+   answering them with a 502 if it can't be reached */
+void fcgi_dispatch(ws_worker_p worker, int backend) {
+    client_node_p client;
+    while (alive && (client = worker->fcgi_queue[backend]) != NULL) {
+        worker->fcgi_queue[backend] = client->fcgi_next;
+        if (worker->fcgi_queue[backend] == NULL) {
+            worker->fcgi_queue_tail[backend] = NULL;
+        }
+        client->fcgi_next = NULL;
+        int sent = fcgi_assign(client);
+        if (sent == 0) {
+            /* Still first in line */
+            client->fcgi_next = worker->fcgi_queue[backend];
+            worker->fcgi_queue[backend] = client;
+            if (client->fcgi_next == NULL) {
+                worker->fcgi_queue_tail[backend] = client;
+            }
+            return;
+        } else if (sent == -1) {
+            fcgi_bad_gateway(client);
+            wake_client(client);
+        }
+    }
+}
+
+/* Starts a client's dynamic response from a backend, sending its request
+   now or queueing it for the next free connection */
+void fcgi_start(client_node_p client, int backend) {
+    ws_worker_p worker = client->worker;
+    client->fcgi_backend = backend;
+    client->fcgi_state = WS_FCGI_STATE_QUEUED;
+    client->status = 0;
+    client->out_offset = 0;
+    client->out_size = 0;
+    int sent = worker->fcgi_queue[backend] == NULL ? fcgi_assign(client) : 0;
+    if (sent == 0) {
+        client->fcgi_next = NULL;
+        if (worker->fcgi_queue_tail[backend] != NULL) {
+            worker->fcgi_queue_tail[backend]->fcgi_next = client;
+        } else {
+            worker->fcgi_queue[backend] = client;
+        }
+        worker->fcgi_queue_tail[backend] = client;
+    } else if (sent == -1) {
+        fcgi_bad_gateway(client);
+    }
+}
+
+/* Handles a record read from a backend connection.
+   Returns the client to wake for its new output, or NULL */
+client_node_p fcgi_record(ws_worker_p worker, ws_fcgi_conn_p conn, ws_fcgi_record_t *record) {
+    if (record->type == WS_FCGI_GET_VALUES_RESULT) {
+        ws_fcgi_values(conn, record);
+        ws_log(WS_LOG_DEBUG, "FastCGI backend %s takes %d requests per connection\n",
+            ws_fcgi_backends[conn->backend].path, conn->max_reqs);
+        return NULL;
+    }
+    if (record->id < 1 || record->id > WS_FCGI_MAX_MPX || conn->reqs[record->id] == NULL) {
+        return NULL;
+    }
+
+    /* Aborted requests are only waited on to free their id */
+    client_node_p client = conn->reqs[record->id];
+    if (record->type == WS_FCGI_END_REQUEST) {
+        conn->reqs[record->id] = NULL;
+        conn->active--;
+        if ((void *)client == (void *)conn) return NULL;
+        client->fcgi = NULL;
+        if (client->fcgi_state == WS_FCGI_STATE_HEADER) {
+            fcgi_bad_gateway(client);
+        } else {
+            client->fcgi_state = WS_FCGI_STATE_DONE;
+            if (client->chunked && !fcgi_append(client, WS_STR_LAST_CHUNK, strlen(WS_STR_LAST_CHUNK))) {
+                drop_client(client);
+                return NULL;
+            }
+        }
+        return client;
+    } else if ((void *)client == (void *)conn) {
+        return NULL;
+    } else if (record->type == WS_FCGI_STDERR && record->len > 0) {
+        ws_log(WS_LOG_WARN, "FastCGI backend %s: %.*s\n", ws_fcgi_backends[conn->backend].path,
+            record->len, record->content);
+        return NULL;
+    } else if (record->type != WS_FCGI_STDOUT || record->len == 0) {
+        return NULL;
+    }
+
+    /* Output before the header is done is held until it is */
+    int result = 1;
+    if (client->fcgi_state == WS_FCGI_STATE_BODY) {
+        result = fcgi_append_body(client, record->content, record->len) ? 1 : -1;
+    } else if (!fcgi_append(client, record->content, record->len)) {
+        result = -1;
+    } else {
+        result = fcgi_header(client);
+    }
+    if (result == -1 && client->fcgi_state == WS_FCGI_STATE_BODY) {
+        perror("Couldn't buffer FastCGI output");
+        drop_client(client);
+        return NULL;
+    } else if (result == -1) {
+        ws_log(WS_LOG_WARN, "FastCGI backend %s sent a bad header\n",
+            ws_fcgi_backends[conn->backend].path);
+        conn->reqs[record->id] = conn;
+        ws_fcgi_abort(conn, record->id);
+        fcgi_bad_gateway(client);
+    }
+    return result == 0 ? NULL : client;
+}
+
+/* Closes a backend connection that failed, answering its requests with a
+   502, or closing their clients if the header was already sent */
+void fcgi_fail(ws_worker_p worker, ws_fcgi_conn_p conn) {
+    client_node_p owners[WS_FCGI_MAX_MPX];
+    int count = 0, backend = conn->backend;
+    for (int id = 1; id <= WS_FCGI_MAX_MPX; id++) {
+        if (conn->reqs[id] != NULL && conn->reqs[id] != (void *)conn) {
+            owners[count++] = conn->reqs[id];
+        }
+    }
+    ws_log(WS_LOG_WARN, "FastCGI connection to %s failed: %s\n",
+        ws_fcgi_backends[backend].path, strerror(errno));
+    ws_event_del(&worker->loop, conn->fd);
+    ws_fcgi_close(conn);
+
+    /* Serving an HTTP/2 connection can end its other streams, so they are
+       all settled before any client is woken */
+    int wake = 0;
+    for (int i = 0; i < count; i++) {
+        client_node_p client = owners[i];
+        client->fcgi = NULL;
+        if (client->fcgi_state == WS_FCGI_STATE_HEADER) {
+            fcgi_bad_gateway(client);
+            owners[wake++] = client->h2_parent ? client->h2_parent : client;
+        } else if (client->h2_parent != NULL) {
+            owners[wake++] = h2_drop(client);
+        } else {
+            rm_client(worker, client->socket);
+        }
+    }
+    for (int i = 0; i < wake; i++) {
+        int seen = FALSE;
+        for (int j = 0; j < i && !seen; j++) {
+            seen = owners[j] == owners[i];
+        }
+        if (!seen && owners[i]->stage != WS_STAGE_CLOSED) {
+            wake_client(owners[i]);
+        }
+    }
+    fcgi_dispatch(worker, backend);
+}
+
+/* Moves a backend connection along until it would block: hands on each
+   record read, writes the requests queued, then reads more */
+void fcgi_serve(ws_worker_p worker, ws_fcgi_conn_p conn) {
+    while (alive && conn->fd != -1) {
+        /* Hand on the records already read, unless a client is behind */
+        ws_fcgi_record_t record;
+        while (alive && !conn->paused && ws_fcgi_peek(conn, &record)) {
+            client_node_p client = fcgi_record(worker, conn, &record);
+            ws_fcgi_consume(conn, &record);
+            if (client != NULL) {
+                wake_client(client);
+
+                /* Stop reading while it can't keep up */
+                if (conn->reqs[record.id] == client 
+                        && client->stream_len - client->stream_offset > WS_FCGI_STREAM_MAX) {
+                    conn->paused = TRUE;
+                }
+            }
+            if (record.type == WS_FCGI_END_REQUEST || record.type == WS_FCGI_GET_VALUES_RESULT) {
+                fcgi_dispatch(worker, conn->backend);
+            }
+        }
+        fcgi_flush(worker, conn);
+        if (conn->paused || !(conn->ready & WS_EV_READ)) return;
+
+        ssize_t n = ws_fcgi_read(conn);
+        if (n == -1 && would_block()) {
+            conn->ready &= ~WS_EV_READ;
+            return;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            if (n == 0) errno = ECONNRESET;
+            fcgi_fail(worker, conn);
+            return;
+        }
+    }
+}
+
+/* Returns the backend connection an event is for, or NULL */
+ws_fcgi_conn_p fcgi_conn_of(ws_worker_p worker, void *data) {
+    ws_fcgi_conn_p conn = data;
+    if (worker->fcgi_conns == NULL || conn < worker->fcgi_conns 
+            || conn >= worker->fcgi_conns + worker->fcgi_conn_count) {
+        return NULL;
+    }
+    return conn;
+}
+
+/* Points a client's response at a page, or the 404 page if it's missing,
+   and finishes its header, unless the page has to be loaded from disk
+   first: then this is called again once it has been */
+void respond(client_node_p client, char *url, int parse_type) {
+    int served = serve_page(client, url, parse_type);
+    if (served == -1) return;
+    if (!served) {
+        ws_log(WS_LOG_TRACE, "Page %s is missing!\n", url);
+        build_url(url, WS_URL_404);
+        parse_type = WS_STATUS_MISSING;
+        served = serve_page(client, url, parse_type);
+        if (served == -1) return;
+        if (!served) {
+            client->status = parse_type;
+            client->out_size = build_header(client->out, parse_type, url, 0, NULL, 0, WS_CODING_IDENTITY);
+        }
+    }
+    if (parse_type != WS_STATUS_OK) {
+        WS_STATS_ADD(client->worker->err_count, 1);
+    }
+
+    /* Invalid requests can't be trusted to be framed right */
+    if (parse_type == WS_STATUS_INVALID) {
+        client->keep_alive = FALSE;
+    }
+    finish_header(client);
+}
+
+/* Parses a client's data and writes the correct response to its data */
+void parse_data(client_node_p client) {
+    ws_log(WS_LOG_TRACE, "Parse started for client{%s}\n", ctoa(client));
+    /* Setup vars */
+    int parse_type = WS_STATUS_INVALID;
+    ws_http_request_p req = client->req;
+    char *url_tail = WS_URL_500;
+    char target[WS_MAX_DATA];
+    char url[WS_MAX_DATA];
+
+    /* Decide if the connection stays open */
+    client->requests++;
+    client->keep_alive = ws_http_keep_alive(req) && client->requests < max_requests;
+
+    /* Determine type of output */
+    if (req->state != WS_HTTP_DONE || req->method.len != 3
+            || memcmp(req->method.ptr,"GET",3) != 0 || req->target.ptr[0] != '/') {
+        /* Check for invalid start */
+        url_tail = WS_URL_500;
+    } else {
+        /* Decode the URL into its path, the request itself is left
+           untouched. Room is kept for the .html build_url() may add */
+        url_tail = target;
+        if (ws_path_decode(req->target.ptr, req->target.len, target, sizeof(target) - 5) == -1) {
+            url_tail = WS_URL_500;
+            ws_log(WS_LOG_TRACE, "URL was malformed or dangerous, 500 sent\n");
+        }
+        ws_log(WS_LOG_TRACE, "Parsed url: %s\n",url_tail);
+
+        /* Dynamic pages are answered by their backend, header and all */
+        int backend = ws_fcgi_route(req->target.ptr, req->target.len);
+        if (backend != -1 && url_tail == target) {
+            ws_log(WS_LOG_TRACE, "Sent to FastCGI backend %s\n", ws_fcgi_backends[backend].path);
+            fcgi_start(client, backend);
+            return;
+        }
+
+        /* Handle index */
+        if (strcmp(url_tail,"/") == 0) {
+            url_tail = WS_URL_INDEX;
+        }
+        parse_type = WS_STATUS_OK;
+    }
+
+    /* Point the response at the page, or the 404 page if it's missing */
+    build_url(url, url_tail);
+    if (parse_type == WS_STATUS_OK && strcmp(url_tail, WS_URL_STATS) == 0 
+            && serve_stats(client)) {
+        ws_log(WS_LOG_TRACE, "Sent stats\n");
+        finish_header(client);
+    } else {
+        respond(client, url, parse_type);
+    }
+}
+
+/* Logs a client's finished request */
+void log_access(client_node_p client, long us) {
+    ws_http_request_p req = client->req;
+    const char *method = req->method.ptr ? req->method.ptr : "-";
+    const char *target = req->target.ptr ? req->target.ptr : "-";
+    ws_log_access((struct sockaddr *)&client->addr, method, req->method.ptr ? req->method.len : 1,
+        target, req->target.ptr ? req->target.len : 1, client->status, client->sent, us);
+}
+
+/* Sends the next piece of a client's response, at most max bytes of it
+   (userspace TLS always sends up to a record). Buffered data (the header)
+   and cached responses go first, then the file through sendfile() or the
+   buffer.
+   Returns bytes sent, 0 once the response is complete, or -1 with errno set */
+ssize_t send_response(client_node_p client, size_t max) {
+    ssize_t n;
+    size_t buffered = client->out_size - client->out_offset;
+    size_t cached = client->entry ? client->entry_end - client->entry_offset : 0;
+    size_t streamed = client->stream_len - client->stream_offset;
+    if (buffered > 0 || cached > 0 || streamed > 0) {
+        /* Gather the buffer, cached response and backend output into one send */
+        struct iovec iov[3];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        if (buffered > 0) {
+            iov[msg.msg_iovlen].iov_base = client->out+client->out_offset;
+            iov[msg.msg_iovlen++].iov_len = buffered;
+        }
+        if (cached > 0) {
+            iov[msg.msg_iovlen].iov_base = client->entry->data+client->entry_offset;
+            iov[msg.msg_iovlen++].iov_len = cached;
+        }
+        if (streamed > 0) {
+            iov[msg.msg_iovlen].iov_base = client->stream+client->stream_offset;
+            iov[msg.msg_iovlen++].iov_len = streamed;
+        }
+        size_t total = 0;
+        for (int i = 0; i < msg.msg_iovlen; i++) {
+            if (total + iov[i].iov_len >= max) {
+                iov[i].iov_len = max - total;
+                msg.msg_iovlen = i + 1;
+                break;
+            }
+            total += iov[i].iov_len;
+        }
+
+        int flags = MSG_NOSIGNAL;
+#ifdef MSG_MORE
+        /* Coalesce the header with the start of the sendfile() body, or
+           with the next part */
+        if ((use_sendfile && client->file_offset < client->file_size)
+                || client->range_index < client->range_count) {
+            flags |= MSG_MORE;
+        }
+#endif
+        n = client_send(client, &msg, flags);
+        if (n > 0) {
+            size_t left = n;
+            size_t from_buffer = left < buffered ? left : buffered;
+            client->out_offset += from_buffer;
+            left -= from_buffer;
+            size_t from_cache = left < cached ? left : cached;
+            client->entry_offset += from_cache;
+            client->stream_offset += left - from_cache;
+            if (client->stream_offset == client->stream_len) {
+                client->stream_offset = 0;
+                client->stream_len = 0;
+            }
+
+            /* A backend connection paused for this client reads again once
+               it has caught up */
+            if (client->fcgi != NULL && client->fcgi->paused
+                    && client->stream_len - client->stream_offset <= WS_FCGI_STREAM_MAX / 2) {
+                client->fcgi->paused = FALSE;
+                client->worker->fcgi_pending = TRUE;
+            }
+        }
+        return n;
+    }
+
+    /* Wait for more from the backend without watching the socket */
+    if (client->fcgi_state != WS_FCGI_STATE_NONE && client->fcgi_state != WS_FCGI_STATE_DONE) {
+        ws_event_mod(&client->worker->loop, client->socket, 0, client);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    /* Check if the whole file (or part) has been sent */
+    off_t remaining = client->file_size - client->file_offset;
+    if (remaining <= 0) {
+        return next_part(client) ? send_response(client, max) : 0;
+    }
+
+    /* Only bytes read ahead are sent, so neither call waits on disk */
+    remaining = file_ready(client);
+    if (remaining == 0) {
+        ws_event_mod(&client->worker->loop, client->socket, 0, client);
+        errno = EAGAIN;
+        return -1;
+    }
+
+#ifdef WS_HAVE_SENDFILE
+    if (use_sendfile && plain_writes(client)) {
+        n = sendfile(client->socket, client->file, &client->file_offset, 
+            (size_t)remaining < max ? (size_t)remaining : max);
+        if (n == 0) {
+            errno = EIO; /* File shrank under us */
+            return -1;
+        } else if (n != -1 || (errno != EINVAL && errno != ENOSYS)) {
+            return n;
+        }
+        /* Not supported for this file, fall back to buffering it */
+    }
+#endif
+
+    /* Read the next chunk into the buffer and send from there */
+    size_t chunk = remaining < WS_MAX_DATA ? (size_t)remaining : WS_MAX_DATA;
+    n = pread(client->file, client->out, chunk < max ? chunk : max, client->file_offset);
+    if (n <= 0) {
+        if (n == 0) errno = EIO;
+        return -1;
+    }
+    client->file_offset += n;
+    client->out_offset = 0;
+    client->out_size = n;
+    return send_response(client, max);
+}
+
+/* Switches a client whose response is ready to sending */
+void start_sending(client_node_p client) {
+    ws_stats_p stats = &client->worker->stats;
+    if (client->fcgi_state == WS_FCGI_STATE_NONE) {
+        /* Dynamic responses count theirs once the backend's header is in */
+        WS_STATS_ADD(stats->statuses[ws_stats_status_index(client->status)], 1);
+    }
+    WS_STATS_ADD(stats->sending, 1);
+
+    /* Set stage to sending, the socket is most likely writable */
+    set_deadline(client, WS_DEADLINE_SEND);
+    client->stage = WS_STAGE_SENDING;
+    client->ready |= WS_EV_WRITE;
+    ws_event_mod(&client->worker->loop, client->socket, WS_EV_WRITE, client);
+}
+
+/* Parses a complete request and switches the client to sending, once its
+   page is loaded if it waits on disk for it.
+   Returns FALSE if the buffer for the response couldn't be borrowed */
+int start_response(client_node_p client, int req_len) {
+    client->out = ws_buf_get(&client->worker->buffers, WS_MAX_DATA);
+    if (client->out == NULL) return FALSE;
+    WS_STATS_ADD(client->worker->req_count, 1);
+    client->req_len = req_len;
+    if (client->req_start < 0) {
+        client->req_start = monotonic_us();
+    }
+    parse_data(client);
+    if (client->stage != WS_STAGE_DISK) {
+        start_sending(client);
+    }
+    return TRUE;
+}
+
+/* Cleans up a sent response and switches a kept-alive client back to
+   reading, keeping any pipelined data that followed the request */
+void finish_response(client_node_p client) {
+    if (client->file != -1) {
+        close(client->file);
+        client->file = -1;
+    }
+    if (client->entry != NULL) {
+        ws_cache_release(client->entry);
+        client->entry = NULL;
+    }
+    client->file_offset = 0;
+    client->file_size = 0;
+    client->entry_offset = 0;
+    client->entry_end = 0;
+    client->range_count = 0;
+    client->range_index = 0;
+    client->out_offset = 0;
+    client->out_size = 0;
+    disk_detach(client);
+    client->disk_start = 0;
+    client->disk_end = 0;
+    release_response(client);
+    fcgi_release(client);
+
+    /* Drop the request, keeping what came after it, and only keep the
+       buffer if something did */
+    client->data_size -= client->req_len;
+    memmove(client->data, client->data+client->req_len, client->data_size);
+    client->req_len = 0;
+    ws_http_init(client->req);
+    release_request(client);
+
+    /* A pipelined request has already arrived */
+    client->req_start = client->data_size > 0 ? monotonic_us() : -1;
+    client->sent_first = FALSE;
+    client->sent = 0;
+    WS_STATS_ADD(client->worker->stats.sending, -1);
+    client->stage = WS_STAGE_READING;
+    ws_event_mod(&client->worker->loop, client->socket, WS_EV_READ, client);
+    set_deadline(client, client->data_size > 0 ? WS_DEADLINE_HEADER : WS_DEADLINE_IDLE);
+}
+
+/* Answers a client whose page the disk pool has loaded, from what it found */
+void disk_loaded(client_node_p client, disk_job_p job) {
+    ws_worker_p worker = client->worker;
+    for (int i = 0; i < job->entry_count; i++) {
+        job->entries[i]->pinned = job->entries[i]->status != WS_STATUS_OK;
+        ws_cache_put(&worker->cache, job->entries[i]);
+    }
+    ws_log(WS_LOG_TRACE, "Loaded %s with %d entries%s\n", job->path, job->entry_count,
+        job->file != -1 ? " and its file" : "");
+
+    /* The page is served again, finding what was loaded this time */
+    client->disk = job;
+    client->stage = client->h2_parent != NULL ? WS_STAGE_SENDING : WS_STAGE_READING;
+    respond(client, job->path, job->status);
+    client->disk = NULL;
+    disk_free(job);
+    if (client->h2_parent != NULL) {
+        WS_STATS_ADD(worker->stats.statuses[ws_stats_status_index(client->status)], 1);
+        wake_client(client);
+        return;
+    }
+    WS_STATS_ADD(worker->stats.disk, -1);
+    start_sending(client);
+    serve_client(client);
+}
+
+/* Sends on for a client whose next window the disk pool has read */
+void disk_read(client_node_p client, disk_job_p job) {
+    if (job->len <= 0) {
+        /* Errors and a shrunk file are found by sending it as it is */
+        client->disk_start = job->offset;
+        client->disk_end = client->file_size;
+    } else if (job->offset == client->disk_end && client->disk_start < client->disk_end) {
+        client->disk_end += job->len;
+    } else {
+        client->disk_start = job->offset;
+        client->disk_end = job->offset + job->len;
+    }
+    disk_free(job);
+    if (client->stage != WS_STAGE_DISK) return; /* Read before it was needed */
+    client->stage = WS_STAGE_SENDING;
+    if (client->h2_parent == NULL) {
+        WS_STATS_ADD(client->worker->stats.disk, -1);
+        WS_STATS_ADD(client->worker->stats.sending, 1);
+    }
+    wake_client(client);
+}
+
+/* Finishes the jobs the disk pool has done for a worker's clients, freeing
+   those of clients that have gone */
+void disk_complete(ws_worker_p worker) {
+    ws_disk_job_p next;
+    for (ws_disk_job_p done = ws_disk_take(&worker->disk); done != NULL; done = next) {
+        next = done->next;
+        disk_job_p job = (disk_job_p)done;
+        client_node_p client = job->client;
+        if (client == NULL) {
+            disk_free(job);
+            continue;
+        }
+        client->disk = NULL;
+        if (job->kind == WS_DISK_LOAD) {
+            disk_loaded(client, job);
+        } else {
+            disk_read(client, job);
+        }
+    }
+}
+
+/* Frees the node of an HTTP/2 stream that ended or was reset, once its
+   slot in the connection is free */
+void h2_end_stream(client_node_p node) {
+    ws_worker_p worker = node->worker;
+    if (node->file != -1) {
+        close(node->file);
+    }
+    if (node->entry != NULL) {
+        ws_cache_release(node->entry);
+    }
+    fcgi_detach(node);
+    disk_detach(node);
+    release_response(node);
+    node->data_size = 0;
+    release_request(node);
+    WS_STATS_ADD(worker->stats.streams, -1);
+    node->stage = WS_STAGE_CLOSED;
+    pool_free(&worker->clients, node);
+}
+
+/* Takes a node from the pool to answer a stream of a connection, with a
+   data buffer as large as a request gets. Returns NULL if there is no memory */
+client_node_p h2_stream_node(client_node_p client, ws_h2_stream_p stream) {
+    ws_worker_p worker = client->worker;
+    ws_buf_pool_p pool = &worker->buffers;
+    client_node_p node = pool_alloc(&worker->clients);
+    if (node == NULL) return NULL;
+    init_client(node, worker, client->socket);
+    memcpy(&node->addr, &client->addr, sizeof(node->addr));
+    node->data = ws_buf_get(pool, WS_MAX_DATA);
+    node->req = ws_buf_get(pool, sizeof(ws_http_request_t));
+    if (node->data == NULL || node->req == NULL) {
+        ws_buf_put(pool, node->data, WS_MAX_DATA);
+        ws_buf_put(pool, node->req, sizeof(ws_http_request_t));
+        pool_free(&worker->clients, node);
+        return NULL;
+    }
+    node->data_cap = ws_buf_fit(WS_MAX_DATA);
+    ws_http_init(node->req);
+    node->h2_parent = client;
+    node->h2_stream = stream;
+    node->stage = WS_STAGE_SENDING;
+    stream->data = node;
+    WS_STATS_ADD(worker->stats.streams, 1);
+    return node;
+}
+
+/* Returns TRUE if a field's name or value can go in a request line as is */
+static int h2_field_ok(const char *s, int len, int name) {
+    for (int i = 0; i < len; i++) {
+        if (s[i] == '\r' || s[i] == '\n' || s[i] == '\0' 
+                || (name && i > 0 && (s[i] == ':' || s[i] == ' '))) return FALSE;
+    }
+    return TRUE;
+}
+
+/* Writes the fields of a stream's request into its data as an HTTP/1.1
+   request, for the parser to take like any other. Returns its length, 0 if
+   it doesn't fit, or -1 if the fields are malformed */
+int h2_request_text(client_node_p node, ws_h2_event_t *ev) {
+    const ws_h2_field_t *method = NULL, *path = NULL, *authority = NULL;
+    for (int i = 0; i < ev->nfields; i++) {
+        const ws_h2_field_t *field = &ev->fields[i];
+        if (field->name_len == 0 || !h2_field_ok(field->name, field->name_len, TRUE)
+                || !h2_field_ok(field->value, field->value_len, FALSE)) return -1;
+        if (field->name[0] != ':') continue;
+        if (field->name_len == 7 && memcmp(field->name, ":method", 7) == 0) {
+            method = field;
+        } else if (field->name_len == 5 && memcmp(field->name, ":path", 5) == 0) {
+            path = field;
+        } else if (field->name_len == 10 && memcmp(field->name, ":authority", 10) == 0) {
+            authority = field;
+        } else if (field->name_len != 7 || memcmp(field->name, ":scheme", 7) != 0) {
+            return -1;
+        }
+    }
+    if (method == NULL || path == NULL || method->value_len == 0 || path->value_len == 0) {
+        return -1;
+    }
+
+    /* :authority stands in for Host */
+    int cap = node->data_cap, len;
+    len = snprintf(node->data, cap, "%.*s %.*s HTTP/1.1\r\n", method->value_len, method->value,
+        path->value_len, path->value);
+    if (authority != NULL && len < cap) {
+        len += snprintf(node->data+len, cap-len, "Host: %.*s\r\n", authority->value_len,
+            authority->value);
+    }
+    for (int i = 0; i < ev->nfields && len < cap; i++) {
+        const ws_h2_field_t *field = &ev->fields[i];
+        if (field->name[0] == ':' || (authority != NULL && field->name_len == 4 
+                && strncasecmp(field->name, "host", 4) == 0)) continue;
+        len += snprintf(node->data+len, cap-len, "%.*s: %.*s\r\n", field->name_len, field->name,
+            field->value_len, field->value);
+    }
+    if (len < cap) {
+        len += snprintf(node->data+len, cap-len, "\r\n");
+    }
+    return len < cap ? len : 0;
+}
+
+/* Parses the request text in a stream's data and points the stream at its
+   response, as start_response() does for a connection */
+void h2_start(client_node_p client, client_node_p node) {
+    ws_worker_p worker = client->worker;
+    ws_stats_p stats = &worker->stats;
+
+    /* -k counts streams, the connection winds down once it is reached */
+    client->requests++;
+    if (client->requests >= max_requests) {
+        ws_h2_goaway(client->h2, WS_H2_NO_ERROR);
+    }
+
+    /* Requests too big for the buffer are invalid, as over HTTP/1 */
+    int len = node->data_size;
+    if (len == 0 || ws_http_parse(node->req, node->data, len) != len) {
+        node->req->state = WS_HTTP_ERROR;
+    }
+    node->req_len = len;
+    node->out = ws_buf_get(&worker->buffers, WS_MAX_DATA);
+    if (node->out == NULL) {
+        perror("Couldn't allocate response buffer");
+        WS_STATS_ADD(worker->err_count, 1);
+        ws_h2_reset(client->h2, node->h2_stream, WS_H2_INTERNAL_ERROR);
+        h2_end_stream(node);
+        return;
+    }
+    WS_STATS_ADD(worker->req_count, 1);
+    node->req_start = monotonic_us();
+    parse_data(node);
+    if (node->fcgi_state == WS_FCGI_STATE_NONE && node->stage != WS_STAGE_DISK) {
+        WS_STATS_ADD(stats->statuses[ws_stats_status_index(node->status)], 1);
+    }
+}
+
+/* Opens a node for a stream whose request arrived, and answers it */
+void h2_request(client_node_p client, ws_h2_event_t *ev) {
+    ws_worker_p worker = client->worker;
+    client_node_p node = h2_stream_node(client, ev->stream);
+    if (node == NULL) {
+        perror("Couldn't allocate stream");
+        WS_STATS_ADD(worker->err_count, 1);
+        ws_h2_reset(client->h2, ev->stream, WS_H2_REFUSED_STREAM);
+        return;
+    }
+    int len = h2_request_text(node, ev);
+    if (len == -1) {
+        ws_log(WS_LOG_DEBUG, "Client{%s} sent a malformed request on stream %u\n",
+            ctoa(client), ev->stream->id);
+        WS_STATS_ADD(worker->err_count, 1);
+        ws_h2_reset(client->h2, ev->stream, WS_H2_PROTOCOL_ERROR);
+        h2_end_stream(node);
+        return;
+    }
+    node->data_size = len;
+    h2_start(client, node);
+}
+
+/* Switches a client to HTTP/2 on a new connection, whose first frames are
+   whatever was read after the request it answered, if any. Returns FALSE
+   if the connection couldn't be allocated */
+int h2_switch(client_node_p client, ws_h2_conn_p conn) {
+    if (conn == NULL) return FALSE;
+    int rest = client->data_size - client->req_len;
+    if (rest > 0) {
+        size_t room;
+        memcpy(ws_h2_in(conn, &room), client->data+client->req_len, rest);
+        ws_h2_read(conn, rest);
+    }
+    client->data_size = 0;
+    client->req_len = 0;
+    release_request(client);
+    client->h2 = conn;
+    client->stage = WS_STAGE_H2;
+    client->ready |= WS_EV_WRITE;
+    WS_STATS_ADD(client->worker->stats.h2_connections, 1);
+    ws_log(WS_LOG_DEBUG, "Client{%s} switched to HTTP/2\n", ctoa(client));
+    return TRUE;
+}
+
+/* Switches a client whose first request asks to upgrade to h2c, answering
+   that request as stream 1. Returns FALSE if it doesn't ask, or can't be */
+int h2_upgrade(client_node_p client) {
+    ws_http_request_p req = client->req;
+    if (!use_h2 || client->tls != NULL || client->requests > 0 || req->state != WS_HTTP_DONE
+            || req->connection.ptr == NULL || !ws_http_has_token(&req->connection, "upgrade")) {
+        return FALSE;
+    }
+    const ws_http_slice_t *upgrade = ws_http_header(req, "Upgrade");
+    const ws_http_slice_t *settings = ws_http_header(req, "HTTP2-Settings");
+    if (upgrade == NULL || settings == NULL || !ws_http_has_token(upgrade, "h2c")) return FALSE;
+
+    /* Bad settings just leave the request on HTTP/1.1 */
+    ws_h2_conn_p conn = ws_h2_new(WS_STR_SWITCHING, strlen(WS_STR_SWITCHING));
+    if (conn == NULL) return FALSE;
+    ws_h2_stream_p stream = ws_h2_upgrade(conn, settings->ptr, settings->len);
+    client_node_p node = stream ? h2_stream_node(client, stream) : NULL;
+    if (node == NULL) {
+        ws_h2_free(conn);
+        return FALSE;
+    }
+    memcpy(node->data, client->data, client->req_len);
+    node->data_size = client->req_len;
+    h2_switch(client, conn);
+    h2_start(client, node);
+    return TRUE;
+}
+
+/* Turns the HTTP/1 header parse_data() left in a stream's out into fields,
+   names lowercased into buf, and moves out_offset to the body after it.
+   Returns the number of fields, or -1 if the header is cut short */
+int h2_fields(client_node_p node, ws_h2_field_t *fields, int max, char *buf) {
+    char *header = node->out;
+    int end = 0;
+    while (end+3 < node->out_size && memcmp(header+end, "\r\n\r\n", 4) != 0) end++;
+    if (end+3 >= node->out_size || end < 12) return -1;
+    node->out_offset = end + 4;
+
+    /* The status line only gives its code */
+    fields[0].name = ":status";
+    fields[0].name_len = 7;
+    fields[0].value = header+9;
+    fields[0].value_len = 3;
+    int n = 1, used = 0;
+    char *line = memchr(header, '\n', end) + 1;
+    while (line < header+end+2 && n < max) {
+        char *eol = memchr(line, '\r', header+end+2 - line);
+        char *colon = memchr(line, ':', eol - line);
+        if (colon != NULL) {
+            int name_len = colon - line;
+            char *value = colon+1;
+            while (value < eol && *value == ' ') value++;
+
+            /* Connection-specific fields have no place in HTTP/2 */
+            if (!(name_len == 10 && strncasecmp(line, "Connection", 10) == 0)
+                    && !(name_len == 10 && strncasecmp(line, "Keep-Alive", 10) == 0)
+                    && !(name_len == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0)
+                    && !(name_len == 7 && strncasecmp(line, "Upgrade", 7) == 0)
+                    && !(name_len == 16 && strncasecmp(line, "Proxy-Connection", 16) == 0)) {
+                for (int i = 0; i < name_len; i++) {
+                    char c = line[i];
+                    buf[used+i] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+                }
+                fields[n].name = buf+used;
+                fields[n].name_len = name_len;
+                fields[n].value = value;
+                fields[n].value_len = eol - value;
+                used += name_len;
+                n++;
+            }
+        }
+        line = eol + 2;
+    }
+    return n;
+}
+
+/* Returns TRUE if a stream has body left to send, or still to come */
+int h2_body_pending(client_node_p node) {
+    return node->out_offset < node->out_size 
+        || (node->entry != NULL && node->entry_offset < node->entry_end)
+        || node->stream_offset < node->stream_len
+        || (node->fcgi_state != WS_FCGI_STATE_NONE && node->fcgi_state != WS_FCGI_STATE_DONE)
+        || (node->file != -1 && node->file_offset < node->file_size)
+        || (node->range_count > 0 && node->range_index <= node->range_count);
+}
+
+/* Copies the next body bytes of a stream into buf, in the order
+   send_response() sends them: out, the cached response, backend output,
+   then the file, moving on to the next part of a multipart response.
+   Returns the bytes copied, or -1 with errno set if the file can't be read */
+ssize_t h2_body(client_node_p node, char *buf, size_t max) {
+    size_t len = 0;
+    while (len < max) {
+        size_t n = max - len;
+        if (node->out_offset < node->out_size) {
+            if (n > (size_t)(node->out_size - node->out_offset)) n = node->out_size - node->out_offset;
+            memcpy(buf+len, node->out+node->out_offset, n);
+            node->out_offset += n;
+        } else if (node->entry != NULL && node->entry_offset < node->entry_end) {
+            if (n > node->entry_end - node->entry_offset) n = node->entry_end - node->entry_offset;
+            memcpy(buf+len, node->entry->data+node->entry_offset, n);
+            node->entry_offset += n;
+        } else if (node->stream_offset < node->stream_len) {
+            if (n > node->stream_len - node->stream_offset) n = node->stream_len - node->stream_offset;
+            memcpy(buf+len, node->stream+node->stream_offset, n);
+            node->stream_offset += n;
+            if (node->stream_offset == node->stream_len) {
+                node->stream_offset = 0;
+                node->stream_len = 0;
+            }
+
+            /* A backend connection paused for this stream reads again once
+               it has caught up */
+            if (node->fcgi != NULL && node->fcgi->paused
+                    && node->stream_len - node->stream_offset <= WS_FCGI_STREAM_MAX / 2) {
+                node->fcgi->paused = FALSE;
+                node->worker->fcgi_pending = TRUE;
+            }
+        } else if (node->fcgi_state != WS_FCGI_STATE_NONE && node->fcgi_state != WS_FCGI_STATE_DONE) {
+            break; /* More is on its way from the backend */
+        } else if (node->file != -1 && node->file_offset < node->file_size) {
+            off_t ready = file_ready(node);
+            if (ready == 0) break; /* Sent on once it has been read ahead */
+            if ((off_t)n > ready) n = ready;
+            ssize_t got = pread(node->file, buf+len, n, node->file_offset);
+            if (got <= 0) {
+                if (got == 0) errno = EIO;
+                return -1;
+            }
+            n = got;
+            node->file_offset += n;
+        } else if (next_part(node)) {
+            continue;
+        } else {
+            break;
+        }
+        len += n;
+    }
+    return len;
+}
+
+/* Logs a stream whose last frame is queued, and frees it */
+void h2_finish(client_node_p client, client_node_p node) {
+    ws_worker_p worker = client->worker;
+    long us = monotonic_us() - node->req_start;
+    ws_stats_record(&worker->stats.total, us);
+    log_access(node, us);
+    ws_h2_close(client->h2, node->h2_stream);
+    h2_end_stream(node);
+}
+
+/* Queues a stream's next frame: its HEADERS once the response header is
+   known, then DATA as far as the windows allow. Returns FALSE if nothing
+   could be queued */
+int h2_send(client_node_p client, client_node_p node) {
+    ws_worker_p worker = client->worker;
+    ws_h2_conn_p conn = client->h2;
+    ws_h2_stream_p stream = node->h2_stream;
+    if (node->stage == WS_STAGE_DISK) return FALSE;
+    if (!node->sent_first) {
+        if (node->fcgi_state == WS_FCGI_STATE_QUEUED || node->fcgi_state == WS_FCGI_STATE_HEADER) {
+            return FALSE;
+        }
+        ws_h2_field_t fields[WS_H2_MAX_FIELDS];
+        char names[WS_MAX_DATA];
+        int out_offset = node->out_offset;
+        int n = h2_fields(node, fields, WS_H2_MAX_FIELDS, names);
+        if (n == -1) {
+            ws_log(WS_LOG_WARN, "Client{%s} response header cut short\n", ctoa(node));
+            WS_STATS_ADD(worker->err_count, 1);
+            ws_h2_reset(conn, stream, WS_H2_INTERNAL_ERROR);
+            h2_end_stream(node);
+            return TRUE;
+        }
+        int end = !h2_body_pending(node);
+        if (!ws_h2_headers(conn, stream, fields, n, end)) {
+            node->out_offset = out_offset; /* Converted again once there is room */
+            return FALSE;
+        }
+        node->sent_first = TRUE;
+        ws_stats_record(&worker->stats.ttfb, monotonic_us() - node->req_start);
+        if (end) {
+            h2_finish(client, node);
+        }
+        return TRUE;
+    }
+
+    size_t room = ws_h2_data_room(conn, stream);
+    if (room == 0) return FALSE;
+    ssize_t n = h2_body(node, ws_h2_data_buf(conn), room);
+    if (n == -1) {
+        perror("Couldn't read page");
+        WS_STATS_ADD(worker->err_count, 1);
+        ws_h2_reset(conn, stream, WS_H2_INTERNAL_ERROR);
+        h2_end_stream(node);
+        return TRUE;
+    }
+    int end = !h2_body_pending(node);
+    if (n == 0 && !end) return FALSE;
+    ws_h2_data(conn, stream, n, end);
+    node->sent += n;
+    if (end) {
+        h2_finish(client, node);
+    }
+    return TRUE;
+}
+
+/* Queues frames for a connection's streams in turns, one frame per stream
+   each round, so the files sent on it are interleaved, until none of them
+   can queue more */
+void h2_fill(client_node_p client) {
+    ws_h2_conn_p conn = client->h2;
+    for (int idle = 0; conn->active > 0 && idle < WS_H2_MAX_STREAMS; ) {
+        ws_h2_stream_p stream = &conn->streams[conn->next];
+        conn->next = (conn->next + 1) % WS_H2_MAX_STREAMS;
+        if (stream->id != 0 && stream->data != NULL && h2_send(client, stream->data)) {
+            idle = 0;
+        } else {
+            idle++;
+        }
+    }
+}
+
+/* Moves an HTTP/2 connection along until it would block: takes the frames
+   read, queues the streams' frames, writes them, and reads more */
+void h2_serve(client_node_p client) {
+    ws_worker_p worker = client->worker;
+    ws_h2_conn_p conn = client->h2;
+    ws_h2_event_t ev;
+    size_t room, pending;
+    long turn = 0; /* Bytes sent this turn, its streams share it */
+    while (alive) {
+        /* Requests open streams, resets end them */
+        int event;
+        while ((event = ws_h2_next(conn, &ev)) != WS_H2_EVENT_NONE) {
+            if (event == WS_H2_EVENT_REQUEST) {
+                h2_request(client, &ev);
+            } else if (event == WS_H2_EVENT_RESET && ev.stream->data != NULL) {
+                h2_end_stream(ev.stream->data);
+                ev.stream->data = NULL;
+            } else if (event == WS_H2_EVENT_ERROR) {
+                ws_log(WS_LOG_DEBUG, "Client{%s} broke the HTTP/2 protocol\n", ctoa(client));
+                WS_STATS_ADD(worker->err_count, 1);
+            }
+        }
+        h2_fill(client);
+
+        /* Write what is queued */
+        const char *out = ws_h2_out(conn, &pending);
+        if (pending > 0 && (client->ready & WS_EV_WRITE)) {
+            size_t allowed = send_allowance(client, turn);
+            if (allowed == 0) break; /* Reads wait for its next turn too */
+            struct iovec iov;
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            iov.iov_base = (void *)out;
+            iov.iov_len = pending < allowed ? pending : allowed;
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            ssize_t n = client_send(client, &msg, MSG_NOSIGNAL);
+            if (n > 0) {
+                ws_h2_wrote(conn, n);
+                client->sent += n;
+                turn += n;
+                spend_tokens(client, n);
+                WS_STATS_ADD(worker->stats.bytes_sent, n);
+                continue;
+            } else if (would_block()) {
+                client->ready &= ~WS_EV_WRITE;
+            } else if (errno == EINTR) {
+                continue;
+            } else {
+                perror("Client send failed");
+                WS_STATS_ADD(worker->err_count, 1);
+                rm_client(worker, client->socket);
+                return;
+            }
+        }
+        if (ws_h2_done(conn)) {
+            ws_log(WS_LOG_DEBUG, "Client{%s} HTTP/2 connection done\n", ctoa(client));
+            rm_client(worker, client->socket);
+            return;
+        }
+
+        /* Read more while there is room for it */
+        char *in = ws_h2_in(conn, &room);
+        if (room == 0 || !(client->ready & WS_EV_READ)) break;
+        ssize_t n = client_read(client, in, room);
+        if (n == -1) {
+            if (would_block()) {
+                client->ready &= ~WS_EV_READ;
+                break;
+            } else if (errno == EINTR) {
+                continue;
+            }
+            perror("Client read failed");
+            WS_STATS_ADD(worker->err_count, 1);
+            rm_client(worker, client->socket);
+            return;
+        } else if (n == 0) {
+            ws_log(WS_LOG_DEBUG, "Client{%s} closed remotly\n", ctoa(client));
+            rm_client(worker, client->socket);
+            return;
+        }
+        ws_h2_read(conn, n);
+        WS_STATS_ADD(worker->stats.bytes_received, n);
+    }
+    if (!alive) return;
+
+    /* Only select needs to be told; a full read buffer waits on writes,
+       and a throttled connection on its timer */
+    ws_h2_out(conn, &pending);
+    ws_h2_in(conn, &room);
+    if (client->send_queue != WS_SEND_THROTTLED) {
+        ws_event_mod(&worker->loop, client->socket, 
+            (room > 0 ? WS_EV_READ : 0) | (pending > 0 ? WS_EV_WRITE : 0), client);
+    }
+
+    /* Idle once every stream is answered, else sending at the -R rate */
+    int kind = conn->active > 0 || pending > 0 ? WS_DEADLINE_SEND : WS_DEADLINE_IDLE;
+    if (client->deadline != kind) {
+        set_deadline(client, kind);
+    }
+}
+
+/* Moves a client through the FSM until it would block, closes it when done */
+void serve_client(client_node_p curr) {
+    ws_worker_p worker = curr->worker;
+    long turn = 0; /* Bytes sent this turn */
+
+    /* A client waiting for its turn to send is served then */
+    if (curr->send_queue != WS_SEND_NONE) return;
+    while (alive) {
+        if (curr->stage == WS_STAGE_READING) {
+            /* HTTP/2 by prior knowledge starts with the preface instead of
+               a request, and waits for the rest of it while it matches */
+            int req_len = 0;
+            int preface = curr->data_size < WS_H2_PREFACE_LEN ? curr->data_size : WS_H2_PREFACE_LEN;
+            if (use_h2 && curr->requests == 0 && curr->data_size > 0
+                    && memcmp(curr->data, WS_H2_PREFACE, preface) == 0) {
+                if (preface == WS_H2_PREFACE_LEN) {
+                    if (!h2_switch(curr, ws_h2_new(NULL, 0))) {
+                        perror("Couldn't allocate HTTP/2 connection");
+                        WS_STATS_ADD(worker->err_count, 1);
+                        rm_client(worker, curr->socket);
+                        return;
+                    }
+                    continue;
+                }
+            } else if (curr->data_size > 0) {
+                /* A pipelined request may already be waiting in the buffer */
+                req_len = ws_http_parse(curr->req, curr->data, curr->data_size);
+                if (req_len == 0 && curr->data_size == curr->data_cap && grow_data(curr)) {
+                    continue;
+                }
+                if (req_len == -1 || (req_len == 0 && curr->data_size == curr->data_cap)) {
+                    /* Malformed or too big, answered with 500 and closed */
+                    curr->req->state = WS_HTTP_ERROR;
+                    req_len = curr->data_size;
+                }
+            }
+            if (req_len > 0) {
+                curr->req_len = req_len;
+                if (h2_upgrade(curr)) continue;
+                if (!start_response(curr, req_len)) {
+                    perror("Couldn't allocate response buffer");
+                    WS_STATS_ADD(worker->err_count, 1);
+                    rm_client(worker, curr->socket);
+                    return;
+                }
+                continue;
+            }
+            if (!(curr->ready & WS_EV_READ)) return;
+            if (curr->data == NULL && !borrow_request(curr)) {
+                perror("Couldn't allocate request buffer");
+                WS_STATS_ADD(worker->err_count, 1);
+                rm_client(worker, curr->socket);
+                return;
+            }
+
+            /* Read in a chunk of data */
+            ws_log(WS_LOG_TRACE, "Client{%s} started read\n",ctoa(curr));
+            int diff = client_read(curr, 
+                curr->data+curr->data_size, curr->data_cap-curr->data_size);
+            if (diff == -1) {
+                if (would_block()) {
+                    /* Drained, wait for the next edge without holding a
+                       buffer if nothing came */
+                    curr->ready &= ~WS_EV_READ;
+                    release_request(curr);
+                    return;
+                } else if (errno == EINTR) {
+                    continue;
+                }
+                perror("Client read failed");
+                WS_STATS_ADD(worker->err_count, 1);
+                rm_client(worker, curr->socket);
+                return;
+            }
+            curr->data_size += diff;
+            ws_log(WS_LOG_TRACE, "Client{%s} read %d bytes\n",ctoa(curr),diff);
+            WS_STATS_ADD(worker->stats.bytes_received, diff);
+
+            /* Check if empty read (socket closed) */
+            if (diff == 0) {
+                ws_log(WS_LOG_DEBUG, "Client{%s} closed remotly\n",ctoa(curr));
+                rm_client(worker, curr->socket);
+                return;
+            }
+            if (curr->req_start < 0) {
+                curr->req_start = monotonic_us();
+            }
+
+            /* The whole request must arrive in time from its first byte */
+            if (curr->deadline != WS_DEADLINE_HEADER) {
+                set_deadline(curr, WS_DEADLINE_HEADER);
+            }
+        } else if (curr->stage == WS_STAGE_HANDSHAKE) {
+            int want = 0;
+            if (ws_tls_handshake(curr->tls, &want) == -1) {
+                if (would_block()) {
+                    /* Only select needs to be told which way it waits */
+                    curr->ready &= ~want;
+                    ws_event_mod(&worker->loop, curr->socket, want, curr);
+                    return;
+                } else if (errno == EINTR) {
+                    continue;
+                }
+                ws_log(WS_LOG_DEBUG, "Client{%s} TLS handshake failed: %s\n", ctoa(curr),
+                    errno == EPROTO ? ws_tls_error() : strerror(errno));
+                WS_STATS_ADD(worker->stats.handshake_errors, 1);
+                rm_client(worker, curr->socket);
+                return;
+            }
+
+            /* The kernel may have taken over encrypting, then the socket
+               is written to as on a plain connection */
+            curr->ktls = ws_tls_ktls(curr->tls);
+            WS_STATS_ADD(worker->stats.handshakes, 1);
+            if (ws_tls_resumed(curr->tls)) {
+                WS_STATS_ADD(worker->stats.resumed, 1);
+            }
+            if (curr->ktls) {
+                WS_STATS_ADD(worker->stats.ktls, 1);
+            }
+            ws_log(WS_LOG_DEBUG, "Client{%s} negotiated %s %s%s%s\n", ctoa(curr),
+                ws_tls_version(curr->tls), ws_tls_cipher(curr->tls),
+                ws_tls_resumed(curr->tls) ? " resumed" : "", curr->ktls ? " kTLS" : "");
+            curr->stage = WS_STAGE_READING;
+            ws_event_mod(&worker->loop, curr->socket, WS_EV_READ, curr);
+            set_deadline(curr, WS_DEADLINE_IDLE);
+            if (use_h2 && ws_tls_h2(curr->tls) && !h2_switch(curr, ws_h2_new(NULL, 0))) {
+                perror("Couldn't allocate HTTP/2 connection");
+                WS_STATS_ADD(worker->err_count, 1);
+                rm_client(worker, curr->socket);
+                return;
+            }
+        } else if (curr->stage == WS_STAGE_H2) {
+            h2_serve(curr);
+            return;
+        } else if (curr->stage == WS_STAGE_SENDING) {
+            if (!(curr->ready & WS_EV_WRITE)) return;
+
+            /* Send as much of the remaining response as its turn allows */
+            size_t allowed = send_allowance(curr, turn);
+            if (allowed == 0) return;
+            ssize_t bytes_sent = send_response(curr, allowed);
+            if (bytes_sent == -1) {
+                if (would_block()) {
+                    curr->ready &= ~WS_EV_WRITE;
+                    return;
+                } else if (errno == EINTR) {
+                    continue;
+                }
+                perror("Client send failed");
+                WS_STATS_ADD(worker->err_count, 1);
+                rm_client(worker, curr->socket);
+                return;
+            }
+            ws_log(WS_LOG_TRACE, "Client{%s} sent %zd bytes\n",ctoa(curr),bytes_sent);
+            if (bytes_sent > 0) {
+                curr->sent += bytes_sent;
+                turn += bytes_sent;
+                spend_tokens(curr, bytes_sent);
+                WS_STATS_ADD(worker->stats.bytes_sent, bytes_sent);
+                if (!curr->sent_first) {
+                    ws_stats_record(&worker->stats.ttfb, monotonic_us() - curr->req_start);
+                    curr->sent_first = TRUE;
+                }
+            }
+
+            /* If everything was sent, close connection or wait for the next request */
+            if (bytes_sent == 0) {
+                long us = monotonic_us() - curr->req_start;
+                ws_stats_record(&worker->stats.total, us);
+                log_access(curr, us);
+                if (!curr->keep_alive) {
+                    rm_client(worker, curr->socket);
+                    return;
+                }
+                finish_response(curr);
+            }
+        } else {
+            return;
+        }
+    }
+}
+
+/* Stops watching the listener, so new connections wait in its backlog
+   until accept_clients() is called again */
+void pause_accepting(ws_worker_p worker) {
+    if (worker->accept_paused) return;
+    ws_event_del(&worker->loop, worker->server.socket);
+    if (worker->tls_server.socket != -1) {
+        ws_event_del(&worker->loop, worker->tls_server.socket);
+    }
+    worker->accept_paused = TRUE;
+    worker->accept_pending = FALSE;
+    ws_log(WS_LOG_DEBUG, "Worker %d paused accepting with %ld clients open\n",
+        worker->index, WS_STATS_GET(worker->stats.open));
+}
+
+/* Accepts waiting connections from one listener until there are none,
+   the connection limit is reached, or this iteration's budget is spent.
+   Returns FALSE if accepting paused */
+int accept_from(ws_worker_p worker, client_node_p listener, int resumed) {
+    int tls = listener == &worker->tls_server;
+    for (int n = 0; alive; n++) {
+        if (worker->conn_limit > 0 && WS_STATS_GET(worker->stats.open) >= worker->conn_limit) {
+            pause_accepting(worker);
+            return FALSE;
+        }
+        if (n == WS_ACCEPT_BUDGET) {
+            /* Serve the clients already ready before taking more */
+            worker->accept_pending = TRUE;
+            return TRUE;
+        }
+
+        /* Clients are drained until EAGAIN, so they must not block */
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+#ifdef WS_HAVE_ACCEPT4
+        int new_socket = accept4(listener->socket, (struct sockaddr *)&addr, &addr_len,
+            SOCK_NONBLOCK);
+#else
+        int new_socket = accept(listener->socket, (struct sockaddr *)&addr, &addr_len);
+        if (new_socket != -1) {
+            fcntl(new_socket, F_SETFL, fcntl(new_socket, F_GETFL) | O_NONBLOCK);
+        }
+#endif
+        if (new_socket == -1) {
+            if (would_block()) {
+                return TRUE;
+            } else if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            } else if (errno == EMFILE || errno == ENFILE) {
+                /* Leave them queued until a client closes, or for a while */
+                ws_log(WS_LOG_WARN, "Worker %d out of fds with %ld clients open: %s\n",
+                    worker->index, WS_STATS_GET(worker->stats.open), strerror(errno));
+                pause_accepting(worker);
+                ws_timer_set(&worker->timers, &worker->server.timer, 
+                    worker->now_ms + WS_ACCEPT_RETRY_MS);
+                return FALSE;
+            }
+            perror("Client failed to connect");
+            WS_STATS_ADD(worker->err_count, 1);
+            return TRUE;
+        }
+        if (resumed) {
+            WS_STATS_ADD(worker->stats.deferred, 1);
+        }
+
+        /* Kept-alive responses must not wait on Nagle, MSG_MORE corks instead */
+        int opt = 1;
+        setsockopt(new_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        add_client(worker, new_socket, (struct sockaddr *)&addr, addr_len, tls);
+    }
+    return TRUE;
+}
+
+/* Watches a listener for connections, returns 0 or -1 */
+int watch_listener(ws_worker_p worker, client_node_p listener) {
+    if (ws_event_add(&worker->loop, listener->socket, WS_EV_READ, listener) == -1) {
+        perror("Couldn't watch server socket");
+        return -1;
+    }
+    return 0;
+}
+
+/* Accepts waiting connections from every listener, until there are none,
+   the connection limit is reached, or this iteration's budget is spent */
+void accept_clients(ws_worker_p worker) {
+    /* Connections queued while paused are deferred ones */
+    int resumed = worker->accept_paused;
+    if (resumed) {
+        if (worker->conn_limit > 0 && WS_STATS_GET(worker->stats.open) >= worker->conn_limit) {
+            worker->accept_pending = FALSE;
+            return;
+        }
+        ws_timer_cancel(&worker->timers, &worker->server.timer);
+        watch_listener(worker, &worker->server);
+        if (worker->tls_server.socket != -1) {
+            watch_listener(worker, &worker->tls_server);
+        }
+        worker->accept_paused = FALSE;
+        ws_log(WS_LOG_DEBUG, "Worker %d resumed accepting\n", worker->index);
+    }
+    worker->accept_pending = FALSE;
+
+    if (accept_from(worker, &worker->server, resumed) && worker->tls_server.socket != -1) {
+        accept_from(worker, &worker->tls_server, resumed);
+    }
+}
+
+/* Loads an error page into the cache before any client needs it */
+void prebuild_page(ws_worker_p worker, char *tail, int status) {
+    char url[WS_MAX_DATA];
+    struct stat info;
+    build_url(url, tail);
+    int page = open_page(&worker->paths, url, &info);
+    if (page == -1) {
+        perror("Couldn't prebuild error page");
+        return;
+    }
+    ws_cache_entry_p entry = cache_page(worker, url, status, WS_CODING_IDENTITY, page, &info);
+    if (entry) {
+        ws_cache_release(entry);
+    }
+    close(page);
+}
+
+/* Adds a page's responses to a pack: the page for a status, and for 200s
+   every coding worth sending it in. Returns 0 or -1 */
+int pack_page(ws_pack_writer_p writer, ws_path_cache_p paths, char *url, int status) {
+    struct stat info;
+    int page = open_page(paths, url, &info);
+    if (page == -1) return -1;
+    ws_cache_entry_p plain = read_page(url, status, WS_CODING_IDENTITY, page, &info);
+    close(page);
+    if (plain == NULL || ws_pack_writer_add(writer, plain) == -1) {
+        if (plain) ws_cache_release(plain);
+        return -1;
+    }
+    if (status != WS_STATUS_OK || !is_compressible(url)) return 0;
+
+    /* Same choices as encode_page(), a precompressed sibling first */
+    for (int c = WS_CODING_IDENTITY+1; c < WS_CODINGS; c++) {
+        char path[PATH_MAX];
+        ws_cache_entry_p entry;
+        snprintf(path, sizeof(path), "%s%s", url, ws_compress_ext(c));
+        page = open_page(paths, path, &info);
+        if (page != -1) {
+            entry = read_page(url, WS_STATUS_OK, c, page, &info);
+            close(page);
+            if (entry == NULL) return -1;
+            entry->mtime = plain->mtime;
+            entry->file_size = plain->file_size;
+        } else {
+            entry = compress_entry(url, plain, c);
+        }
+        if (entry != NULL && ws_pack_writer_add(writer, entry) == -1) {
+            ws_cache_release(entry);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Adds every page in a folder under root to a pack, url holds the folder's
+   path and has room for PATH_MAX. Returns 0 or -1 */
+int pack_folder(ws_pack_writer_p writer, ws_path_cache_p paths, char *url) {
+    DIR *dir = opendir(url);
+    if (dir == NULL) return -1;
+    size_t len = strlen(url);
+    int result = 0;
+    struct dirent *ent;
+    while (result == 0 && (ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.' && (ent->d_name[1] == '\0' 
+                || (ent->d_name[1] == '.' && ent->d_name[2] == '\0'))) {
+            continue;
+        }
+        if (len + 1 + strlen(ent->d_name) >= PATH_MAX) continue;
+        sprintf(url+len, "/%s", ent->d_name);
+
+        struct stat info;
+        char *path = url+strlen(root);
+        if (lstat(url, &info) == -1) {
+            result = -1;
+        } else if (S_ISDIR(info.st_mode)) {
+            result = pack_folder(writer, paths, url);
+        } else if (S_ISREG(info.st_mode) && has_extension(path)
+                && strlen(path) < WS_MAX_DATA - 5) {
+            /* Only pages a request can reach: ones without an extension
+               are asked for as .html, and symlinks are never followed */
+            result = pack_page(writer, paths, path, WS_STATUS_OK);
+        }
+    }
+    url[len] = '\0';
+    closedir(dir);
+    return result;
+}
+
+/* Builds a site pack of every page under root and the error pages, into
+   a malloc'd blob. Returns 0 or -1 */
+int build_pack(char **blob, size_t *size) {
+    ws_pack_writer_t writer;
+    ws_path_cache_t paths;
+    char url[PATH_MAX];
+    ws_pack_writer_init(&writer);
+    ws_path_init(&paths, root_fd, FALSE);
+
+    /* Paths are keyed as requests find them, after root */
+    snprintf(url, sizeof(url), "%s", root);
+    int result = pack_folder(&writer, &paths, url);
+    if (result == 0) {
+        build_url(url, WS_URL_404);
+        if (pack_page(&writer, &paths, url, WS_STATUS_MISSING) == -1) {
+            perror("Couldn't pack error page");
+        }
+        build_url(url, WS_URL_500);
+        if (pack_page(&writer, &paths, url, WS_STATUS_INVALID) == -1) {
+            perror("Couldn't pack error page");
+        }
+    }
+    if (result == 0) {
+        result = ws_pack_writer_finish(&writer, blob, size);
+    }
+    int err = errno;
+    ws_pack_writer_free(&writer);
+    errno = err;
+    return result;
+}
+
+/* Parses a byte count with an optional K, M or G suffix, returns -1 if invalid */
+long parse_size(char *str) {
+    char *end;
+    long size = strtol(str, &end, 10);
+    if (end == str || size < 0) return -1;
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+    }
+    return *end == '\0' ? size : -1;
+}
+
+/* Sets the max-age of an extension (* for every other file).
+   Returns FALSE if it can't be added */
+int add_max_age(char *ext, int len, long seconds) {
+    if (*ext == '.') {
+        ext++;
+        len--;
+    }
+    if (seconds < 0 || len < 1) return FALSE;
+    if (len == 1 && *ext == '*') {
+        default_max_age = seconds;
+        return TRUE;
+    }
+    if (len >= (int)sizeof(max_ages[0].ext)) return FALSE;
+
+    /* A repeated extension replaces its earlier max-age */
+    for (int i = 0; i < max_age_count; i++) {
+        if (strncasecmp(max_ages[i].ext, ext, len) == 0 && max_ages[i].ext[len] == '\0') {
+            max_ages[i].seconds = seconds;
+            return TRUE;
+        }
+    }
+    if (max_age_count == WS_MAX_AGES) return FALSE;
+    memcpy(max_ages[max_age_count].ext, ext, len);
+    max_ages[max_age_count].ext[len] = '\0';
+    max_ages[max_age_count].seconds = seconds;
+    max_age_count++;
+    return TRUE;
+}
+
+/* Raises the open file limit as far as allowed, for many clients */
+void raise_fd_limit() {
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &lim) == -1) {
+            perror("Couldn't raise open file limit");
+        }
+    }
+}
+
+/* Opens a worker's listener on address, returns 0 or -1 on error.
+   Every worker binds the same port, and the kernel balances between them */
+int open_listener(client_node_p listener, struct sockaddr *address, socklen_t addr_len) {
+    listener->socket = socket(address->sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener->socket == -1) {
+        perror("Server socket creation error");
+        return -1;
+    }
+    // Do something to enable simultaneous v6?
+
+    /* Allow quick restarts while old connections sit in TIME_WAIT */
+    int opt = 1;
+    setsockopt(listener->socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+#ifdef SO_REUSEPORT
+    if (worker_count > 1 
+            && setsockopt(listener->socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        perror("Couldn't share server port");
+        return -1;
+    }
+#endif
+
+    /* Bind the server to the port */
+    if (bind(listener->socket, address, addr_len) < 0) {
+        perror("Server binding error");
+        return -1;
+    }
+
+    /* Enable listening mode on the server */
+    if (listen(listener->socket, backlog) < 0) {
+        perror("Server listening error");
+        return -1;
+    }
+    return 0;
+}
+
+/* Sets up a worker's event loop, cache and shutdown pipe, returns 0 or -1 */
+int worker_init(ws_worker_p worker) {
+    int fds[2];
+
+    /* Setup event backend and initial client set, falling back from
+       io_uring on kernels that can't run it */
+    int err = ws_event_init(&worker->loop, backend);
+    if (err == -1 && backend == WS_BACKEND_URING) {
+        ws_log(WS_LOG_WARN, "io_uring unavailable (%s), using %s\n", strerror(errno),
+            ws_event_name(WS_BACKEND_DEFAULT));
+        backend = WS_BACKEND_DEFAULT;
+        err = ws_event_init(&worker->loop, backend);
+    }
+    if (err == -1) {
+        perror("Event backend creation error");
+        return -1;
+    }
+    watch_listener(worker, &worker->server);
+    worker->server.stage = WS_STAGE_READING;
+    worker->server.worker = worker;
+    if (worker->tls_server.socket != -1) {
+        watch_listener(worker, &worker->tls_server);
+        worker->tls_server.stage = WS_STAGE_READING;
+        worker->tls_server.worker = worker;
+    }
+
+    /* Signals wake the loop through a pipe, whichever thread they hit */
+    if (pipe(fds) == -1) {
+        perror("Worker pipe creation error");
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    worker->waker.socket = fds[0];
+    worker->wake_fd = fds[1];
+    ws_event_add(&worker->loop, worker->waker.socket, WS_EV_READ, &worker->waker);
+
+    /* The disk pool posts what it did for the worker's clients to a queue
+       the loop watches */
+    if (disk_threads > 0) {
+        if (ws_disk_queue_init(&worker->disk) == -1) {
+            perror("Disk queue creation error");
+            return -1;
+        }
+        ws_event_add(&worker->loop, worker->disk.fd, WS_EV_READ, &worker->disk_events);
+    }
+
+    /* Setup cache, watch for changes and prebuild the error pages.
+       Each worker gets an equal share of the memory cap */
+    if (ws_cache_init(&worker->cache, root, cache_max / worker_count) == -1) {
+        perror("Cache creation error");
+        return -1;
+    }
+    if (pack.base != NULL) {
+        /* Packed pages never change, and the error pages are in it */
+        worker->pack_entries = ws_pack_entries(&pack);
+        if (worker->pack_entries == NULL) {
+            perror("Site pack entries creation error");
+            return -1;
+        }
+        ws_path_init(&worker->paths, root_fd, FALSE);
+    } else {
+        worker->notifier.socket = ws_cache_watch(&worker->cache);
+        if (worker->notifier.socket != -1) {
+            ws_event_add(&worker->loop, worker->notifier.socket, WS_EV_READ, &worker->notifier);
+        }
+
+        /* Folders are only kept open while changes to them are seen */
+        ws_path_init(&worker->paths, root_fd, worker->notifier.socket != -1);
+        prebuild_page(worker, WS_URL_404, WS_STATUS_MISSING);
+        prebuild_page(worker, WS_URL_500, WS_STATUS_INVALID);
+    }
+    ws_buf_init(&worker->buffers);
+    ws_timer_init(&worker->timers, monotonic_ms());
+    ws_timer_setup(&worker->server.timer, &worker->server);
+
+    /* Backend connections are opened as requests need them */
+    if (ws_fcgi_backend_count > 0) {
+        worker->fcgi_conn_count = ws_fcgi_backend_count * WS_FCGI_CONNS;
+        worker->fcgi_conns = calloc(worker->fcgi_conn_count, sizeof(ws_fcgi_conn_t));
+        if (worker->fcgi_conns == NULL) {
+            perror("FastCGI connections creation error");
+            return -1;
+        }
+        for (int c = 0; c < worker->fcgi_conn_count; c++) {
+            worker->fcgi_conns[c].fd = -1;
+        }
+    }
+
+    /* Each worker gets an equal share of the connection limit, at least one */
+    worker->conn_limit = max_connections > 0 ? (max_connections + worker_count - 1) / worker_count : 0;
+    ws_log(WS_LOG_TRACE, "Worker %d listening with socket %d\n",worker->index,worker->server.socket);
+    return 0;
+}
+
+/* Runs a worker's event loop until the server is killed */
+void *worker_run(void *arg) {
+    ws_worker_p worker = arg;
+    ws_event_t events[WS_MAX_EVENTS];
+
+#ifdef WS_HAVE_AFFINITY
+    /* Keep the worker, and the cache lines of its clients, on one CPU */
+    if (pin_workers) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker->index % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            fprintf(stderr,"Couldn't pin worker %d\n",worker->index);
+        }
+    }
+#endif
+
+    worker->now_ms = monotonic_ms();
+    while (alive) {
+        /* Close clients past their deadline, give clients queued to send
+           their turn and take connections left waiting, then wait for ready
+           sockets until the next deadline (or the first worker's next stats
+           dump), or just poll if more wait */
+        ws_timer_advance(&worker->timers, worker->now_ms, client_timeout);
+        run_sends(worker);
+        if (worker->accept_pending) {
+            accept_clients(worker);
+        }
+        if (worker->fcgi_pending) {
+            /* Backend connections paused for a client that caught up */
+            worker->fcgi_pending = FALSE;
+            for (int c = 0; c < worker->fcgi_conn_count && alive; c++) {
+                if (worker->fcgi_conns[c].fd != -1 && !worker->fcgi_conns[c].paused) {
+                    fcgi_serve(worker, &worker->fcgi_conns[c]);
+                }
+            }
+        }
+        int timeout = worker->accept_pending || worker->fcgi_pending || sends_pending(worker) ? 0 
+            : (int)ws_timer_next(&worker->timers, worker->now_ms);
+        int dump = worker->index == 0 ? dump_stats(worker) : -1;
+        if (dump != -1 && (timeout == -1 || dump < timeout)) {
+            timeout = dump;
+        }
+        int i = ws_event_wait(&worker->loop, events, WS_MAX_EVENTS, timeout);
+        worker->now_ms = monotonic_ms();
+
+        /* Check for timeout or interrupt */
+        if (i <= 0) {
+            if (i == -1 && errno != EINTR) {
+                perror("Event wait failed");
+            }
+            continue;
+        }
+
+        /* Serve only the clients that are ready */
+        for (int e = 0; e < i && alive; e++) {
+            client_node_p curr = events[e].data;
+            ws_fcgi_conn_p conn;
+            if (curr == &worker->server || curr == &worker->tls_server) {
+                accept_clients(worker);
+            } else if (curr == &worker->notifier) {
+                ws_cache_notify(&worker->cache);
+                ws_path_flush(&worker->paths);
+            } else if (curr == &worker->waker) {
+                continue; /* Only sent once alive is cleared */
+            } else if (curr == &worker->disk_events) {
+                disk_complete(worker);
+            } else if ((conn = fcgi_conn_of(worker, events[e].data)) != NULL) {
+                if (conn->fd != -1) {
+                    conn->ready |= events[e].events;
+                    fcgi_serve(worker, conn);
+                }
+            } else {
+                curr->ready |= events[e].events;
+                serve_client(curr);
+            }
+        }
+    }
+
+    /* Close every client, the cache is kept for the stats */
+    client_table_p clients = &worker->clients;
+    for (int fd = 0; fd < clients->size && clients->count > 0; fd++) {
+        if (clients->nodes[fd]) {
+            rm_client(worker, fd);
+        }
+    }
+    rm_client(worker, worker->server.socket);
+    if (worker->tls_server.socket != -1) {
+        rm_client(worker, worker->tls_server.socket);
+    }
+    table_destroy(clients);
+    for (int c = 0; c < worker->fcgi_conn_count; c++) {
+        if (worker->fcgi_conns[c].fd != -1) {
+            ws_event_del(&worker->loop, worker->fcgi_conns[c].fd);
+            ws_fcgi_close(&worker->fcgi_conns[c]);
+        }
+    }
+    return NULL;
+}
+
+/* Frees whatever a worker still holds, once the disk pool has stopped */
+void worker_destroy(ws_worker_p worker) {
+    if (worker->notifier.socket != -1) {
+        ws_event_del(&worker->loop, worker->notifier.socket);
+    }
+    if (worker->disk.fd != -1) {
+        /* Its clients are gone, so whatever was done for them is dropped */
+        disk_complete(worker);
+        ws_event_del(&worker->loop, worker->disk.fd);
+        ws_disk_queue_destroy(&worker->disk);
+    }
+    ws_cache_destroy(&worker->cache);
+    ws_path_destroy(&worker->paths);
+    free(worker->pack_entries);
+    free(worker->fcgi_conns);
+    ws_buf_destroy(&worker->buffers);
+    ws_event_del(&worker->loop, worker->waker.socket);
+    close(worker->waker.socket);
+    close(worker->wake_fd);
+    ws_event_close(&worker->loop);
+}
+
+/* Running logic */
+int main(int argc, char *argv[]) {
+    /* Setup main vars */
+    struct sockaddr *address;
+    struct sockaddr_in address4;
+    struct sockaddr_in6 address6;
+    socklen_t addr_len;
+    char *addr_str = NULL;
+    char addr_ver = AF_INET;
+    int port = WS_DEFAULT_PORT;
+    int tls_port = WS_DEFAULT_PORT;
+#ifdef WS_HAVE_SENDFILE
+    use_sendfile = TRUE;
+#endif
+
+    /* Parse args */
+    if (argc < 2) {
+        printf(USAGE_STR,argv[0]);
+        return 0;
+    } else {
+        /* Get root */
+        root = argv[1];
+
+        /* Check for help */
+        if (strcmp(root,"--help") == 0) {
+            printf(HELP_STR,argv[0]);
+            return 0;
+        }
+
+        for (int i=2; i < argc; i++) {
+            if (strcmp(argv[i],"-a") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                addr_str = argv[i+1];
+                i++;
+            } else if (strcmp(argv[i],"-p") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                port = atoi(argv[i+1]);
+                i++;
+            } else if (strcmp(argv[i],"-e") == 0) {
+                /* Ensure value was given and is a known backend */
+                if (argc == i+1 || (backend = ws_event_backend(argv[i+1])) == -1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-m") == 0) {
+                /* Ensure value was given and is a size */
+                if (argc == i+1 || (cache_max = parse_size(argv[i+1])) < 0) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-k") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1 || (max_requests = atoi(argv[i+1])) < 1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-t") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1 || (idle_timeout = atol(argv[i+1]) * 1000L) < 1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-r") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1 || (header_timeout = atol(argv[i+1]) * 1000L) < 1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-R") == 0) {
+                /* Ensure value was given and is a size */
+                if (argc == i+1 || (min_rate = parse_size(argv[i+1])) < 0) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-w") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1 || (worker_count = atoi(argv[i+1])) < 1
+                        || worker_count > WS_MAX_WORKERS) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-c") == 0) {
+                /* Ensure value was given as ext=seconds */
+                char *seconds;
+                if (argc == i+1 || (seconds = strchr(argv[i+1],'=')) == NULL
+                        || !add_max_age(argv[i+1], seconds-argv[i+1], atol(seconds+1))) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-z") == 0) {
+                /* Ensure value was given and is a size */
+                if (argc == i+1 || (min_compress = parse_size(argv[i+1])) < 0) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-s") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1 || (stats_interval = atol(argv[i+1]) * 1000L) < 1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-M") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                mime_file = argv[i+1];
+                i++;
+            } else if (strcmp(argv[i],"-B") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1 || (backlog = atoi(argv[i+1])) < 1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-C") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1 || (max_connections = atol(argv[i+1])) < 0) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-q") == 0) {
+                /* Ensure value was given and is a size */
+                if (argc == i+1 || (send_budget = parse_size(argv[i+1])) < 0) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-L") == 0) {
+                /* Ensure value was given and is a size */
+                if (argc == i+1 || (rate_limit = parse_size(argv[i+1])) < 0) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-j") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1 || (disk_threads = atoi(argv[i+1])) < 0 
+                        || disk_threads > WS_DISK_MAX_THREADS) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-A") == 0) {
+                pin_workers = TRUE;
+            } else if (strcmp(argv[i],"-b") == 0) {
+                use_sendfile = FALSE;
+            } else if (strcmp(argv[i],"-l") == 0) {
+                /* Ensure value was given and is a known level */
+                if (argc == i+1 || (ws_log_level = ws_log_parse_level(argv[i+1])) == -1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-v") == 0) {
+                ws_log_level = WS_LOG_TRACE;
+            } else if (strcmp(argv[i],"--pack") == 0) {
+                use_pack = TRUE;
+            } else if (strcmp(argv[i],"--pack-file") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                use_pack = TRUE;
+                pack_file = argv[i+1];
+                i++;
+            } else if (strcmp(argv[i],"-f") == 0 || strcmp(argv[i],"-F") == 0) {
+                /* Ensure value was given as prefix=socket or prefix=program */
+                if (argc == i+1 || ws_fcgi_add_backend(argv[i+1], argv[i][1] == 'F') == -1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                i++;
+            } else if (strcmp(argv[i],"-P") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                tls_port = atoi(argv[i+1]);
+                i++;
+            } else if (strcmp(argv[i],"--cert") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                tls_cert = argv[i+1];
+                i++;
+            } else if (strcmp(argv[i],"--key") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                tls_key = argv[i+1];
+                i++;
+            } else if (strcmp(argv[i],"--no-ktls") == 0) {
+                use_ktls = FALSE;
+            } else if (strcmp(argv[i],"--no-h2") == 0) {
+                use_h2 = FALSE;
+            } else if (strcmp(argv[i],"--pack-build") == 0) {
+                /* Ensure value was given */
+                if (argc == i+1) {
+                    printf(USAGE_STR,argv[0]);
+                    return 0;
+                }
+                pack_out = argv[i+1];
+                i++;
+            } else {
+                printf(USAGE_STR,argv[0]);
+                return 0;
+            }
+        }
+    }
+
+    /* Check for root folder access */
+    DIR *rootdir = opendir(root);
+    if (rootdir == NULL) {
+        perror("Couldn't access root folder");
+        return errno;
+    } else {
+        closedir(rootdir);
+    }
+
+    /* Every page is opened beneath it from now on */
+    root_fd = ws_path_root(root);
+    if (root_fd == -1) {
+        perror("Couldn't open root folder");
+        return errno;
+    }
+
+    /* Load the content types, the file's replacing built-in ones */
+    if (ws_mime_init() == -1) {
+        perror("Couldn't set up content types");
+        return errno;
+    }
+    if (mime_file != NULL && ws_mime_load(mime_file) == -1) {
+        perror("Couldn't load content types");
+        return errno;
+    }
+
+    /* Building a site pack ahead of time is all the packer does */
+    if (pack_out != NULL) {
+        char *blob;
+        size_t size;
+        ws_log_start(STDOUT_FILENO);
+        int err = build_pack(&blob, &size) == -1 ? errno : 0;
+        ws_log_stop();
+        if (err != 0) {
+            errno = err;
+            perror("Couldn't build site pack");
+            return errno;
+        }
+        if (ws_pack_save(pack_out, blob, size) == -1) {
+            perror("Couldn't write site pack");
+            return errno;
+        }
+        ws_pack_load(&pack, blob, size);
+        printf("Packed %u pages in %u responses, %zu bytes, into %s\n",
+            pack.header->npaths, pack.header->nrecords, size, pack_out);
+        ws_pack_close(&pack);
+        return 0;
+    }
+
+    /* Load the certificate every worker's HTTPS clients are served with */
+    if (tls_cert != NULL && ws_tls_init(tls_cert, tls_key, use_ktls, use_h2) == -1) {
+        perror(ws_tls_supported() ? "Couldn't load TLS certificate" : "Couldn't set up TLS");
+        return errno;
+    }
+
+    /* Install intrupt handler, run by whichever worker gets the signal */
+    struct sigaction sig; /* For setting up intr handler */
+    sig.sa_handler = intr_handler;
+    sigfillset(&sig.sa_mask);
+    sig.sa_flags = 0;
+    if (sigaction(SIGINT, &sig, NULL)) {
+        perror("Couldn't set signal handler for SIGINT");
+        return errno;
+    }
+
+    /* Peers closing mid-send must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Allow as many clients as the system lets us */
+    raise_fd_limit();
+
+    /* Configure server address and port, accounting for IPv6 */
+    if (addr_str) {
+        if (inet_pton(AF_INET, addr_str, &(address4.sin_addr))) {
+            addr_ver = AF_INET;
+            address4.sin_family = AF_INET;
+            address4.sin_port = htons( port );
+            address = (struct sockaddr *)&address4;
+            addr_len = sizeof(address4);
+        } else if (inet_pton(AF_INET6, addr_str, &(address6.sin6_addr))) {
+            addr_ver = AF_INET6;
+            address6.sin6_family = AF_INET6;
+            address6.sin6_port = htons( port );
+            address = (struct sockaddr *)&address6;
+            addr_len = sizeof(address6);
+        } else {
+            fprintf(stderr,"Error binding TCP socket: Cannot assign requested address\n");
+            return 1;
+        }
+    } else {
+        addr_ver = AF_INET;
+        address4.sin_family = AF_INET;
+        address4.sin_addr.s_addr = INADDR_ANY;
+        address4.sin_port = htons( port );
+        address = (struct sockaddr *)(&address4);
+        addr_len = sizeof(address4);
+    }
+
+    /* The HTTPS listeners bind the same address on their own port */
+    struct sockaddr_storage tls_address;
+    socklen_t tls_addr_len = addr_len;
+    memcpy(&tls_address, address, addr_len);
+    if (addr_ver == AF_INET6) {
+        ((struct sockaddr_in6 *)&tls_address)->sin6_port = htons( tls_port );
+    } else {
+        ((struct sockaddr_in *)&tls_address)->sin_port = htons( tls_port );
+    }
+
+    /* Each worker gets its own listeners, the first one picks the ports */
+    workers = calloc(worker_count, sizeof(ws_worker_t));
+    if (workers == NULL) {
+        perror("Couldn't allocate workers");
+        return errno;
+    }
+    for (int w = 0; w < worker_count; w++) {
+        workers[w].index = w;
+        workers[w].notifier.socket = -1;
+        workers[w].waker.socket = -1;
+        workers[w].wake_fd = -1;
+        workers[w].disk.fd = -1;
+        workers[w].tls_server.socket = -1;
+        if (open_listener(&workers[w].server, address, addr_len) == -1) {
+            return errno;
+        }
+        if (tls_cert != NULL && open_listener(&workers[w].tls_server, 
+                (struct sockaddr *)&tls_address, tls_addr_len) == -1) {
+            return errno;
+        }
+        if (w == 0) {
+            /* Later listeners bind the ports that were actually assigned */
+            getsockname(workers[0].server.socket, address, &addr_len);
+            if (tls_cert != NULL) {
+                getsockname(workers[0].tls_server.socket, 
+                    (struct sockaddr *)&tls_address, &tls_addr_len);
+            }
+        }
+    }
+
+    /* Print and flush socket info */
+    if (addr_ver == AF_INET6) {
+        port = ntohs(((struct sockaddr_in6 *) address)->sin6_port);
+        tls_port = ntohs(((struct sockaddr_in6 *)&tls_address)->sin6_port);
+    } else {
+        port = ntohs(((struct sockaddr_in *) address)->sin_port);
+        tls_port = ntohs(((struct sockaddr_in *)&tls_address)->sin_port);
+    }
+    fprintf(stdout,"HTTP server is using TCP port %d\nHTTPS server is using TCP port %d\n", 
+        port, tls_cert != NULL ? tls_port : -1);
+    fflush(stdout);
+
+    /* Everything after goes through the log, written out by its own thread */
+    if (ws_log_start(STDOUT_FILENO) == -1) {
+        perror("Logger thread creation error");
+        return errno;
+    }
+
+    /* Load the site pack the workers share, mapping a prebuilt one if given */
+    if (use_pack) {
+        long start = monotonic_ms();
+        char *blob;
+        size_t size;
+        int err = pack_file != NULL ? ws_pack_open(&pack, pack_file)
+            : build_pack(&blob, &size) == -1 ? -1 : ws_pack_load(&pack, blob, size);
+        if (err == -1) {
+            perror("Couldn't load site pack");
+            return errno;
+        }
+        ws_log(WS_LOG_INFO, "Loaded site pack of %u pages in %u responses, %zu bytes, in %ldms\n",
+            pack.header->npaths, pack.header->nrecords, pack.size, monotonic_ms() - start);
+    }
+
+    /* Only pages off the disk need the pool, packs are already in memory */
+    if (pack.base != NULL) {
+        disk_threads = 0;
+    }
+
+    /* Setup every worker before any starts, so a failure leaves none running */
+    for (int w = 0; w < worker_count; w++) {
+        if (worker_init(&workers[w]) == -1) {
+            return errno;
+        }
+    }
+    ws_log(WS_LOG_TRACE, "Using %s event backend with %d workers\n",ws_event_name(backend),worker_count);
+
+    /* File work goes to the pool once the workers can take its results */
+    if (disk_threads > 0 && ws_disk_start(disk_threads, root_fd) == -1) {
+        perror("Disk thread creation error");
+        return errno;
+    }
+
+    /* Start the FastCGI programs last, so nothing failing after leaves them running */
+    if (ws_fcgi_spawn() == -1) {
+        perror("Couldn't start FastCGI backend");
+        ws_fcgi_stop();
+        return errno;
+    }
+
+    /* The main thread runs the first worker itself */
+    for (int w = 1; w < worker_count; w++) {
+        int err = pthread_create(&workers[w].thread, NULL, worker_run, &workers[w]);
+        if (err != 0) {
+            errno = err;
+            perror("Worker thread creation error");
+            return errno;
+        }
+    }
+    worker_run(&workers[0]);
+
+    /* The others were woken by the signal handler too */
+    for (int w = 1; w < worker_count; w++) {
+        pthread_join(workers[w].thread, NULL);
+    }
+    ws_disk_stop();
+
+    /* Report stats summed over every worker, and free them */
+    long clients = 0, requests = 0, errors = 0;
+    long hits = 0, misses = 0, evictions = 0, invalidations = 0;
+    size_t entries = 0, bytes = 0;
+    for (int w = 0; w < worker_count; w++) {
+        ws_worker_p worker = &workers[w];
+        ws_log(WS_LOG_TRACE, "Worker %d clients=%ld requests=%ld errors=%ld\n",
+            w, worker->client_count, worker->req_count, worker->err_count);
+        clients += worker->client_count;
+        requests += worker->req_count;
+        errors += worker->err_count;
+        hits += worker->cache.hits;
+        misses += worker->cache.misses;
+        evictions += worker->cache.evictions;
+        invalidations += worker->cache.invalidations;
+        entries += worker->cache.count;
+        bytes += worker->cache.bytes;
+        worker_destroy(worker);
+    }
+    free(workers);
+    ws_fcgi_stop();
+    ws_tls_free();
+    ws_pack_close(&pack);
+    ws_mime_free();
+    ws_log_stop();
+    printf("Workers=%d clients=%ld requests=%ld errors=%ld\n",
+        worker_count, clients, requests, errors);
+    printf("Cache hits=%ld misses=%ld evictions=%ld invalidations=%ld entries=%zu bytes=%zu\n",
+        hits, misses, evictions, invalidations, entries, bytes);
+
+    printf("Server exiting cleanly.\n");
+    return 0;
+}
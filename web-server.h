@@ -1,126 +1,496 @@
-/* Jenna Whilden (jpwolf101@gmail.com) 11-22-2021 */
-/* Simple HTML web server header */
-
-/*
-Program Archetecture:
- -  Parse and validate root folder addr, and optional port, ip and verbose flags
-    - Default ip is any avaiable, Default port is auto-assigned
- -  Open initial listening socket for that IP
- -  Print and flush port information to stdout
- -  Use select to wait for a socket to open
- -  Iterate through each ready socket, consulting action FSM to determine work
-
-Socket Action FSM:
- -  If socket is the listener: accept new client and create client with stage 0
- -  If socket is a client, find matching struct:
-     -  If current stage is READING, start/continue saving data to struct
-         -  If recv'd entire client data, parse the read data, and set stage
-            to SENDING
-         -  If partial recv, keep stage at READING
-     -  If current stage is SENDING, follow below sending logic
-
-Parsing Overview:
- - All inputs must start with "GET /", or else be invalid (500)
- - Next piece is a string "/<!!>"
- - "/<!!>" must be an implemented page, or else be invalid (404)
- - "/<!!>" will be followed by a newline or a space, and all else
-   is ignored (Treat everything as HTTP/1.1)
- - "/" is iterpreted as "/index.html"
- - If no extension is provided, assumed to be .html
-
-Sending Logic Overview:
- - Only sockets that immediatly need to be written to are added to select list
- 1.   If data_offset == data_size, read in more data from the pipe to data buf
-       a.   Set data_size to bytes read and set data_offset to 0
- 2.   Attempt to send entire data buf, starting at data_offset
- 3.   Increase data_offset by bytes written
- 4.   If EOF reached, write is complete, close socket
-
-*/
-
-#ifndef WEB_SERVER_H
-#define WEB_SERVER_H
-
-#include<stdio.h> /* File* struct */
-
-/* Define contant URLs */
-#define WS_URL_INDEX       "/index.html"
-#define WS_URL_404         "/err404.html"
-#define WS_URL_500         "/err500.html"
-
-/* Define header string */
-/* HTTP status (200 OK, 500 OK, 404 Not Found, etc), 
-   type (text/html, application/json), content length */
-#define WS_STR_CONTENT_HEADER "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\n\r\n"
-
-/* Define parsing statuses */
-#define WS_STATUS_OK        200
-#define WS_STATUS_MISSING   404
-#define WS_STATUS_INVALID   500
-
-/* Define content type strings */
-#define WS_TYPE_UNKNOWN    "application/octet-stream"
-#define WS_TYPE_HTML       "text/html"
-#define WS_TYPE_CSS        "text/css"
-#define WS_TYPE_JS         "text/javascript"
-#define WS_TYPE_GIF        "image/gif"
-#define WS_TYPE_JPEG       "image/jpeg"
-#define WS_TYPE_PNG        "image/png"
-#define WS_TYPE_SVG        "image/svg+xml"
-
-/* Define known file extentions */
-#define WS_EXT_HTML        ".html"
-#define WS_EXT_HTM         ".htm"
-#define WS_EXT_CSS         ".css"
-#define WS_EXT_JS          ".js"
-#define WS_EXT_GIF         ".gif"
-#define WS_EXT_JPG         ".jpg"
-#define WS_EXT_JPEG        ".jpeg"
-#define WS_EXT_PNG         ".png"
-#define WS_EXT_SVG         ".svg"
-#define WS_EXT_XML         ".xml"
-
-/* Define client stages */
-#define WS_STAGE_READING   0
-#define WS_STAGE_SENDING   1
-
-/* Define ctoa levels */
-#define WS_CTOA_SIMPLE     0
-#define WS_CTOA_SOCKET     1
-#define WS_CTOA_DATA       2
-#define WS_CTOA_FULL       3
-
-/* Define misc */
-#define WS_MAX_DATA        (1<<12) /* 4KB for storing in client buffer */
-#define WS_MAX_HEADER      (256) /* Max possible len of header */
-#define WS_PREFIX_LEN      4
-#define WS_DEFAULT_PORT    0
-#define USAGE_STR          "Usage: %s root [-v] [-a ip-address] [-p port]\n"
-#define HELP_STR           "Simple HTML web server\n" USAGE_STR "\n" \
-                           "root\t\tThe path to the root directory of the web server\n" \
-                           "-v\t\tEnables verbose output, printing additional client details\n" \
-                           "-a <ip-address>\tAn IPv4 or IPv6 address to be used for the web server [defaults to any open]\n" \
-                           "-p <port>\tThe port number for accessing the web server [defaults to a random unused port]\n"
-
-#ifndef TRUE
-#define TRUE 1
-#endif
-#ifndef FALSE
-#define FALSE (!TRUE)
-#endif
-
-/* Node in linked list of clients */
-struct client_node_t {
-    long id;                    /* Unique identifier */
-    int socket;                 /* FD of the socket */
-    FILE *pipe;                 /* FILE* for pipe to external process */
-    int stage;                  /* What the client needs to do */
-    int offset;                 /* Current offset in data */
-    int data_size;              /* Size of data (to write) */
-    char data[WS_MAX_DATA];     /* Data recv'd from socket / to be written */
-    struct client_node_t *next; /* Next client node in LL */
-};
-typedef struct client_node_t client_node_t;
-typedef client_node_t* client_node_p;
-
-#endif
\ No newline at end of file
+/* Jenna Whilden (jpwolf101@gmail.com) 11-22-2021 */
+/* Simple HTML web server header */
+
+/*
+Program Archetecture:
+ -  Parse and validate root folder addr, and optional port, ip and verbose flags
+    - Default ip is any avaiable, Default port is auto-assigned
+ -  Start one worker per requested core, each with its own listening socket
+    bound to the same port with SO_REUSEPORT, so the kernel spreads new
+    connections across them and they never share a lock
+ -  With a certificate, each worker also gets a listener on the HTTPS port
+    (see ws-tls.h), whose clients are served the same way once their TLS
+    handshake is done
+ -  Print and flush port information to stdout
+ -  Each worker owns its event loop, client table, timer wheel and cache, and
+    clients stay on the worker that accepted them
+ -  Register the listener and every client once with the event backend
+    (epoll edge-triggered by default on Linux, select as a fallback)
+ -  Wait for ready sockets and run only those through the action FSM, each
+    until it would block, so an iteration costs O(ready) not O(clients)
+ -  File work that can block on a cold disk (opening, stating and reading
+    pages the cache doesn't have, and reading large files ahead of sending)
+    runs on a small pool of -j threads shared by the workers (see
+    ws-disk.h), which post what they did back to the worker's loop
+ -  On SIGINT every worker is woken through its pipe, and the main thread
+    joins them and prints their stats summed up
+
+Socket Action FSM:
+ -  If socket is a listener: accept new client and create client with stage 0
+    (READING), or HANDSHAKE on the HTTPS listener
+ -  If socket is a FastCGI backend connection: write the requests queued on
+    it, then hand each record read to the client it is for, which is woken
+    when output arrives for it; a connection stops reading while a client's
+    unsent output is over WS_FCGI_STREAM_MAX, until that client catches up
+ -  If socket is a client, find matching struct:
+     -  If current stage is HANDSHAKE, continue the TLS handshake, and set
+        stage to READING once it is done; from then on reads are decrypted,
+        and writes are encrypted by the kernel (kTLS) or in user space
+     -  If current stage is READING, start/continue saving data to struct
+         -  If data holds an entire request, parse it, and set stage
+            to SENDING
+         -  If partial recv, keep stage at READING
+         -  If its page has to be read from disk first, set stage to DISK
+            until the pool has loaded it, then to SENDING
+     -  If current stage is SENDING, follow below sending logic
+         -  If the file bytes it would send next haven't been read ahead,
+            set stage to DISK until they have, then back to SENDING
+         -  Once sent, close the socket, or if the connection is kept alive,
+            drop the request from data and go back to READING, where any
+            pipelined request already in data is parsed straight away
+     -  A connection whose first bytes are the HTTP/2 preface, whose first
+        request asks to upgrade to h2c, or which picked h2 through ALPN,
+        goes to stage H2 for good (see ws-h2.h): frames are read and
+        written there, and each stream gets a client node of its own that
+        is never in the table and never has a deadline of its own, answered
+        like any request and turned into HEADERS and DATA frames, which
+        the streams queue in turns
+ -  Every client has one deadline on its worker's timer wheel (see
+    ws-timer.h), replaced as it changes stage:
+     -  IDLE while waiting for a request to start (after connecting or a
+        kept-alive response), closed after -t seconds
+     -  HEADER from a request's first byte, closed if the rest hasn't
+        arrived -r seconds later, however slowly it trickles in
+     -  SEND while SENDING, checked every WS_SEND_WINDOW seconds and closed
+        if less than -R bytes a second were read since the last check
+     -  SEND too while waiting on DISK, for its page or mid-response, from
+        when the job is handed to the pool; a check that finds it still
+        waiting starts a new window, since the disk is holding it up
+ -  Sends are scheduled so long downloads can't hold up short ones (see
+    below): a bulk response sends at most -q bytes per loop turn, and a
+    client out of its -L tokens waits on its worker's wheel
+ -  New connections are accepted until EAGAIN, at most WS_ACCEPT_BUDGET at
+    a time so a burst can't starve the clients already ready; the rest are
+    accepted on the next iteration, after those clients are served
+ -  At the -C limit, or when out of fds, the listener is taken out of the
+    event set and connections wait in its backlog (-B) rather than being
+    refused; accepting resumes once a client closes (or after
+    WS_ACCEPT_RETRY_MS when out of fds)
+ -  A client only holds buffers (see ws-buf.h) while it needs them: data
+    and its parse state from the first byte of a request until it has been
+    answered and nothing pipelined is left, and out while SENDING; data
+    starts small and doubles up to WS_MAX_DATA when a request outgrows it
+
+Parsing Overview:
+ - Requests are parsed incrementally as data arrives (see ws-http.h), and
+   the parse resumes where it stopped, so each byte is only scanned once
+ - A request ends at its first newline if it has no HTTP version, or else at
+   the empty line after its headers; malformed requests, or ones that don't
+   fit in the buffer, are invalid (500)
+ - The method must be GET and the target must start with "/", or else be
+   invalid (500)
+ - The target must be an implemented page, or else be missing (404)
+ - Pages carry a strong ETag (inode, size and mtime) and Last-Modified, and
+   requests whose If-None-Match (or else If-Modified-Since) still matches
+   get a bodyless 304 instead
+ - Compressible pages are sent brotli or gzip encoded when Accept-Encoding
+   allows it, from a precompressed sibling or a cached compressed copy
+   (see ws-compress.h)
+ - A Range header (unless an If-Range no longer matches) gets a 206 with
+   just that range, or a multipart/byteranges body for several, or a 416
+   when none of them are in the page
+ - HTTP/1.1 connections are kept alive unless "Connection: close" is sent,
+   HTTP/1.0 ones only with "Connection: keep-alive"; all else is ignored
+ - "/__stats" is answered with the stats of every worker in the Prometheus
+   text format (see ws-stats.h), built fresh for each request
+ - "/" is iterpreted as "/index.html"
+ - If no extension is provided, assumed to be .html
+ - The Content-Type comes from the page's last extension (see ws-mime.h),
+   and is only looked up when its header is built, since cached pages
+   keep theirs
+ - With a site pack (see ws-pack.h), pages are looked up in it by the path
+   those two rules give, and anything it doesn't hold is missing (404)
+ - Targets under a FastCGI prefix (see ws-fcgi.h) skip all of that and go to
+   their backend, whose CGI header (Status, then its other lines) becomes
+   the response header; without a Content-Length the body is chunked for
+   HTTP/1.1, or ends the connection for HTTP/1.0
+
+Sending Logic Overview:
+ - Sockets are only watched for writing while they are in the SENDING stage
+ 1.   If out_offset < out_size, send the out buf (header) from out_offset
+       a.   With sendfile, MSG_MORE holds it back to share packets with the body
+ 2.   Else if the file isn't fully sent, send the rest of it:
+       a.   With sendfile, the kernel copies it to the socket from file_offset
+       b.   Without it, read the next chunk into the out buf and go to 1
+       c.   TLS connections encrypting in user space always do b, and
+            send up to a record's worth of the pieces at a time
+ 3.   Repeat until the socket would block
+ 4.   Dynamic responses send the backend's output as it arrives, in the same
+      gathered write as the header; while it has nothing new the socket is
+      left unwatched, and output arriving makes it writable again
+ 5.   If file_offset == file_size and all data sent, the response is done,
+      unless more parts of a multipart/byteranges response are left: then
+      the next part's header goes in the out buf, the cached or file offsets
+      are moved to its range, and it goes back to 1
+ 6.   A response is short while what it has sent and has left fits in
+      WS_SHORT_RESPONSE, and bulk after that. Short ones (and so every first
+      byte) send until the socket would block; a bulk one stops once it has
+      sent -q bytes in the turn and waits in its worker's bulk queue. An
+      HTTP/2 connection is sent as one bulk response
+ 7.   Each loop turn starts by giving the clients queued in the last one
+      their next turn, short ones first, before waiting on new events, so a
+      new request's first bytes only ever wait behind one turn of each
+      bulk response
+ 8.   With -L, each connection has a token bucket of that many bytes a
+      second (holding up to a second's worth), and one that runs out waits
+      on a timer of its own on the wheel until a tick's worth has come in
+ 9.   With the disk pool, file bytes are only sent once they have been read
+      ahead: a large file's first WS_DISK_WINDOW comes with its load, and
+      the next window is read once half of the last is sent, so a sender
+      only waits on disk if it outruns the pool
+
+*/
+
+#ifndef WEB_SERVER_H
+#define WEB_SERVER_H
+
+#include<stdio.h> /* File* struct */
+#include<sys/types.h> /* off_t */
+#include<pthread.h> /* Worker threads */
+#include<sys/socket.h> /* Client addresses */
+#include<sys/stat.h> /* File info of disk jobs */
+#include "ws-event.h" /* Event loop of each worker */
+#include "ws-cache.h" /* Response cache of each worker */
+#include "ws-http.h" /* Request being parsed by each client */
+#include "ws-compress.h" /* Content codings */
+#include "ws-stats.h" /* Stats of each worker */
+#include "ws-log.h" /* Levels of log messages */
+#include "ws-buf.h" /* Buffers borrowed by each client */
+#include "ws-timer.h" /* Deadlines of each client */
+#include "ws-pack.h" /* Site pack shared by the workers */
+#include "ws-fcgi.h" /* FastCGI backends of dynamic pages */
+#include "ws-tls.h" /* TLS of HTTPS clients */
+#include "ws-h2.h" /* HTTP/2 connections */
+#include "ws-path.h" /* Folders of each worker under root */
+#include "ws-disk.h" /* File work off the event loops */
+
+struct ws_worker_t; /* Worker owning a client, defined below */
+
+/* Define contant URLs */
+#define WS_URL_INDEX       "/index.html"
+#define WS_URL_404         "/err404.html"
+#define WS_URL_500         "/err500.html"
+#define WS_URL_STATS       "/__stats"
+
+/* Define header string */
+/* HTTP status (200 OK, 500 OK, 404 Not Found, etc), 
+   type (text/html, application/json), content length */
+#define WS_STR_CONTENT_HEADER "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\n"
+/* Validators and freshness of a page: ETag, Last-Modified, then max-age */
+#define WS_STR_VALIDATORS  "ETag: %s\r\nLast-Modified: %s\r\n"
+#define WS_STR_CACHE_CONTROL "Cache-Control: max-age=%ld\r\n"
+/* Status line of a bodyless reply to a conditional request */
+#define WS_STR_NOT_MODIFIED "HTTP/1.1 304 Not Modified\r\n"
+/* Range responses: type, length and range (or boundary) of a single range
+   or multipart response, each part's header, the closing boundary, and
+   the reply to unsatisfiable ranges */
+#define WS_STR_PARTIAL_HEADER "HTTP/1.1 206 Partial Content\r\nContent-Type: %s\r\nContent-Length: %lld\r\nContent-Range: bytes %lld-%lld/%lld\r\n"
+#define WS_STR_MULTIPART_HEADER "HTTP/1.1 206 Partial Content\r\nContent-Type: multipart/byteranges; boundary=%016lx\r\nContent-Length: %lld\r\n"
+#define WS_STR_PART_HEADER "\r\n--%016lx\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n"
+#define WS_STR_PART_END    "\r\n--%016lx--\r\n"
+#define WS_STR_NOT_SATISFIABLE "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%lld\r\nContent-Length: 0\r\n"
+#define WS_STR_ACCEPT_RANGES "Accept-Ranges: bytes\r\n"
+/* Coding of a compressed body, and the note that it depends on the request */
+#define WS_STR_CONTENT_ENCODING "Content-Encoding: %s\r\n"
+#define WS_STR_VARY        "Vary: Accept-Encoding\r\n"
+/* Responses built per request, like the stats */
+#define WS_STR_NO_STORE    "Cache-Control: no-store\r\n"
+/* Dynamic responses: the status line from a backend's Status header (or
+   200), the framing of a body of unknown length, each chunk's size and the
+   last chunk, and the reply when the backend fails before its header */
+#define WS_STR_STATUS_LINE "HTTP/1.1 %.*s\r\n"
+#define WS_STR_CHUNKED     "Transfer-Encoding: chunked\r\n"
+#define WS_STR_CHUNK_SIZE  "%zx\r\n"
+#define WS_STR_LAST_CHUNK  "0\r\n\r\n"
+#define WS_STR_BAD_GATEWAY "HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\n"
+/* Last header line, which ends the header */
+#define WS_STR_KEEP_ALIVE  "Connection: keep-alive\r\n\r\n"
+#define WS_STR_CLOSE       "Connection: close\r\n\r\n"
+/* Reply to a request upgrading to HTTP/2, its answer follows as stream 1 */
+#define WS_STR_SWITCHING   "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n"
+
+/* Define parsing statuses */
+#define WS_STATUS_OK        200
+#define WS_STATUS_PARTIAL    206
+#define WS_STATUS_NOT_MODIFIED 304
+#define WS_STATUS_NOT_SATISFIABLE 416
+#define WS_STATUS_MISSING   404
+#define WS_STATUS_INVALID   500
+#define WS_STATUS_BAD_GATEWAY 502
+
+/* Define content type strings, pages get theirs from ws-mime.h */
+#define WS_TYPE_STATS      "text/plain; version=0.0.4"
+
+/* Define client stages */
+#define WS_STAGE_READING   0
+#define WS_STAGE_SENDING   1
+#define WS_STAGE_CLOSED    2 /* Back in the pool, events already waited for are dropped */
+#define WS_STAGE_HANDSHAKE 3 /* TLS handshake before the first request */
+#define WS_STAGE_H2        4 /* HTTP/2 connection, its streams have nodes of their own */
+#define WS_STAGE_DISK      5 /* Waiting on the disk pool for its page or file bytes */
+
+/* Define kinds of disk jobs */
+#define WS_DISK_LOAD       0 /* Find and read a page the cache doesn't have */
+#define WS_DISK_READ       1 /* Read the next window of a file being sent */
+
+/* Define stages of a FastCGI response */
+#define WS_FCGI_STATE_NONE   0 /* Not a dynamic request */
+#define WS_FCGI_STATE_QUEUED 1 /* Waiting for a free backend connection */
+#define WS_FCGI_STATE_HEADER 2 /* Sent, reading the backend's CGI header */
+#define WS_FCGI_STATE_BODY   3 /* Header sent on, streaming the body */
+#define WS_FCGI_STATE_DONE   4 /* Backend finished, sending what is left */
+
+/* Define ctoa levels */
+#define WS_CTOA_SIMPLE     0
+#define WS_CTOA_SOCKET     1
+#define WS_CTOA_DATA       2
+#define WS_CTOA_FULL       3
+
+/* Define client deadlines */
+#define WS_DEADLINE_IDLE   0
+#define WS_DEADLINE_HEADER 1
+#define WS_DEADLINE_SEND   2
+
+/* Define send queues, waited in for a turn to send */
+#define WS_SEND_NONE       -1 /* Not waiting */
+#define WS_SEND_SHORT      0  /* Short responses, given their turn first */
+#define WS_SEND_BULK       1  /* Bulk responses and HTTP/2 connections */
+#define WS_SEND_TURN       2  /* Taken from the two, being given their turn */
+#define WS_SEND_QUEUES     3
+#define WS_SEND_THROTTLED  3  /* Out of tokens, waiting on its throttle timer */
+
+/* Define misc */
+#define WS_MAX_DATA        (1<<12) /* 4KB for storing in client buffer */
+#define WS_FIRST_DATA      (1<<10) /* Data buffer borrowed for a new request, doubled up to WS_MAX_DATA */
+#define WS_MAX_HEADER      (512) /* Max possible len of header */
+#define WS_POOL_SLAB       64 /* Client nodes allocated per slab */
+#define WS_DEFAULT_MAX_REQUESTS 100 /* Requests per kept-alive connection */
+#define WS_DEFAULT_IDLE_TIMEOUT 5 /* Seconds before idle clients close */
+#define WS_DEFAULT_HEADER_TIMEOUT 10 /* Seconds a request may take to arrive */
+#define WS_DEFAULT_MIN_RATE 256 /* Bytes per second a response must be read at */
+#define WS_SEND_WINDOW     10 /* Seconds over which the send rate is measured */
+#define WS_DEFAULT_BACKLOG 511 /* Connections the kernel queues for each listener */
+#define WS_ACCEPT_BUDGET   64 /* Connections accepted at once before serving others */
+#define WS_ACCEPT_RETRY_MS 100 /* Wait before accepting again after running out of fds */
+#define WS_DEFAULT_SEND_BUDGET (64L<<10) /* Bytes a bulk response sends per loop turn */
+#define WS_SHORT_RESPONSE  (256L<<10) /* Responses up to this never wait for a turn */
+#define WS_DEFAULT_DISK_THREADS 2 /* Threads doing file work off the loops */
+#define WS_DEFAULT_PORT    0
+#define WS_MAX_WORKERS     256
+#define WS_MAX_AGES        32 /* Extensions with their own max-age */
+#define WS_DEFAULT_MIN_COMPRESS 256 /* Smaller pages are sent uncompressed */
+#define USAGE_STR          "Usage: %s root [-v] [-l level] [-a ip-address] [-p port] [-e epoll|select|io_uring] [-b] [-m cache-bytes] [-k max-requests] [-t idle-seconds] [-r request-seconds] [-R min-bytes-per-second] [-w workers] [-B backlog] [-C max-connections] [-q send-budget-bytes] [-L bytes-per-second] [-j disk-threads] [-A] [-c ext=seconds]... [-M mime-types-file] [-z min-compress-bytes] [-s stats-seconds] [--pack | --pack-file file | --pack-build file] [-f prefix=socket]... [-F prefix=program]... [-P https-port] [--cert file] [--key file] [--no-ktls] [--no-h2]\n"
+#define HELP_STR           "Simple HTML web server\n" USAGE_STR "\n" \
+                           "root\t\tThe path to the root directory of the web server\n" \
+                           "-v\t\tEnables verbose output, printing additional client details (same as -l trace)\n" \
+                           "-l <level>\tLog level: error, warn, info (one access record per request), debug (connections), or trace [defaults to info]\n" \
+                           "-a <ip-address>\tAn IPv4 or IPv6 address to be used for the web server [defaults to any open]\n" \
+                           "-p <port>\tThe port number for accessing the web server [defaults to a random unused port]\n" \
+                           "-e <backend>\tThe event backend, epoll, select or io_uring [defaults to epoll on Linux]\n" \
+                           "-b\t\tBuffers file bodies through user space instead of using sendfile\n" \
+                           "-m <bytes>\tMemory cap of the response cache, with an optional K, M or G suffix, 0 disables it [defaults to 64M]\n" \
+                           "-k <count>\tMax requests served on one kept-alive connection [defaults to 100]\n" \
+                           "-t <seconds>\tTime a connection may sit idle before it is closed [defaults to 5]\n" \
+                           "-r <seconds>\tTime a request may take to arrive once it starts [defaults to 10]\n" \
+                           "-R <bytes>\tSlowest a response may be read, per second over 10s, 0 for no limit [defaults to 256]\n" \
+                           "-w <count>\tNumber of worker event loops, each on its own thread and listener [defaults to 1]\n" \
+                           "-B <count>\tConnections the kernel queues for each worker's listener [defaults to 511]\n" \
+                           "-C <count>\tOpen connections at which accepting pauses, split between the workers, 0 for no limit [defaults to 0]\n" \
+                           "-q <bytes>\tMost a response over 256K sends per loop turn before others get theirs, with an optional K, M or G suffix, 0 for no limit [defaults to 64K]\n" \
+                           "-L <bytes>\tLimits each connection to that many bytes a second, with an optional K, M or G suffix [defaults to no limit]\n" \
+                           "-j <count>\tThreads opening and reading files off the event loops, 0 to do it on them [defaults to 2]\n" \
+                           "-A\t\tPins each worker to its own CPU\n" \
+                           "-c <ext>=<sec>\tCache-Control max-age for files with an extension, * for all others, may be repeated [defaults to none sent]\n" \
+                           "-M <file>\tAdds the types of a mime.types file (a type then its extensions on each line) to the built-in ones\n" \
+                           "-z <bytes>\tSmallest page compressed for clients that accept gzip or brotli [defaults to 256]\n" \
+                           "-s <seconds>\tDumps the stats served at /__stats to stdout this often [defaults to never]\n" \
+                           "--pack\t\tReads every page under root into a site pack at startup, and serves only from it\n" \
+                           "--pack-file <file>\tServes only from a site pack built by --pack-build\n" \
+                           "--pack-build <file>\tWrites a site pack of root (with the -c and -z options given) to a file and exits\n" \
+                           "-f <prefix>=<socket>\tAnswers GET requests under a path prefix from the FastCGI backend on a Unix socket, may be repeated\n" \
+                           "-F <prefix>=<program>\tSame, from a FastCGI program started with the server (2 processes sharing one socket)\n" \
+                           "-P <port>\tThe port number for HTTPS, served when --cert is given [defaults to a random unused port]\n" \
+                           "--cert <file>\tPEM certificate chain of the HTTPS server, with its key unless --key is given\n" \
+                           "--key <file>\tPEM private key of the certificate\n" \
+                           "--no-ktls\tEncrypts HTTPS responses in user space instead of handing the keys to the kernel\n" \
+                           "--no-h2\t\tServes only HTTP/1, turning off HTTP/2 by prior knowledge, h2c upgrades and ALPN\n"
+
+#ifdef LINUX
+#define WS_HAVE_SENDFILE
+#define WS_HAVE_AFFINITY
+#define WS_HAVE_ACCEPT4
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+#if WS_MAX_DATA > WS_BUF_MAX
+#error "Client buffers must fit the largest buffer pool class"
+#endif
+
+/* Cache-Control max-age of the files with one extension */
+struct ws_max_age_t {
+    char ext[16];               /* Extension without the dot */
+    long seconds;               /* max-age sent for it */
+};
+typedef struct ws_max_age_t ws_max_age_t;
+
+/* A connected client, pooled and indexed by socket */
+struct client_node_t {
+    long id;                    /* Unique identifier */
+    struct ws_worker_t *worker; /* Worker serving the client */
+    int socket;                 /* FD of the socket */
+    struct sockaddr_storage addr; /* Address it connected from */
+    int file;                   /* FD of the file being sent, or -1 */
+    off_t file_offset;          /* Offset of the next file byte to send */
+    off_t file_size;            /* Offset the file bytes to send end at */
+    struct ws_cache_entry_t *entry; /* Cached response being sent, or NULL */
+    size_t entry_offset;        /* Offset of the next cached byte to send */
+    size_t entry_end;           /* Offset the cached bytes to send end at */
+    int stage;                  /* What the client needs to do */
+    int status;                 /* Status of the response being sent */
+    long req_start;             /* Time in us the request began arriving, -1 before */
+    int sent_first;             /* TRUE once the response's first byte is sent */
+    long sent;                  /* Bytes of the response sent so far */
+    int ready;                  /* WS_EV_* flags known ready, until EAGAIN */
+    int keep_alive;             /* TRUE if the connection outlives the response */
+    int requests;               /* Requests parsed on this connection */
+    int req_len;                /* Bytes of data taken by the current request */
+    ws_http_request_p req;      /* Parse state of the current request, borrowed with data */
+    ws_http_range_t *ranges;    /* Parts of a multipart response, borrowed, or NULL */
+    int range_count;            /* Number of parts, 0 if not multipart */
+    int range_index;            /* Next part to send, range_count for the end */
+    unsigned long boundary;     /* Separator of the parts */
+    const char *range_type;     /* Content type of the parts */
+    off_t range_total;          /* Size of the whole page */
+    int data_size;              /* Size of data (recv'd) */
+    int data_cap;               /* Size of the data buffer, 0 if none is borrowed */
+    char *data;                 /* Data recv'd from socket, borrowed while a request is in */
+    int out_offset;             /* Current offset in out */
+    int out_size;               /* Size of out (to write) */
+    char *out;                  /* Header / file data to be written, borrowed while sending */
+    int deadline;               /* WS_DEADLINE_* its timer is for, -1 for none */
+    long send_mark;             /* Bytes sent when the send rate was last checked */
+    ws_timer_t timer;           /* Fires at the deadline */
+    int send_queue;             /* WS_SEND_* it waits in for a turn to send */
+    struct client_node_t *send_prev; /* Neighbours in that queue */
+    struct client_node_t *send_next;
+    long tokens;                /* Bytes the -L rate allows it now, below 0 when in debt */
+    long tokens_ms;             /* Time its tokens were last topped up */
+    ws_timer_t throttle;        /* Fires once a throttled client has tokens again */
+    struct disk_job_t *disk;    /* Disk job in flight for it, or its finished load while answered */
+    off_t disk_start;           /* File bytes known to be read ahead, from here */
+    off_t disk_end;             /* to here */
+    int fcgi_state;             /* WS_FCGI_STATE_* of a dynamic response */
+    int fcgi_backend;           /* Backend answering it, -1 for none */
+    ws_fcgi_conn_p fcgi;        /* Connection carrying it while HEADER or BODY, or NULL */
+    int fcgi_id;                /* Its request id there */
+    int chunked;                /* TRUE if its body is sent in chunks */
+    char *stream;               /* Backend output waiting to be sent, malloc'd, or NULL */
+    size_t stream_offset;       /* Offset of the next byte to send */
+    size_t stream_len;          /* Bytes in stream */
+    size_t stream_cap;          /* Room in stream */
+    struct client_node_t *fcgi_next; /* Next client queued for the same backend */
+    struct ssl_st *tls;         /* TLS connection of an HTTPS client, or NULL */
+    int ktls;                   /* TRUE if the kernel encrypts its writes */
+    ws_h2_conn_p h2;            /* HTTP/2 connection of a client in stage H2, or NULL */
+    struct client_node_t *h2_parent; /* Connection a stream node answers on, or NULL */
+    ws_h2_stream_p h2_stream;   /* Stream it answers */
+    struct client_node_t *next; /* Next free node in the pool */
+};
+typedef struct client_node_t client_node_t;
+typedef client_node_t* client_node_p;
+
+/* File work done for a client on the disk pool */
+struct disk_job_t {
+    ws_disk_job_t job;          /* Pool's part, first */
+    client_node_p client;       /* Client it is for, NULL once it is gone */
+    int kind;                   /* WS_DISK_* */
+    char path[WS_MAX_DATA];     /* Page loaded */
+    int status;                 /* Status it is answered with */
+    int codings;                /* Bit per content coding to look for, from the best accepted */
+    int missing;                /* Bit per coding whose file (the page itself for identity) wasn't found */
+    ws_cache_p cache;           /* Cache the entries are for, only its limits are read */
+    ws_cache_entry_p entries[WS_CODINGS+1]; /* Responses read, for the cache */
+    int entry_count;            /* Number of them */
+    char file_path[WS_MAX_DATA+8]; /* Path of file, a page or its sibling */
+    int file;                   /* File too large for the cache kept open, or -1 */
+    struct stat info;           /* Its stat */
+    off_t offset;               /* Offset of the window read ahead */
+    off_t len;                  /* Its length, then the bytes read */
+};
+typedef struct disk_job_t disk_job_t;
+typedef disk_job_t* disk_job_p;
+
+/* Block of client nodes allocated at once for the pool */
+struct client_slab_t {
+    struct client_slab_t *next;         /* Next slab in the pool */
+    client_node_t nodes[WS_POOL_SLAB];  /* Nodes handed out by the pool */
+};
+typedef struct client_slab_t client_slab_t;
+typedef client_slab_t* client_slab_p;
+
+/* Table of clients indexed by socket, with a free list of pooled nodes */
+struct client_table_t {
+    client_node_p *nodes;       /* Client at each socket, or NULL */
+    int size;                   /* Number of slots in nodes */
+    int count;                  /* Number of clients in the table */
+    client_node_p free;         /* Free list of unused nodes */
+    client_slab_p slabs;        /* Every slab, for cleanup */
+};
+typedef struct client_table_t client_table_t;
+typedef client_table_t* client_table_p;
+
+/* An event loop with everything its clients need, one per thread */
+struct ws_worker_t {
+    int index;                  /* Position in the workers array */
+    pthread_t thread;           /* Thread running the loop */
+    ws_event_loop_t loop;       /* Event backend waiting on the sockets */
+    client_node_t server;       /* Client node of the listener */
+    client_node_t tls_server;   /* Client node of the HTTPS listener, socket -1 without one */
+    client_node_t notifier;     /* Event data of the cache's change notifier */
+    client_node_t waker;        /* Read end of the shutdown pipe */
+    client_node_t disk_events;  /* Event data of the disk pool's completion queue */
+    ws_disk_queue_t disk;       /* Jobs the disk pool has done for its clients */
+    int wake_fd;                /* Write end of the shutdown pipe */
+    client_table_t clients;     /* Connected clients, indexed by socket */
+    ws_cache_t cache;           /* Assembled responses of recently used pages */
+    ws_path_cache_t paths;      /* Folders under root kept open */
+    ws_cache_entry_p pack_entries; /* The site pack's responses, or NULL without one */
+    ws_buf_pool_t buffers;      /* Buffers lent to clients with data in flight */
+    ws_timer_wheel_t timers;    /* Deadlines of the clients */
+    ws_fcgi_conn_p fcgi_conns;  /* WS_FCGI_CONNS connections to each backend, or NULL */
+    int fcgi_conn_count;        /* Number of them */
+    int fcgi_pending;           /* TRUE if a paused backend connection may resume */
+    client_node_p fcgi_queue[WS_FCGI_MAX_BACKENDS]; /* Clients waiting for each backend */
+    client_node_p fcgi_queue_tail[WS_FCGI_MAX_BACKENDS]; /* Last of them */
+    long now_ms;                /* Time of the current event loop iteration */
+    long conn_limit;            /* Open clients at which accepting pauses, 0 for none */
+    int accept_pending;         /* TRUE if connections may be queued, accepted next iteration */
+    int accept_paused;          /* TRUE while the listener is unwatched, at the limit or out of fds */
+    client_node_p send_head[WS_SEND_QUEUES]; /* Clients waiting for a turn to send, by queue */
+    client_node_p send_tail[WS_SEND_QUEUES]; /* Last of them */
+    long stats_due;             /* Time in ms of the next stats dump, 0 before the first */
+    ws_stats_t stats;           /* Counters and latencies, only written by this worker */
+    long client_count;          /* Total number of clients */
+    long req_count;             /* Total number of requests */
+    long err_count;             /* Total number of errors */
+};
+typedef struct ws_worker_t ws_worker_t;
+typedef ws_worker_t* ws_worker_p;
+
+#endif
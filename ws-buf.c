@@ -0,0 +1,68 @@
+/* Simple HTML web server buffer pool */
+#include <stdlib.h>         /* Memory management */
+#include "ws-buf.h"         /* Buffer pool consts and structs */
+#include "ws-stats.h"       /* Stat updates */
+
+/* Returns the class a request for size bytes is given */
+static int class_of(size_t size) {
+    int index = 0;
+    while (index < WS_BUF_CLASSES-1 && ws_buf_class_size(index) < size) index++;
+    return index;
+}
+
+/* Sets up an empty pool */
+void ws_buf_init(ws_buf_pool_p pool) {
+    for (int i = 0; i < WS_BUF_CLASSES; i++) {
+        pool->classes[i].free = NULL;
+        pool->classes[i].free_count = 0;
+        pool->classes[i].in_use = 0;
+    }
+}
+
+/* Frees every buffer on the free lists */
+void ws_buf_destroy(ws_buf_pool_p pool) {
+    for (int i = 0; i < WS_BUF_CLASSES; i++) {
+        ws_buf_class_t *class = &pool->classes[i];
+        while (class->free) {
+            struct ws_buf_free_t *next = class->free->next;
+            free(class->free);
+            class->free = next;
+        }
+        WS_STATS_ADD(class->free_count, -class->free_count);
+    }
+}
+
+/* Returns the size of the class a request for size bytes is given */
+size_t ws_buf_fit(size_t size) {
+    return ws_buf_class_size(class_of(size));
+}
+
+/* Borrows a buffer of at least size bytes (at most WS_BUF_MAX), or
+   returns NULL if none could be allocated */
+void *ws_buf_get(ws_buf_pool_p pool, size_t size) {
+    ws_buf_class_t *class = &pool->classes[class_of(size)];
+    struct ws_buf_free_t *buf = class->free;
+    if (buf != NULL) {
+        class->free = buf->next;
+        WS_STATS_ADD(class->free_count, -1);
+    } else if ((buf = malloc(ws_buf_class_size(class - pool->classes))) == NULL) {
+        return NULL;
+    }
+    WS_STATS_ADD(class->in_use, 1);
+    return buf;
+}
+
+/* Returns a buffer borrowed for size bytes, NULL is ignored */
+void ws_buf_put(ws_buf_pool_p pool, void *buf, size_t size) {
+    if (buf == NULL) return;
+    ws_buf_class_t *class = &pool->classes[class_of(size)];
+    WS_STATS_ADD(class->in_use, -1);
+    if (class->free_count >= WS_BUF_KEEP) {
+        free(buf);
+        return;
+    }
+    struct ws_buf_free_t *node = buf;
+    node->next = class->free;
+    class->free = node;
+    WS_STATS_ADD(class->free_count, 1);
+}
@@ -0,0 +1,68 @@
+/* Simple HTML web server buffer pool header */
+
+/*
+Buffer Pool Overview:
+ -  Clients only hold buffers while a request or response is in flight, and
+    borrow them from their worker's pool, so an idle connection is just its
+    node
+ -  Buffers come in power of two size classes, from WS_BUF_MIN up to
+    WS_BUF_MAX, and a request is given the smallest class that fits it
+ -  Returned buffers are kept on a free list per class for the next client,
+    up to WS_BUF_KEEP of them, and freed beyond that, so the pool shrinks
+    back after a burst
+ -  Each pool belongs to one worker and is only used by its thread, so no
+    locks are taken; its counters are stats, readable from any thread
+*/
+
+#ifndef WS_BUF_H
+#define WS_BUF_H
+
+#include <stddef.h>         /* size_t */
+
+/* Define size classes */
+#define WS_BUF_MIN_BITS     8
+#define WS_BUF_MIN          (1<<WS_BUF_MIN_BITS) /* Smallest class, 256B */
+#define WS_BUF_CLASSES      5  /* 256B, 512B, 1KB, 2KB, 4KB */
+#define WS_BUF_MAX          (WS_BUF_MIN<<(WS_BUF_CLASSES-1)) /* Largest class */
+#define WS_BUF_KEEP         256 /* Free buffers kept per class */
+
+/* A free buffer, linked through its own first bytes */
+struct ws_buf_free_t {
+    struct ws_buf_free_t *next;
+};
+
+/* Buffers of one size */
+struct ws_buf_class_t {
+    struct ws_buf_free_t *free;     /* Buffers ready to hand out */
+    long free_count;                /* Buffers on the free list, a stat */
+    long in_use;                    /* Buffers handed out, a stat */
+};
+typedef struct ws_buf_class_t ws_buf_class_t;
+
+/* A worker's buffers */
+struct ws_buf_pool_t {
+    ws_buf_class_t classes[WS_BUF_CLASSES];
+};
+typedef struct ws_buf_pool_t ws_buf_pool_t;
+typedef ws_buf_pool_t* ws_buf_pool_p;
+
+/* Returns the size of a class */
+#define ws_buf_class_size(index) ((size_t)WS_BUF_MIN << (index))
+
+/* Sets up an empty pool */
+void ws_buf_init(ws_buf_pool_p pool);
+
+/* Frees every buffer on the free lists */
+void ws_buf_destroy(ws_buf_pool_p pool);
+
+/* Returns the size of the class a request for size bytes is given */
+size_t ws_buf_fit(size_t size);
+
+/* Borrows a buffer of at least size bytes (at most WS_BUF_MAX), or
+   returns NULL if none could be allocated */
+void *ws_buf_get(ws_buf_pool_p pool, size_t size);
+
+/* Returns a buffer borrowed for size bytes, NULL is ignored */
+void ws_buf_put(ws_buf_pool_p pool, void *buf, size_t size);
+
+#endif
@@ -0,0 +1,357 @@
+/* Simple HTML web server response cache */
+#include <stdio.h>          /* High level read and write */
+#include <stdlib.h>         /* Memory management */
+#include <unistd.h>         /* Lower level read and write */
+#include <string.h>         /* String parsing */
+#include <errno.h>          /* Error handling */
+#include <dirent.h>         /* Walking folders */
+#include <fcntl.h>          /* fstatat */
+#include <sys/stat.h>       /* File validation */
+#include "ws-cache.h"       /* Cache consts and structs */
+#ifdef WS_HAVE_INOTIFY
+#include <sys/inotify.h>    /* File change notifications */
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+/* Hashes a key with FNV-1a */
+static unsigned long hash_key(const char *key) {
+    unsigned long hash = 14695981039346656037UL;
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+/* Returns the memory charged for an entry */
+static size_t entry_bytes(ws_cache_entry_p entry) {
+    return sizeof(ws_cache_entry_t) + strlen(entry->key) + 1 + entry->size;
+}
+
+/* Sets up an empty cache for files under root, capped at max_bytes */
+int ws_cache_init(ws_cache_p cache, const char *root, size_t max_bytes) {
+    memset(cache, 0, sizeof(ws_cache_t));
+    cache->root = root;
+    cache->max_bytes = max_bytes;
+    cache->notify_fd = -1;
+    cache->nbuckets = WS_CACHE_MIN_BUCKETS;
+    cache->buckets = calloc(cache->nbuckets, sizeof(ws_cache_entry_p));
+    return cache->buckets == NULL ? -1 : 0;
+}
+
+/* Returns TRUE if a body of size bytes may be cached */
+int ws_cache_fits(ws_cache_p cache, size_t size) {
+    return size <= WS_CACHE_MAX_ENTRY && size < cache->max_bytes;
+}
+
+/* Removes an entry from the LRU list */
+static void lru_unlink(ws_cache_p cache, ws_cache_entry_p entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else if (cache->head == entry) cache->head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else if (cache->tail == entry) cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+/* Adds an entry to the front of the LRU list */
+static void lru_push(ws_cache_p cache, ws_cache_entry_p entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head) cache->head->prev = entry;
+    cache->head = entry;
+    if (cache->tail == NULL) cache->tail = entry;
+}
+
+/* Unlists an entry and drops the cache's reference */
+static void remove_entry(ws_cache_p cache, ws_cache_entry_p entry) {
+    ws_cache_entry_p *link = &cache->buckets[entry->hash % cache->nbuckets];
+    while (*link != entry) link = &(*link)->hnext;
+    *link = entry->hnext;
+    entry->hnext = NULL;
+    if (!entry->pinned) lru_unlink(cache, entry);
+    cache->count--;
+    cache->bytes -= entry_bytes(entry);
+    ws_cache_release(entry);
+}
+
+/* Doubles the hash table once it gets crowded */
+static void grow_buckets(ws_cache_p cache) {
+    size_t nbuckets = cache->nbuckets * 2;
+    ws_cache_entry_p *buckets = calloc(nbuckets, sizeof(ws_cache_entry_p));
+    if (buckets == NULL) return;
+    for (size_t i = 0; i < cache->nbuckets; i++) {
+        ws_cache_entry_p entry = cache->buckets[i];
+        while (entry) {
+            ws_cache_entry_p next = entry->hnext;
+            entry->hnext = buckets[entry->hash % nbuckets];
+            buckets[entry->hash % nbuckets] = entry;
+            entry = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->nbuckets = nbuckets;
+}
+
+/* Checks an entry against its file, for when changes aren't watched */
+static int entry_valid(ws_cache_p cache, ws_cache_entry_p entry) {
+    char path[4096];
+    struct stat info;
+    snprintf(path, sizeof(path), "%s%s", cache->root, entry->key);
+    return stat(path, &info) == 0 && info.st_mtime == entry->mtime
+        && info.st_size == entry->file_size;
+}
+
+/* Looks up a response, returns a referenced entry or NULL on a miss */
+ws_cache_entry_p ws_cache_get(ws_cache_p cache, const char *key, int status,
+        int coding) {
+    if (cache->max_bytes == 0) return NULL;
+
+    unsigned long hash = hash_key(key);
+    ws_cache_entry_p entry = cache->buckets[hash % cache->nbuckets];
+    while (entry && (entry->hash != hash || entry->status != status
+            || entry->coding != coding || strcmp(entry->key, key) != 0)) {
+        entry = entry->hnext;
+    }
+
+    /* Without notifications, every hit has to be checked */
+    if (entry && cache->notify_fd == -1 && !entry_valid(cache, entry)) {
+        cache->invalidations++;
+        remove_entry(cache, entry);
+        entry = NULL;
+    }
+    if (entry == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+
+    /* Mark as most recently used */
+    if (!entry->pinned && cache->head != entry) {
+        lru_unlink(cache, entry);
+        lru_push(cache, entry);
+    }
+    cache->hits++;
+    entry->refs++;
+    return entry;
+}
+
+/* Allocates an unlisted entry with room for a header and body */
+ws_cache_entry_p ws_cache_new(const char *key, int status, int coding,
+        size_t header_len, size_t body_len) {
+    size_t key_len = strlen(key) + 1;
+    ws_cache_entry_p entry = malloc(sizeof(ws_cache_entry_t) + key_len
+        + header_len + body_len);
+    if (entry == NULL) return NULL;
+    memset(entry, 0, sizeof(ws_cache_entry_t));
+    entry->key = (char *)(entry + 1);
+    memcpy(entry->key, key, key_len);
+    entry->data = entry->key + key_len;
+    entry->header_len = header_len;
+    entry->size = header_len + body_len;
+    entry->status = status;
+    entry->coding = coding;
+    entry->hash = hash_key(key);
+    entry->refs = 1;
+    return entry;
+}
+
+/* Adds a filled entry, evicting others to stay under the cap. The caller
+   keeps its reference */
+void ws_cache_put(ws_cache_p cache, ws_cache_entry_p entry) {
+    size_t bytes = entry_bytes(entry);
+    if (cache->max_bytes == 0 || bytes > cache->max_bytes) return;
+
+    /* Replace any older copy */
+    ws_cache_entry_p old = cache->buckets[entry->hash % cache->nbuckets];
+    while (old && (old->hash != entry->hash || old->status != entry->status
+            || old->coding != entry->coding || strcmp(old->key, entry->key) != 0)) {
+        old = old->hnext;
+    }
+    if (old) remove_entry(cache, old);
+
+    /* Evict least recently used entries until it fits */
+    while (cache->bytes + bytes > cache->max_bytes && cache->tail) {
+        cache->evictions++;
+        remove_entry(cache, cache->tail);
+    }
+    if (cache->bytes + bytes > cache->max_bytes) return; /* Only pinned left */
+
+    if (cache->count >= cache->nbuckets) grow_buckets(cache);
+    entry->hnext = cache->buckets[entry->hash % cache->nbuckets];
+    cache->buckets[entry->hash % cache->nbuckets] = entry;
+    if (!entry->pinned) lru_push(cache, entry);
+    cache->count++;
+    cache->bytes += bytes;
+    entry->refs++;
+}
+
+/* Drops a reference, freeing the entry once it is unused */
+void ws_cache_release(ws_cache_entry_p entry) {
+    if (--entry->refs == 0) {
+        free(entry);
+    }
+}
+
+/* Drops every entry for a path */
+void ws_cache_invalidate(ws_cache_p cache, const char *key) {
+    unsigned long hash = hash_key(key);
+    ws_cache_entry_p entry = cache->buckets[hash % cache->nbuckets];
+    while (entry) {
+        ws_cache_entry_p next = entry->hnext;
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) {
+            cache->invalidations++;
+            remove_entry(cache, entry);
+        }
+        entry = next;
+    }
+}
+
+/* Drops every entry */
+static void invalidate_all(ws_cache_p cache) {
+    for (size_t i = 0; i < cache->nbuckets; i++) {
+        while (cache->buckets[i]) {
+            cache->invalidations++;
+            remove_entry(cache, cache->buckets[i]);
+        }
+    }
+}
+
+/* Frees every entry that isn't in use and stops watching files */
+void ws_cache_destroy(ws_cache_p cache) {
+    for (size_t i = 0; i < cache->nbuckets; i++) {
+        while (cache->buckets[i]) {
+            remove_entry(cache, cache->buckets[i]);
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = NULL;
+    for (int i = 0; i < cache->nwatches; i++) {
+        free(cache->watches[i].path);
+    }
+    free(cache->watches);
+    cache->watches = NULL;
+    cache->nwatches = 0;
+    if (cache->notify_fd != -1) {
+        close(cache->notify_fd);
+        cache->notify_fd = -1;
+    }
+}
+
+#ifdef WS_HAVE_INOTIFY
+/* Watches a folder (relative to root) and every folder below it */
+static void watch_folder(ws_cache_p cache, const char *rel) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s%s", cache->root, rel);
+    int wd = inotify_add_watch(cache->notify_fd, path, IN_CLOSE_WRITE
+        | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM
+        | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR);
+    if (wd == -1) {
+        perror("Couldn't watch folder");
+        return;
+    }
+
+    /* Remember which folder the watch is for, a moved folder keeps its wd */
+    for (int i = 0; i < cache->nwatches; i++) {
+        if (cache->watches[i].wd == wd) {
+            free(cache->watches[i].path);
+            cache->watches[i].path = strdup(rel);
+            return;
+        }
+    }
+    ws_cache_watch_t *watches = realloc(cache->watches,
+        (cache->nwatches+1) * sizeof(ws_cache_watch_t));
+    if (watches == NULL) return;
+    cache->watches = watches;
+    cache->watches[cache->nwatches].wd = wd;
+    cache->watches[cache->nwatches].path = strdup(rel);
+    cache->nwatches++;
+
+    /* Watch sub folders */
+    DIR *dir = opendir(path);
+    if (dir == NULL) return;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') continue;
+        char sub[4096];
+        struct stat info;
+        if (fstatat(dirfd(dir), ent->d_name, &info, 0) == 0 && S_ISDIR(info.st_mode)) {
+            snprintf(sub, sizeof(sub), "%s/%s", rel, ent->d_name);
+            watch_folder(cache, sub);
+        }
+    }
+    closedir(dir);
+}
+#endif
+
+/* Starts watching root for changes, returns the fd to wait on or -1 */
+int ws_cache_watch(ws_cache_p cache) {
+#ifdef WS_HAVE_INOTIFY
+    if (cache->max_bytes == 0) return -1;
+    cache->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache->notify_fd == -1) {
+        perror("Couldn't watch root, validating cache hits with stat");
+        return -1;
+    }
+    watch_folder(cache, "");
+    return cache->notify_fd;
+#else
+    return -1;
+#endif
+}
+
+/* Handles pending change notifications */
+void ws_cache_notify(ws_cache_p cache) {
+#ifdef WS_HAVE_INOTIFY
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(cache->notify_fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len;
+                ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+            struct inotify_event *ev = (struct inotify_event *)ptr;
+
+            /* Events were lost, nothing can be trusted */
+            if (ev->mask & IN_Q_OVERFLOW) {
+                invalidate_all(cache);
+                continue;
+            }
+
+            /* Find the folder the event happened in */
+            int w = 0;
+            while (w < cache->nwatches && cache->watches[w].wd != ev->wd) w++;
+            if (w == cache->nwatches) continue;
+            if (ev->mask & IN_IGNORED) {
+                /* Folder is gone, forget its watch */
+                free(cache->watches[w].path);
+                cache->watches[w] = cache->watches[--cache->nwatches];
+                continue;
+            }
+            if (ev->len == 0) continue;
+
+            char key[4096];
+            snprintf(key, sizeof(key), "%s/%s", cache->watches[w].path, ev->name);
+            if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+                watch_folder(cache, key);
+            } else if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_DELETE | IN_MOVED_FROM))) {
+                /* Everything below the folder moved, drop it all */
+                invalidate_all(cache);
+            } else {
+                ws_cache_invalidate(cache, key);
+
+                /* Compressed copies of a page may come from its siblings */
+                size_t len = strlen(key);
+                if (len > 3 && (strcmp(key+len-3, ".gz") == 0 
+                        || strcmp(key+len-3, ".br") == 0)) {
+                    key[len-3] = '\0';
+                    ws_cache_invalidate(cache, key);
+                }
+            }
+        }
+    }
+#endif
+}
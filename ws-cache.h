@@ -0,0 +1,120 @@
+/* Simple HTML web server response cache header */
+
+/*
+Response Cache Overview:
+ -  Entries hold a fully assembled response (header then body) for one URL
+    path, the path a request resolves to after the index and .html rules
+ -  Lookups hash the path, status and content coding, so error pages (404,
+    500) and compressed copies are cached next to the plain 200 response;
+    error pages are pinned, never evicted
+ -  Entries are kept in LRU order, and the least recently used ones are
+    evicted whenever the cache would grow past its memory cap
+ -  Clients sending an entry hold a reference, so evicted or invalidated
+    entries are only freed once the last client has finished with them
+ -  On Linux, inotify watches every folder under root and drops entries as
+    soon as their file changes, so hits never touch the filesystem; a change
+    to a precompressed sibling (page.gz, page.br) drops the page's entries
+ -  Elsewhere (or if inotify fails), hits stat() the file and drop the entry
+    if its mtime or size changed
+*/
+
+#ifndef WS_CACHE_H
+#define WS_CACHE_H
+
+#include <stddef.h>         /* size_t */
+#include <time.h>           /* time_t */
+#include <sys/types.h>      /* off_t */
+
+#ifdef LINUX
+#define WS_HAVE_INOTIFY
+#endif
+
+/* Define misc */
+#define WS_CACHE_DEFAULT_MAX  (64L<<20) /* Default memory cap, 64MB */
+#define WS_CACHE_MAX_ENTRY    (1L<<18) /* Larger files bypass the cache */
+#define WS_CACHE_MIN_BUCKETS  64
+#define WS_CACHE_ETAG_LEN     64 /* Room for an ETag and its terminator */
+
+/* A cached response */
+struct ws_cache_entry_t {
+    char *key;                      /* URL path the response is for */
+    int status;                     /* HTTP status of the response */
+    int coding;                     /* Content coding it was looked up by */
+    unsigned long hash;             /* Hash of key */
+    char *data;                     /* Header followed by body */
+    size_t header_len;              /* Bytes of header at the start of data */
+    size_t size;                    /* Total bytes in data */
+    time_t mtime;                   /* Modification time of the file */
+    off_t file_size;                /* Size of the file */
+    char etag[WS_CACHE_ETAG_LEN];   /* Validator of the file, with quotes */
+    int refs;                       /* Clients using it, +1 while cached */
+    int pinned;                     /* TRUE if never evicted */
+    struct ws_cache_entry_t *hnext; /* Next entry in hash bucket */
+    struct ws_cache_entry_t *prev;  /* More recently used entry */
+    struct ws_cache_entry_t *next;  /* Less recently used entry */
+};
+typedef struct ws_cache_entry_t ws_cache_entry_t;
+typedef ws_cache_entry_t* ws_cache_entry_p;
+
+/* A watched folder */
+struct ws_cache_watch_t {
+    int wd;                         /* inotify watch descriptor */
+    char *path;                     /* Path relative to root ("" for root) */
+};
+typedef struct ws_cache_watch_t ws_cache_watch_t;
+
+/* State of a response cache */
+struct ws_cache_t {
+    const char *root;               /* Folder the keys are relative to */
+    ws_cache_entry_p *buckets;      /* Hash table of entries */
+    size_t nbuckets;                /* Number of buckets */
+    size_t count;                   /* Number of entries */
+    ws_cache_entry_p head;          /* Most recently used entry */
+    ws_cache_entry_p tail;          /* Least recently used entry */
+    size_t bytes;                   /* Memory used by entries */
+    size_t max_bytes;               /* Memory cap, 0 disables the cache */
+    int notify_fd;                  /* inotify instance, or -1 to stat() */
+    ws_cache_watch_t *watches;      /* Watched folders */
+    int nwatches;                   /* Number of watched folders */
+    long hits;                      /* Lookups that found an entry */
+    long misses;                    /* Lookups that didn't */
+    long evictions;                 /* Entries dropped to stay under the cap */
+    long invalidations;             /* Entries dropped as their file changed */
+};
+typedef struct ws_cache_t ws_cache_t;
+typedef ws_cache_t* ws_cache_p;
+
+/* Sets up an empty cache for files under root, capped at max_bytes */
+int ws_cache_init(ws_cache_p cache, const char *root, size_t max_bytes);
+
+/* Frees every entry that isn't in use and stops watching files */
+void ws_cache_destroy(ws_cache_p cache);
+
+/* Returns TRUE if a body of size bytes may be cached */
+int ws_cache_fits(ws_cache_p cache, size_t size);
+
+/* Looks up a response, returns a referenced entry or NULL on a miss */
+ws_cache_entry_p ws_cache_get(ws_cache_p cache, const char *key, int status,
+    int coding);
+
+/* Allocates an unlisted entry with room for a header and body */
+ws_cache_entry_p ws_cache_new(const char *key, int status, int coding,
+    size_t header_len, size_t body_len);
+
+/* Adds a filled entry, evicting others to stay under the cap. The caller
+   keeps its reference */
+void ws_cache_put(ws_cache_p cache, ws_cache_entry_p entry);
+
+/* Drops a reference, freeing the entry once it is unused */
+void ws_cache_release(ws_cache_entry_p entry);
+
+/* Drops every entry for a path */
+void ws_cache_invalidate(ws_cache_p cache, const char *key);
+
+/* Starts watching root for changes, returns the fd to wait on or -1 */
+int ws_cache_watch(ws_cache_p cache);
+
+/* Handles pending change notifications */
+void ws_cache_notify(ws_cache_p cache);
+
+#endif
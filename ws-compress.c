@@ -0,0 +1,115 @@
+/* Simple HTML web server content encoding */
+#include <stdio.h>          /* NULL */
+#include <string.h>         /* Memory copies */
+#include "ws-compress.h"    /* Coding consts */
+#ifdef WS_HAVE_GZIP
+#include <zlib.h>           /* gzip */
+#endif
+#ifdef WS_HAVE_BROTLI
+#include <brotli/encode.h>  /* brotli */
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+/* Returns TRUE if the server was built with a coding */
+int ws_compress_supported(int coding) {
+    switch (coding) {
+#ifdef WS_HAVE_GZIP
+        case WS_CODING_GZIP:
+            return TRUE;
+#endif
+#ifdef WS_HAVE_BROTLI
+        case WS_CODING_BROTLI:
+            return TRUE;
+#endif
+        default:
+            return FALSE;
+    }
+}
+
+/* Returns the Content-Encoding name of a coding */
+const char *ws_compress_name(int coding) {
+    switch (coding) {
+        case WS_CODING_GZIP:
+            return "gzip";
+        case WS_CODING_BROTLI:
+            return "br";
+        default:
+            return "identity";
+    }
+}
+
+/* Returns the extension of a coding's precompressed siblings */
+const char *ws_compress_ext(int coding) {
+    switch (coding) {
+        case WS_CODING_GZIP:
+            return ".gz";
+        case WS_CODING_BROTLI:
+            return ".br";
+        default:
+            return "";
+    }
+}
+
+/* Returns the most bytes that compressing size bytes can produce */
+size_t ws_compress_bound(int coding, size_t size) {
+    switch (coding) {
+#ifdef WS_HAVE_GZIP
+        case WS_CODING_GZIP:
+            return compressBound(size) + 18; /* gzip header and trailer */
+#endif
+#ifdef WS_HAVE_BROTLI
+        case WS_CODING_BROTLI:
+            return BrotliEncoderMaxCompressedSize(size);
+#endif
+        default:
+            return size;
+    }
+}
+
+#ifdef WS_HAVE_GZIP
+/* Compresses with zlib, in the gzip format */
+static int compress_gzip(int level, const char *in, size_t in_len,
+        char *out, size_t *out_len) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    /* 15 bits of window, +16 for a gzip header */
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    stream.next_in = (unsigned char *)in;
+    stream.avail_in = in_len;
+    stream.next_out = (unsigned char *)out;
+    stream.avail_out = *out_len;
+    int result = deflate(&stream, Z_FINISH);
+    *out_len = stream.total_out;
+    deflateEnd(&stream);
+    return result == Z_STREAM_END ? 0 : -1;
+}
+#endif
+
+/* Compresses in_len bytes into out, which holds *out_len bytes, at a level
+   (0 for the default). Sets *out_len to the compressed size.
+   Returns 0, or -1 if it failed or didn't fit */
+int ws_compress(int coding, int level, const char *in, size_t in_len,
+        char *out, size_t *out_len) {
+    switch (coding) {
+#ifdef WS_HAVE_GZIP
+        case WS_CODING_GZIP:
+            return compress_gzip(level ? level : WS_GZIP_LEVEL, in, in_len, out, out_len);
+#endif
+#ifdef WS_HAVE_BROTLI
+        case WS_CODING_BROTLI:
+            return BrotliEncoderCompress(level ? level : WS_BROTLI_LEVEL,
+                BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, in_len,
+                (const uint8_t *)in, out_len, (uint8_t *)out) ? 0 : -1;
+#endif
+        default:
+            return -1;
+    }
+}
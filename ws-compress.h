@@ -0,0 +1,51 @@
+/* Simple HTML web server content encoding header */
+
+/*
+Content Encoding Overview:
+ -  Compressible pages (text, scripts, SVG) are sent in the best coding the
+    client's Accept-Encoding allows, brotli first, then gzip
+ -  A precompressed sibling (page.html.br, page.html.gz) is sent when there
+    is one, so large assets can be compressed offline at the best level
+ -  Otherwise cacheable pages are compressed once, when first asked for, and
+    the compressed response is cached next to the plain one
+ -  Pages below a minimum size, or that don't shrink, are sent as they are,
+    and that outcome is cached too so it isn't tried again
+ -  Which codings exist depends on the libraries the server was built with
+*/
+
+#ifndef WS_COMPRESS_H
+#define WS_COMPRESS_H
+
+#include <stddef.h>         /* size_t */
+
+/* Define content codings */
+#define WS_CODING_IDENTITY 0
+#define WS_CODING_GZIP     1
+#define WS_CODING_BROTLI   2
+#define WS_CODINGS         3
+
+/* Define default levels. Compressing stalls the worker, so these trade a
+   little size for speed (brotli 11 takes ~40x longer than 5 for ~4% less);
+   precompressed siblings are the place for the best levels */
+#define WS_GZIP_LEVEL      6
+#define WS_BROTLI_LEVEL    5
+
+/* Returns TRUE if the server was built with a coding */
+int ws_compress_supported(int coding);
+
+/* Returns the Content-Encoding name of a coding */
+const char *ws_compress_name(int coding);
+
+/* Returns the extension of a coding's precompressed siblings */
+const char *ws_compress_ext(int coding);
+
+/* Returns the most bytes that compressing size bytes can produce */
+size_t ws_compress_bound(int coding, size_t size);
+
+/* Compresses in_len bytes into out, which holds *out_len bytes, at a level
+   (0 for the default). Sets *out_len to the compressed size.
+   Returns 0, or -1 if it failed or didn't fit */
+int ws_compress(int coding, int level, const char *in, size_t in_len,
+    char *out, size_t *out_len);
+
+#endif
@@ -0,0 +1,188 @@
+/* Simple HTML web server disk thread pool */
+#include <stdio.h>          /* NULL */
+#include <stdlib.h>         /* Memory management */
+#include <unistd.h>         /* pipe, read, write */
+#include <fcntl.h>          /* Non-blocking fds and fadvise */
+#include <errno.h>          /* Error handling */
+#include <stdint.h>         /* uint64_t */
+#include "ws-disk.h"        /* Disk pool consts and structs */
+#ifdef LINUX
+#define WS_HAVE_EVENTFD
+#include <sys/eventfd.h>    /* Completion counters */
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+/* Shared pool state */
+static pthread_t threads[WS_DISK_MAX_THREADS]; /* Pool threads */
+static int thread_count = 0;    /* Number of them running */
+static int root_fd = -1;        /* Root every page is resolved beneath */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; /* Guards the jobs waiting */
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER; /* Signalled as jobs come in */
+static ws_disk_job_p head = NULL; /* Oldest job waiting */
+static ws_disk_job_p tail = NULL; /* Newest job waiting */
+static int stopping = FALSE;    /* TRUE once threads should leave when idle */
+
+/* Posts a finished job to its worker and wakes the worker's loop */
+static void post(ws_disk_job_p job) {
+    ws_disk_queue_p queue = job->queue;
+    job->next = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->done_tail != NULL) {
+        queue->done_tail->next = job;
+    } else {
+        queue->done = job;
+    }
+    queue->done_tail = job;
+    pthread_mutex_unlock(&queue->lock);
+
+    /* A full pipe or counter already has the loop woken */
+#ifdef WS_HAVE_EVENTFD
+    uint64_t one = 1;
+    if (write(queue->wake_fd, &one, sizeof(one)) == -1) return;
+#else
+    char one = 1;
+    if (write(queue->wake_fd, &one, 1) == -1) return;
+#endif
+}
+
+/* Runs jobs as they come in, until the pool stops and none are left */
+static void *disk_thread(void *arg) {
+    ws_path_cache_t paths;
+    ws_path_init(&paths, root_fd, FALSE);
+    pthread_mutex_lock(&lock);
+    while (TRUE) {
+        while (head == NULL && !stopping) {
+            pthread_cond_wait(&wake, &lock);
+        }
+        if (head == NULL) break;
+        ws_disk_job_p job = head;
+        head = job->next;
+        if (head == NULL) tail = NULL;
+        pthread_mutex_unlock(&lock);
+
+        job->run(job, &paths);
+        post(job);
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    ws_path_destroy(&paths);
+    return NULL;
+}
+
+/* Starts threads resolving pages beneath root */
+int ws_disk_start(int count, int root) {
+    root_fd = root;
+    stopping = FALSE;
+    if (count > WS_DISK_MAX_THREADS) count = WS_DISK_MAX_THREADS;
+    for (thread_count = 0; thread_count < count; thread_count++) {
+        int err = pthread_create(&threads[thread_count], NULL, disk_thread, NULL);
+        if (err != 0) {
+            ws_disk_stop();
+            errno = err;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Runs every job already submitted, then stops and joins the threads */
+void ws_disk_stop() {
+    pthread_mutex_lock(&lock);
+    stopping = TRUE;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    thread_count = 0;
+}
+
+/* Sets up a worker's completion queue */
+int ws_disk_queue_init(ws_disk_queue_p queue) {
+    queue->done = queue->done_tail = NULL;
+#ifdef WS_HAVE_EVENTFD
+    queue->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (queue->fd == -1) return -1;
+    queue->wake_fd = queue->fd;
+#else
+    int fds[2];
+    if (pipe(fds) == -1) return -1;
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    queue->fd = fds[0];
+    queue->wake_fd = fds[1];
+#endif
+    pthread_mutex_init(&queue->lock, NULL);
+    return 0;
+}
+
+/* Closes a completion queue */
+void ws_disk_queue_destroy(ws_disk_queue_p queue) {
+    if (queue->fd == -1) return;
+    if (queue->wake_fd != queue->fd) {
+        close(queue->wake_fd);
+    }
+    close(queue->fd);
+    queue->fd = queue->wake_fd = -1;
+    pthread_mutex_destroy(&queue->lock);
+}
+
+/* Hands a job to the pool */
+void ws_disk_submit(ws_disk_job_p job, ws_disk_run_t run, ws_disk_queue_p queue) {
+    job->run = run;
+    job->queue = queue;
+    job->next = NULL;
+    pthread_mutex_lock(&lock);
+    if (tail != NULL) {
+        tail->next = job;
+    } else {
+        head = job;
+    }
+    tail = job;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Takes every finished job off a queue. The fd is cleared first, so a job
+   posted after the list is taken wakes the loop again */
+ws_disk_job_p ws_disk_take(ws_disk_queue_p queue) {
+    char buf[64];
+    while (read(queue->fd, buf, sizeof(buf)) > 0);
+    pthread_mutex_lock(&queue->lock);
+    ws_disk_job_p jobs = queue->done;
+    queue->done = queue->done_tail = NULL;
+    pthread_mutex_unlock(&queue->lock);
+    return jobs;
+}
+
+/* Tells the kernel a file will be read from start to end */
+void ws_disk_sequential(int fd) {
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+/* Reads a window of a file into the page cache */
+ssize_t ws_disk_warm(int fd, off_t offset, off_t len) {
+    static __thread char scratch[WS_DISK_SCRATCH];
+#ifdef POSIX_FADV_WILLNEED
+    /* Let the kernel queue the whole window before the first read waits */
+    posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+#endif
+    off_t done = 0;
+    while (done < len) {
+        off_t want = len - done < WS_DISK_SCRATCH ? len - done : WS_DISK_SCRATCH;
+        ssize_t n = pread(fd, scratch, want, offset + done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) return -1;
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
@@ -0,0 +1,88 @@
+/* Simple HTML web server disk thread pool header */
+
+/*
+Disk Pool Overview:
+ -  A few threads shared by every worker do the file work that can block
+    on a cold disk or a slow network filesystem (opening and stating pages,
+    reading them into the cache, reading large files ahead of sending), so
+    an event loop never waits on it and its other clients keep being served
+ -  A job is a function run on a pool thread, with whatever it needs in
+    the struct it is embedded in (see web-server.h); jobs are taken in the
+    order they were submitted
+ -  Each worker has its own completion queue: a finished job is appended to
+    it under its lock, and its eventfd (a pipe where there is none) is
+    written, which the worker's event loop watches like a socket
+ -  Threads resolve pages beneath root with a path cache of their own (see
+    ws-path.h), which never keeps folders open, so the workers' folders
+    and change notifications stay theirs alone
+ -  Large files are opened with a sequential access hint, and read ahead a
+    window at a time: the kernel is told which bytes are coming
+    (POSIX_FADV_WILLNEED), and they are then read through a scratch buffer
+    so they are in the page cache by the time the job completes, and
+    sendfile() or pread() on the event loop never goes to disk
+*/
+
+#ifndef WS_DISK_H
+#define WS_DISK_H
+
+#include <sys/types.h>      /* off_t, ssize_t */
+#include <pthread.h>        /* Pool threads and locks */
+#include "ws-path.h"        /* Pages resolved beneath root */
+
+/* Define misc */
+#define WS_DISK_MAX_THREADS 64
+#define WS_DISK_WINDOW      (256L<<10) /* Bytes of a large file read ahead at once */
+#define WS_DISK_SCRATCH     (64L<<10) /* Buffer a window is read through */
+
+struct ws_disk_job_t;
+
+/* Work of a job, run on a pool thread with that thread's paths */
+typedef void (*ws_disk_run_t)(struct ws_disk_job_t *job, ws_path_cache_p paths);
+
+/* A worker's completion queue */
+struct ws_disk_queue_t {
+    int fd;                     /* eventfd (or pipe read end) its loop watches */
+    int wake_fd;                /* What threads write to, the same eventfd or the pipe's write end */
+    pthread_mutex_t lock;       /* Guards done */
+    struct ws_disk_job_t *done; /* Finished jobs, oldest first */
+    struct ws_disk_job_t *done_tail; /* Last of them */
+};
+typedef struct ws_disk_queue_t ws_disk_queue_t;
+typedef ws_disk_queue_t* ws_disk_queue_p;
+
+/* The pool's part of a job, first in the struct it is embedded in */
+struct ws_disk_job_t {
+    ws_disk_run_t run;          /* Work to do off the loop */
+    ws_disk_queue_p queue;      /* Queue it is posted to once done */
+    struct ws_disk_job_t *next; /* Next job waiting, or next done */
+};
+typedef struct ws_disk_job_t ws_disk_job_t;
+typedef ws_disk_job_t* ws_disk_job_p;
+
+/* Starts threads resolving pages beneath root, returns 0 or -1 with errno set */
+int ws_disk_start(int threads, int root);
+
+/* Runs every job already submitted, then stops and joins the threads */
+void ws_disk_stop();
+
+/* Sets up a worker's completion queue, returns 0 or -1 with errno set */
+int ws_disk_queue_init(ws_disk_queue_p queue);
+
+/* Closes a completion queue, whose finished jobs must have been taken */
+void ws_disk_queue_destroy(ws_disk_queue_p queue);
+
+/* Hands a job to the pool, to be posted to queue once run */
+void ws_disk_submit(ws_disk_job_p job, ws_disk_run_t run, ws_disk_queue_p queue);
+
+/* Takes every finished job off a queue, oldest first, clearing its fd.
+   Returns the first, the rest linked through next, or NULL */
+ws_disk_job_p ws_disk_take(ws_disk_queue_p queue);
+
+/* Tells the kernel a file will be read from start to end */
+void ws_disk_sequential(int fd);
+
+/* Reads len bytes of a file from offset into the page cache, on a pool
+   thread. Returns the bytes read, less at the end of the file, or -1 */
+ssize_t ws_disk_warm(int fd, off_t offset, off_t len);
+
+#endif
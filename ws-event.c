@@ -0,0 +1,462 @@
+/* Simple HTML web server event backends */
+#define _GNU_SOURCE         /* POLLRDHUP */
+#include <stdio.h>          /* NULL */
+#include <stdlib.h>         /* Memory management */
+#include <string.h>         /* String parsing */
+#include <unistd.h>         /* close */
+#include <errno.h>          /* Error handling */
+#include <sys/select.h>     /* Select */
+#include "ws-event.h"       /* Event backend consts and structs */
+#ifdef WS_HAVE_EPOLL
+#include <sys/epoll.h>      /* Epoll */
+#endif
+#ifdef WS_HAVE_URING
+#include <poll.h>           /* Poll masks */
+#include <sys/mman.h>       /* Ring mappings */
+#include <sys/syscall.h>    /* Raw io_uring syscalls */
+#include <linux/io_uring.h> /* io_uring structs */
+
+/* user_data of requests whose completions are ignored */
+#define WS_URING_IGNORE    (~0ULL)
+
+/* Mapped submission and completion rings of an io_uring */
+struct ws_uring_t {
+    int fd;                         /* io_uring instance */
+    void *sq_map;                   /* Submission ring mapping */
+    size_t sq_map_len;              /* Its length */
+    void *cq_map;                   /* Completion ring mapping, may be sq_map */
+    size_t cq_map_len;              /* Its length */
+    struct io_uring_sqe *sqes;      /* Submission entries */
+    size_t sqes_len;                /* Their mapped length */
+    unsigned *sq_head;              /* Next entry the kernel takes */
+    unsigned *sq_tail;              /* Next entry we fill, as published */
+    unsigned sq_mask;               /* Entries - 1 */
+    unsigned *sq_array;             /* Entry index of each ring slot */
+    unsigned sq_local;              /* Next entry we fill, not yet published */
+    unsigned *cq_head;              /* Next completion we take */
+    unsigned *cq_tail;              /* Next completion the kernel posts */
+    unsigned cq_mask;               /* Completions - 1 */
+    struct io_uring_cqe *cqes;      /* Completion entries */
+};
+#endif
+
+/* Parses a backend name, returns -1 if unknown or unsupported */
+int ws_event_backend(const char *name) {
+    if (strcmp(name, "select") == 0) {
+        return WS_BACKEND_SELECT;
+    }
+#ifdef WS_HAVE_EPOLL
+    if (strcmp(name, "epoll") == 0) {
+        return WS_BACKEND_EPOLL;
+    }
+#endif
+#ifdef WS_HAVE_URING
+    if (strcmp(name, "io_uring") == 0) {
+        return WS_BACKEND_URING;
+    }
+#endif
+    return -1;
+}
+
+/* Returns the name of a backend */
+const char *ws_event_name(int backend) {
+    switch (backend) {
+        case WS_BACKEND_EPOLL:
+            return "epoll";
+        case WS_BACKEND_SELECT:
+            return "select";
+        case WS_BACKEND_URING:
+            return "io_uring";
+        default:
+            return "unknown";
+    }
+}
+
+#ifdef WS_HAVE_URING
+/* Releases an io_uring's mappings and fd */
+static void uring_close(struct ws_uring_t *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_map != NULL && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_len);
+    }
+    if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED) munmap(ring->sq_map, ring->sq_map_len);
+    if (ring->fd != -1) close(ring->fd);
+    free(ring);
+}
+
+/* Sets up an io_uring and maps its rings, returns it or NULL with errno set.
+   Multishot polls and wait timeouts need Linux 5.13, which is the first to
+   report IORING_FEAT_RSRC_TAGS */
+static struct ws_uring_t *uring_open() {
+    struct ws_uring_t *ring = calloc(1, sizeof(struct ws_uring_t));
+    if (ring == NULL) return NULL;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, WS_URING_ENTRIES, &params);
+    if (ring->fd == -1) {
+        free(ring);
+        return NULL;
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_RSRC_TAGS)) {
+        uring_close(ring);
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    /* Map the rings, which share one mapping on newer kernels */
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP && ring->cq_map_len > ring->sq_map_len) {
+        ring->sq_map_len = ring->cq_map_len;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        uring_close(ring);
+        return NULL;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            uring_close(ring);
+            return NULL;
+        }
+    }
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        uring_close(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sq_map, *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_local = *ring->sq_tail;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+/* Submits queued requests, and waits for min_complete completions or the
+   timeout (ms, -1 blocks). Returns 0, or -1 with errno set */
+static int uring_enter(struct ws_uring_t *ring, unsigned min_complete, int timeout) {
+    unsigned pending = ring->sq_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts = { timeout / 1000, (timeout % 1000) * 1000000LL };
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (min_complete && timeout >= 0) {
+        arg.ts = (unsigned long long)(unsigned long)&ts;
+    }
+    flags |= IORING_ENTER_EXT_ARG;
+    if (syscall(__NR_io_uring_enter, ring->fd, pending, min_complete, flags,
+            &arg, sizeof(arg)) == -1) {
+        return errno == ETIME ? 0 : -1;
+    }
+    return 0;
+}
+
+/* Takes a free submission entry, submitting the queue first if it is full.
+   Returns NULL if there's no room */
+static struct io_uring_sqe *uring_sqe(struct ws_uring_t *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local - head > ring->sq_mask) {
+        if (uring_enter(ring, 0, 0) == -1) return NULL;
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sq_local - head > ring->sq_mask) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+    unsigned index = ring->sq_local & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local++;
+    return sqe;
+}
+
+/* Publishes the entries filled since the last call */
+static void uring_publish(struct ws_uring_t *ring) {
+    __atomic_store_n(ring->sq_tail, ring->sq_local, __ATOMIC_RELEASE);
+}
+
+/* Returns the user_data of an fd's current registration */
+static unsigned long long uring_key(ws_event_loop_p loop, int fd) {
+    return (unsigned long long)loop->slots[fd].gen << 32 | (unsigned)fd;
+}
+
+/* Queues a multishot poll of fd for reading and writing */
+static int uring_arm(ws_event_loop_p loop, int fd) {
+    struct io_uring_sqe *sqe = uring_sqe(loop->uring);
+    if (sqe == NULL) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN | POLLOUT | POLLRDHUP;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = uring_key(loop, fd);
+    uring_publish(loop->uring);
+    return 0;
+}
+#endif
+
+/* Creates the backend, returns 0 on success or -1 with errno set */
+int ws_event_init(ws_event_loop_p loop, int backend) {
+    loop->backend = backend;
+    loop->epfd = -1;
+    loop->max_fd = -1;
+    loop->uring = NULL;
+    loop->slots = NULL;
+    loop->nslots = 0;
+    FD_ZERO(&loop->rdset);
+    FD_ZERO(&loop->wrset);
+    memset(loop->data, 0, sizeof(loop->data));
+
+#ifdef WS_HAVE_URING
+    if (backend == WS_BACKEND_URING) {
+        loop->uring = uring_open();
+        return loop->uring == NULL ? -1 : 0;
+    }
+#endif
+#ifdef WS_HAVE_EPOLL
+    if (backend == WS_BACKEND_EPOLL) {
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        return loop->epfd == -1 ? -1 : 0;
+    }
+#endif
+    if (backend != WS_BACKEND_SELECT) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Releases the backend */
+void ws_event_close(ws_event_loop_p loop) {
+    if (loop->epfd != -1) {
+        close(loop->epfd);
+        loop->epfd = -1;
+    }
+#ifdef WS_HAVE_URING
+    if (loop->uring != NULL) {
+        uring_close(loop->uring);
+        loop->uring = NULL;
+    }
+#endif
+    free(loop->slots);
+    loop->slots = NULL;
+    loop->nslots = 0;
+}
+
+/* Sets the select interest of fd */
+static int select_set(ws_event_loop_p loop, int fd, int events, void *data) {
+    /* select can't watch fds past FD_SETSIZE */
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        errno = EMFILE;
+        return -1;
+    }
+    FD_CLR(fd, &loop->rdset);
+    FD_CLR(fd, &loop->wrset);
+    if (events & WS_EV_READ) FD_SET(fd, &loop->rdset);
+    if (events & WS_EV_WRITE) FD_SET(fd, &loop->wrset);
+    loop->data[fd] = data;
+    if (fd > loop->max_fd) loop->max_fd = fd;
+    return 0;
+}
+
+/* Registers fd with the given WS_EV_* interest */
+int ws_event_add(ws_event_loop_p loop, int fd, int events, void *data) {
+#ifdef WS_HAVE_EPOLL
+    if (loop->backend == WS_BACKEND_EPOLL) {
+        /* Edge-triggered, so both directions are registered up front */
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = data;
+        return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+#endif
+#ifdef WS_HAVE_URING
+    if (loop->backend == WS_BACKEND_URING) {
+        /* Grow the slots to cover fd, doubling like the client table */
+        if (fd >= loop->nslots) {
+            int size = loop->nslots ? loop->nslots : WS_MAX_EVENTS;
+            while (size <= fd) size *= 2;
+            ws_event_slot_t *slots = realloc(loop->slots, size * sizeof(ws_event_slot_t));
+            if (slots == NULL) return -1;
+            memset(slots + loop->nslots, 0, (size - loop->nslots) * sizeof(ws_event_slot_t));
+            loop->slots = slots;
+            loop->nslots = size;
+        }
+        loop->slots[fd].data = data;
+        loop->slots[fd].gen++;
+        return uring_arm(loop, fd);
+    }
+#endif
+    return select_set(loop, fd, events, data);
+}
+
+/* Changes the interest of fd (no-op for edge-triggered backends) */
+int ws_event_mod(ws_event_loop_p loop, int fd, int events, void *data) {
+    if (loop->backend != WS_BACKEND_SELECT) {
+        return 0;
+    }
+    return select_set(loop, fd, events, data);
+}
+
+/* Unregisters fd, must be called before it is closed */
+int ws_event_del(ws_event_loop_p loop, int fd) {
+#ifdef WS_HAVE_EPOLL
+    if (loop->backend == WS_BACKEND_EPOLL) {
+        return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+#endif
+#ifdef WS_HAVE_URING
+    if (loop->backend == WS_BACKEND_URING) {
+        if (fd < 0 || fd >= loop->nslots || loop->slots[fd].data == NULL) {
+            errno = ENOENT;
+            return -1;
+        }
+
+        /* Completions already posted for it are dropped by their key */
+        struct io_uring_sqe *sqe = uring_sqe(loop->uring);
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = uring_key(loop, fd);
+            sqe->user_data = WS_URING_IGNORE;
+            uring_publish(loop->uring);
+        }
+        loop->slots[fd].data = NULL;
+        loop->slots[fd].gen++;
+        return 0;
+    }
+#endif
+    if (fd < 0 || fd >= FD_SETSIZE) {
+        errno = EBADF;
+        return -1;
+    }
+    FD_CLR(fd, &loop->rdset);
+    FD_CLR(fd, &loop->wrset);
+    loop->data[fd] = NULL;
+
+    /* Find new max fd */
+    while (loop->max_fd >= 0 && loop->data[loop->max_fd] == NULL) {
+        loop->max_fd--;
+    }
+    return 0;
+}
+
+/* Waits for up to max ready sockets using select */
+static int select_wait(ws_event_loop_p loop, ws_event_t *events, int max, int timeout) {
+    fd_set rdset = loop->rdset;
+    fd_set wrset = loop->wrset;
+    struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+
+    int ready = select(loop->max_fd+1, &rdset, &wrset, NULL,
+        timeout < 0 ? NULL : &tv);
+    if (ready <= 0) return ready;
+
+    /* Collect ready sockets */
+    int count = 0;
+    for (int fd = 0; fd <= loop->max_fd && ready > 0 && count < max; fd++) {
+        int flags = 0;
+        if (FD_ISSET(fd, &rdset)) flags |= WS_EV_READ;
+        if (FD_ISSET(fd, &wrset)) flags |= WS_EV_WRITE;
+        if (flags) {
+            ready--;
+            events[count].events = flags;
+            events[count].data = loop->data[fd];
+            count++;
+        }
+    }
+    return count;
+}
+
+#ifdef WS_HAVE_URING
+/* Takes up to max completions as events, re-arming polls the kernel ended */
+static int uring_reap(ws_event_loop_p loop, ws_event_t *events, int max) {
+    struct ws_uring_t *ring = loop->uring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    int count = 0;
+    while (head != tail && count < max) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        unsigned long long key = cqe->user_data;
+        int fd = (int)(key & 0xffffffffULL);
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        head++;
+
+        /* Drop removals and completions for an fd's earlier use */
+        if (key == WS_URING_IGNORE || fd >= loop->nslots
+                || loop->slots[fd].data == NULL || key != uring_key(loop, fd)) {
+            continue;
+        }
+        if (!(flags & IORING_CQE_F_MORE)) {
+            /* The kernel ended the poll (error or overflow), start another */
+            uring_arm(loop, fd);
+        }
+        if (res <= 0) continue;
+
+        int ev = 0;
+        if (res & POLLIN) ev |= WS_EV_READ;
+        if (res & POLLOUT) ev |= WS_EV_WRITE;
+        if (res & (POLLERR | POLLHUP | POLLRDHUP)) ev |= WS_EV_HUP | WS_EV_READ;
+        events[count].events = ev;
+        events[count].data = loop->slots[fd].data;
+        count++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return count;
+}
+#endif
+
+/* Waits for up to max ready sockets, timeout in ms (-1 blocks).
+   Returns the number of events, or -1 with errno set */
+int ws_event_wait(ws_event_loop_p loop, ws_event_t *events, int max, int timeout) {
+#ifdef WS_HAVE_URING
+    if (loop->backend == WS_BACKEND_URING) {
+        struct ws_uring_t *ring = loop->uring;
+        unsigned pending = ring->sq_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+        /* Completions already posted are taken without a syscall, only
+           flushing queued requests first if there are any */
+        int count = uring_reap(loop, events, max);
+        if (count > 0) {
+            if (pending > 0 && uring_enter(ring, 0, 0) == -1) return -1;
+            return count;
+        }
+        if (uring_enter(ring, 1, timeout) == -1) return -1;
+        return uring_reap(loop, events, max);
+    }
+#endif
+#ifdef WS_HAVE_EPOLL
+    if (loop->backend == WS_BACKEND_EPOLL) {
+        struct epoll_event evs[WS_MAX_EVENTS];
+        if (max > WS_MAX_EVENTS) max = WS_MAX_EVENTS;
+
+        int ready = epoll_wait(loop->epfd, evs, max, timeout);
+        for (int i = 0; i < ready; i++) {
+            int flags = 0;
+            if (evs[i].events & EPOLLIN) flags |= WS_EV_READ;
+            if (evs[i].events & EPOLLOUT) flags |= WS_EV_WRITE;
+            if (evs[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+                flags |= WS_EV_HUP | WS_EV_READ;
+            }
+            events[i].events = flags;
+            events[i].data = evs[i].data.ptr;
+        }
+        return ready;
+    }
+#endif
+    return select_wait(loop, events, max, timeout);
+}
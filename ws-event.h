@@ -0,0 +1,110 @@
+/* Simple HTML web server event backend header */
+
+/*
+Event Backend Overview:
+ -  Sockets are registered once with the interest they need (read/write),
+    along with an opaque pointer that is handed back when they become ready
+ -  epoll (Linux default) is edge-triggered: read and write interest are both
+    registered once per connection, so ws_event_mod() is a no-op and callers
+    must drain a socket until EAGAIN before waiting again
+ -  select (fallback) is level-triggered: interest sets are kept in the loop
+    and only changed by ws_event_mod(), so no per-iteration rebuild is needed
+ -  io_uring (Linux, selectable) arms a multishot poll per socket, which
+    fires on every wakeup like epoll's edge trigger, so callers drain sockets
+    the same way. Adding and removing sockets only queues requests, and they
+    are submitted with the next wait in one io_uring_enter(), so a new
+    connection costs no extra syscall, and waiting costs none while
+    completions are already queued
+ -  ws_event_wait() only reports ready sockets, so the cost of an iteration
+    scales with activity instead of the total number of connections
+*/
+
+#ifndef WS_EVENT_H
+#define WS_EVENT_H
+
+#include <sys/select.h>     /* fd_set */
+
+#ifdef LINUX
+#define WS_HAVE_EPOLL
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define WS_HAVE_URING
+#endif
+#endif
+#endif
+
+/* Define event backends */
+#define WS_BACKEND_SELECT  0
+#define WS_BACKEND_EPOLL   1
+#define WS_BACKEND_URING   2
+#ifdef WS_HAVE_EPOLL
+#define WS_BACKEND_DEFAULT WS_BACKEND_EPOLL
+#else
+#define WS_BACKEND_DEFAULT WS_BACKEND_SELECT
+#endif
+
+/* Define event flags */
+#define WS_EV_READ         (1<<0)
+#define WS_EV_WRITE        (1<<1)
+#define WS_EV_HUP          (1<<2) /* Error or hangup, treat as readable */
+
+/* Define misc */
+#define WS_MAX_EVENTS      256 /* Max events returned by one wait */
+#define WS_URING_ENTRIES   1024 /* Requests queued between waits (io_uring only) */
+
+/* A single ready socket */
+struct ws_event_t {
+    int events;                 /* WS_EV_* flags that are ready */
+    void *data;                 /* Pointer given when registered */
+};
+typedef struct ws_event_t ws_event_t;
+
+/* A registered fd (io_uring only) */
+struct ws_event_slot_t {
+    void *data;                 /* Pointer given when registered, NULL if free */
+    unsigned gen;               /* Bumped on every add and remove, so completions
+                                   for an earlier use of the fd are dropped */
+};
+typedef struct ws_event_slot_t ws_event_slot_t;
+
+/* State of an event backend */
+struct ws_event_loop_t {
+    int backend;                /* WS_BACKEND_* in use */
+    int epfd;                   /* epoll instance (epoll only) */
+    fd_set rdset;               /* Read interest (select only) */
+    fd_set wrset;               /* Write interest (select only) */
+    int max_fd;                 /* Largest registered fd (select only) */
+    void *data[FD_SETSIZE];     /* Registered pointers (select only) */
+    struct ws_uring_t *uring;   /* Mapped rings (io_uring only) */
+    ws_event_slot_t *slots;     /* Registration of each fd (io_uring only) */
+    int nslots;                 /* Number of slots (io_uring only) */
+};
+typedef struct ws_event_loop_t ws_event_loop_t;
+typedef ws_event_loop_t* ws_event_loop_p;
+
+/* Parses a backend name, returns -1 if unknown or unsupported */
+int ws_event_backend(const char *name);
+
+/* Returns the name of a backend */
+const char *ws_event_name(int backend);
+
+/* Creates the backend, returns 0 on success or -1 with errno set */
+int ws_event_init(ws_event_loop_p loop, int backend);
+
+/* Releases the backend */
+void ws_event_close(ws_event_loop_p loop);
+
+/* Registers fd with the given WS_EV_* interest */
+int ws_event_add(ws_event_loop_p loop, int fd, int events, void *data);
+
+/* Changes the interest of fd (no-op for edge-triggered backends) */
+int ws_event_mod(ws_event_loop_p loop, int fd, int events, void *data);
+
+/* Unregisters fd, must be called before it is closed */
+int ws_event_del(ws_event_loop_p loop, int fd);
+
+/* Waits for up to max ready sockets, timeout in ms (-1 blocks).
+   Returns the number of events, or -1 with errno set */
+int ws_event_wait(ws_event_loop_p loop, ws_event_t *events, int max, int timeout);
+
+#endif
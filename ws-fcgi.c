@@ -0,0 +1,419 @@
+/* Simple HTML web server FastCGI client */
+#include <stdio.h>          /* Socket paths */
+#include <stdlib.h>         /* Memory management */
+#include <string.h>         /* Memory copies */
+#include <unistd.h>         /* Lower level read and write */
+#include <sys/syscall.h>    /* Closing inherited fds */
+#include <errno.h>          /* Error handling */
+#include <signal.h>         /* Stopping spawned processes */
+#include <sys/socket.h>     /* Unix sockets */
+#include <sys/wait.h>       /* Reaping spawned processes */
+#include "ws-fcgi.h"        /* FastCGI consts and structs */
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+/* Globals */
+ws_fcgi_backend_t ws_fcgi_backends[WS_FCGI_MAX_BACKENDS];
+int ws_fcgi_backend_count = 0;
+
+/* Adds a backend from "prefix=socket", or "prefix=program" to spawn it.
+   Returns 0 or -1 with errno set */
+int ws_fcgi_add_backend(const char *spec, int spawn) {
+    const char *target = strchr(spec, '=');
+    if (target == NULL || spec[0] != '/' || target[1] == '\0'
+            || ws_fcgi_backend_count == WS_FCGI_MAX_BACKENDS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* "/app/" and "/app" are the same prefix, and "/" covers every path */
+    int len = target - spec;
+    while (len > 0 && spec[len-1] == '/') len--;
+    if (len >= WS_FCGI_PREFIX_LEN) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    ws_fcgi_backend_p backend = &ws_fcgi_backends[ws_fcgi_backend_count];
+    memset(backend, 0, sizeof(ws_fcgi_backend_t));
+    memcpy(backend->prefix, spec, len);
+    backend->prefix[len] = '\0';
+    backend->prefix_len = len;
+    if (spawn) {
+        backend->program = target+1;
+        snprintf(backend->path, sizeof(backend->path), "/tmp/ws-fcgi-%d-%d.sock",
+            (int)getpid(), ws_fcgi_backend_count);
+    } else if (strlen(target+1) >= sizeof(backend->path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    } else {
+        strcpy(backend->path, target+1);
+    }
+    ws_fcgi_backend_count++;
+    return 0;
+}
+
+/* Starts the processes of every spawned backend, returns 0 or -1 */
+int ws_fcgi_spawn(void) {
+    for (int b = 0; b < ws_fcgi_backend_count; b++) {
+        ws_fcgi_backend_p backend = &ws_fcgi_backends[b];
+        if (backend->program == NULL) continue;
+
+        /* The processes share one listening socket, handed over as fd 0 */
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, backend->path);
+        unlink(backend->path);
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener == -1) return -1;
+        if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1
+                || listen(listener, SOMAXCONN) == -1) {
+            int err = errno;
+            close(listener);
+            errno = err;
+            return -1;
+        }
+
+        char command[4096];
+        snprintf(command, sizeof(command), "exec %s", backend->program);
+        for (int i = 0; i < WS_FCGI_SPAWN; i++) {
+            pid_t pid = fork();
+            if (pid == -1) {
+                int err = errno;
+                close(listener);
+                errno = err;
+                return -1;
+            } else if (pid == 0) {
+                /* Nothing of the server's but stdout and stderr is kept */
+                dup2(listener, 0);
+#ifdef SYS_close_range
+                syscall(SYS_close_range, 3, ~0U, 0);
+#else
+                for (int fd = 3; fd < 1024; fd++) close(fd);
+#endif
+                signal(SIGPIPE, SIG_DFL);
+                execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+                _exit(127);
+            }
+            backend->pids[i] = pid;
+        }
+        close(listener);
+    }
+    return 0;
+}
+
+/* Stops the spawned processes and removes their sockets */
+void ws_fcgi_stop(void) {
+    for (int b = 0; b < ws_fcgi_backend_count; b++) {
+        ws_fcgi_backend_p backend = &ws_fcgi_backends[b];
+        if (backend->program == NULL) continue;
+        for (int i = 0; i < WS_FCGI_SPAWN; i++) {
+            if (backend->pids[i] > 0) {
+                kill(backend->pids[i], SIGTERM);
+                waitpid(backend->pids[i], NULL, 0);
+                backend->pids[i] = 0;
+            }
+        }
+        unlink(backend->path);
+    }
+}
+
+/* Returns the backend serving a request target, or -1 for none. The
+   longest prefix wins, and it must end at a path segment */
+int ws_fcgi_route(const char *target, int len) {
+    int best = -1;
+    for (int b = 0; b < ws_fcgi_backend_count; b++) {
+        ws_fcgi_backend_p backend = &ws_fcgi_backends[b];
+        int n = backend->prefix_len;
+        if (n <= len && memcmp(target, backend->prefix, n) == 0
+                && (n == len || target[n] == '/' || target[n] == '?')
+                && (best == -1 || n > ws_fcgi_backends[best].prefix_len)) {
+            best = b;
+        }
+    }
+    return best;
+}
+
+/* Makes room for len more bytes of queued records, returns 0 or -1 */
+static int reserve_out(ws_fcgi_conn_p conn, size_t len) {
+    /* Written bytes are dropped first */
+    if (conn->out_offset > 0) {
+        conn->out_len -= conn->out_offset;
+        memmove(conn->out, conn->out + conn->out_offset, conn->out_len);
+        conn->out_offset = 0;
+    }
+    if (conn->out_len + len <= conn->out_cap) return 0;
+    size_t cap = conn->out_cap ? conn->out_cap : 4096;
+    while (cap < conn->out_len + len) cap *= 2;
+    char *out = realloc(conn->out, cap);
+    if (out == NULL) return -1;
+    conn->out = out;
+    conn->out_cap = cap;
+    return 0;
+}
+
+/* Writes a record header into buf */
+static void put_header(unsigned char *buf, int type, int id, int len) {
+    buf[0] = WS_FCGI_VERSION;
+    buf[1] = type;
+    buf[2] = (id >> 8) & 0xff;
+    buf[3] = id & 0xff;
+    buf[4] = (len >> 8) & 0xff;
+    buf[5] = len & 0xff;
+    buf[6] = 0; /* No padding */
+    buf[7] = 0;
+}
+
+/* Queues bytes as records of a type, split as records require. An empty
+   stream ends with an empty record. Returns 0 or -1 */
+static int queue_stream(ws_fcgi_conn_p conn, int type, int id, const char *data, size_t len) {
+    size_t records = len / WS_FCGI_MAX_CONTENT + 1;
+    if (reserve_out(conn, len + records * WS_FCGI_HEADER_LEN) == -1) return -1;
+    do {
+        int n = len < WS_FCGI_MAX_CONTENT ? (int)len : WS_FCGI_MAX_CONTENT;
+        put_header((unsigned char *)conn->out + conn->out_len, type, id, n);
+        conn->out_len += WS_FCGI_HEADER_LEN;
+        if (n > 0) {
+            memcpy(conn->out + conn->out_len, data, n);
+            conn->out_len += n;
+            data += n;
+            len -= n;
+        }
+    } while (len > 0);
+    return 0;
+}
+
+/* Writes the length of a name or value into buf, returns its size */
+static int put_length(unsigned char *buf, int len) {
+    if (len < 128) {
+        buf[0] = len;
+        return 1;
+    }
+    buf[0] = ((len >> 24) & 0x7f) | 0x80;
+    buf[1] = (len >> 16) & 0xff;
+    buf[2] = (len >> 8) & 0xff;
+    buf[3] = len & 0xff;
+    return 4;
+}
+
+/* Reads the length of a name or value, returns its size or -1 if it runs
+   past end */
+static int get_length(const unsigned char *buf, const unsigned char *end, int *len) {
+    if (buf >= end) return -1;
+    if (buf[0] < 128) {
+        *len = buf[0];
+        return 1;
+    }
+    if (end - buf < 4) return -1;
+    *len = ((buf[0] & 0x7f) << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+    return 4;
+}
+
+/* Encodes name-value pairs into a malloc'd buffer, returns it or NULL */
+static char *encode_params(const ws_fcgi_param_t *params, int nparams, size_t *len) {
+    size_t size = 0;
+    for (int i = 0; i < nparams; i++) {
+        size += 8 + params[i].name_len + params[i].value_len;
+    }
+    unsigned char *buf = malloc(size ? size : 1);
+    if (buf == NULL) return NULL;
+    size_t n = 0;
+    for (int i = 0; i < nparams; i++) {
+        n += put_length(buf+n, params[i].name_len);
+        n += put_length(buf+n, params[i].value_len);
+        memcpy(buf+n, params[i].name, params[i].name_len);
+        n += params[i].name_len;
+        memcpy(buf+n, params[i].value, params[i].value_len);
+        n += params[i].value_len;
+    }
+    *len = n;
+    return (char *)buf;
+}
+
+/* Opens a connection to a backend and queues the FCGI_GET_VALUES query.
+   Returns 0 or -1 with errno set */
+int ws_fcgi_connect(ws_fcgi_conn_p conn, int backend) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, ws_fcgi_backends[backend].path);
+
+    /* Unix sockets connect at once or not at all */
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    memset(conn, 0, sizeof(ws_fcgi_conn_t));
+    conn->fd = fd;
+    conn->backend = backend;
+    conn->max_reqs = 1;
+    conn->in = malloc(WS_FCGI_IN_SIZE);
+    if (conn->in == NULL) {
+        ws_fcgi_close(conn);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* Whether it multiplexes, and how much, decides how many requests it gets */
+    static const ws_fcgi_param_t query[] = {
+        { "FCGI_MPXS_CONNS", 15, "", 0 },
+        { "FCGI_MAX_REQS", 13, "", 0 },
+    };
+    size_t len;
+    char *values = encode_params(query, 2, &len);
+    if (values == NULL || queue_stream(conn, WS_FCGI_GET_VALUES, 0, values, len) == -1) {
+        free(values);
+        ws_fcgi_close(conn);
+        errno = ENOMEM;
+        return -1;
+    }
+    free(values);
+    return 0;
+}
+
+/* Closes a connection and frees its buffers */
+void ws_fcgi_close(ws_fcgi_conn_p conn) {
+    if (conn->fd != -1) {
+        close(conn->fd);
+    }
+    free(conn->in);
+    free(conn->out);
+    memset(conn, 0, sizeof(ws_fcgi_conn_t));
+    conn->fd = -1;
+}
+
+/* Returns a free request id of a connection, or 0 if it is full */
+int ws_fcgi_free_id(ws_fcgi_conn_p conn) {
+    if (conn->active >= conn->max_reqs) return 0;
+    for (int id = 1; id <= conn->max_reqs; id++) {
+        if (conn->reqs[id] == NULL) return id;
+    }
+    return 0;
+}
+
+/* Queues a request with its parameters and an empty body.
+   Returns 0 or -1 with errno set */
+int ws_fcgi_request(ws_fcgi_conn_p conn, int id, const ws_fcgi_param_t *params, int nparams) {
+    /* A responder, and the connection stays open after it */
+    unsigned char begin[WS_FCGI_HEADER_LEN + 8] = { 0 };
+    put_header(begin, WS_FCGI_BEGIN_REQUEST, id, 8);
+    begin[WS_FCGI_HEADER_LEN + 1] = 1; /* FCGI_RESPONDER */
+    begin[WS_FCGI_HEADER_LEN + 2] = 1; /* FCGI_KEEP_CONN */
+
+    size_t len;
+    char *encoded = encode_params(params, nparams, &len);
+    if (encoded == NULL || reserve_out(conn, sizeof(begin)) == -1) {
+        free(encoded);
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(conn->out + conn->out_len, begin, sizeof(begin));
+    conn->out_len += sizeof(begin);
+    int result = 0;
+    if ((len > 0 && queue_stream(conn, WS_FCGI_PARAMS, id, encoded, len) == -1)
+            || queue_stream(conn, WS_FCGI_PARAMS, id, NULL, 0) == -1
+            || queue_stream(conn, WS_FCGI_STDIN, id, NULL, 0) == -1) {
+        errno = ENOMEM;
+        result = -1;
+    }
+    free(encoded);
+    return result;
+}
+
+/* Queues the abort of a request */
+int ws_fcgi_abort(ws_fcgi_conn_p conn, int id) {
+    if (reserve_out(conn, WS_FCGI_HEADER_LEN) == -1) return -1;
+    put_header((unsigned char *)conn->out + conn->out_len, WS_FCGI_ABORT_REQUEST, id, 0);
+    conn->out_len += WS_FCGI_HEADER_LEN;
+    return 0;
+}
+
+/* Writes queued records, returns bytes written, 0 once none are left, or
+   -1 with errno set (EAGAIN when the socket is full) */
+ssize_t ws_fcgi_flush(ws_fcgi_conn_p conn) {
+    if (conn->out_offset == conn->out_len) {
+        conn->out_offset = 0;
+        conn->out_len = 0;
+        return 0;
+    }
+    ssize_t n = send(conn->fd, conn->out + conn->out_offset,
+        conn->out_len - conn->out_offset, MSG_NOSIGNAL);
+    if (n > 0) {
+        conn->out_offset += n;
+    }
+    return n;
+}
+
+/* Reads what the socket has into the buffer, returns bytes read, 0 at
+   end of stream, or -1 with errno set */
+ssize_t ws_fcgi_read(ws_fcgi_conn_p conn) {
+    if (conn->in_len == WS_FCGI_IN_SIZE) {
+        errno = ENOBUFS; /* Records are consumed before reading more */
+        return -1;
+    }
+    ssize_t n = read(conn->fd, conn->in + conn->in_len, WS_FCGI_IN_SIZE - conn->in_len);
+    if (n > 0) {
+        conn->in_len += n;
+    }
+    return n;
+}
+
+/* Finds the first whole record in the buffer, returns TRUE if there is one.
+   It stays there until ws_fcgi_consume() */
+int ws_fcgi_peek(ws_fcgi_conn_p conn, ws_fcgi_record_t *record) {
+    const unsigned char *buf = (const unsigned char *)conn->in;
+    if (conn->in_len < WS_FCGI_HEADER_LEN) return FALSE;
+    int len = (buf[4] << 8) | buf[5];
+    int size = WS_FCGI_HEADER_LEN + len + buf[6];
+    if (conn->in_len < size) return FALSE;
+    record->type = buf[1];
+    record->id = (buf[2] << 8) | buf[3];
+    record->content = conn->in + WS_FCGI_HEADER_LEN;
+    record->len = len;
+    record->size = size;
+    return TRUE;
+}
+
+/* Drops a record found by ws_fcgi_peek() */
+void ws_fcgi_consume(ws_fcgi_conn_p conn, ws_fcgi_record_t *record) {
+    conn->in_len -= record->size;
+    memmove(conn->in, conn->in + record->size, conn->in_len);
+}
+
+/* Applies an FCGI_GET_VALUES_RESULT record to a connection */
+void ws_fcgi_values(ws_fcgi_conn_p conn, ws_fcgi_record_t *record) {
+    const unsigned char *buf = (const unsigned char *)record->content;
+    const unsigned char *end = buf + record->len;
+    int mpxs = FALSE, max_reqs = WS_FCGI_MAX_MPX;
+    while (buf < end) {
+        int name_len, value_len, n;
+        if ((n = get_length(buf, end, &name_len)) == -1) return;
+        buf += n;
+        if ((n = get_length(buf, end, &value_len)) == -1) return;
+        buf += n;
+        /* Each is up to 31 bits, so they are checked apart rather than summed */
+        if (name_len > end - buf || value_len > end - buf - name_len) return;
+
+        /* Values are decimal numbers */
+        char value[16];
+        int copy = value_len < (int)sizeof(value)-1 ? value_len : (int)sizeof(value)-1;
+        memcpy(value, buf + name_len, copy);
+        value[copy] = '\0';
+        if (name_len == 15 && memcmp(buf, "FCGI_MPXS_CONNS", 15) == 0) {
+            mpxs = atoi(value) > 0;
+        } else if (name_len == 13 && memcmp(buf, "FCGI_MAX_REQS", 13) == 0 && atoi(value) > 0) {
+            max_reqs = atoi(value);
+        }
+        buf += name_len + value_len;
+    }
+    conn->max_reqs = !mpxs ? 1 : max_reqs < WS_FCGI_MAX_MPX ? max_reqs : WS_FCGI_MAX_MPX;
+}
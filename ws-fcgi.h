@@ -0,0 +1,152 @@
+/* Simple HTML web server FastCGI client header */
+
+/*
+FastCGI Overview:
+ -  Requests whose path starts with a configured prefix are answered by a
+    FastCGI backend listening on a Unix socket: one given with -f, or one
+    spawned at startup from a program given with -F (its processes get the
+    listening socket as fd 0, as FastCGI programs expect)
+ -  Each worker keeps up to WS_FCGI_CONNS persistent connections to each
+    backend (FCGI_KEEP_CONN), opened on demand and registered with its
+    event loop like clients, so talking to a backend never blocks
+ -  Backends are asked (FCGI_GET_VALUES) whether they multiplex; those that
+    do get up to WS_FCGI_MAX_MPX requests at once on each connection, told
+    apart by request id, and the others one at a time. Requests that find
+    every connection busy wait in a queue for the next free one
+ -  This file only holds the protocol: building and parsing records, and a
+    connection's read and write buffers; web-server.c routes requests and
+    streams the backend's output into the client's SENDING stage
+*/
+
+#ifndef WS_FCGI_H
+#define WS_FCGI_H
+
+#include <stddef.h>         /* size_t */
+#include <sys/types.h>      /* pid_t, ssize_t */
+#include <sys/un.h>         /* Unix socket paths */
+
+/* Define record types (FastCGI 1.0) */
+#define WS_FCGI_BEGIN_REQUEST     1
+#define WS_FCGI_ABORT_REQUEST     2
+#define WS_FCGI_END_REQUEST       3
+#define WS_FCGI_PARAMS            4
+#define WS_FCGI_STDIN             5
+#define WS_FCGI_STDOUT            6
+#define WS_FCGI_STDERR            7
+#define WS_FCGI_GET_VALUES        9
+#define WS_FCGI_GET_VALUES_RESULT 10
+
+/* Define misc */
+#define WS_FCGI_VERSION     1
+#define WS_FCGI_HEADER_LEN  8  /* Bytes before a record's content */
+#define WS_FCGI_MAX_CONTENT 65535 /* Largest content of one record */
+#define WS_FCGI_IN_SIZE     (WS_FCGI_HEADER_LEN + WS_FCGI_MAX_CONTENT + 255) /* Room for any record */
+#define WS_FCGI_MAX_BACKENDS 8 /* Prefixes that can be routed */
+#define WS_FCGI_PREFIX_LEN  64 /* Longest prefix, with its terminator */
+#define WS_FCGI_CONNS       8  /* Connections each worker keeps to a backend */
+#define WS_FCGI_MAX_MPX     16 /* Requests in flight on one connection */
+#define WS_FCGI_SPAWN       2  /* Processes started for a -F program */
+#define WS_FCGI_STREAM_MAX  (1<<18) /* Output held for a slow client before its connection pauses */
+
+/* A parameter sent with a request */
+struct ws_fcgi_param_t {
+    const char *name;
+    int name_len;
+    const char *value;
+    int value_len;
+};
+typedef struct ws_fcgi_param_t ws_fcgi_param_t;
+
+/* A record read from a backend, pointing into its connection's buffer */
+struct ws_fcgi_record_t {
+    int type;                       /* WS_FCGI_* record type */
+    int id;                         /* Request id, 0 for management records */
+    const char *content;            /* Content bytes */
+    int len;                        /* Number of them */
+    int size;                       /* Bytes of the whole record, padding included */
+};
+typedef struct ws_fcgi_record_t ws_fcgi_record_t;
+
+/* Where requests with a prefix go */
+struct ws_fcgi_backend_t {
+    char prefix[WS_FCGI_PREFIX_LEN]; /* Path prefix, without a trailing slash */
+    int prefix_len;                 /* Its length */
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)]; /* Unix socket */
+    const char *program;            /* Command spawned on the socket, or NULL */
+    pid_t pids[WS_FCGI_SPAWN];      /* Processes running it, 0 if none */
+};
+typedef struct ws_fcgi_backend_t ws_fcgi_backend_t;
+typedef ws_fcgi_backend_t* ws_fcgi_backend_p;
+
+/* A connection to a backend */
+struct ws_fcgi_conn_t {
+    int fd;                         /* Socket, or -1 if not connected */
+    int backend;                    /* Index of the backend */
+    int max_reqs;                   /* Requests it may carry at once, 1 until known */
+    int active;                     /* Requests in flight on it */
+    void *reqs[WS_FCGI_MAX_MPX+1];  /* Owner of each request id (from 1), NULL if free */
+    int ready;                      /* WS_EV_* flags known ready, until EAGAIN */
+    int paused;                     /* TRUE while a record waits for its client to drain */
+    char *in;                       /* Bytes read, WS_FCGI_IN_SIZE of room */
+    int in_len;                     /* Number of them */
+    char *out;                      /* Records waiting to be written */
+    size_t out_offset;              /* Offset of the next byte to write */
+    size_t out_len;                 /* Bytes in out */
+    size_t out_cap;                 /* Room in out */
+};
+typedef struct ws_fcgi_conn_t ws_fcgi_conn_t;
+typedef ws_fcgi_conn_t* ws_fcgi_conn_p;
+
+/* Backends, set up before the workers start and only read after */
+extern ws_fcgi_backend_t ws_fcgi_backends[WS_FCGI_MAX_BACKENDS];
+extern int ws_fcgi_backend_count;
+
+/* Adds a backend from "prefix=socket", or "prefix=program" to spawn it.
+   Returns 0 or -1 with errno set */
+int ws_fcgi_add_backend(const char *spec, int spawn);
+
+/* Starts the processes of every spawned backend, returns 0 or -1 */
+int ws_fcgi_spawn(void);
+
+/* Stops the spawned processes and removes their sockets */
+void ws_fcgi_stop(void);
+
+/* Returns the backend serving a request target, or -1 for none */
+int ws_fcgi_route(const char *target, int len);
+
+/* Opens a connection to a backend and queues the FCGI_GET_VALUES query.
+   Returns 0 or -1 with errno set */
+int ws_fcgi_connect(ws_fcgi_conn_p conn, int backend);
+
+/* Closes a connection and frees its buffers */
+void ws_fcgi_close(ws_fcgi_conn_p conn);
+
+/* Returns a free request id of a connection, or 0 if it is full */
+int ws_fcgi_free_id(ws_fcgi_conn_p conn);
+
+/* Queues a request with its parameters and an empty body.
+   Returns 0 or -1 with errno set */
+int ws_fcgi_request(ws_fcgi_conn_p conn, int id, const ws_fcgi_param_t *params, int nparams);
+
+/* Queues the abort of a request */
+int ws_fcgi_abort(ws_fcgi_conn_p conn, int id);
+
+/* Writes queued records, returns bytes written, 0 once none are left, or
+   -1 with errno set (EAGAIN when the socket is full) */
+ssize_t ws_fcgi_flush(ws_fcgi_conn_p conn);
+
+/* Reads what the socket has into the buffer, returns bytes read, 0 at
+   end of stream, or -1 with errno set */
+ssize_t ws_fcgi_read(ws_fcgi_conn_p conn);
+
+/* Finds the first whole record in the buffer, returns TRUE if there is one.
+   It stays there until ws_fcgi_consume() */
+int ws_fcgi_peek(ws_fcgi_conn_p conn, ws_fcgi_record_t *record);
+
+/* Drops a record found by ws_fcgi_peek() */
+void ws_fcgi_consume(ws_fcgi_conn_p conn, ws_fcgi_record_t *record);
+
+/* Applies an FCGI_GET_VALUES_RESULT record to a connection */
+void ws_fcgi_values(ws_fcgi_conn_p conn, ws_fcgi_record_t *record);
+
+#endif
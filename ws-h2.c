@@ -0,0 +1,1032 @@
+/* Simple HTML web server HTTP/2 */
+#include <stdio.h>          /* NULL */
+#include <stdlib.h>         /* Memory management */
+#include <string.h>         /* Memory copies */
+#include <strings.h>        /* Case-insensitive compares */
+#include "ws-h2.h"          /* HTTP/2 consts */
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+/* Define HPACK consts */
+#define WS_HPACK_STATIC    61 /* Entries of the static table */
+#define WS_HPACK_OVERHEAD  32 /* Size every entry counts for besides its strings */
+
+/* Static table (RFC 7541 Appendix A), from index 1 */
+static const char *static_names[WS_HPACK_STATIC] = {
+    ":authority", ":method", ":method", ":path",
+    ":path", ":scheme", ":scheme", ":status",
+    ":status", ":status", ":status", ":status",
+    ":status", ":status", "accept-charset", "accept-encoding",
+    "accept-language", "accept-ranges", "accept", "access-control-allow-origin",
+    "age", "allow", "authorization", "cache-control",
+    "content-disposition", "content-encoding", "content-language", "content-length",
+    "content-location", "content-range", "content-type", "cookie",
+    "date", "etag", "expect", "expires",
+    "from", "host", "if-match", "if-modified-since",
+    "if-none-match", "if-range", "if-unmodified-since", "last-modified",
+    "link", "location", "max-forwards", "proxy-authenticate",
+    "proxy-authorization", "range", "referer", "refresh",
+    "retry-after", "server", "set-cookie", "strict-transport-security",
+    "transfer-encoding", "user-agent", "vary", "via",
+    "www-authenticate",
+};
+static const char *static_values[WS_HPACK_STATIC] = {
+    "", "GET", "POST", "/", "/index.html", "http",
+    "https", "200", "204", "206", "304", "400",
+    "404", "500", "", "gzip, deflate", "", "",
+    "", "", "", "", "", "",
+    "", "", "", "", "", "",
+    "", "", "", "", "", "",
+    "", "", "", "", "", "",
+    "", "", "", "", "", "",
+    "", "", "", "", "", "",
+    "", "", "", "", "", "",
+    "",
+};
+
+/* Huffman code of each symbol and its length in bits (RFC 7541 Appendix B),
+   256 is EOS */
+static const uint32_t huff_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff,
+};
+static const uint8_t huff_lens[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+/* The code is canonical: codes of each length are consecutive, from the
+   first one, in the order of the symbols sorted by length */
+static const uint32_t huff_first[31] = {
+    0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x14, 0x5c,
+    0xf8, 0x0, 0x3f8, 0x7fa, 0xffa, 0x1ff8, 0x3ffc, 0x7ffc,
+    0x0, 0x0, 0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+    0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0, 0x3ffffffc,
+};
+static const uint16_t huff_index[31] = {
+    0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79, 82, 84, 90, 92,
+    0, 0, 0, 95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 0, 253,
+};
+static const uint16_t huff_count[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4,
+};
+static const uint16_t huff_symbols[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+    52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+    110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+    119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+    43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+    179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+    163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+    158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+    144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+    212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+    256,
+};
+
+/* Response fields whose values rarely repeat, sent without indexing so
+   they don't push the ones that do out of the peer's table */
+static const char *unindexed[] = {
+    "age", "content-length", "content-range", "date", "etag", "expires",
+    "last-modified", "location", "set-cookie", NULL
+};
+
+/* Reads a big-endian 32-bit int */
+static uint32_t get32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* Writes a big-endian 32-bit int */
+static void put32(unsigned char *p, uint32_t value) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+/* Drops the oldest entries of a table until its size is at most max */
+static void table_evict(ws_hpack_table_p table, int max) {
+    int drop = 0, bytes = 0;
+    while (table->size > max && drop < table->count) {
+        int len = table->name_lens[drop] + table->value_lens[drop];
+        table->size -= len + WS_HPACK_OVERHEAD;
+        bytes += len;
+        drop++;
+    }
+    if (drop == 0) return;
+
+    /* Entries are packed oldest first, so the dropped ones are the front */
+    memmove(table->data, table->data + bytes, table->data_len - bytes);
+    table->data_len -= bytes;
+    table->count -= drop;
+    for (int i = 0; i < table->count; i++) {
+        table->offsets[i] = table->offsets[i + drop] - bytes;
+        table->name_lens[i] = table->name_lens[i + drop];
+        table->value_lens[i] = table->value_lens[i + drop];
+    }
+}
+
+/* Adds an entry as the newest of a table. The strings must not point into
+   the table, since adding can evict them */
+static void table_add(ws_hpack_table_p table, const char *name, int name_len,
+        const char *value, int value_len) {
+    int size = name_len + value_len + WS_HPACK_OVERHEAD;
+    if (size > table->max_size) {
+        /* Too big for the table, which ends up empty */
+        table_evict(table, 0);
+        return;
+    }
+    table_evict(table, table->max_size - size);
+
+    int i = table->count++;
+    table->offsets[i] = table->data_len;
+    table->name_lens[i] = name_len;
+    table->value_lens[i] = value_len;
+    memcpy(table->data + table->data_len, name, name_len);
+    memcpy(table->data + table->data_len + name_len, value, value_len);
+    table->data_len += name_len + value_len;
+    table->size += size;
+}
+
+/* Looks up an index of the static and dynamic tables. Returns FALSE if
+   there is no such entry */
+static int table_get(ws_hpack_table_p table, uint32_t index, const char **name, int *name_len,
+        const char **value, int *value_len) {
+    if (index == 0) return FALSE;
+    if (index <= WS_HPACK_STATIC) {
+        *name = static_names[index - 1];
+        *name_len = strlen(*name);
+        *value = static_values[index - 1];
+        *value_len = strlen(*value);
+        return TRUE;
+    }
+
+    /* Dynamic entries are numbered newest first */
+    index -= WS_HPACK_STATIC;
+    if (index > (uint32_t)table->count) return FALSE;
+    int i = table->count - index;
+    *name = table->data + table->offsets[i];
+    *name_len = table->name_lens[i];
+    *value = *name + *name_len;
+    *value_len = table->value_lens[i];
+    return TRUE;
+}
+
+/* Finds a field in the tables. Returns the index of an entry matching it
+   whole, or 0 with the index of one matching its name in name_index */
+static uint32_t table_find(ws_hpack_table_p table, const ws_h2_field_t *field,
+        uint32_t *name_index) {
+    *name_index = 0;
+    for (int i = 0; i < WS_HPACK_STATIC; i++) {
+        if (strncmp(static_names[i], field->name, field->name_len) != 0
+                || static_names[i][field->name_len] != '\0') continue;
+        if (strncmp(static_values[i], field->value, field->value_len) == 0
+                && static_values[i][field->value_len] == '\0') {
+            return i + 1;
+        }
+        if (*name_index == 0) *name_index = i + 1;
+    }
+    for (int i = table->count - 1; i >= 0; i--) {
+        const char *name = table->data + table->offsets[i];
+        if (table->name_lens[i] != field->name_len
+                || memcmp(name, field->name, field->name_len) != 0) continue;
+        uint32_t index = WS_HPACK_STATIC + table->count - i;
+        if (table->value_lens[i] == field->value_len
+                && memcmp(name + field->name_len, field->value, field->value_len) == 0) {
+            return index;
+        }
+        if (*name_index == 0) *name_index = index;
+    }
+    return 0;
+}
+
+/* Decodes an integer with a prefix of bits. Returns the bytes it took,
+   or -1 if it is cut short or too large to be sane */
+static int get_int(const unsigned char *p, size_t len, int bits, uint32_t *value) {
+    if (len < 1) return -1;
+    uint32_t max = (1u << bits) - 1;
+    uint32_t v = p[0] & max;
+    if (v < max) {
+        *value = v;
+        return 1;
+    }
+    size_t i = 1;
+    int shift = 0;
+    do {
+        if (i >= len || shift > 21) return -1;
+        v += (uint32_t)(p[i] & 0x7f) << shift;
+        shift += 7;
+    } while (p[i++] & 0x80);
+    *value = v;
+    return i;
+}
+
+/* Encodes an integer with a prefix of bits, the rest of the first byte
+   being first. Returns the bytes written, or -1 if there is no room */
+static int put_int(unsigned char *p, size_t room, int bits, uint8_t first, uint32_t value) {
+    uint32_t max = (1u << bits) - 1;
+    if (room < 1) return -1;
+    if (value < max) {
+        p[0] = first | value;
+        return 1;
+    }
+    p[0] = first | max;
+    value -= max;
+    size_t i = 1;
+    while (value >= 0x80) {
+        if (i >= room) return -1;
+        p[i++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    if (i >= room) return -1;
+    p[i++] = value;
+    return i;
+}
+
+/* Decodes a Huffman string into buf. Returns its length, or -1 if it is
+   malformed or doesn't fit */
+static int huff_decode(const unsigned char *p, size_t len, char *buf, size_t room) {
+    uint32_t code = 0;
+    int bits = 0;
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        for (int b = 7; b >= 0; b--) {
+            code = code << 1 | ((p[i] >> b) & 1);
+            if (++bits > 30) return -1;
+
+            /* The code is canonical: codes of a length are consecutive, and
+               the prefix of a longer one is past them all */
+            uint32_t offset = code - huff_first[bits];
+            if (offset >= huff_count[bits]) continue;
+            int symbol = huff_symbols[huff_index[bits] + offset];
+            if (symbol == 256 || n == room) return -1;
+            buf[n++] = symbol;
+            code = 0;
+            bits = 0;
+        }
+    }
+
+    /* What's left must be padding: the start of EOS, all ones, under a byte */
+    if (bits > 7 || code != (1u << bits) - 1) return -1;
+    return n;
+}
+
+/* Returns the length of a string Huffman coded */
+static size_t huff_len(const char *s, int len) {
+    size_t bits = 0;
+    for (int i = 0; i < len; i++) {
+        bits += huff_lens[(unsigned char)s[i]];
+    }
+    return (bits + 7) / 8;
+}
+
+/* Huffman codes a string into out, which must have room for huff_len() */
+static void huff_encode(const char *s, int len, unsigned char *out) {
+    uint64_t acc = 0;
+    int bits = 0;
+    for (int i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        acc = acc << huff_lens[c] | huff_codes[c];
+        bits += huff_lens[c];
+        while (bits >= 8) {
+            bits -= 8;
+            *out++ = acc >> bits;
+        }
+        acc &= (1u << bits) - 1;
+    }
+    if (bits > 0) {
+        *out = acc << (8 - bits) | (0xff >> bits);
+    }
+}
+
+/* Decodes a string literal into buf. Returns the bytes of the block it
+   took, or -1 if it is malformed or doesn't fit */
+static int get_string(const unsigned char *p, size_t len, char *buf, size_t room, int *out_len) {
+    uint32_t n;
+    int used = get_int(p, len, 7, &n);
+    if (used < 0 || n > len - used) return -1;
+    if (p[0] & 0x80) {
+        int decoded = huff_decode(p + used, n, buf, room);
+        if (decoded < 0) return -1;
+        *out_len = decoded;
+    } else {
+        if (n > room) return -1;
+        memcpy(buf, p + used, n);
+        *out_len = n;
+    }
+    return used + n;
+}
+
+/* Encodes a string literal, Huffman coded when that is shorter. Returns
+   the bytes written, or -1 if there is no room */
+static int put_string(unsigned char *p, size_t room, const char *s, int len) {
+    size_t huff = huff_len(s, len);
+    int used;
+    if (huff < (size_t)len) {
+        used = put_int(p, room, 7, 0x80, huff);
+        if (used < 0 || room - used < huff) return -1;
+        huff_encode(s, len, p + used);
+        return used + huff;
+    }
+    used = put_int(p, room, 7, 0x00, len);
+    if (used < 0 || room - used < (size_t)len) return -1;
+    memcpy(p + used, s, len);
+    return used + len;
+}
+
+/* Returns TRUE if a field is worth a place in the peer's table */
+static int indexable(const ws_h2_field_t *field) {
+    for (int i = 0; unindexed[i] != NULL; i++) {
+        if (strncmp(unindexed[i], field->name, field->name_len) == 0
+                && unindexed[i][field->name_len] == '\0') return FALSE;
+    }
+    return TRUE;
+}
+
+/* Encodes fields into a header block */
+int ws_hpack_encode(ws_hpack_table_p table, const ws_h2_field_t *fields, int nfields,
+        unsigned char *out, size_t size) {
+    size_t pos = 0;
+    int used;
+
+    /* A smaller table the peer asked for is announced first */
+    if (table->update) {
+        used = put_int(out, size, 5, 0x20, table->max_size);
+        if (used < 0) return -1;
+        pos += used;
+        table->update = FALSE;
+    }
+
+    for (int i = 0; i < nfields; i++) {
+        const ws_h2_field_t *field = &fields[i];
+        uint32_t name_index;
+        uint32_t index = table_find(table, field, &name_index);
+        if (index) {
+            used = put_int(out + pos, size - pos, 7, 0x80, index);
+            if (used < 0) return -1;
+            pos += used;
+            continue;
+        }
+
+        int indexing = indexable(field);
+        if (indexing) {
+            used = put_int(out + pos, size - pos, 6, 0x40, name_index);
+        } else {
+            used = put_int(out + pos, size - pos, 4, 0x00, name_index);
+        }
+        if (used < 0) return -1;
+        pos += used;
+        if (name_index == 0) {
+            used = put_string(out + pos, size - pos, field->name, field->name_len);
+            if (used < 0) return -1;
+            pos += used;
+        }
+        used = put_string(out + pos, size - pos, field->value, field->value_len);
+        if (used < 0) return -1;
+        pos += used;
+        if (indexing) {
+            table_add(table, field->name, field->name_len, field->value, field->value_len);
+        }
+    }
+    return pos;
+}
+
+/* Copies a string into buf, returns where it went or NULL if it doesn't fit */
+static char *copy_string(char *buf, size_t size, size_t *used, const char *s, int len) {
+    if (size - *used < (size_t)len) return NULL;
+    char *copy = buf + *used;
+    memcpy(copy, s, len);
+    *used += len;
+    return copy;
+}
+
+/* Decodes a header block into fields */
+int ws_hpack_decode(ws_hpack_table_p table, const unsigned char *block, size_t len,
+        ws_h2_field_t *fields, int max, char *buf, size_t size) {
+    size_t pos = 0, used = 0;
+    int n = 0;
+    while (pos < len) {
+        uint8_t first = block[pos];
+        uint32_t index;
+        int ret;
+        const char *name, *value;
+        int name_len, value_len;
+
+        if (first & 0x80) {
+            /* Indexed field */
+            ret = get_int(block + pos, len - pos, 7, &index);
+            if (ret < 0 || !table_get(table, index, &name, &name_len, &value, &value_len)) return -1;
+            pos += ret;
+            name = copy_string(buf, size, &used, name, name_len);
+            value = copy_string(buf, size, &used, value, value_len);
+            if (name == NULL || value == NULL) return -1;
+        } else if ((first & 0xe0) == 0x20) {
+            /* Table size update, only allowed before the first field */
+            ret = get_int(block + pos, len - pos, 5, &index);
+            if (ret < 0 || index > WS_H2_TABLE_SIZE || n > 0) return -1;
+            pos += ret;
+            table->max_size = index;
+            table_evict(table, index);
+            continue;
+        } else {
+            /* Literal, with incremental indexing, without, or never indexed */
+            int indexing = (first & 0xc0) == 0x40;
+            ret = get_int(block + pos, len - pos, indexing ? 6 : 4, &index);
+            if (ret < 0) return -1;
+            pos += ret;
+            if (index) {
+                if (!table_get(table, index, &name, &name_len, &value, &value_len)) return -1;
+                name = copy_string(buf, size, &used, name, name_len);
+                if (name == NULL) return -1;
+            } else {
+                char *copy = buf + used;
+                ret = get_string(block + pos, len - pos, copy, size - used, &name_len);
+                if (ret < 0) return -1;
+                pos += ret;
+                used += name_len;
+                name = copy;
+            }
+            char *copy = buf + used;
+            ret = get_string(block + pos, len - pos, copy, size - used, &value_len);
+            if (ret < 0) return -1;
+            pos += ret;
+            used += value_len;
+            value = copy;
+            if (indexing) {
+                table_add(table, name, name_len, value, value_len);
+            }
+        }
+
+        if (n == max) return -1;
+        fields[n].name = name;
+        fields[n].name_len = name_len;
+        fields[n].value = value;
+        fields[n].value_len = value_len;
+        n++;
+    }
+    return n;
+}
+
+/* Moves what is left to write to the front of out, returns the room after it */
+static size_t out_room(ws_h2_conn_p conn) {
+    if (conn->out_offset > 0) {
+        memmove(conn->out, conn->out + conn->out_offset, conn->out_len - conn->out_offset);
+        conn->out_len -= conn->out_offset;
+        conn->out_offset = 0;
+    }
+    return WS_H2_OUT_SIZE - conn->out_len;
+}
+
+/* Writes a frame header */
+static void frame_header(char *p, size_t len, int type, int flags, uint32_t id) {
+    p[0] = len >> 16;
+    p[1] = len >> 8;
+    p[2] = len;
+    p[3] = type;
+    p[4] = flags;
+    put32((unsigned char *)p + 5, id & 0x7fffffff);
+}
+
+/* Queues a frame. Returns FALSE if there is no room for it */
+static int put_frame(ws_h2_conn_p conn, int type, int flags, uint32_t id,
+        const void *payload, size_t len) {
+    if (out_room(conn) < WS_H2_FRAME_HEADER + len) return FALSE;
+    frame_header(conn->out + conn->out_len, len, type, flags, id);
+    if (len > 0) {
+        memcpy(conn->out + conn->out_len + WS_H2_FRAME_HEADER, payload, len);
+    }
+    conn->out_len += WS_H2_FRAME_HEADER + len;
+    return TRUE;
+}
+
+/* Queues a RST_STREAM */
+static void put_reset(ws_h2_conn_p conn, uint32_t id, uint32_t code) {
+    unsigned char payload[4];
+    put32(payload, code);
+    put_frame(conn, WS_H2_RST_STREAM, 0, id, payload, sizeof(payload));
+}
+
+/* Queues a WINDOW_UPDATE */
+static void put_window_update(ws_h2_conn_p conn, uint32_t id, uint32_t increment) {
+    unsigned char payload[4];
+    put32(payload, increment);
+    put_frame(conn, WS_H2_WINDOW_UPDATE, 0, id, payload, sizeof(payload));
+}
+
+/* Returns an open stream by id, or NULL */
+static ws_h2_stream_p find_stream(ws_h2_conn_p conn, uint32_t id) {
+    for (int i = 0; i < WS_H2_MAX_STREAMS; i++) {
+        if (conn->streams[i].id == id) return &conn->streams[i];
+    }
+    return NULL;
+}
+
+/* Opens a stream in a free slot, or returns NULL if there is none */
+static ws_h2_stream_p open_stream(ws_h2_conn_p conn, uint32_t id) {
+    ws_h2_stream_p stream = find_stream(conn, 0);
+    if (stream == NULL) return NULL;
+    stream->id = id;
+    stream->window = conn->initial_window;
+    stream->data = NULL;
+    conn->active++;
+    return stream;
+}
+
+/* Applies a SETTINGS payload. Returns 0, or the error code it deserves */
+static uint32_t apply_settings(ws_h2_conn_p conn, const unsigned char *p, size_t len) {
+    for (size_t i = 0; i + 6 <= len; i += 6) {
+        int id = p[i] << 8 | p[i + 1];
+        uint32_t value = get32(p + i + 2);
+        switch (id) {
+            case WS_H2_SETTINGS_HEADER_TABLE_SIZE:
+                /* Our encoder never uses more than our own default */
+                if (value > WS_H2_TABLE_SIZE) value = WS_H2_TABLE_SIZE;
+                if ((int)value != conn->encoder.max_size) {
+                    conn->encoder.max_size = value;
+                    table_evict(&conn->encoder, value);
+                    conn->encoder.update = TRUE;
+                }
+                break;
+            case WS_H2_SETTINGS_ENABLE_PUSH:
+                if (value > 1) return WS_H2_PROTOCOL_ERROR;
+                break;
+            case WS_H2_SETTINGS_INITIAL_WINDOW_SIZE:
+                if (value > WS_H2_MAX_WINDOW) return WS_H2_FLOW_CONTROL_ERROR;
+                /* Open streams' windows move by the difference */
+                for (int s = 0; s < WS_H2_MAX_STREAMS; s++) {
+                    if (conn->streams[s].id == 0) continue;
+                    conn->streams[s].window += (long)value - conn->initial_window;
+                    if (conn->streams[s].window > WS_H2_MAX_WINDOW) return WS_H2_FLOW_CONTROL_ERROR;
+                }
+                conn->initial_window = value;
+                break;
+            case WS_H2_SETTINGS_MAX_FRAME_SIZE:
+                if (value < WS_H2_MAX_FRAME || value > 0xffffff) return WS_H2_PROTOCOL_ERROR;
+                conn->max_frame = value;
+                break;
+            default:
+                /* Limits on what we send that we stay under anyway, or unknown */
+                break;
+        }
+    }
+    return 0;
+}
+
+/* Starts a connection */
+ws_h2_conn_p ws_h2_new(const char *before, size_t len) {
+    ws_h2_conn_p conn = malloc(sizeof(ws_h2_conn_t));
+    if (conn == NULL) return NULL;
+    memset(conn->streams, 0, sizeof(conn->streams));
+    conn->active = 0;
+    conn->next = 0;
+    conn->last_id = 0;
+    conn->window = WS_H2_WINDOW;
+    conn->initial_window = WS_H2_WINDOW;
+    conn->max_frame = WS_H2_MAX_FRAME;
+    conn->preface = TRUE;
+    conn->closing = FALSE;
+    conn->failed = FALSE;
+    conn->block_id = 0;
+    conn->block_len = 0;
+    memset(&conn->decoder, 0, sizeof(conn->decoder));
+    conn->decoder.max_size = WS_H2_TABLE_SIZE;
+    memset(&conn->encoder, 0, sizeof(conn->encoder));
+    conn->encoder.max_size = WS_H2_TABLE_SIZE;
+    conn->in_len = 0;
+    conn->out_offset = 0;
+    conn->out_len = 0;
+    if (len > 0) {
+        memcpy(conn->out, before, len);
+        conn->out_len = len;
+    }
+
+    /* No pushes, and no more streams or fields than a connection holds */
+    unsigned char settings[18];
+    settings[0] = 0;
+    settings[1] = WS_H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    put32(settings + 2, WS_H2_MAX_STREAMS);
+    settings[6] = 0;
+    settings[7] = WS_H2_SETTINGS_ENABLE_PUSH;
+    put32(settings + 8, 0);
+    settings[12] = 0;
+    settings[13] = WS_H2_SETTINGS_MAX_HEADER_LIST_SIZE;
+    put32(settings + 14, WS_H2_FIELDS_SIZE);
+    put_frame(conn, WS_H2_SETTINGS, 0, 0, settings, sizeof(settings));
+    return conn;
+}
+
+/* Frees a connection */
+void ws_h2_free(ws_h2_conn_p conn) {
+    free(conn);
+}
+
+/* Returns the value of a base64url digit, or -1 */
+static int base64_digit(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '-' || c == '+') return 62;
+    if (c == '_' || c == '/') return 63;
+    return -1;
+}
+
+/* Applies the settings of an upgrade request and opens stream 1 */
+ws_h2_stream_p ws_h2_upgrade(ws_h2_conn_p conn, const char *settings, int len) {
+    unsigned char payload[WS_H2_MAX_FRAME];
+    size_t n = 0;
+    uint32_t acc = 0;
+    int bits = 0;
+    for (int i = 0; i < len && settings[i] != '='; i++) {
+        int digit = base64_digit(settings[i]);
+        if (digit < 0 || n == sizeof(payload)) return NULL;
+        acc = acc << 6 | digit;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            payload[n++] = acc >> bits;
+            acc &= (1u << bits) - 1;
+        }
+    }
+    if (n % 6 != 0 || apply_settings(conn, payload, n) != 0) return NULL;
+
+    conn->last_id = 1;
+    return open_stream(conn, 1);
+}
+
+/* Returns where bytes read go */
+char *ws_h2_in(ws_h2_conn_p conn, size_t *room) {
+    *room = sizeof(conn->in) - conn->in_len;
+    return conn->in + conn->in_len;
+}
+
+/* Adds bytes read */
+void ws_h2_read(ws_h2_conn_p conn, size_t n) {
+    conn->in_len += n;
+}
+
+/* Fails the connection with a GOAWAY */
+static int conn_error(ws_h2_conn_p conn, uint32_t code) {
+    ws_h2_goaway(conn, code);
+    conn->failed = TRUE;
+    conn->in_len = 0;
+    return WS_H2_EVENT_ERROR;
+}
+
+/* Decodes a whole header block, opening its stream if it is a request */
+static int header_block(ws_h2_conn_p conn, ws_h2_event_t *ev) {
+    uint32_t id = conn->block_id;
+    conn->block_id = 0;
+
+    /* Even blocks that are ignored change the decoder's table */
+    int n = ws_hpack_decode(&conn->decoder, (unsigned char *)conn->block, conn->block_len,
+        ev->fields, WS_H2_MAX_FIELDS, conn->fields, sizeof(conn->fields));
+    if (n < 0) return conn_error(conn, WS_H2_COMPRESSION_ERROR);
+
+    /* Trailers, and blocks of streams already closed, are of no use */
+    if (find_stream(conn, id) || id <= conn->last_id) return WS_H2_EVENT_NONE;
+    if (id % 2 == 0) return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+    conn->last_id = id;
+    if (conn->closing) return WS_H2_EVENT_NONE;
+
+    ev->stream = open_stream(conn, id);
+    if (ev->stream == NULL) {
+        put_reset(conn, id, WS_H2_REFUSED_STREAM);
+        return WS_H2_EVENT_NONE;
+    }
+    ev->nfields = n;
+    return WS_H2_EVENT_REQUEST;
+}
+
+/* Handles one frame. Returns what it needs from the server */
+static int handle_frame(ws_h2_conn_p conn, int type, int flags, uint32_t id,
+        const unsigned char *p, size_t len, ws_h2_event_t *ev) {
+    ws_h2_stream_p stream;
+
+    /* A header block must be continued before anything else */
+    if (conn->block_id && type != WS_H2_CONTINUATION) {
+        return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+    }
+
+    switch (type) {
+        case WS_H2_DATA:
+            if (id == 0) return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+            /* Request bodies aren't used, so their bytes are handed straight
+               back, padding included */
+            if (len > 0) {
+                put_window_update(conn, 0, len);
+                if (find_stream(conn, id) && !(flags & WS_H2_FLAG_END_STREAM)) {
+                    put_window_update(conn, id, len);
+                }
+            }
+            return WS_H2_EVENT_NONE;
+
+        case WS_H2_HEADERS:
+            if (id == 0) return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+            if (flags & WS_H2_FLAG_PADDED) {
+                if (len < 1 || p[0] >= len) return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+                len -= 1 + p[0];
+                p++;
+            }
+            if (flags & WS_H2_FLAG_PRIORITY) {
+                if (len < 5) return conn_error(conn, WS_H2_FRAME_SIZE_ERROR);
+                p += 5;
+                len -= 5;
+            }
+            memcpy(conn->block, p, len);
+            conn->block_len = len;
+            conn->block_id = id;
+            conn->block_end = flags & WS_H2_FLAG_END_STREAM;
+            if (flags & WS_H2_FLAG_END_HEADERS) return header_block(conn, ev);
+            return WS_H2_EVENT_NONE;
+
+        case WS_H2_CONTINUATION:
+            if (conn->block_id == 0 || id != conn->block_id) {
+                return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+            }
+            if (conn->block_len + len > sizeof(conn->block)) {
+                return conn_error(conn, WS_H2_ENHANCE_YOUR_CALM);
+            }
+            memcpy(conn->block + conn->block_len, p, len);
+            conn->block_len += len;
+            if (flags & WS_H2_FLAG_END_HEADERS) return header_block(conn, ev);
+            return WS_H2_EVENT_NONE;
+
+        case WS_H2_PRIORITY:
+            /* Streams take turns anyway */
+            if (id == 0) return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+            return WS_H2_EVENT_NONE;
+
+        case WS_H2_RST_STREAM:
+            if (id == 0) return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+            if (len != 4) return conn_error(conn, WS_H2_FRAME_SIZE_ERROR);
+            stream = find_stream(conn, id);
+            if (stream == NULL) return WS_H2_EVENT_NONE;
+            stream->id = 0;
+            conn->active--;
+            ev->stream = stream;
+            return WS_H2_EVENT_RESET;
+
+        case WS_H2_SETTINGS:
+            if (id != 0) return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+            if (flags & WS_H2_FLAG_ACK) {
+                if (len != 0) return conn_error(conn, WS_H2_FRAME_SIZE_ERROR);
+                return WS_H2_EVENT_NONE;
+            }
+            if (len % 6 != 0) return conn_error(conn, WS_H2_FRAME_SIZE_ERROR);
+            uint32_t code = apply_settings(conn, p, len);
+            if (code) return conn_error(conn, code);
+            put_frame(conn, WS_H2_SETTINGS, WS_H2_FLAG_ACK, 0, NULL, 0);
+            return WS_H2_EVENT_NONE;
+
+        case WS_H2_PUSH_PROMISE:
+            /* Clients can't push */
+            return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+
+        case WS_H2_PING:
+            if (id != 0) return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+            if (len != 8) return conn_error(conn, WS_H2_FRAME_SIZE_ERROR);
+            if (!(flags & WS_H2_FLAG_ACK)) {
+                put_frame(conn, WS_H2_PING, WS_H2_FLAG_ACK, 0, p, len);
+            }
+            return WS_H2_EVENT_NONE;
+
+        case WS_H2_GOAWAY:
+            /* The peer is leaving: finish what it asked for, take nothing new */
+            if (id != 0) return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+            conn->closing = TRUE;
+            return WS_H2_EVENT_NONE;
+
+        case WS_H2_WINDOW_UPDATE:
+            if (len != 4) return conn_error(conn, WS_H2_FRAME_SIZE_ERROR);
+            uint32_t increment = get32(p) & 0x7fffffff;
+            if (id == 0) {
+                if (increment == 0) return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+                if (conn->window + increment > WS_H2_MAX_WINDOW) {
+                    return conn_error(conn, WS_H2_FLOW_CONTROL_ERROR);
+                }
+                conn->window += increment;
+                return WS_H2_EVENT_NONE;
+            }
+            stream = find_stream(conn, id);
+            if (stream == NULL) return WS_H2_EVENT_NONE;
+            if (increment == 0 || stream->window + increment > WS_H2_MAX_WINDOW) {
+                put_reset(conn, id, increment ? WS_H2_FLOW_CONTROL_ERROR : WS_H2_PROTOCOL_ERROR);
+                stream->id = 0;
+                conn->active--;
+                ev->stream = stream;
+                return WS_H2_EVENT_RESET;
+            }
+            stream->window += increment;
+            return WS_H2_EVENT_NONE;
+
+        default:
+            /* Unknown frames are ignored */
+            return WS_H2_EVENT_NONE;
+    }
+}
+
+/* Handles the frames read until one needs the server */
+int ws_h2_next(ws_h2_conn_p conn, ws_h2_event_t *ev) {
+    if (conn->failed) {
+        conn->in_len = 0;
+        return WS_H2_EVENT_NONE;
+    }
+
+    size_t pos = 0;
+    int event = WS_H2_EVENT_NONE;
+    if (conn->preface) {
+        size_t n = conn->in_len < WS_H2_PREFACE_LEN ? conn->in_len : WS_H2_PREFACE_LEN;
+        if (memcmp(conn->in, WS_H2_PREFACE, n) != 0) return conn_error(conn, WS_H2_PROTOCOL_ERROR);
+        if (n < WS_H2_PREFACE_LEN) return WS_H2_EVENT_NONE;
+        pos = WS_H2_PREFACE_LEN;
+        conn->preface = FALSE;
+    }
+
+    /* Frames are only taken while their answers (ACKs, WINDOW_UPDATEs,
+       resets) are sure to fit */
+    while (event == WS_H2_EVENT_NONE && conn->in_len - pos >= WS_H2_FRAME_HEADER
+            && out_room(conn) >= WS_H2_RESERVE) {
+        const unsigned char *p = (unsigned char *)conn->in + pos;
+        size_t len = p[0] << 16 | p[1] << 8 | p[2];
+        if (len > WS_H2_MAX_FRAME) {
+            event = conn_error(conn, WS_H2_FRAME_SIZE_ERROR);
+            return event;
+        }
+        if (conn->in_len - pos < WS_H2_FRAME_HEADER + len) break;
+        pos += WS_H2_FRAME_HEADER + len;
+        event = handle_frame(conn, p[3], p[4], get32(p + 5) & 0x7fffffff,
+            p + WS_H2_FRAME_HEADER, len, ev);
+        if (conn->failed) return event;
+    }
+
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+    return event;
+}
+
+/* Queues the response header of a stream */
+int ws_h2_headers(ws_h2_conn_p conn, ws_h2_stream_p stream, const ws_h2_field_t *fields,
+        int nfields, int end_stream) {
+    /* Streams wait for the client's preface, so an upgrading client has
+       switched before its answer comes */
+    if (conn->preface) return FALSE;
+
+    /* The block is at most a little over the strings in it */
+    size_t bound = 8;
+    for (int i = 0; i < nfields; i++) {
+        bound += fields[i].name_len + fields[i].value_len + 12;
+    }
+    if (bound > WS_H2_BLOCK_SIZE) bound = WS_H2_BLOCK_SIZE;
+    size_t frames = bound / conn->max_frame + 1;
+    if (out_room(conn) < bound + frames * WS_H2_FRAME_HEADER + WS_H2_RESERVE) return FALSE;
+
+    unsigned char block[WS_H2_BLOCK_SIZE];
+    int len = ws_hpack_encode(&conn->encoder, fields, nfields, block, bound);
+    if (len < 0) return FALSE;
+
+    /* A HEADERS frame, then CONTINUATIONs if it takes more than one */
+    int type = WS_H2_HEADERS;
+    int pos = 0;
+    do {
+        int chunk = len - pos < conn->max_frame ? len - pos : conn->max_frame;
+        int flags = 0;
+        if (type == WS_H2_HEADERS && end_stream) flags |= WS_H2_FLAG_END_STREAM;
+        if (pos + chunk == len) flags |= WS_H2_FLAG_END_HEADERS;
+        put_frame(conn, type, flags, stream->id, block + pos, chunk);
+        pos += chunk;
+        type = WS_H2_CONTINUATION;
+    } while (pos < len);
+    return TRUE;
+}
+
+/* Returns the most DATA bytes a stream may queue now */
+size_t ws_h2_data_room(ws_h2_conn_p conn, ws_h2_stream_p stream) {
+    if (conn->preface) return 0;
+    size_t room = out_room(conn);
+    if (room < WS_H2_RESERVE + WS_H2_FRAME_HEADER) return 0;
+    room -= WS_H2_RESERVE + WS_H2_FRAME_HEADER;
+    long window = conn->window < stream->window ? conn->window : stream->window;
+    if (window <= 0) return 0;
+    if (room > (size_t)window) room = window;
+    if (room > (size_t)conn->max_frame) room = conn->max_frame;
+    return room;
+}
+
+/* Returns where the next DATA frame's payload goes */
+char *ws_h2_data_buf(ws_h2_conn_p conn) {
+    out_room(conn);
+    return conn->out + conn->out_len + WS_H2_FRAME_HEADER;
+}
+
+/* Queues a DATA frame already at ws_h2_data_buf() */
+int ws_h2_data(ws_h2_conn_p conn, ws_h2_stream_p stream, size_t len, int end_stream) {
+    if (WS_H2_OUT_SIZE - conn->out_len < WS_H2_FRAME_HEADER + len) return FALSE;
+    frame_header(conn->out + conn->out_len, len, WS_H2_DATA,
+        end_stream ? WS_H2_FLAG_END_STREAM : 0, stream->id);
+    conn->out_len += WS_H2_FRAME_HEADER + len;
+    conn->window -= len;
+    stream->window -= len;
+    return TRUE;
+}
+
+/* Frees a stream the server is done with */
+void ws_h2_close(ws_h2_conn_p conn, ws_h2_stream_p stream) {
+    stream->id = 0;
+    stream->data = NULL;
+    conn->active--;
+}
+
+/* Resets a stream and frees it */
+void ws_h2_reset(ws_h2_conn_p conn, ws_h2_stream_p stream, uint32_t code) {
+    put_reset(conn, stream->id, code);
+    ws_h2_close(conn, stream);
+}
+
+/* Queues a GOAWAY */
+void ws_h2_goaway(ws_h2_conn_p conn, uint32_t code) {
+    if (conn->closing && !conn->failed && code == WS_H2_NO_ERROR) return;
+    unsigned char payload[8];
+    put32(payload, conn->last_id);
+    put32(payload + 4, code);
+    put_frame(conn, WS_H2_GOAWAY, 0, 0, payload, sizeof(payload));
+    conn->closing = TRUE;
+}
+
+/* Returns the frames waiting to be written */
+const char *ws_h2_out(ws_h2_conn_p conn, size_t *len) {
+    *len = conn->out_len - conn->out_offset;
+    return conn->out + conn->out_offset;
+}
+
+/* Drops bytes written */
+void ws_h2_wrote(ws_h2_conn_p conn, size_t n) {
+    conn->out_offset += n;
+    if (conn->out_offset == conn->out_len) {
+        conn->out_offset = 0;
+        conn->out_len = 0;
+    }
+}
+
+/* Returns TRUE once a closing connection has sent everything it will */
+int ws_h2_done(ws_h2_conn_p conn) {
+    return conn->closing && conn->out_offset == conn->out_len
+        && (conn->failed || conn->active == 0);
+}
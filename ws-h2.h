@@ -0,0 +1,226 @@
+/* Simple HTML web server HTTP/2 header */
+
+/*
+HTTP/2 Overview:
+ -  Cleartext connections switch to HTTP/2 when they start with the client
+    preface (prior knowledge), or when a request asks to with "Upgrade: h2c"
+    and HTTP2-Settings, which is then answered as stream 1; HTTPS ones when
+    the client picks h2 through ALPN
+ -  Each request arrives on a stream of its own, up to WS_H2_MAX_STREAMS at
+    once on a connection, and its header block is HPACK decoded (dynamic
+    table and Huffman coding included) into a plain list of fields
+ -  Responses are HPACK encoded too: fields that repeat between responses
+    (content type, cache control...) go into the dynamic table the first
+    time and are one byte after that, the rest are sent as literals
+ -  Frames waiting to be written are kept in one buffer per connection;
+    DATA frames are only added while both the stream's and the connection's
+    send windows allow it, and while there is room left for control frames
+ -  This file only holds the protocol: framing, settings, flow control and
+    HPACK; web-server.c answers each stream with a client node of its own,
+    and takes turns between the streams one DATA frame at a time, so files
+    sent on one connection are interleaved
+*/
+
+#ifndef WS_H2_H
+#define WS_H2_H
+
+#include <stddef.h>         /* size_t */
+#include <stdint.h>         /* Fixed width ints */
+
+/* Define frame types (RFC 9113) */
+#define WS_H2_DATA          0x0
+#define WS_H2_HEADERS       0x1
+#define WS_H2_PRIORITY      0x2
+#define WS_H2_RST_STREAM    0x3
+#define WS_H2_SETTINGS      0x4
+#define WS_H2_PUSH_PROMISE  0x5
+#define WS_H2_PING          0x6
+#define WS_H2_GOAWAY        0x7
+#define WS_H2_WINDOW_UPDATE 0x8
+#define WS_H2_CONTINUATION  0x9
+
+/* Define frame flags */
+#define WS_H2_FLAG_END_STREAM  0x1
+#define WS_H2_FLAG_ACK         0x1
+#define WS_H2_FLAG_END_HEADERS 0x4
+#define WS_H2_FLAG_PADDED      0x8
+#define WS_H2_FLAG_PRIORITY    0x20
+
+/* Define settings */
+#define WS_H2_SETTINGS_HEADER_TABLE_SIZE      0x1
+#define WS_H2_SETTINGS_ENABLE_PUSH            0x2
+#define WS_H2_SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define WS_H2_SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define WS_H2_SETTINGS_MAX_FRAME_SIZE         0x5
+#define WS_H2_SETTINGS_MAX_HEADER_LIST_SIZE   0x6
+
+/* Define error codes */
+#define WS_H2_NO_ERROR          0x0
+#define WS_H2_PROTOCOL_ERROR    0x1
+#define WS_H2_INTERNAL_ERROR    0x2
+#define WS_H2_FLOW_CONTROL_ERROR 0x3
+#define WS_H2_STREAM_CLOSED     0x5
+#define WS_H2_FRAME_SIZE_ERROR  0x6
+#define WS_H2_REFUSED_STREAM    0x7
+#define WS_H2_CANCEL            0x8
+#define WS_H2_COMPRESSION_ERROR 0x9
+#define WS_H2_ENHANCE_YOUR_CALM 0xb
+
+/* Define what ws_h2_next() found */
+#define WS_H2_EVENT_NONE    0 /* No whole frame left, or no room to answer one */
+#define WS_H2_EVENT_REQUEST 1 /* A stream's request header arrived */
+#define WS_H2_EVENT_RESET   2 /* A stream was reset, and its slot is free */
+#define WS_H2_EVENT_ERROR   3 /* The connection failed, a GOAWAY is queued */
+
+/* Define misc */
+#define WS_H2_PREFACE       "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define WS_H2_PREFACE_LEN   24
+#define WS_H2_FRAME_HEADER  9  /* Bytes before a frame's payload */
+#define WS_H2_MAX_FRAME     16384 /* Largest frame read, and written unless the peer allows more */
+#define WS_H2_MAX_STREAMS   32 /* Streams a peer may have open at once */
+#define WS_H2_WINDOW        65535 /* Initial flow-control window */
+#define WS_H2_MAX_WINDOW    0x7fffffffL /* Largest window */
+#define WS_H2_TABLE_SIZE    4096 /* HPACK dynamic table of each direction */
+#define WS_H2_TABLE_ENTRIES (WS_H2_TABLE_SIZE / 32) /* Most entries one can hold */
+#define WS_H2_MAX_FIELDS    64 /* Header fields in one request */
+#define WS_H2_FIELDS_SIZE   8192 /* Decoded bytes of one request's fields */
+#define WS_H2_BLOCK_SIZE    16384 /* Encoded header block, with its CONTINUATIONs */
+#define WS_H2_OUT_SIZE      (1<<16) /* Frames queued for writing */
+#define WS_H2_RESERVE       1024 /* Room in out kept for control frames */
+
+/* A header field, decoded or to encode */
+struct ws_h2_field_t {
+    const char *name;
+    int name_len;
+    const char *value;
+    int value_len;
+};
+typedef struct ws_h2_field_t ws_h2_field_t;
+
+/* An HPACK dynamic table, its entries' strings packed oldest first */
+struct ws_hpack_table_t {
+    int offsets[WS_H2_TABLE_ENTRIES]; /* Start of each entry in data, oldest first */
+    int name_lens[WS_H2_TABLE_ENTRIES]; /* Length of each name, its value follows */
+    int value_lens[WS_H2_TABLE_ENTRIES]; /* Length of each value */
+    int count;                  /* Entries in the table */
+    char data[WS_H2_TABLE_SIZE]; /* Names and values */
+    int data_len;               /* Bytes of data used */
+    int size;                   /* HPACK size: lengths plus 32 per entry */
+    int max_size;               /* Size it is held under */
+    int update;                 /* TRUE if the encoder must announce max_size */
+};
+typedef struct ws_hpack_table_t ws_hpack_table_t;
+typedef ws_hpack_table_t* ws_hpack_table_p;
+
+/* A stream of a connection */
+struct ws_h2_stream_t {
+    uint32_t id;                /* Stream id, 0 if the slot is free */
+    long window;                /* Bytes the peer lets us send on it */
+    void *data;                 /* Whatever answers it */
+};
+typedef struct ws_h2_stream_t ws_h2_stream_t;
+typedef ws_h2_stream_t* ws_h2_stream_p;
+
+/* What ws_h2_next() found */
+struct ws_h2_event_t {
+    ws_h2_stream_p stream;      /* Stream it is about */
+    ws_h2_field_t fields[WS_H2_MAX_FIELDS]; /* Request fields, pointing into the connection */
+    int nfields;                /* Number of them */
+};
+typedef struct ws_h2_event_t ws_h2_event_t;
+
+/* An HTTP/2 connection */
+struct ws_h2_conn_t {
+    ws_h2_stream_t streams[WS_H2_MAX_STREAMS]; /* Open streams */
+    int active;                 /* Number of them */
+    int next;                   /* Slot whose turn it is to send */
+    uint32_t last_id;           /* Highest stream id the peer opened */
+    long window;                /* Bytes the peer lets us send on the connection */
+    long initial_window;        /* Window of new streams, from the peer's settings */
+    int max_frame;              /* Largest frame the peer takes */
+    int preface;                /* TRUE until the client preface has arrived */
+    int closing;                /* TRUE once a GOAWAY is queued, no new streams are taken */
+    int failed;                 /* TRUE if that GOAWAY reported an error */
+    uint32_t block_id;          /* Stream of the header block being continued, 0 if none */
+    int block_end;              /* TRUE if that block ends its request */
+    int block_len;              /* Bytes of it */
+    char block[WS_H2_BLOCK_SIZE]; /* Fragments of a header block */
+    char fields[WS_H2_FIELDS_SIZE]; /* Strings of the last decoded request */
+    ws_hpack_table_t decoder;   /* Table of the requests' header blocks */
+    ws_hpack_table_t encoder;   /* Table of the responses' */
+    char in[WS_H2_FRAME_HEADER + WS_H2_MAX_FRAME]; /* Bytes read, at most a frame */
+    int in_len;                 /* Number of them */
+    char out[WS_H2_OUT_SIZE];   /* Frames waiting to be written */
+    size_t out_offset;          /* Offset of the next byte to write */
+    size_t out_len;             /* Bytes in out */
+};
+typedef struct ws_h2_conn_t ws_h2_conn_t;
+typedef ws_h2_conn_t* ws_h2_conn_p;
+
+/* Starts a connection, queueing the server's SETTINGS after any bytes
+   given (the 101 reply of an upgrade). Returns the connection or NULL */
+ws_h2_conn_p ws_h2_new(const char *before, size_t len);
+
+/* Frees a connection */
+void ws_h2_free(ws_h2_conn_p conn);
+
+/* Applies the base64url HTTP2-Settings of an upgrade request and opens
+   stream 1 for it. Returns the stream, or NULL if the settings are bad */
+ws_h2_stream_p ws_h2_upgrade(ws_h2_conn_p conn, const char *settings, int len);
+
+/* Returns where bytes read go, and how many fit */
+char *ws_h2_in(ws_h2_conn_p conn, size_t *room);
+
+/* Adds n bytes read into the buffer ws_h2_in() returned */
+void ws_h2_read(ws_h2_conn_p conn, size_t n);
+
+/* Handles the frames read until one needs the server, returns what it
+   needs as a WS_H2_EVENT_* */
+int ws_h2_next(ws_h2_conn_p conn, ws_h2_event_t *ev);
+
+/* Queues the response header of a stream, ending it too if end_stream.
+   Returns FALSE if there is no room for it yet, or the client's preface
+   hasn't arrived */
+int ws_h2_headers(ws_h2_conn_p conn, ws_h2_stream_p stream, const ws_h2_field_t *fields,
+    int nfields, int end_stream);
+
+/* Returns the most DATA bytes a stream may queue now, by the windows and
+   the room in out */
+size_t ws_h2_data_room(ws_h2_conn_p conn, ws_h2_stream_p stream);
+
+/* Returns where the next DATA frame's payload goes */
+char *ws_h2_data_buf(ws_h2_conn_p conn);
+
+/* Queues a DATA frame of len bytes, already at ws_h2_data_buf(). Returns
+   FALSE if there isn't room for even an empty frame */
+int ws_h2_data(ws_h2_conn_p conn, ws_h2_stream_p stream, size_t len, int end_stream);
+
+/* Frees a stream the server is done with */
+void ws_h2_close(ws_h2_conn_p conn, ws_h2_stream_p stream);
+
+/* Resets a stream and frees it */
+void ws_h2_reset(ws_h2_conn_p conn, ws_h2_stream_p stream, uint32_t code);
+
+/* Queues a GOAWAY, after which no new streams are taken */
+void ws_h2_goaway(ws_h2_conn_p conn, uint32_t code);
+
+/* Returns where the frames waiting to be written start, and how many bytes */
+const char *ws_h2_out(ws_h2_conn_p conn, size_t *len);
+
+/* Drops n bytes written from the start of the queue */
+void ws_h2_wrote(ws_h2_conn_p conn, size_t n);
+
+/* Returns TRUE once a closing connection has sent everything it will */
+int ws_h2_done(ws_h2_conn_p conn);
+
+/* Encodes fields into a header block, returns its length or -1 if it
+   doesn't fit in size */
+int ws_hpack_encode(ws_hpack_table_p table, const ws_h2_field_t *fields, int nfields,
+    unsigned char *out, size_t size);
+
+/* Decodes a header block into fields, their strings copied into buf.
+   Returns the number of fields, or -1 if the block is malformed */
+int ws_hpack_decode(ws_hpack_table_p table, const unsigned char *block, size_t len,
+    ws_h2_field_t *fields, int max, char *buf, size_t size);
+
+#endif
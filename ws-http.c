@@ -0,0 +1,444 @@
+/* Simple HTML web server HTTP request parser */
+#define _GNU_SOURCE         /* strptime and timegm */
+#include <stddef.h>         /* offsetof */
+#include <time.h>           /* HTTP dates */
+#include <string.h>         /* String parsing */
+#include <strings.h>        /* Case-insensitive compares */
+#include "ws-http.h"        /* Parser consts and structs */
+#ifdef WS_HAVE_SSE2
+#include <immintrin.h>      /* SSE2 and AVX2 intrinsics */
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+/* Returns TRUE for bytes that may not appear in a request line or header:
+   control characters other than tab and CR, newlines included, and DEL */
+#define IS_STOP(C) ((C) < 0x20 ? (C) != '\t' && (C) != '\r' : (C) == 0x7f)
+
+/* Returns the first stop byte in [p, end), or end if there is none */
+static const char *scan_scalar(const char *p, const char *end) {
+    for (; p < end; p++) {
+        unsigned char c = *p;
+        if (IS_STOP(c)) return p;
+    }
+    return end;
+}
+
+#ifdef WS_HAVE_SSE2
+/* Same as scan_scalar, 16 bytes at a time */
+static const char *scan_sse2(const char *p, const char *end) {
+    const __m128i ctl = _mm_set1_epi8(0x1f);
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i del = _mm_set1_epi8(0x7f);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        /* Unsigned v <= 0x1f, minus the allowed ones, plus DEL */
+        __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v);
+        __m128i ok = _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, cr));
+        __m128i stop = _mm_or_si128(_mm_andnot_si128(ok, low), _mm_cmpeq_epi8(v, del));
+        int mask = _mm_movemask_epi8(stop);
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return scan_scalar(p, end);
+}
+#endif
+
+#ifdef WS_HAVE_AVX2
+/* Same as scan_scalar, 32 bytes at a time */
+__attribute__((target("avx2")))
+static const char *scan_avx2(const char *p, const char *end) {
+    const __m256i ctl = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v);
+        __m256i ok = _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, cr));
+        __m256i stop = _mm256_or_si256(_mm256_andnot_si256(ok, low), _mm256_cmpeq_epi8(v, del));
+        unsigned int mask = _mm256_movemask_epi8(stop);
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return scan_sse2(p, end);
+}
+#endif
+
+static const char *scan_auto(const char *p, const char *end);
+
+/* Line scanner in use, picked on first use */
+static const char *(*scan_line)(const char *, const char *) = scan_auto;
+
+/* Picks the best scanner, then scans */
+static const char *scan_auto(const char *p, const char *end) {
+    ws_http_use_scanner(WS_HTTP_SCAN_AVX2);
+    return scan_line(p, end);
+}
+
+/* Picks the line scanner, returns the one used (the best one supported if
+   the requested one isn't) */
+int ws_http_use_scanner(int scanner) {
+#ifdef WS_HAVE_AVX2
+    if (scanner >= WS_HTTP_SCAN_AVX2 && __builtin_cpu_supports("avx2")) {
+        scan_line = scan_avx2;
+        return WS_HTTP_SCAN_AVX2;
+    }
+#endif
+#ifdef WS_HAVE_SSE2
+    if (scanner >= WS_HTTP_SCAN_SSE2) {
+        scan_line = scan_sse2;
+        return WS_HTTP_SCAN_SSE2;
+    }
+#endif
+    scan_line = scan_scalar;
+    return WS_HTTP_SCAN_SCALAR;
+}
+
+/* Returns the name of a line scanner */
+const char *ws_http_scanner_name(int scanner) {
+    switch (scanner) {
+        case WS_HTTP_SCAN_AVX2:
+            return "avx2";
+        case WS_HTTP_SCAN_SSE2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+/* Resets a request before parsing a new one */
+void ws_http_init(ws_http_request_p req) {
+    /* Headers are only read up to nheaders, so only the rest is cleared */
+    memset(req, 0, offsetof(ws_http_request_t, headers));
+    req->nheaders = 0;
+    memset(&req->host, 0, sizeof(ws_http_request_t) - offsetof(ws_http_request_t, host));
+}
+
+/* Sets a slice to [start, stop) */
+static void set_slice(ws_http_slice_t *slice, const char *start, const char *stop) {
+    slice->ptr = start;
+    slice->len = stop - start;
+}
+
+/* Returns TRUE if a slice equals str, ignoring case */
+static int slice_is(const ws_http_slice_t *slice, const char *str, int len) {
+    return slice->len == len && strncasecmp(slice->ptr, str, len) == 0;
+}
+
+/* Splits the request line into method, target and version.
+   Returns 0, or -1 if it is malformed */
+static int parse_request_line(ws_http_request_p req, const char *line, const char *end) {
+    const char *c = line;
+    while (c < end && *c != ' ') c++;
+    set_slice(&req->method, line, c);
+    while (c < end && *c == ' ') c++;
+
+    const char *target = c;
+    while (c < end && *c != ' ') c++;
+    set_slice(&req->target, target, c);
+    while (c < end && *c == ' ') c++;
+
+    const char *version = c;
+    while (end > version && *(end-1) == ' ') end--;
+    if (req->method.len == 0 || req->target.len == 0) return -1;
+
+    /* No version means a simple request, which has no headers */
+    if (version == end) {
+        req->minor = -1;
+        return 0;
+    }
+    set_slice(&req->version, version, end);
+    if (end - version != 8 || memcmp(version, "HTTP/1.", 7) != 0
+            || version[7] < '0' || version[7] > '9') {
+        return -1;
+    }
+    req->minor = version[7] - '0';
+    return 0;
+}
+
+/* Records a header line, picking out the ones the server acts on.
+   Returns 0, or -1 if it is malformed */
+static int parse_header(ws_http_request_p req, const char *line, const char *end) {
+    const char *colon = memchr(line, ':', end - line);
+    if (colon == NULL || colon == line || req->nheaders == WS_HTTP_MAX_HEADERS) {
+        return -1;
+    }
+    /* Whitespace before the colon (or folded lines) is never allowed */
+    if (*(colon-1) == ' ' || *(colon-1) == '\t' || *line == ' ' || *line == '\t') {
+        return -1;
+    }
+
+    /* Trim the value */
+    const char *value = colon+1;
+    while (value < end && (*value == ' ' || *value == '\t')) value++;
+    while (end > value && (*(end-1) == ' ' || *(end-1) == '\t')) end--;
+
+    ws_http_header_t *header = &req->headers[req->nheaders++];
+    set_slice(&header->name, line, colon);
+    set_slice(&header->value, value, end);
+
+    /* Known headers, picked by length first */
+    ws_http_slice_t *known = NULL;
+    switch (header->name.len) {
+        case 4:
+            if (slice_is(&header->name, "Host", 4)) known = &req->host;
+            break;
+        case 5:
+            if (slice_is(&header->name, "Range", 5)) known = &req->range;
+            break;
+        case 10:
+            if (slice_is(&header->name, "Connection", 10)) known = &req->connection;
+            break;
+        case 13:
+            if (slice_is(&header->name, "If-None-Match", 13)) known = &req->if_none_match;
+            break;
+        case 15:
+            if (slice_is(&header->name, "Accept-Encoding", 15)) known = &req->accept_encoding;
+            break;
+        case 17:
+            if (slice_is(&header->name, "If-Modified-Since", 17)) known = &req->if_modified_since;
+            break;
+    }
+    if (known) {
+        *known = header->value;
+    }
+    return 0;
+}
+
+/* Marks a request as malformed */
+static int parse_failed(ws_http_request_p req) {
+    req->state = WS_HTTP_ERROR;
+    return -1;
+}
+
+/* Continues parsing the size bytes of data, which must start at the same
+   place as in earlier calls. Returns the request's length once complete,
+   0 if more data is needed, or -1 if it is malformed */
+int ws_http_parse(ws_http_request_p req, const char *data, int size) {
+    const char *end = data + size;
+    if (req->state == WS_HTTP_DONE) return req->length;
+    if (req->state == WS_HTTP_ERROR) return -1;
+
+    while (TRUE) {
+        /* Find the end of the current line, resuming where the last call stopped */
+        const char *stop = scan_line(data + req->scan, end);
+        if (stop == end) {
+            req->scan = size;
+            return 0;
+        }
+        if (*stop != '\n') return parse_failed(req);
+
+        const char *line = data + req->line;
+        const char *line_end = stop;
+        if (line_end > line && *(line_end-1) == '\r') line_end--;
+        req->line = req->scan = stop - data + 1;
+
+        if (req->state == WS_HTTP_REQUEST_LINE) {
+            /* Empty lines before a request are skipped */
+            if (line_end == line) continue;
+            if (parse_request_line(req, line, line_end) == -1) {
+                return parse_failed(req);
+            }
+            if (req->minor < 0) break;
+            req->state = WS_HTTP_HEADERS;
+        } else if (line_end == line) {
+            break; /* Empty line ends the headers */
+        } else if (parse_header(req, line, line_end) == -1) {
+            return parse_failed(req);
+        }
+    }
+    req->state = WS_HTTP_DONE;
+    req->length = req->line;
+    return req->length;
+}
+
+/* Returns the value of a header (case-insensitive name), or NULL */
+const ws_http_slice_t *ws_http_header(ws_http_request_p req, const char *name) {
+    int len = strlen(name);
+    for (int i = 0; i < req->nheaders; i++) {
+        if (slice_is(&req->headers[i].name, name, len)) {
+            return &req->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+/* Returns TRUE if a comma separated value holds a token (case-insensitive) */
+int ws_http_has_token(const ws_http_slice_t *value, const char *token) {
+    const char *c = value->ptr;
+    const char *end = c + value->len;
+    int len = strlen(token);
+    while (c < end) {
+        /* Skip separators, then compare one token */
+        while (c < end && (*c == ' ' || *c == '\t' || *c == ',')) c++;
+        const char *stop = c;
+        while (stop < end && *stop != ',' && *stop != ' ' && *stop != '\t'
+                && *stop != ';') stop++;
+        if (stop - c == len && strncasecmp(c, token, len) == 0) return TRUE;
+        c = stop;
+        while (c < end && *c != ',') c++;
+    }
+    return FALSE;
+}
+
+/* Returns TRUE if the connection should be kept open after the response.
+   HTTP/1.1 keeps it unless told to close, HTTP/1.0 only when asked */
+int ws_http_keep_alive(ws_http_request_p req) {
+    if (req->state != WS_HTTP_DONE || req->minor < 0) return FALSE;
+    if (req->connection.ptr) {
+        if (ws_http_has_token(&req->connection, "close")) return FALSE;
+        if (ws_http_has_token(&req->connection, "keep-alive")) return TRUE;
+    }
+    return req->minor >= 1;
+}
+
+/* Returns TRUE if an If-None-Match value matches an ETag (quotes included).
+   Matching is weak, as If-None-Match requires, so W/ prefixes are ignored */
+int ws_http_etag_match(const ws_http_slice_t *value, const char *etag) {
+    const char *c = value->ptr;
+    const char *end = c + value->len;
+    int len = strlen(etag);
+    while (c < end) {
+        while (c < end && (*c == ' ' || *c == '\t' || *c == ',')) c++;
+        if (c < end && *c == '*') return TRUE;
+        if (end - c >= 2 && c[0] == 'W' && c[1] == '/') c += 2;
+
+        /* Compare one quoted tag, commas may appear inside it */
+        const char *stop = c;
+        if (stop < end && *stop == '"') {
+            stop = memchr(stop+1, '"', end-stop-1);
+            stop = stop ? stop+1 : end;
+        }
+        while (stop < end && *stop != ',' && *stop != ' ' && *stop != '\t') stop++;
+        if (stop - c == len && memcmp(c, etag, len) == 0) return TRUE;
+        c = stop;
+    }
+    return FALSE;
+}
+
+/* Writes an HTTP date (RFC 9110 IMF-fixdate) into buf, returns its length */
+int ws_http_format_date(char *buf, size_t size, time_t when) {
+    struct tm tm;
+    gmtime_r(&when, &tm);
+    return strftime(buf, size, WS_HTTP_DATE_FORMAT, &tm);
+}
+
+/* Parses an HTTP date, returns it or -1 if it isn't an IMF-fixdate */
+time_t ws_http_parse_date(const ws_http_slice_t *value) {
+    char date[WS_HTTP_DATE_LEN];
+    struct tm tm;
+    if (value->len >= WS_HTTP_DATE_LEN) return -1;
+    memcpy(date, value->ptr, value->len);
+    date[value->len] = '\0';
+
+    memset(&tm, 0, sizeof(tm));
+    char *end = strptime(date, WS_HTTP_DATE_FORMAT, &tm);
+    if (end == NULL || *end != '\0') return -1;
+    return timegm(&tm);
+}
+
+/* Reads a decimal number from [c, end), returns the end of it or NULL */
+static const char *parse_offset(const char *c, const char *end, off_t *value) {
+    const char *start = c;
+    *value = 0;
+    while (c < end && *c >= '0' && *c <= '9') {
+        if (*value > (WS_HTTP_MAX_OFFSET - (*c - '0')) / 10) return NULL;
+        *value = *value * 10 + (*c - '0');
+        c++;
+    }
+    return c == start ? NULL : c;
+}
+
+/* Parses a Range value for a body of size bytes into at most max ranges.
+   Returns the number of satisfiable ranges, 0 if the header should be
+   ignored (malformed, another unit, or too many ranges), or -1 if none of
+   the ranges can be satisfied */
+int ws_http_parse_ranges(const ws_http_slice_t *value, off_t size,
+        ws_http_range_t *ranges, int max) {
+    const char *c = value->ptr;
+    const char *end = c + value->len;
+    int count = 0;
+    if (value->len < 6 || strncasecmp(c, "bytes=", 6) != 0) return 0;
+    c += 6;
+
+    while (c < end) {
+        off_t first, last;
+        while (c < end && (*c == ' ' || *c == '\t' || *c == ',')) c++;
+        if (c == end) break;
+
+        if (*c == '-') {
+            /* Suffix range, the last bytes of the body */
+            if ((c = parse_offset(c+1, end, &last)) == NULL) return 0;
+            if (last == 0) goto next; /* Unsatisfiable */
+            first = last < size ? size - last : 0;
+            last = size - 1;
+        } else {
+            if ((c = parse_offset(c, end, &first)) == NULL) return 0;
+            if (c == end || *c != '-') return 0;
+            c++;
+            if (c < end && *c >= '0' && *c <= '9') {
+                if ((c = parse_offset(c, end, &last)) == NULL) return 0;
+                if (last < first) return 0;
+            } else {
+                last = size - 1; /* Open ended */
+            }
+            if (last >= size) last = size - 1;
+        }
+        if (first < size) {
+            if (count == max) return 0;
+            ranges[count].first = first;
+            ranges[count].last = last;
+            count++;
+        }
+next:
+        while (c < end && (*c == ' ' || *c == '\t')) c++;
+        if (c < end && *c != ',') return 0;
+    }
+    return count > 0 ? count : -1;
+}
+
+/* Returns TRUE if an Accept-Encoding value allows a coding, either by name
+   or through "*", with a non-zero q */
+int ws_http_accepts(const ws_http_slice_t *value, const char *coding) {
+    const char *c = value->ptr;
+    const char *end = c + value->len;
+    int len = strlen(coding);
+    int star = FALSE;
+    while (c < end) {
+        while (c < end && (*c == ' ' || *c == '\t' || *c == ',')) c++;
+        const char *stop = c;
+        while (stop < end && *stop != ',' && *stop != ';' && *stop != ' ' 
+                && *stop != '\t') stop++;
+        int named = stop - c == len && strncasecmp(c, coding, len) == 0;
+        int any = stop - c == 1 && *c == '*';
+
+        /* Only a q of zero turns a coding down */
+        int allowed = TRUE;
+        c = stop;
+        while (c < end && *c != ',') {
+            if (*c == 'q' || *c == 'Q') {
+                const char *q = c+1;
+                while (q < end && (*q == ' ' || *q == '\t')) q++;
+                if (q < end && *q == '=') {
+                    q++;
+                    while (q < end && (*q == ' ' || *q == '\t')) q++;
+                    allowed = FALSE;
+                    for (; q < end && ((*q >= '0' && *q <= '9') || *q == '.'); q++) {
+                        if (*q >= '1' && *q <= '9') allowed = TRUE;
+                    }
+                    c = q;
+                    continue;
+                }
+            }
+            c++;
+        }
+        if (named) return allowed;
+        if (any) star = allowed;
+    }
+    return star;
+}
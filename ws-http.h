@@ -0,0 +1,140 @@
+/* Simple HTML web server HTTP request parser header */
+
+/*
+Request Parser Overview:
+ -  Requests are parsed in place in the client's buffer: the method, target,
+    version and every header are recorded as slices (pointer and length)
+    into it, so nothing is copied or allocated
+ -  Parsing is resumable: each call scans only bytes it hasn't seen yet and
+    keeps the start of the unfinished line, so a request split across many
+    reads is still scanned once in total
+ -  Line ends are found with SSE2 or AVX2 (picked at runtime) 16 or 32 bytes
+    at a time, and control bytes are rejected in the same pass
+ -  A request line without an HTTP version is a simple (HTTP/0.9) request
+    and ends at its newline, others end at the empty line after the headers
+ -  The headers the server acts on (Host, Connection, If-None-Match,
+    If-Modified-Since, Range, Accept-Encoding) are picked out while parsing
+*/
+
+#ifndef WS_HTTP_H
+#define WS_HTTP_H
+
+#include <stddef.h>         /* size_t */
+#include <time.h>           /* time_t */
+#include <sys/types.h>      /* off_t */
+
+#ifdef __SSE2__
+#define WS_HAVE_SSE2
+#if defined(__GNUC__) && defined(__x86_64__)
+#define WS_HAVE_AVX2
+#endif
+#endif
+
+/* Define parser states */
+#define WS_HTTP_REQUEST_LINE 0
+#define WS_HTTP_HEADERS      1
+#define WS_HTTP_DONE         2
+#define WS_HTTP_ERROR        3
+
+/* Define line scanners */
+#define WS_HTTP_SCAN_SCALAR  0
+#define WS_HTTP_SCAN_SSE2    1
+#define WS_HTTP_SCAN_AVX2    2
+
+/* Define misc */
+#define WS_HTTP_MAX_HEADERS  32 /* More headers than this is an error */
+#define WS_HTTP_DATE_FORMAT  "%a, %d %b %Y %H:%M:%S GMT"
+#define WS_HTTP_DATE_LEN     32 /* Room for a date and its terminator */
+#define WS_HTTP_MAX_RANGES   16 /* More ranges than this are ignored */
+#define WS_HTTP_MAX_OFFSET   ((off_t)1 << 62) /* Larger offsets are invalid */
+
+/* A piece of the request buffer */
+struct ws_http_slice_t {
+    const char *ptr;            /* Start of the piece, NULL if absent */
+    int len;                    /* Length of the piece */
+};
+typedef struct ws_http_slice_t ws_http_slice_t;
+
+/* A header line, with the value's surrounding whitespace trimmed */
+struct ws_http_header_t {
+    ws_http_slice_t name;
+    ws_http_slice_t value;
+};
+typedef struct ws_http_header_t ws_http_header_t;
+
+/* An inclusive range of body bytes */
+struct ws_http_range_t {
+    off_t first;                /* First byte */
+    off_t last;                 /* Last byte */
+};
+typedef struct ws_http_range_t ws_http_range_t;
+
+/* A request being parsed */
+struct ws_http_request_t {
+    int state;                  /* WS_HTTP_* parser state */
+    int line;                   /* Offset of the line being parsed */
+    int scan;                   /* Offset scanning resumes from */
+    int length;                 /* Bytes taken by the request once DONE */
+    ws_http_slice_t method;     /* Request method, e.g. GET */
+    ws_http_slice_t target;     /* Request target, e.g. /index.html */
+    ws_http_slice_t version;    /* HTTP version, absent for simple requests */
+    int minor;                  /* 1 for HTTP/1.1, 0 for 1.0, -1 for 0.9 */
+    ws_http_header_t headers[WS_HTTP_MAX_HEADERS]; /* Headers in order */
+    int nheaders;               /* Number of headers */
+    ws_http_slice_t host;       /* Known headers, absent if not sent */
+    ws_http_slice_t connection;
+    ws_http_slice_t if_none_match;
+    ws_http_slice_t if_modified_since;
+    ws_http_slice_t range;
+    ws_http_slice_t accept_encoding;
+};
+typedef struct ws_http_request_t ws_http_request_t;
+typedef ws_http_request_t* ws_http_request_p;
+
+/* Picks the line scanner, returns the one used (the best one supported if
+   the requested one isn't) */
+int ws_http_use_scanner(int scanner);
+
+/* Returns the name of a line scanner */
+const char *ws_http_scanner_name(int scanner);
+
+/* Resets a request before parsing a new one */
+void ws_http_init(ws_http_request_p req);
+
+/* Continues parsing the size bytes of data, which must start at the same
+   place as in earlier calls. Returns the request's length once complete,
+   0 if more data is needed, or -1 if it is malformed */
+int ws_http_parse(ws_http_request_p req, const char *data, int size);
+
+/* Returns the value of a header (case-insensitive name), or NULL */
+const ws_http_slice_t *ws_http_header(ws_http_request_p req, const char *name);
+
+/* Returns TRUE if a comma separated value holds a token (case-insensitive) */
+int ws_http_has_token(const ws_http_slice_t *value, const char *token);
+
+/* Returns TRUE if the connection should be kept open after the response.
+   HTTP/1.1 keeps it unless told to close, HTTP/1.0 only when asked */
+int ws_http_keep_alive(ws_http_request_p req);
+
+/* Returns TRUE if an If-None-Match value matches an ETag (quotes included).
+   Matching is weak, as If-None-Match requires, so W/ prefixes are ignored */
+int ws_http_etag_match(const ws_http_slice_t *value, const char *etag);
+
+/* Writes an HTTP date (RFC 9110 IMF-fixdate) into buf, returns its length */
+int ws_http_format_date(char *buf, size_t size, time_t when);
+
+/* Parses an HTTP date, returns it or -1 if it isn't an IMF-fixdate */
+time_t ws_http_parse_date(const ws_http_slice_t *value);
+
+/* Parses a Range value for a body of size bytes into at most max ranges.
+   Returns the number of satisfiable ranges, 0 if the header should be
+   ignored (malformed, another unit, or too many ranges), or -1 if none of
+   the ranges can be satisfied */
+int ws_http_parse_ranges(const ws_http_slice_t *value, off_t size,
+    ws_http_range_t *ranges, int max);
+
+/* Returns TRUE if an Accept-Encoding value allows a coding, either by name
+   or through "*", with a non-zero q */
+int ws_http_accepts(const ws_http_slice_t *value, const char *coding);
+
+#endif
@@ -0,0 +1,273 @@
+/* Simple HTML web server logger */
+#include <stdio.h>          /* Formatting records */
+#include <stdarg.h>         /* Variable arguments */
+#include <string.h>         /* Memory copies */
+#include <strings.h>        /* Case-insensitive compares */
+#include <unistd.h>         /* Lower level write */
+#include <errno.h>          /* Error handling */
+#include <time.h>           /* Wall clock times */
+#include <pthread.h>        /* Flusher thread */
+#include <netinet/in.h>     /* Address structs */
+#include <arpa/inet.h>      /* Address to string conversions */
+#include "ws-log.h"         /* Logger consts */
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+/* Define record kinds */
+#define WS_LOG_KIND_TEXT    0
+#define WS_LOG_KIND_ACCESS  1
+
+/* Fields of an access record */
+struct ws_log_access_t {
+    unsigned short family;          /* AF_INET, AF_INET6, or 0 if unknown */
+    unsigned short port;            /* Client port, network order */
+    unsigned char addr[16];         /* Client address */
+    char method[8];                 /* Request method */
+    char path[WS_LOG_PATH];         /* Request target */
+    int status;                     /* Response status */
+    long bytes;                     /* Response bytes sent */
+    long us;                        /* Request arriving to last byte sent */
+};
+typedef struct ws_log_access_t ws_log_access_t;
+
+/* A slot of the ring */
+struct ws_log_record_t {
+    unsigned long seq;              /* Position it is free (== pos) or full (== pos+1) at */
+    int level;                      /* WS_LOG_* */
+    int kind;                       /* WS_LOG_KIND_* */
+    struct timespec time;           /* Wall clock time it was logged */
+    union {
+        char text[WS_LOG_TEXT];     /* Formatted message */
+        ws_log_access_t access;     /* Access record */
+    } data;
+};
+typedef struct ws_log_record_t ws_log_record_t;
+
+/* Globals */
+int ws_log_level = WS_LOG_INFO;
+static const char *level_names[] = { "error", "warn", "info", "debug", "trace" };
+static ws_log_record_t ring[WS_LOG_SLOTS]; /* Records waiting to be written */
+static unsigned long tail = 0; /* Next position claimed by a producer, atomic */
+static unsigned long head = 0; /* Next position read by the flusher */
+static unsigned long dropped = 0; /* Records lost to a full ring, atomic */
+static int running = FALSE; /* TRUE while the flusher runs */
+static int stopping = FALSE; /* Set to make the flusher finish, atomic */
+static int out_fd = -1; /* Where records are written */
+static pthread_t flusher; /* Thread writing records out */
+
+/* Claims the next free slot, or returns NULL (and counts a drop) when the
+   ring is full. The slot is published by ring_publish() */
+static ws_log_record_t *ring_claim() {
+    unsigned long pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+    for (;;) {
+        ws_log_record_t *slot = &ring[pos & (WS_LOG_SLOTS-1)];
+        unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)(seq - pos);
+        if (diff == 0) {
+            /* Free for this turn, take it unless another thread did first */
+            if (__atomic_compare_exchange_n(&tail, &pos, pos+1, TRUE,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                clock_gettime(CLOCK_REALTIME, &slot->time);
+                return slot;
+            }
+        } else if (diff < 0) {
+            /* Still holds last turn's record */
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Hands a filled slot to the flusher */
+static void ring_publish(ws_log_record_t *slot) {
+    unsigned long pos = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, pos+1, __ATOMIC_RELEASE);
+}
+
+/* Returns the level with a name, or -1 */
+int ws_log_parse_level(const char *name) {
+    for (int i = WS_LOG_ERROR; i <= WS_LOG_TRACE; i++) {
+        if (strcasecmp(name, level_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+/* Queues a message at a level, printf style */
+void ws_log_text(int level, const char *format, ...) {
+    ws_log_record_t *slot = ring_claim();
+    if (slot == NULL) return;
+    slot->level = level;
+    slot->kind = WS_LOG_KIND_TEXT;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(slot->data.text, WS_LOG_TEXT, format, args);
+    va_end(args);
+    ring_publish(slot);
+}
+
+/* Queues an access record for a request */
+void ws_log_access(const struct sockaddr *addr, const char *method, int method_len,
+        const char *path, int path_len, int status, long bytes, long us) {
+    if (ws_log_level < WS_LOG_INFO) return;
+    ws_log_record_t *slot = ring_claim();
+    if (slot == NULL) return;
+    slot->level = WS_LOG_INFO;
+    slot->kind = WS_LOG_KIND_ACCESS;
+
+    ws_log_access_t *access = &slot->data.access;
+    access->family = 0;
+    if (addr != NULL && addr->sa_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+        access->family = AF_INET;
+        access->port = in->sin_port;
+        memcpy(access->addr, &in->sin_addr, sizeof(in->sin_addr));
+    } else if (addr != NULL && addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+        access->family = AF_INET6;
+        access->port = in6->sin6_port;
+        memcpy(access->addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+    }
+    if (method_len >= (int)sizeof(access->method)) method_len = sizeof(access->method)-1;
+    if (path_len >= WS_LOG_PATH) path_len = WS_LOG_PATH-1;
+    memcpy(access->method, method, method_len);
+    access->method[method_len] = '\0';
+    memcpy(access->path, path, path_len);
+    access->path[path_len] = '\0';
+    access->status = status;
+    access->bytes = bytes;
+    access->us = us;
+    ring_publish(slot);
+}
+
+/* Returns the number of records dropped because the ring was full */
+unsigned long ws_log_dropped(void) {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+/* Writes a whole buffer, retrying short writes */
+static void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(out_fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return; /* Nowhere left to report it */
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+/* Formats a record as a line into buf, which holds at least a record's
+   worth. Returns its length */
+static int format_record(char *buf, ws_log_record_t *record) {
+    /* Records mostly share their second, so its text is kept */
+    static time_t last_sec = -1;
+    static char stamp[32];
+    if (record->time.tv_sec != last_sec) {
+        struct tm tm;
+        gmtime_r(&record->time.tv_sec, &tm);
+        strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+        last_sec = record->time.tv_sec;
+    }
+    int len = sprintf(buf, "%s.%06ldZ ", stamp, record->time.tv_nsec / 1000);
+
+    if (record->kind == WS_LOG_KIND_TEXT) {
+        /* Messages may already end their line */
+        int text_len = strlen(record->data.text);
+        if (text_len > 0 && record->data.text[text_len-1] == '\n') text_len--;
+        len += sprintf(buf+len, "%s %.*s\n", level_names[record->level],
+            text_len, record->data.text);
+    } else {
+        ws_log_access_t *access = &record->data.access;
+        char addr[INET6_ADDRSTRLEN] = "-";
+        if (access->family != 0) {
+            inet_ntop(access->family, access->addr, addr, sizeof(addr));
+        }
+        len += sprintf(buf+len, access->family == AF_INET6
+                ? "access client=[%s]:%u method=%s path=%s status=%d bytes=%ld duration_us=%ld\n"
+                : "access client=%s:%u method=%s path=%s status=%d bytes=%ld duration_us=%ld\n",
+            addr, ntohs(access->port), access->method, access->path,
+            access->status, access->bytes, access->us);
+    }
+    return len;
+}
+
+/* Formats and writes every published record, returns how many */
+static long drain() {
+    static char buf[WS_LOG_BATCH];
+    size_t len = 0;
+    long count = 0;
+    for (;;) {
+        ws_log_record_t *slot = &ring[head & (WS_LOG_SLOTS-1)];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head+1) break;
+
+        /* Leave room for the longest line before formatting another */
+        if (len + WS_LOG_TEXT + WS_LOG_PATH + 256 > WS_LOG_BATCH) {
+            write_all(buf, len);
+            len = 0;
+        }
+        len += format_record(buf+len, slot);
+        __atomic_store_n(&slot->seq, head + WS_LOG_SLOTS, __ATOMIC_RELEASE);
+        head++;
+        count++;
+    }
+    write_all(buf, len);
+    return count;
+}
+
+/* Writes records out until the logger is stopped */
+static void *flush_run(void *arg) {
+    unsigned long reported = 0;
+    struct timespec pause = { 0, WS_LOG_FLUSH_MS * 1000000L };
+    for (;;) {
+        int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        long count = drain();
+
+        /* Report drops once there is room again */
+        unsigned long lost = ws_log_dropped();
+        if (lost != reported) {
+            ws_log_text(WS_LOG_WARN, "Log ring full, dropped %lu records", lost - reported);
+            reported = lost;
+            count++;
+        }
+        if (stop && count == 0) break;
+
+        /* Let records pile up into a batch, unless the ring is filling */
+        if (__atomic_load_n(&tail, __ATOMIC_RELAXED) - head < WS_LOG_SLOTS/2) {
+            nanosleep(&pause, NULL);
+        }
+    }
+    return NULL;
+}
+
+/* Starts the flusher writing records to fd, returns 0 or -1 on error */
+int ws_log_start(int fd) {
+    /* Slot i is free for the first turn at position i */
+    for (unsigned long i = 0; i < WS_LOG_SLOTS; i++) {
+        ring[i].seq = i;
+    }
+    out_fd = fd;
+    __atomic_store_n(&stopping, FALSE, __ATOMIC_RELEASE);
+    int err = pthread_create(&flusher, NULL, flush_run, NULL);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    running = TRUE;
+    return 0;
+}
+
+/* Writes out every record left and stops the flusher */
+void ws_log_stop(void) {
+    if (!running) return;
+    running = FALSE;
+    __atomic_store_n(&stopping, TRUE, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+}
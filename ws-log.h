@@ -0,0 +1,67 @@
+/* Simple HTML web server logger header */
+
+/*
+Logging Overview:
+ -  Every message has a level, and ws_log() checks it before formatting
+    anything, so disabled levels cost one compare
+ -  Records go into one fixed ring of slots shared by every thread, claimed
+    with a compare-and-swap on its tail (a bounded MPMC queue, used here with
+    a single consumer), so logging never takes a lock or waits on I/O
+ -  Access records are stored as fields (address, method, path, status,
+    bytes, duration) and only formatted by the flusher; other messages are
+    formatted into their slot by the caller
+ -  A background thread drains the ring every few ms (sooner once it is
+    half full), formats the records and writes them out in large batches
+ -  When the ring is full records are dropped and counted instead of
+    waiting, and the flusher logs how many were lost
+*/
+
+#ifndef WS_LOG_H
+#define WS_LOG_H
+
+#include <sys/socket.h>     /* struct sockaddr */
+
+/* Define log levels */
+#define WS_LOG_ERROR        0
+#define WS_LOG_WARN         1
+#define WS_LOG_INFO         2  /* Access records and startup */
+#define WS_LOG_DEBUG        3  /* Connections opening and closing */
+#define WS_LOG_TRACE        4  /* Every read, send and parse */
+
+/* Define ring layout */
+#define WS_LOG_SLOTS        4096 /* Records the ring holds, a power of two */
+#define WS_LOG_TEXT         232  /* Longest message kept */
+#define WS_LOG_PATH         160  /* Longest access path kept */
+#define WS_LOG_BATCH        (1<<16) /* Bytes written at once */
+#define WS_LOG_FLUSH_MS     10 /* Time the flusher sleeps between batches */
+
+/* Level at and below which messages are logged */
+extern int ws_log_level;
+
+/* Logs a message at a level, printf style */
+#define ws_log(LEVEL, ...) do { \
+        if ((LEVEL) <= ws_log_level) ws_log_text((LEVEL), __VA_ARGS__); \
+    } while (0)
+
+/* Returns the level with a name, or -1 */
+int ws_log_parse_level(const char *name);
+
+/* Starts the flusher writing records to fd, returns 0 or -1 on error.
+   Nothing may be logged before it starts */
+int ws_log_start(int fd);
+
+/* Writes out every record left and stops the flusher */
+void ws_log_stop(void);
+
+/* Queues a message at a level, printf style */
+void ws_log_text(int level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* Queues an access record for a request */
+void ws_log_access(const struct sockaddr *addr, const char *method, int method_len,
+    const char *path, int path_len, int status, long bytes, long us);
+
+/* Returns the number of records dropped because the ring was full */
+unsigned long ws_log_dropped(void);
+
+#endif
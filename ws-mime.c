@@ -0,0 +1,193 @@
+/* Simple HTML web server MIME types */
+#include <stdio.h>          /* Reading mime.types */
+#include <stdlib.h>         /* Memory management */
+#include <string.h>         /* String compares */
+#include <ctype.h>          /* Lower casing extensions */
+#include <errno.h>          /* Error handling */
+#include "ws-mime.h"        /* MIME consts and structs */
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+/* Built-in types, as pairs of an extension and its type */
+static const char *defaults[][2] = {
+    { "html", "text/html" }, { "htm", "text/html" },
+    { "css", "text/css" },
+    { "js", "text/javascript" }, { "mjs", "text/javascript" },
+    { "json", "application/json" }, { "map", "application/json" },
+    { "webmanifest", "application/manifest+json" },
+    { "xml", "application/xml" },
+    { "txt", "text/plain" }, { "md", "text/markdown" }, { "csv", "text/csv" },
+    { "gif", "image/gif" },
+    { "jpg", "image/jpeg" }, { "jpeg", "image/jpeg" },
+    { "png", "image/png" },
+    { "svg", "image/svg+xml" },
+    { "ico", "image/vnd.microsoft.icon" },
+    { "webp", "image/webp" }, { "avif", "image/avif" },
+    { "woff", "font/woff" }, { "woff2", "font/woff2" },
+    { "ttf", "font/ttf" }, { "otf", "font/otf" },
+    { "wasm", "application/wasm" },
+    { "pdf", "application/pdf" },
+    { "zip", "application/zip" }, { "gz", "application/gzip" },
+    { "mp4", "video/mp4" }, { "webm", "video/webm" },
+    { "mp3", "audio/mpeg" }, { "ogg", "audio/ogg" }, { "wav", "audio/wav" },
+};
+
+/* Globals */
+static ws_mime_t *slots = NULL; /* Hash table of extensions */
+static size_t nslots = 0; /* Its size, a power of two */
+static size_t count = 0; /* Extensions in it */
+static char **loaded = NULL; /* Types read from files, freed with the table */
+static int nloaded = 0; /* Number of them */
+static const ws_mime_t unknown = { "", WS_MIME_DEFAULT, FALSE };
+
+/* Returns TRUE if bodies of a type are worth compressing */
+static int compressible(const char *type) {
+    return strncmp(type, "text/", 5) == 0 || strstr(type, "xml") != NULL
+        || strstr(type, "javascript") != NULL || strstr(type, "json") != NULL
+        || strcmp(type, "application/wasm") == 0 || strcmp(type, "font/ttf") == 0
+        || strcmp(type, "font/otf") == 0;
+}
+
+/* Hashes a lower case extension (FNV-1a) */
+static size_t hash_ext(const char *ext) {
+    size_t hash = 2166136261u;
+    while (*ext) {
+        hash ^= (unsigned char)*ext++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Returns the slot an extension is in, or the free one it would go in */
+static ws_mime_t *find_slot(ws_mime_t *table, size_t size, const char *ext) {
+    size_t i = hash_ext(ext) & (size-1);
+    while (table[i].ext[0] != '\0' && strcmp(table[i].ext, ext) != 0) {
+        i = (i+1) & (size-1);
+    }
+    return &table[i];
+}
+
+/* Doubles the table, returns 0 or -1 */
+static int grow_slots() {
+    size_t size = nslots ? nslots * 2 : WS_MIME_MIN_SLOTS;
+    ws_mime_t *table = calloc(size, sizeof(ws_mime_t));
+    if (table == NULL) return -1;
+    for (size_t i = 0; i < nslots; i++) {
+        if (slots[i].ext[0] != '\0') {
+            *find_slot(table, size, slots[i].ext) = slots[i];
+        }
+    }
+    free(slots);
+    slots = table;
+    nslots = size;
+    return 0;
+}
+
+/* Sets the type of an extension (len bytes, without the dot), replacing any
+   it had. The type must outlive the table. Returns 0 or -1 */
+int ws_mime_add(const char *ext, int len, const char *type) {
+    char lower[WS_MIME_EXT_LEN];
+    if (len <= 0 || len >= WS_MIME_EXT_LEN) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < len; i++) {
+        lower[i] = tolower((unsigned char)ext[i]);
+    }
+    lower[len] = '\0';
+
+    /* Keep the table at most half full, so probes stay short */
+    if ((count+1) * 2 > nslots && grow_slots() == -1) return -1;
+    ws_mime_t *slot = find_slot(slots, nslots, lower);
+    if (slot->ext[0] == '\0') {
+        strcpy(slot->ext, lower);
+        count++;
+    }
+    slot->type = type;
+    slot->compressible = compressible(type);
+    return 0;
+}
+
+/* Fills the table with the built-in types, returns 0 or -1 */
+int ws_mime_init(void) {
+    for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++) {
+        if (ws_mime_add(defaults[i][0], strlen(defaults[i][0]), defaults[i][1]) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Adds every type of a mime.types file, returns the number of extensions
+   added or -1 with errno set */
+int ws_mime_load(const char *file) {
+    FILE *in = fopen(file, "r");
+    if (in == NULL) return -1;
+    char line[1024];
+    int added = 0;
+    while (fgets(line, sizeof(line), in) != NULL) {
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char *save;
+        char *type = strtok_r(line, " \t\r\n", &save);
+        char *ext = strtok_r(NULL, " \t\r\n", &save);
+        if (type == NULL || ext == NULL) continue;
+
+        /* Every extension of the line shares one copy of the type */
+        char **more = realloc(loaded, (nloaded+1) * sizeof(char *));
+        if (more == NULL || (type = strdup(type)) == NULL) {
+            if (more) loaded = more;
+            fclose(in);
+            return -1;
+        }
+        loaded = more;
+        loaded[nloaded++] = type;
+        for (; ext != NULL; ext = strtok_r(NULL, " \t\r\n", &save)) {
+            if (ws_mime_add(ext, strlen(ext), type) == 0) {
+                added++;
+            } else if (errno != EINVAL) {
+                fclose(in);
+                return -1;
+            }
+        }
+    }
+    fclose(in);
+    return added;
+}
+
+/* Returns the type of a file by its path, never NULL */
+const ws_mime_t *ws_mime_find(const char *path) {
+    const char *name = strrchr(path, '/');
+    const char *ext = strrchr(name ? name : path, '.');
+    if (ext == NULL || slots == NULL) return &unknown;
+
+    char lower[WS_MIME_EXT_LEN];
+    int len = 0;
+    for (ext++; *ext; ext++) {
+        if (len == WS_MIME_EXT_LEN-1) return &unknown;
+        lower[len++] = tolower((unsigned char)*ext);
+    }
+    if (len == 0) return &unknown;
+    lower[len] = '\0';
+    ws_mime_t *slot = find_slot(slots, nslots, lower);
+    return slot->ext[0] != '\0' ? slot : &unknown;
+}
+
+/* Frees the table and every type loaded from a file */
+void ws_mime_free(void) {
+    for (int i = 0; i < nloaded; i++) {
+        free(loaded[i]);
+    }
+    free(loaded);
+    free(slots);
+    loaded = NULL;
+    nloaded = 0;
+    slots = NULL;
+    nslots = 0;
+    count = 0;
+}
@@ -0,0 +1,53 @@
+/* Simple HTML web server MIME types header */
+
+/*
+MIME Types Overview:
+ -  A page's content type comes from the last extension of its file name
+    (after the last dot following the last slash), compared without case,
+    so "a.tar.GZ" is gzip and "/v1.2/notes" has none
+ -  Extensions are kept in one open addressing hash table, so a lookup is a
+    hash of the extension and usually a single compare
+ -  The table starts with compiled-in types for common web files, and -M
+    adds the types of a mime.types file (a type then its extensions on
+    each line, # starts a comment), replacing built-in ones it repeats
+ -  Each type also records whether it is worth compressing (text, XML,
+    JSON, scripts and fonts without their own compression)
+ -  The table is filled before the workers start and only read after, so
+    lookups take no locks
+*/
+
+#ifndef WS_MIME_H
+#define WS_MIME_H
+
+/* Define table layout */
+#define WS_MIME_EXT_LEN     16 /* Longest extension kept, with its terminator */
+#define WS_MIME_MIN_SLOTS   128 /* Slots of the table, doubled when half full */
+#define WS_MIME_DEFAULT     "application/octet-stream" /* Type of anything else */
+
+/* An extension and its type */
+struct ws_mime_t {
+    char ext[WS_MIME_EXT_LEN];      /* Lower case extension without the dot, "" if free */
+    const char *type;               /* Content type sent for it */
+    int compressible;               /* TRUE if bodies of the type are compressed */
+};
+typedef struct ws_mime_t ws_mime_t;
+typedef ws_mime_t* ws_mime_p;
+
+/* Fills the table with the built-in types, returns 0 or -1 */
+int ws_mime_init(void);
+
+/* Sets the type of an extension (len bytes, without the dot), replacing any
+   it had. The type must outlive the table. Returns 0 or -1 */
+int ws_mime_add(const char *ext, int len, const char *type);
+
+/* Adds every type of a mime.types file, returns the number of extensions
+   added or -1 with errno set */
+int ws_mime_load(const char *file);
+
+/* Returns the type of a file by its path, never NULL */
+const ws_mime_t *ws_mime_find(const char *path);
+
+/* Frees the table and every type loaded from a file */
+void ws_mime_free(void);
+
+#endif
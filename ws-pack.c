@@ -0,0 +1,442 @@
+/* Simple HTML web server site pack */
+#include <stdio.h>          /* Temporary file names */
+#include <stdlib.h>         /* Memory management */
+#include <string.h>         /* String compares */
+#include <unistd.h>         /* Lower level file access */
+#include <fcntl.h>          /* Opening files */
+#include <errno.h>          /* Error handling */
+#include <sys/mman.h>       /* Mapping packs */
+#include <sys/stat.h>       /* File sizes */
+#include "ws-pack.h"        /* Pack consts and structs */
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+/* Rounds an offset up to the next 8 bytes */
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+/* Hashes a path with a seed (FNV-1a, then a final mix so every bit of the
+   seed reaches every bit of the result) */
+static uint64_t hash_path(const char *key, size_t len, uint32_t seed) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Returns the slot a path would be in, without checking it is there */
+static uint32_t slot_of(ws_pack_p pack, const char *key, size_t len) {
+    const ws_pack_header_t *header = pack->header;
+    uint32_t bucket = hash_path(key, len, 0) % header->nbuckets;
+    return hash_path(key, len, pack->seeds[bucket]) % header->npaths;
+}
+
+/* Finds the tables of a pack in its blob and checks every offset in them
+   stays inside it. Returns 0 or -1 with errno set to EINVAL */
+static int index_pack(ws_pack_p pack) {
+    const ws_pack_header_t *header = (const ws_pack_header_t *)pack->base;
+    if (pack->size < sizeof(ws_pack_header_t) 
+            || memcmp(header->magic, WS_PACK_MAGIC, sizeof(header->magic)) != 0
+            || header->version != WS_PACK_VERSION || header->size != pack->size
+            || header->npaths == 0 || header->nbuckets == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t offset = ALIGN8(sizeof(ws_pack_header_t));
+    size_t seeds = offset;
+    offset = ALIGN8(offset + header->nbuckets * sizeof(uint32_t));
+    size_t paths = offset;
+    offset += header->npaths * sizeof(ws_pack_path_t);
+    size_t records = offset;
+    offset += header->nrecords * sizeof(ws_pack_record_t);
+    if (offset > pack->size) {
+        errno = EINVAL;
+        return -1;
+    }
+    pack->header = header;
+    pack->seeds = (const uint32_t *)(pack->base + seeds);
+    pack->paths = (const ws_pack_path_t *)(pack->base + paths);
+    pack->records = (const ws_pack_record_t *)(pack->base + records);
+
+    for (uint32_t i = 0; i < header->npaths; i++) {
+        const ws_pack_path_t *path = &pack->paths[i];
+        if (path->key >= pack->size || path->key_len >= pack->size - path->key
+                || pack->base[path->key + path->key_len] != '\0'
+                || path->first > header->nrecords || path->count > header->nrecords - path->first) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < header->nrecords; i++) {
+        const ws_pack_record_t *record = &pack->records[i];
+        if (record->data > pack->size || record->size > pack->size - record->data
+                || record->header_len > record->size
+                || memchr(record->etag, '\0', sizeof(record->etag)) == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Maps a pack file, returns 0 or -1 with errno set (EINVAL if it isn't a
+   valid pack) */
+int ws_pack_open(ws_pack_p pack, const char *file) {
+    struct stat info;
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) return -1;
+    if (fstat(fd, &info) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (info.st_size < (off_t)sizeof(ws_pack_header_t)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Every page is read by some request sooner or later, so fault it all in now */
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+#endif
+    void *base = mmap(NULL, info.st_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+    pack->base = base;
+    pack->size = info.st_size;
+    pack->mapped = TRUE;
+    if (index_pack(pack) == -1) {
+        int err = errno;
+        ws_pack_close(pack);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* Uses a malloc'd blob as a pack, which it then owns. Returns 0 or -1 with
+   errno set */
+int ws_pack_load(ws_pack_p pack, char *blob, size_t size) {
+    pack->base = blob;
+    pack->size = size;
+    pack->mapped = FALSE;
+    if (index_pack(pack) == -1) {
+        int err = errno;
+        ws_pack_close(pack);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* Unmaps or frees a pack */
+void ws_pack_close(ws_pack_p pack) {
+    if (pack->base == NULL) return;
+    if (pack->mapped) {
+        munmap(pack->base, pack->size);
+    } else {
+        free(pack->base);
+    }
+    pack->base = NULL;
+    pack->size = 0;
+}
+
+/* Returns the record of a response, or -1 if the pack doesn't have it */
+int ws_pack_find(ws_pack_p pack, const char *key, int status, int coding) {
+    size_t len = strlen(key);
+    const ws_pack_path_t *path = &pack->paths[slot_of(pack, key, len)];
+    if (path->key_len != len || memcmp(pack->base + path->key, key, len) != 0) {
+        return -1;
+    }
+    for (uint32_t i = path->first; i < path->first + path->count; i++) {
+        if (pack->records[i].status == status && pack->records[i].coding == coding) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Returns an array of cache entries, one per record, that serve the
+   records straight from the pack. NULL on error */
+ws_cache_entry_p ws_pack_entries(ws_pack_p pack) {
+    const ws_pack_header_t *header = pack->header;
+    ws_cache_entry_p entries = calloc(header->nrecords ? header->nrecords : 1,
+        sizeof(ws_cache_entry_t));
+    if (entries == NULL) return NULL;
+    for (uint32_t p = 0; p < header->npaths; p++) {
+        const ws_pack_path_t *path = &pack->paths[p];
+        for (uint32_t i = path->first; i < path->first + path->count; i++) {
+            const ws_pack_record_t *record = &pack->records[i];
+            ws_cache_entry_p entry = &entries[i];
+            entry->key = pack->base + path->key;
+            entry->status = record->status;
+            entry->coding = record->coding;
+            entry->data = pack->base + record->data;
+            entry->header_len = record->header_len;
+            entry->size = record->size;
+            entry->mtime = record->mtime;
+            entry->file_size = record->file_size;
+            memcpy(entry->etag, record->etag, sizeof(entry->etag));
+            entry->refs = 1;
+            entry->pinned = TRUE;
+        }
+    }
+    return entries;
+}
+
+/* Sets up an empty writer */
+void ws_pack_writer_init(ws_pack_writer_p writer) {
+    writer->entries = NULL;
+    writer->count = 0;
+    writer->size = 0;
+}
+
+/* Adds a response (from ws_cache_new()), the writer takes its reference.
+   Returns 0 or -1 with errno set */
+int ws_pack_writer_add(ws_pack_writer_p writer, ws_cache_entry_p entry) {
+    if (writer->count == writer->size) {
+        int size = writer->size ? writer->size * 2 : 64;
+        ws_cache_entry_p *entries = realloc(writer->entries, size * sizeof(ws_cache_entry_p));
+        if (entries == NULL) return -1;
+        writer->entries = entries;
+        writer->size = size;
+    }
+    writer->entries[writer->count++] = entry;
+    return 0;
+}
+
+/* Orders responses by path, then status and coding */
+static int compare_entries(const void *a, const void *b) {
+    ws_cache_entry_p x = *(ws_cache_entry_p const *)a;
+    ws_cache_entry_p y = *(ws_cache_entry_p const *)b;
+    int order = strcmp(x->key, y->key);
+    if (order != 0) return order;
+    if (x->status != y->status) return x->status - y->status;
+    return x->coding - y->coding;
+}
+
+/* Orders buckets of the perfect hash by size, largest first */
+static int *bucket_sizes;
+static int compare_buckets(const void *a, const void *b) {
+    return bucket_sizes[*(const int *)b] - bucket_sizes[*(const int *)a];
+}
+
+/* Finds a seed for every bucket so each path gets a slot of its own.
+   keys holds the first entry of each path. Returns 0 or -1 with errno set */
+static int build_hash(ws_cache_entry_p *keys, uint32_t npaths, uint32_t nbuckets,
+        uint32_t *seeds, uint32_t *slots) {
+    int *bucket = malloc(npaths * sizeof(int));
+    int *sizes = calloc(nbuckets, sizeof(int));
+    int *order = malloc(nbuckets * sizeof(int));
+    char *taken = calloc(npaths, 1);
+    uint32_t *trial = malloc(npaths * sizeof(uint32_t));
+    int result = -1;
+    if (!bucket || !sizes || !order || !taken || !trial) goto done;
+
+    for (uint32_t i = 0; i < npaths; i++) {
+        bucket[i] = hash_path(keys[i]->key, strlen(keys[i]->key), 0) % nbuckets;
+        sizes[bucket[i]]++;
+    }
+    for (uint32_t b = 0; b < nbuckets; b++) order[b] = b;
+    bucket_sizes = sizes;
+    qsort(order, nbuckets, sizeof(int), compare_buckets);
+
+    /* The fullest buckets pick first, while most slots are free */
+    for (uint32_t o = 0; o < nbuckets && sizes[order[o]] > 0; o++) {
+        int b = order[o];
+        uint32_t seed;
+        for (seed = 1; seed < WS_PACK_MAX_SEED; seed++) {
+            int count = 0, ok = TRUE;
+            for (uint32_t i = 0; i < npaths && ok; i++) {
+                if (bucket[i] != b) continue;
+                uint32_t slot = hash_path(keys[i]->key, strlen(keys[i]->key), seed) % npaths;
+                ok = !taken[slot];
+                for (int j = 0; j < count && ok; j++) ok = trial[j] != slot;
+                trial[count++] = slot;
+            }
+            if (ok) break;
+        }
+        if (seed == WS_PACK_MAX_SEED) {
+            errno = EAGAIN;
+            goto done;
+        }
+        seeds[b] = seed;
+        for (uint32_t i = 0; i < npaths; i++) {
+            if (bucket[i] != b) continue;
+            slots[i] = hash_path(keys[i]->key, strlen(keys[i]->key), seed) % npaths;
+            taken[slots[i]] = TRUE;
+        }
+    }
+    result = 0;
+
+done:
+    if (result == -1 && errno == 0) errno = ENOMEM;
+    free(bucket);
+    free(sizes);
+    free(order);
+    free(taken);
+    free(trial);
+    return result;
+}
+
+/* Lays the responses out as a pack in a malloc'd blob. Returns 0 or -1
+   with errno set */
+int ws_pack_writer_finish(ws_pack_writer_p writer, char **blob, size_t *size) {
+    if (writer->count == 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    qsort(writer->entries, writer->count, sizeof(ws_cache_entry_p), compare_entries);
+
+    /* Group the records by path */
+    uint32_t npaths = 0;
+    ws_cache_entry_p *keys = malloc(writer->count * sizeof(ws_cache_entry_p));
+    uint32_t *firsts = malloc(writer->count * sizeof(uint32_t));
+    if (keys == NULL || firsts == NULL) {
+        free(keys);
+        free(firsts);
+        return -1;
+    }
+    for (int i = 0; i < writer->count; i++) {
+        if (i == 0 || strcmp(writer->entries[i]->key, writer->entries[i-1]->key) != 0) {
+            keys[npaths] = writer->entries[i];
+            firsts[npaths++] = i;
+        }
+    }
+    uint32_t nbuckets = npaths / WS_PACK_LOAD + 1;
+    uint32_t *seeds = calloc(nbuckets, sizeof(uint32_t));
+    uint32_t *slots = malloc(npaths * sizeof(uint32_t));
+    if (seeds == NULL || slots == NULL || build_hash(keys, npaths, nbuckets, seeds, slots) == -1) {
+        int err = errno;
+        free(keys);
+        free(firsts);
+        free(seeds);
+        free(slots);
+        errno = err;
+        return -1;
+    }
+
+    /* Size the tables, then the paths, then the responses */
+    size_t offset = ALIGN8(sizeof(ws_pack_header_t));
+    size_t seeds_at = offset;
+    offset = ALIGN8(offset + nbuckets * sizeof(uint32_t));
+    size_t paths_at = offset;
+    offset += npaths * sizeof(ws_pack_path_t);
+    size_t records_at = offset;
+    offset += writer->count * sizeof(ws_pack_record_t);
+    size_t keys_at = offset;
+    for (uint32_t p = 0; p < npaths; p++) {
+        offset += strlen(keys[p]->key) + 1;
+    }
+    offset = ALIGN8(offset);
+    size_t data_at = offset;
+    for (int i = 0; i < writer->count; i++) {
+        offset = ALIGN8(offset + writer->entries[i]->size);
+    }
+
+    char *out = calloc(1, offset);
+    if (out == NULL) {
+        free(keys);
+        free(firsts);
+        free(seeds);
+        free(slots);
+        return -1;
+    }
+    ws_pack_header_t *header = (ws_pack_header_t *)out;
+    memcpy(header->magic, WS_PACK_MAGIC, sizeof(header->magic));
+    header->version = WS_PACK_VERSION;
+    header->npaths = npaths;
+    header->nrecords = writer->count;
+    header->nbuckets = nbuckets;
+    header->size = offset;
+    memcpy(out + seeds_at, seeds, nbuckets * sizeof(uint32_t));
+
+    ws_pack_path_t *paths = (ws_pack_path_t *)(out + paths_at);
+    size_t key_offset = keys_at;
+    for (uint32_t p = 0; p < npaths; p++) {
+        ws_pack_path_t *path = &paths[slots[p]];
+        size_t len = strlen(keys[p]->key);
+        memcpy(out + key_offset, keys[p]->key, len + 1);
+        path->key = key_offset;
+        path->key_len = len;
+        path->first = firsts[p];
+        path->count = (p+1 < npaths ? firsts[p+1] : (uint32_t)writer->count) - firsts[p];
+        key_offset += len + 1;
+    }
+
+    ws_pack_record_t *records = (ws_pack_record_t *)(out + records_at);
+    size_t data_offset = data_at;
+    for (int i = 0; i < writer->count; i++) {
+        ws_cache_entry_p entry = writer->entries[i];
+        ws_pack_record_t *record = &records[i];
+        memcpy(out + data_offset, entry->data, entry->size);
+        record->data = data_offset;
+        record->header_len = entry->header_len;
+        record->size = entry->size;
+        record->mtime = entry->mtime;
+        record->file_size = entry->file_size;
+        record->status = entry->status;
+        record->coding = entry->coding;
+        memcpy(record->etag, entry->etag, sizeof(record->etag));
+        data_offset = ALIGN8(data_offset + entry->size);
+    }
+
+    free(keys);
+    free(firsts);
+    free(seeds);
+    free(slots);
+    *blob = out;
+    *size = offset;
+    return 0;
+}
+
+/* Releases every response added */
+void ws_pack_writer_free(ws_pack_writer_p writer) {
+    for (int i = 0; i < writer->count; i++) {
+        ws_cache_release(writer->entries[i]);
+    }
+    free(writer->entries);
+    ws_pack_writer_init(writer);
+}
+
+/* Writes a blob to a file atomically (through a temporary file and a
+   rename). Returns 0 or -1 with errno set */
+int ws_pack_save(const char *file, const char *blob, size_t size) {
+    char temp[4096];
+    if (snprintf(temp, sizeof(temp), "%s.tmp", file) >= (int)sizeof(temp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return -1;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, blob + done, size - done);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            int err = errno;
+            close(fd);
+            unlink(temp);
+            errno = err;
+            return -1;
+        }
+        done += n;
+    }
+    if (fsync(fd) == -1 || close(fd) == -1 || rename(temp, file) == -1) {
+        int err = errno;
+        unlink(temp);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+/* Simple HTML web server site pack header */
+
+/*
+Site Pack Overview:
+ -  A pack is one blob holding every page under root as complete responses
+    (the header without its Connection line, then the body), built once so
+    serving a page never touches the filesystem
+ -  Each page may have several records: its 200 response, compressed
+    copies (gzip, brotli) and error responses (404, 500) for the error
+    pages, looked up by path, status and coding like the response cache
+ -  Paths are found with a minimal perfect hash (hash and displace): a
+    first hash picks a bucket, whose stored seed makes a second hash that
+    sends every path in the bucket to its own slot, so a lookup is two
+    hashes and one compare, and the table is exactly one slot per path
+ -  Packs are written by --pack-build and mapped read-only by --pack-file,
+    so loading one is an mmap() and a header check; --pack builds one in
+    memory at startup instead
+ -  The layout uses fixed width fields in the host's byte order, so a pack
+    is loaded on the kind of machine that built it
+*/
+
+#ifndef WS_PACK_H
+#define WS_PACK_H
+
+#include <stddef.h>         /* size_t */
+#include <stdint.h>         /* Fixed width fields */
+#include "ws-cache.h"       /* Entries the records are served as */
+
+/* Define format */
+#define WS_PACK_MAGIC       "WSPACK01"
+#define WS_PACK_VERSION     1
+#define WS_PACK_LOAD        2 /* Paths per bucket of the perfect hash */
+#define WS_PACK_MAX_SEED    (1<<20) /* Seeds tried per bucket before giving up */
+
+/* Start of a pack */
+struct ws_pack_header_t {
+    char magic[8];                  /* WS_PACK_MAGIC */
+    uint32_t version;               /* WS_PACK_VERSION */
+    uint32_t npaths;                /* Paths, and slots of the hash */
+    uint32_t nrecords;              /* Responses */
+    uint32_t nbuckets;              /* Seeds of the hash */
+    uint64_t size;                  /* Bytes in the whole pack */
+};
+typedef struct ws_pack_header_t ws_pack_header_t;
+
+/* A slot of the hash, one per path */
+struct ws_pack_path_t {
+    uint64_t key;                   /* Offset of the path, NUL terminated */
+    uint32_t key_len;               /* Its length */
+    uint32_t first;                 /* First of its records */
+    uint32_t count;                 /* Number of its records */
+    uint32_t pad;
+};
+typedef struct ws_pack_path_t ws_pack_path_t;
+
+/* A response */
+struct ws_pack_record_t {
+    uint64_t data;                  /* Offset of the header then body */
+    uint64_t header_len;            /* Bytes of header */
+    uint64_t size;                  /* Bytes of header and body */
+    int64_t mtime;                  /* Modification time of the file */
+    int64_t file_size;              /* Size of the file */
+    int32_t status;                 /* HTTP status */
+    int32_t coding;                 /* Content coding of the body */
+    char etag[WS_CACHE_ETAG_LEN];   /* Validator, with quotes */
+};
+typedef struct ws_pack_record_t ws_pack_record_t;
+
+/* A loaded pack */
+struct ws_pack_t {
+    char *base;                     /* The whole pack */
+    size_t size;                    /* Its size */
+    int mapped;                     /* TRUE if mapped from a file, else malloc'd */
+    const ws_pack_header_t *header;
+    const uint32_t *seeds;          /* Seed of each bucket */
+    const ws_pack_path_t *paths;    /* Slot of each path */
+    const ws_pack_record_t *records; /* Every response, grouped by path */
+};
+typedef struct ws_pack_t ws_pack_t;
+typedef ws_pack_t* ws_pack_p;
+
+/* Responses gathered for a new pack */
+struct ws_pack_writer_t {
+    ws_cache_entry_p *entries;      /* Responses added, owned by the writer */
+    int count;                      /* Number added */
+    int size;                       /* Room in entries */
+};
+typedef struct ws_pack_writer_t ws_pack_writer_t;
+typedef ws_pack_writer_t* ws_pack_writer_p;
+
+/* Maps a pack file, returns 0 or -1 with errno set (EINVAL if it isn't a
+   valid pack) */
+int ws_pack_open(ws_pack_p pack, const char *file);
+
+/* Uses a malloc'd blob as a pack, which it then owns. Returns 0 or -1 with
+   errno set */
+int ws_pack_load(ws_pack_p pack, char *blob, size_t size);
+
+/* Unmaps or frees a pack */
+void ws_pack_close(ws_pack_p pack);
+
+/* Returns the record of a response, or -1 if the pack doesn't have it */
+int ws_pack_find(ws_pack_p pack, const char *key, int status, int coding);
+
+/* Returns an array of cache entries, one per record, that serve the
+   records straight from the pack. Each is pinned and holds one reference
+   of its own, so it is never freed by ws_cache_release(). NULL on error */
+ws_cache_entry_p ws_pack_entries(ws_pack_p pack);
+
+/* Sets up an empty writer */
+void ws_pack_writer_init(ws_pack_writer_p writer);
+
+/* Adds a response (from ws_cache_new()), the writer takes its reference.
+   Returns 0 or -1 with errno set */
+int ws_pack_writer_add(ws_pack_writer_p writer, ws_cache_entry_p entry);
+
+/* Lays the responses out as a pack in a malloc'd blob. Returns 0 or -1
+   with errno set */
+int ws_pack_writer_finish(ws_pack_writer_p writer, char **blob, size_t *size);
+
+/* Releases every response added */
+void ws_pack_writer_free(ws_pack_writer_p writer);
+
+/* Writes a blob to a file atomically (through a temporary file and a
+   rename). Returns 0 or -1 with errno set */
+int ws_pack_save(const char *file, const char *blob, size_t size);
+
+#endif
@@ -0,0 +1,246 @@
+/* Simple HTML web server path resolution */
+#define _GNU_SOURCE         /* O_PATH */
+#include <stdio.h>          /* NULL */
+#include <string.h>         /* String parsing */
+#include <unistd.h>         /* close */
+#include <fcntl.h>          /* openat */
+#include <errno.h>          /* Error handling */
+#include "ws-path.h"        /* Path consts and structs */
+#ifdef LINUX
+#if defined(__has_include)
+#if __has_include(<linux/openat2.h>)
+#define WS_HAVE_OPENAT2
+#include <sys/syscall.h>    /* Raw openat2 syscall */
+#include <linux/openat2.h>  /* open_how and RESOLVE_* */
+#endif
+#endif
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+/* Folders are only opened to look up names in */
+#ifdef O_PATH
+#define WS_PATH_DIR_FLAGS   (O_PATH | O_DIRECTORY)
+#else
+#define WS_PATH_DIR_FLAGS   (O_RDONLY | O_DIRECTORY)
+#endif
+
+#ifdef WS_HAVE_OPENAT2
+/* TRUE if the kernel has openat2(), checked when root is opened */
+static int use_openat2 = FALSE;
+#endif
+
+/* Opens a path relative to a folder, refusing symlinks and anything that
+   leaves the folder. Returns the fd or -1 */
+static int resolve(int dir, const char *rel, int flags) {
+#ifdef WS_HAVE_OPENAT2
+    if (use_openat2) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = flags | O_CLOEXEC;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+        return syscall(SYS_openat2, dir, rel, &how, sizeof(how));
+    }
+#endif
+    /* One folder at a time, paths were decoded so none of them is .. */
+    char name[WS_PATH_DIR_LEN];
+    int fd = dir;
+    const char *slash;
+    while (fd != -1 && (slash = strchr(rel, '/')) != NULL) {
+        int len = slash - rel;
+        int next = -1;
+        if (len < WS_PATH_DIR_LEN) {
+            memcpy(name, rel, len);
+            name[len] = '\0';
+            next = openat(fd, name, WS_PATH_DIR_FLAGS | O_NOFOLLOW | O_CLOEXEC);
+        } else {
+            errno = ENAMETOOLONG;
+        }
+        if (fd != dir) {
+            int err = errno;
+            close(fd);
+            errno = err;
+        }
+        fd = next;
+        rel = slash + 1;
+    }
+    if (fd == -1) return -1;
+    int page = openat(fd, rel, flags | O_NOFOLLOW | O_CLOEXEC);
+    if (fd != dir) {
+        int err = errno;
+        close(fd);
+        errno = err;
+    }
+    return page;
+}
+
+/* Opens root for every page to be resolved beneath */
+int ws_path_root(const char *root) {
+    int fd = open(root, WS_PATH_DIR_FLAGS | O_CLOEXEC);
+    if (fd == -1) return -1;
+#ifdef WS_HAVE_OPENAT2
+    /* Kernels before 5.6, or sandboxes refusing it, walk instead */
+    use_openat2 = TRUE;
+    int probe = resolve(fd, ".", WS_PATH_DIR_FLAGS);
+    if (probe == -1) {
+        use_openat2 = FALSE;
+    } else {
+        close(probe);
+    }
+#endif
+    return fd;
+}
+
+/* Returns the value of a hex digit, or -1 */
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Folds away a "." segment ending at out[n], returns the new length or -1
+   for a ".." one */
+static int end_segment(char *out, int n) {
+    if (n >= 2 && out[n-1] == '.' && out[n-2] == '/') {
+        return n - 1;
+    }
+    if (n >= 3 && out[n-1] == '.' && out[n-2] == '.' && out[n-3] == '/') {
+        return -1;
+    }
+    return n;
+}
+
+/* Decodes a request target into the path of a page */
+int ws_path_decode(const char *target, int len, char *out, int size) {
+    if (len == 0 || target[0] != '/' || size < 2) return -1;
+    int n = 0;
+    for (int i = 0; i < len && target[i] != '?' && target[i] != '#'; i++) {
+        char c = target[i];
+        if (c == '%') {
+            int high = i+2 < len ? hex_digit(target[i+1]) : -1;
+            int low = i+2 < len ? hex_digit(target[i+2]) : -1;
+            if (high == -1 || low == -1) return -1;
+            c = high << 4 | low;
+            i += 2;
+        }
+        if (c == '\0') return -1;
+        if (c == '/') {
+            n = end_segment(out, n);
+            if (n == -1) return -1;
+            if (n > 0 && out[n-1] == '/') continue;
+        }
+        if (n + 1 >= size) return -1;
+        out[n++] = c;
+    }
+    n = end_segment(out, n);
+    if (n == -1) return -1;
+    out[n] = '\0';
+    return n;
+}
+
+/* Starts a worker's folders */
+void ws_path_init(ws_path_cache_p cache, int root, int keep) {
+    cache->root = root;
+    cache->keep = keep;
+    cache->count = 0;
+    for (int i = 0; i < WS_PATH_DIRS; i++) {
+        cache->dirs[i].fd = -1;
+    }
+}
+
+/* Returns the fd of a folder under root (len bytes of name), opening and
+   keeping it if it isn't kept yet, or -1 */
+static int find_dir(ws_path_cache_p cache, const char *name, int len) {
+    ws_path_dir_t *coldest = NULL;
+    for (int i = 0; i < WS_PATH_DIRS; i++) {
+        ws_path_dir_t *dir = &cache->dirs[i];
+        if (dir->fd != -1 && dir->len == len && memcmp(dir->name, name, len) == 0) {
+            dir->hits++;
+            return dir->fd;
+        }
+        if (coldest == NULL || dir->fd == -1 || (coldest->fd != -1 && dir->hits < coldest->hits)) {
+            coldest = dir;
+        }
+    }
+
+    char rel[WS_PATH_DIR_LEN];
+    memcpy(rel, name, len);
+    rel[len] = '\0';
+    int fd = resolve(cache->root, rel, WS_PATH_DIR_FLAGS);
+    if (fd == -1) return -1;
+
+    /* The least used folder makes way, and the rest age so that folders
+       that were hot once don't stay forever */
+    if (coldest->fd != -1) {
+        close(coldest->fd);
+        cache->count--;
+        for (int i = 0; i < WS_PATH_DIRS; i++) {
+            cache->dirs[i].hits /= 2;
+        }
+    }
+    memcpy(coldest->name, rel, len + 1);
+    coldest->len = len;
+    coldest->fd = fd;
+    coldest->hits = 1;
+    cache->count++;
+    return fd;
+}
+
+/* Splits a decoded path into a folder and the name to open in it: the
+   folder the page is in when it is kept, or else root and the whole path.
+   Returns the folder's fd, or -1 if it can't be opened */
+static int split(ws_path_cache_p cache, const char *path, const char **name) {
+    const char *rel = path[0] == '/' ? path+1 : path;
+    const char *slash = strrchr(rel, '/');
+    *name = rel;
+    if (slash == NULL || !cache->keep || slash - rel >= WS_PATH_DIR_LEN) {
+        return cache->root;
+    }
+    *name = slash + 1;
+    return find_dir(cache, rel, slash - rel);
+}
+
+/* Opens a decoded path beneath root */
+int ws_path_open(ws_path_cache_p cache, const char *path, int flags) {
+    const char *name;
+    int dir = split(cache, path, &name);
+    if (dir == -1) return -1;
+    return resolve(dir, name, flags);
+}
+
+/* Stats a decoded path beneath root */
+int ws_path_stat(ws_path_cache_p cache, const char *path, struct stat *info) {
+    int fd = ws_path_open(cache, path, WS_PATH_DIR_FLAGS & ~O_DIRECTORY);
+    if (fd == -1) return -1;
+    int result = fstat(fd, info);
+    close(fd);
+
+    /* Walking opens a symlink itself rather than refusing it */
+    if (result == 0 && S_ISLNK(info->st_mode)) {
+        errno = ELOOP;
+        return -1;
+    }
+    return result;
+}
+
+/* Closes every folder kept */
+void ws_path_flush(ws_path_cache_p cache) {
+    for (int i = 0; i < WS_PATH_DIRS; i++) {
+        if (cache->dirs[i].fd != -1) {
+            close(cache->dirs[i].fd);
+            cache->dirs[i].fd = -1;
+        }
+    }
+    cache->count = 0;
+}
+
+/* Closes every folder kept, root is left open */
+void ws_path_destroy(ws_path_cache_p cache) {
+    ws_path_flush(cache);
+}
@@ -0,0 +1,78 @@
+/* Simple HTML web server path resolution header */
+
+/*
+Path Resolution Overview:
+ -  A request's target is percent-decoded into the path of a page under
+    root: the query and fragment are dropped, repeated slashes and "."
+    segments are folded away, and targets with a ".." segment, a decoded
+    NUL or a broken escape are refused
+ -  root is opened once as a directory, and pages are opened relative to
+    it: with openat2() and RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS on Linux,
+    so the kernel itself refuses any path that would leave root or follow
+    a symlink, and elsewhere (or on kernels without openat2) by walking the
+    path a folder at a time without following symlinks
+ -  Each worker keeps the folders it opens pages in (images/, testing/...)
+    open in a small table, so a page there is one lookup of its name
+    instead of a walk from root; when folders are kept least used ones
+    make way for new ones, and any change under root (seen through the
+    cache's notifications) closes them all, so a moved folder is never
+    served from its old place
+ -  Without notifications folders aren't kept, and every page is resolved
+    from root
+*/
+
+#ifndef WS_PATH_H
+#define WS_PATH_H
+
+#include <sys/stat.h>       /* struct stat */
+
+/* Define misc */
+#define WS_PATH_DIRS        16 /* Folders a worker keeps open */
+#define WS_PATH_DIR_LEN     128 /* Longest folder kept open, with its terminator */
+
+/* A folder under root kept open */
+struct ws_path_dir_t {
+    char name[WS_PATH_DIR_LEN]; /* Its path under root, without slashes at either end */
+    int len;                    /* Length of name */
+    int fd;                     /* The open folder, -1 if the slot is free */
+    unsigned long hits;         /* Pages opened through it, halved as others make way */
+};
+typedef struct ws_path_dir_t ws_path_dir_t;
+
+/* A worker's folders */
+struct ws_path_cache_t {
+    int root;                   /* Root folder, shared by every worker */
+    int keep;                   /* TRUE if folders are kept open */
+    int count;                  /* Folders kept */
+    ws_path_dir_t dirs[WS_PATH_DIRS];
+};
+typedef struct ws_path_cache_t ws_path_cache_t;
+typedef ws_path_cache_t* ws_path_cache_p;
+
+/* Opens root for every page to be resolved beneath, returns its fd or -1
+   with errno set */
+int ws_path_root(const char *root);
+
+/* Decodes len bytes of a request target into the path of a page, starting
+   with a slash, into out (size bytes). Returns the path's length, or -1 if
+   the target is malformed, leaves root or doesn't fit */
+int ws_path_decode(const char *target, int len, char *out, int size);
+
+/* Starts a worker's folders, kept open only when keep is TRUE */
+void ws_path_init(ws_path_cache_p cache, int root, int keep);
+
+/* Opens a decoded path beneath root with open() flags, returns the fd or -1
+   with errno set */
+int ws_path_open(ws_path_cache_p cache, const char *path, int flags);
+
+/* Stats a decoded path beneath root, without following symlinks.
+   Returns 0 or -1 with errno set */
+int ws_path_stat(ws_path_cache_p cache, const char *path, struct stat *info);
+
+/* Closes every folder kept, they are opened again as pages need them */
+void ws_path_flush(ws_path_cache_p cache);
+
+/* Closes every folder kept, root is left open */
+void ws_path_destroy(ws_path_cache_p cache);
+
+#endif
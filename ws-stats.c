@@ -0,0 +1,81 @@
+/* Simple HTML web server statistics */
+#include <stdio.h>          /* Writing stats out */
+#include "ws-stats.h"       /* Stats consts and structs */
+
+/* Statuses with their own counter, the last slot counts the others */
+static const int statuses[WS_STATS_STATUSES] = { 200, 206, 304, 404, 416, 500, 0 };
+
+/* Returns the slot of a status in ws_stats_t.statuses */
+int ws_stats_status_index(int status) {
+    int i = 0;
+    while (i < WS_STATS_STATUSES-1 && statuses[i] != status) i++;
+    return i;
+}
+
+/* Returns the status counted in a slot, 0 for the others */
+int ws_stats_status(int index) {
+    return statuses[index];
+}
+
+/* Returns the bucket of a value. Values below WS_STATS_SUBS get a bucket
+   each, then every power of two gets WS_STATS_SUBS of them */
+static int bucket_of(unsigned long value) {
+    if (value < WS_STATS_SUBS) return value;
+    int msb = 63 - __builtin_clzl(value);
+    int shift = msb - WS_STATS_SUB_BITS;
+    int bucket = (shift + 1) * WS_STATS_SUBS + (int)((value >> shift) - WS_STATS_SUBS);
+    return bucket < WS_STATS_BUCKETS ? bucket : WS_STATS_BUCKETS-1;
+}
+
+/* Returns the smallest value of a bucket */
+static unsigned long bucket_low(int bucket) {
+    int octave = bucket / WS_STATS_SUBS;
+    unsigned long sub = bucket % WS_STATS_SUBS;
+    return octave == 0 ? sub : (WS_STATS_SUBS + sub) << (octave - 1);
+}
+
+/* Records a latency in us, only from the histogram's own worker */
+void ws_stats_record(ws_histogram_p hist, unsigned long us) {
+    WS_STATS_ADD(hist->counts[bucket_of(us)], 1);
+    WS_STATS_ADD(hist->sum, us);
+    WS_STATS_ADD(hist->count, 1);
+}
+
+/* Adds a snapshot of src to dst, which no other thread uses */
+void ws_stats_merge(ws_histogram_p dst, ws_histogram_p src) {
+    for (int i = 0; i < WS_STATS_BUCKETS; i++) {
+        dst->counts[i] += WS_STATS_GET(src->counts[i]);
+    }
+    dst->sum += WS_STATS_GET(src->sum);
+    dst->count += WS_STATS_GET(src->count);
+}
+
+/* Writes the HELP and TYPE lines of a metric */
+void ws_stats_write_meta(FILE *out, const char *name, const char *type,
+        const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Writes a histogram as a Prometheus histogram in seconds */
+void ws_stats_write_histogram(FILE *out, const char *name, const char *help,
+        ws_histogram_p hist) {
+    ws_stats_write_meta(out, name, "histogram", help);
+
+    /* Buckets are cumulative, and the counts were read one at a time, so
+       +Inf uses the last cumulative count to stay consistent with them */
+    unsigned long below = 0;
+    int bucket = 0;
+    for (int le = WS_STATS_MIN_LE; le <= WS_STATS_MAX_LE; le++) {
+        unsigned long bound = 1UL << le;
+        while (bucket < WS_STATS_BUCKETS && bucket_low(bucket+1) <= bound) {
+            below += hist->counts[bucket++];
+        }
+        fprintf(out, "%s_bucket{le=\"%.9g\"} %lu\n", name, bound / 1e6, below);
+    }
+    while (bucket < WS_STATS_BUCKETS) {
+        below += hist->counts[bucket++];
+    }
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n", name, below);
+    fprintf(out, "%s_sum %.6f\n", name, hist->sum / 1e6);
+    fprintf(out, "%s_count %lu\n", name, below);
+}
@@ -0,0 +1,97 @@
+/* Simple HTML web server statistics header */
+
+/*
+Statistics Overview:
+ -  Every worker keeps its own counters, gauges and latency histograms, and
+    is the only thread that writes them, so recording never takes a lock or
+    a locked instruction: an add is a relaxed load and store
+ -  Readers (the /__stats page and the periodic dump, on any worker) sum the
+    workers' stats with relaxed loads, so a snapshot is a moment's view of
+    each counter, never a torn value
+ -  Latencies are kept in microseconds in HDR-style buckets: each power of
+    two is split into WS_STATS_SUBS linear sub-buckets, so every bucket is
+    within 25% of its values from a microsecond to over an hour, in a fixed
+    array with no allocation
+ -  Stats are written in the Prometheus text format (version 0.0.4), the
+    histograms with a bucket for each power of two microseconds
+*/
+
+#ifndef WS_STATS_H
+#define WS_STATS_H
+
+#include <stdio.h>          /* FILE */
+
+/* Define histogram layout */
+#define WS_STATS_SUB_BITS   2
+#define WS_STATS_SUBS       (1<<WS_STATS_SUB_BITS) /* Sub-buckets per power of two */
+#define WS_STATS_BUCKETS    (33*WS_STATS_SUBS) /* Up to 2^33us, larger values go in the last */
+#define WS_STATS_MIN_LE     3  /* Smallest bucket written, 2^3us */
+#define WS_STATS_MAX_LE     26 /* Largest bucket written before +Inf, 2^26us (67s) */
+
+/* Define response statuses counted */
+#define WS_STATS_STATUSES   7  /* 200, 206, 304, 404, 416, 500, and any other */
+#define WS_STATS_DEADLINES  3  /* Idle, request and send timeouts */
+
+/* Single writer updates and any thread reads of stats */
+#define WS_STATS_ADD(counter, n) __atomic_store_n(&(counter), \
+    __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+#define WS_STATS_GET(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+/* A latency histogram */
+struct ws_histogram_t {
+    unsigned long counts[WS_STATS_BUCKETS]; /* Values in each bucket */
+    unsigned long count;            /* Values recorded */
+    unsigned long sum;              /* Total of the values in us */
+};
+typedef struct ws_histogram_t ws_histogram_t;
+typedef ws_histogram_t* ws_histogram_p;
+
+/* Stats of a worker */
+struct ws_stats_t {
+    unsigned long statuses[WS_STATS_STATUSES]; /* Responses by status */
+    unsigned long bytes_sent;       /* Bytes written to clients */
+    unsigned long bytes_received;   /* Bytes read from clients */
+    unsigned long timeouts[WS_STATS_DEADLINES]; /* Clients closed by each kind of deadline */
+    unsigned long deferred;         /* Connections that waited in the backlog while accepting paused */
+    unsigned long rejected;         /* Connections closed as soon as they were accepted */
+    unsigned long handshakes;       /* TLS handshakes completed */
+    unsigned long resumed;          /* Those that resumed a session */
+    unsigned long ktls;             /* Those whose writes the kernel encrypts */
+    unsigned long handshake_errors; /* TLS handshakes that failed */
+    unsigned long h2_connections;   /* Connections switched to HTTP/2 */
+    unsigned long send_deferred;    /* Turns a bulk response ended with its -q budget spent */
+    unsigned long throttled;        /* Times a client ran out of -L tokens */
+    unsigned long disk_loads;       /* Pages loaded on the disk pool */
+    unsigned long disk_reads;       /* File windows read ahead on the disk pool */
+    long open;                      /* Connected clients */
+    long sending;                   /* Clients sending a response */
+    long idle;                      /* Clients waiting for a request */
+    long streams;                   /* HTTP/2 streams being answered */
+    long disk;                      /* Clients waiting on the disk pool */
+    ws_histogram_t ttfb;            /* Request arriving to first byte sent */
+    ws_histogram_t total;           /* Request arriving to last byte sent */
+};
+typedef struct ws_stats_t ws_stats_t;
+typedef ws_stats_t* ws_stats_p;
+
+/* Returns the slot of a status in ws_stats_t.statuses */
+int ws_stats_status_index(int status);
+
+/* Returns the status counted in a slot, 0 for the others */
+int ws_stats_status(int index);
+
+/* Records a latency in us, only from the histogram's own worker */
+void ws_stats_record(ws_histogram_p hist, unsigned long us);
+
+/* Adds a snapshot of src to dst, which no other thread uses */
+void ws_stats_merge(ws_histogram_p dst, ws_histogram_p src);
+
+/* Writes the HELP and TYPE lines of a metric */
+void ws_stats_write_meta(FILE *out, const char *name, const char *type,
+    const char *help);
+
+/* Writes a histogram as a Prometheus histogram in seconds */
+void ws_stats_write_histogram(FILE *out, const char *name, const char *help,
+    ws_histogram_p hist);
+
+#endif
@@ -0,0 +1,161 @@
+/* Simple HTML web server timer wheel */
+#include <stdio.h>          /* NULL */
+#include "ws-timer.h"       /* Timer wheel consts and structs */
+
+/* Ticks a whole wheel spans, later expiries are clamped to it */
+#define WS_TIMER_SPAN      (1UL << (WS_TIMER_SLOT_BITS * WS_TIMER_LEVELS))
+
+/* Returns the tick a time in ms falls in, rounded up */
+static unsigned long tick_of(long ms) {
+    return ms <= 0 ? 0 : ((unsigned long)ms + WS_TIMER_TICK_MS - 1) / WS_TIMER_TICK_MS;
+}
+
+/* Returns the slot of a tick at a level */
+static int slot_index(unsigned long tick, int level) {
+    return (tick >> (WS_TIMER_SLOT_BITS * level)) & (WS_TIMER_SLOTS-1);
+}
+
+/* Puts a timer in the slot of the lowest level its expiry fits */
+static void place(ws_timer_wheel_p wheel, ws_timer_p timer) {
+    unsigned long delta = timer->expires - wheel->now;
+    int level = 0;
+    while (level < WS_TIMER_LEVELS-1 
+            && delta >= 1UL << (WS_TIMER_SLOT_BITS * (level+1))) {
+        level++;
+    }
+    int index = slot_index(timer->expires, level);
+    ws_timer_p *slot = &wheel->slots[level][index];
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot) (*slot)->prev = timer;
+    *slot = timer;
+    timer->slot = slot;
+    wheel->occupied[level] |= 1ULL << index;
+}
+
+/* Takes a pending timer out of its slot */
+static void unlink_timer(ws_timer_wheel_p wheel, ws_timer_p timer) {
+    if (timer->prev) timer->prev->next = timer->next;
+    else *timer->slot = timer->next;
+    if (timer->next) timer->next->prev = timer->prev;
+    if (*timer->slot == NULL) {
+        int index = timer->slot - &wheel->slots[0][0];
+        wheel->occupied[index / WS_TIMER_SLOTS] &= ~(1ULL << (index % WS_TIMER_SLOTS));
+    }
+    timer->prev = timer->next = NULL;
+    timer->slot = NULL;
+}
+
+/* Sets up an empty wheel at a time in ms */
+void ws_timer_init(ws_timer_wheel_p wheel, long now_ms) {
+    for (int level = 0; level < WS_TIMER_LEVELS; level++) {
+        for (int i = 0; i < WS_TIMER_SLOTS; i++) {
+            wheel->slots[level][i] = NULL;
+        }
+        wheel->occupied[level] = 0;
+    }
+    wheel->now = now_ms / WS_TIMER_TICK_MS;
+    wheel->count = 0;
+}
+
+/* Sets up a timer that isn't pending */
+void ws_timer_setup(ws_timer_p timer, void *data) {
+    timer->prev = timer->next = NULL;
+    timer->slot = NULL;
+    timer->expires = 0;
+    timer->data = data;
+}
+
+/* (Re)schedules a timer to fire at a time in ms, rounded up to a tick */
+void ws_timer_set(ws_timer_wheel_p wheel, ws_timer_p timer, long when_ms) {
+    ws_timer_cancel(wheel, timer);
+
+    /* Never in the tick being fired, or beyond the top level */
+    unsigned long expires = tick_of(when_ms);
+    if (expires <= wheel->now) expires = wheel->now + 1;
+    if (expires - wheel->now >= WS_TIMER_SPAN) expires = wheel->now + WS_TIMER_SPAN - 1;
+    timer->expires = expires;
+    place(wheel, timer);
+    wheel->count++;
+}
+
+/* Takes a timer off the wheel, if it is on it */
+void ws_timer_cancel(ws_timer_wheel_p wheel, ws_timer_p timer) {
+    if (timer->slot == NULL) return;
+    unlink_timer(wheel, timer);
+    wheel->count--;
+}
+
+/* Moves every timer of a slot to the levels below */
+static void cascade(ws_timer_wheel_p wheel, int level, int index) {
+    ws_timer_p timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    wheel->occupied[level] &= ~(1ULL << index);
+    while (timer) {
+        ws_timer_p next = timer->next;
+        place(wheel, timer);
+        timer = next;
+    }
+}
+
+/* Fires every timer due by a time in ms, in order of their ticks. fire may
+   set or cancel any timer */
+void ws_timer_advance(ws_timer_wheel_p wheel, long now_ms, ws_timer_fire_t fire) {
+    unsigned long target = now_ms / WS_TIMER_TICK_MS;
+    while (wheel->now < target) {
+        /* With nothing due on the lowest level, skip to its next turn */
+        if (wheel->count == 0) {
+            wheel->now = target;
+            break;
+        }
+        if (wheel->occupied[0] == 0) {
+            unsigned long turn_end = wheel->now | (WS_TIMER_SLOTS-1);
+            if (turn_end >= target) {
+                wheel->now = target;
+                break;
+            }
+            wheel->now = turn_end;
+        }
+        wheel->now++;
+
+        /* At the start of a turn, bring the next slot of each level whose
+           turn also started down, the highest first */
+        if (slot_index(wheel->now, 0) == 0) {
+            int top = 1;
+            while (top < WS_TIMER_LEVELS-1 && slot_index(wheel->now, top) == 0) top++;
+            for (int level = top; level >= 1; level--) {
+                cascade(wheel, level, slot_index(wheel->now, level));
+            }
+        }
+
+        /* Every timer left in this tick's slot is due now */
+        ws_timer_p *slot = &wheel->slots[0][slot_index(wheel->now, 0)];
+        while (*slot) {
+            ws_timer_p timer = *slot;
+            unlink_timer(wheel, timer);
+            wheel->count--;
+            fire(timer);
+        }
+    }
+}
+
+/* Returns the ms until the wheel next needs advancing (the first timer's
+   tick, or an earlier cascade), or -1 if no timers are pending */
+long ws_timer_next(ws_timer_wheel_p wheel, long now_ms) {
+    if (wheel->count == 0) return -1;
+
+    /* Ticks to the next turn of the lowest level, when higher levels cascade */
+    unsigned long ticks = WS_TIMER_SLOTS - slot_index(wheel->now, 0);
+    unsigned long low = wheel->occupied[0];
+    if (low != 0) {
+        /* Rotate so bit 0 is the slot after now's, then find the first set */
+        int from = (slot_index(wheel->now, 0) + 1) & (WS_TIMER_SLOTS-1);
+        unsigned long long rotated = from == 0 ? low : (low >> from) | (low << (WS_TIMER_SLOTS - from));
+        unsigned long first = __builtin_ctzll(rotated) + 1;
+        unsigned long long higher = 0;
+        for (int level = 1; level < WS_TIMER_LEVELS; level++) higher |= wheel->occupied[level];
+        if (first < ticks || higher == 0) ticks = first;
+    }
+    long ms = (long)((wheel->now + ticks) * WS_TIMER_TICK_MS) - now_ms;
+    return ms > 0 ? ms : 0;
+}
@@ -0,0 +1,76 @@
+/* Simple HTML web server timer wheel header */
+
+/*
+Timer Wheel Overview:
+ -  Timers are kept in a hierarchical timing wheel: WS_TIMER_LEVELS wheels
+    of WS_TIMER_SLOTS slots, where each slot of a level spans a whole turn
+    of the level below, so one tick is WS_TIMER_TICK_MS and the top level
+    reaches days ahead
+ -  A timer goes in the slot of the lowest level its expiry fits, so adding
+    and cancelling one is O(1): a doubly linked list insert or unlink, with
+    no search and no allocation (timers are embedded in what they time)
+ -  Advancing fires the slot of each tick passed; when the lowest level
+    wraps, the next slot up is emptied into the levels below ("cascaded"),
+    so a timer is moved at most once per level before it fires
+ -  Nothing is scanned for timers that don't fire: the loop only needs the
+    time until the first non-empty slot, found from a bitmap of occupied
+    slots per level, to bound its wait
+*/
+
+#ifndef WS_TIMER_H
+#define WS_TIMER_H
+
+/* Define wheel layout */
+#define WS_TIMER_TICK_MS    10 /* Resolution of the wheel */
+#define WS_TIMER_SLOT_BITS  6
+#define WS_TIMER_SLOTS      (1<<WS_TIMER_SLOT_BITS) /* Slots per level, one bitmap word */
+#define WS_TIMER_LEVELS     4  /* 640ms, 41s, 44min and 47h per turn */
+
+/* A timer, embedded in whatever it times */
+struct ws_timer_t {
+    struct ws_timer_t *prev;        /* Previous timer in the slot, NULL if first */
+    struct ws_timer_t *next;        /* Next timer in the slot */
+    struct ws_timer_t **slot;       /* Slot it is in, NULL if not pending */
+    unsigned long expires;          /* Tick it fires at */
+    void *data;                     /* Handed back when it fires */
+};
+typedef struct ws_timer_t ws_timer_t;
+typedef ws_timer_t* ws_timer_p;
+
+/* A wheel of pending timers */
+struct ws_timer_wheel_t {
+    ws_timer_p slots[WS_TIMER_LEVELS][WS_TIMER_SLOTS]; /* Timers by expiry */
+    unsigned long long occupied[WS_TIMER_LEVELS]; /* Bit per non-empty slot */
+    unsigned long now;              /* Last tick advanced to */
+    long count;                     /* Pending timers */
+};
+typedef struct ws_timer_wheel_t ws_timer_wheel_t;
+typedef ws_timer_wheel_t* ws_timer_wheel_p;
+
+/* Called for each timer that fires, after it has been taken off the wheel */
+typedef void (*ws_timer_fire_t)(ws_timer_p timer);
+
+/* Sets up an empty wheel at a time in ms */
+void ws_timer_init(ws_timer_wheel_p wheel, long now_ms);
+
+/* Sets up a timer that isn't pending */
+void ws_timer_setup(ws_timer_p timer, void *data);
+
+/* Returns TRUE if a timer is on the wheel */
+#define ws_timer_pending(timer) ((timer)->slot != NULL)
+
+/* (Re)schedules a timer to fire at a time in ms, rounded up to a tick */
+void ws_timer_set(ws_timer_wheel_p wheel, ws_timer_p timer, long when_ms);
+
+/* Takes a timer off the wheel, if it is on it */
+void ws_timer_cancel(ws_timer_wheel_p wheel, ws_timer_p timer);
+
+/* Fires every timer due by a time in ms, in order of their ticks. fire may
+   set or cancel any timer */
+void ws_timer_advance(ws_timer_wheel_p wheel, long now_ms, ws_timer_fire_t fire);
+
+/* Returns the ms until the wheel next needs advancing (the first timer's
+   tick, or an earlier cascade), or -1 if no timers are pending */
+long ws_timer_next(ws_timer_wheel_p wheel, long now_ms);
+
+#endif
@@ -0,0 +1,277 @@
+/* Simple HTML web server TLS */
+#include <stdio.h>          /* NULL */
+#include <string.h>         /* ALPN compares */
+#include <errno.h>          /* Error handling */
+#include "ws-tls.h"         /* TLS consts */
+#include "ws-event.h"       /* Readiness to wait for */
+#ifdef WS_HAVE_TLS
+#include <openssl/ssl.h>    /* TLS connections */
+#include <openssl/err.h>    /* Error queue */
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE (!TRUE)
+#endif
+
+#ifdef WS_HAVE_TLS
+/* Context every worker's connections are made from, read-only once set up */
+static SSL_CTX *ctx = NULL;
+
+/* Returns TRUE if the server was built with TLS */
+int ws_tls_supported(void) {
+    return TRUE;
+}
+
+/* Picks h2 when the client offers it, or else http/1.1 */
+static int select_alpn(SSL *tls, const unsigned char **out, unsigned char *out_len,
+        const unsigned char *in, unsigned int in_len, void *arg) {
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    if (SSL_select_next_proto((unsigned char **)out, out_len, protos, sizeof(protos) - 1,
+            in, in_len) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+/* Loads a certificate chain and its key into the shared context */
+int ws_tls_init(const char *cert, const char *key, int ktls, int h2) {
+    ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == NULL) {
+        ERR_print_errors_fp(stderr);
+        errno = ENOMEM;
+        return -1;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    /* Peers closing without close_notify just close (the length of every
+       response is framed anyway), and renegotiation would make a read
+       wait on a write */
+    long options = SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_RENEGOTIATION
+        | SSL_OP_IGNORE_UNEXPECTED_EOF;
+#ifdef SSL_OP_ENABLE_KTLS
+    if (ktls) {
+        options |= SSL_OP_ENABLE_KTLS;
+    }
+#endif
+    SSL_CTX_set_options(ctx, options);
+
+    /* Writes may stop after any record and be retried from a moved buffer,
+       and idle connections give their record buffers back */
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+        | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+    /* Tickets are sealed with the context's keys, so any worker resumes
+       them; one per handshake is all a client reconnecting needs */
+    SSL_CTX_set_num_tickets(ctx, 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, WS_TLS_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, WS_TLS_TIMEOUT);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"ws", 2);
+    if (h2) {
+        SSL_CTX_set_alpn_select_cb(ctx, select_alpn, NULL);
+    }
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1
+            || SSL_CTX_use_PrivateKey_file(ctx, key ? key : cert, SSL_FILETYPE_PEM) != 1
+            || SSL_CTX_check_private_key(ctx) != 1) {
+        ERR_print_errors_fp(stderr);
+        ws_tls_free();
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Frees the shared context */
+void ws_tls_free(void) {
+    SSL_CTX_free(ctx);
+    ctx = NULL;
+}
+
+/* Starts the server side of a connection on a socket */
+struct ssl_st *ws_tls_accept(int socket) {
+    SSL *tls = SSL_new(ctx);
+    if (tls == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (SSL_set_fd(tls, socket) != 1) {
+        SSL_free(tls);
+        errno = ENOMEM;
+        return NULL;
+    }
+    SSL_set_accept_state(tls);
+    return tls;
+}
+
+/* Turns an OpenSSL failure into errno. Returns 0 if the peer closed, or -1 */
+static int tls_failed(SSL *tls, int ret, int *want) {
+    switch (SSL_get_error(tls, ret)) {
+        case SSL_ERROR_WANT_READ:
+            *want = WS_EV_READ;
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_WANT_WRITE:
+            *want = WS_EV_WRITE;
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        case SSL_ERROR_SYSCALL:
+            /* errno is the failed call's */
+            if (errno == 0) errno = EIO;
+            return -1;
+        default:
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+/* Continues a connection's handshake */
+int ws_tls_handshake(struct ssl_st *tls, int *want) {
+    ERR_clear_error();
+    errno = 0;
+    int ret = SSL_do_handshake(tls);
+    if (ret == 1) return 0;
+    if (tls_failed(tls, ret, want) == 0) {
+        errno = ECONNRESET;
+    }
+    return -1;
+}
+
+/* Reads decrypted bytes */
+ssize_t ws_tls_read(struct ssl_st *tls, char *buf, size_t len, int *want) {
+    size_t n;
+    ERR_clear_error();
+    errno = 0;
+    int ret = SSL_read_ex(tls, buf, len, &n);
+    if (ret == 1) return n;
+    return tls_failed(tls, ret, want);
+}
+
+/* Encrypts and writes bytes, at most a record at a time */
+ssize_t ws_tls_write(struct ssl_st *tls, const char *buf, size_t len, int *want) {
+    size_t n;
+    ERR_clear_error();
+    errno = 0;
+    int ret = SSL_write_ex(tls, buf, len < WS_TLS_RECORD ? len : WS_TLS_RECORD, &n);
+    if (ret == 1) return n;
+    if (tls_failed(tls, ret, want) == 0) {
+        errno = EPIPE;
+    }
+    return -1;
+}
+
+/* Returns TRUE if the kernel encrypts what is written to the socket */
+int ws_tls_ktls(struct ssl_st *tls) {
+    return BIO_get_ktls_send(SSL_get_wbio(tls)) ? TRUE : FALSE;
+}
+
+/* Returns TRUE if the handshake resumed an earlier session */
+int ws_tls_resumed(struct ssl_st *tls) {
+    return SSL_session_reused(tls) ? TRUE : FALSE;
+}
+
+/* Returns TRUE if the client picked HTTP/2 through ALPN */
+int ws_tls_h2(struct ssl_st *tls) {
+    const unsigned char *proto;
+    unsigned int len;
+    SSL_get0_alpn_selected(tls, &proto, &len);
+    return len == 2 && memcmp(proto, "h2", 2) == 0;
+}
+
+/* Returns the protocol version agreed */
+const char *ws_tls_version(struct ssl_st *tls) {
+    return SSL_get_version(tls);
+}
+
+/* Returns the cipher agreed */
+const char *ws_tls_cipher(struct ssl_st *tls) {
+    return SSL_get_cipher_name(tls);
+}
+
+/* Returns OpenSSL's reason for the last failure on this thread */
+const char *ws_tls_error(void) {
+    const char *reason = ERR_reason_error_string(ERR_peek_last_error());
+    return reason ? reason : "connection failed";
+}
+
+/* Sends close_notify if it can without blocking, and frees a connection */
+void ws_tls_close(struct ssl_st *tls) {
+    if (SSL_is_init_finished(tls)) {
+        SSL_shutdown(tls);
+    }
+    ERR_clear_error();
+    SSL_free(tls);
+}
+
+#else
+
+/* Returns TRUE if the server was built with TLS */
+int ws_tls_supported(void) {
+    return FALSE;
+}
+
+/* Fails, there is no TLS to set up */
+int ws_tls_init(const char *cert, const char *key, int ktls, int h2) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+/* Frees nothing */
+void ws_tls_free(void) {
+}
+
+/* Fails, no connection can be made */
+struct ssl_st *ws_tls_accept(int socket) {
+    errno = ENOTSUP;
+    return NULL;
+}
+
+/* The rest are never reached without a connection */
+int ws_tls_handshake(struct ssl_st *tls, int *want) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t ws_tls_read(struct ssl_st *tls, char *buf, size_t len, int *want) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+ssize_t ws_tls_write(struct ssl_st *tls, const char *buf, size_t len, int *want) {
+    errno = ENOTSUP;
+    return -1;
+}
+
+int ws_tls_ktls(struct ssl_st *tls) {
+    return FALSE;
+}
+
+int ws_tls_resumed(struct ssl_st *tls) {
+    return FALSE;
+}
+
+int ws_tls_h2(struct ssl_st *tls) {
+    return FALSE;
+}
+
+const char *ws_tls_version(struct ssl_st *tls) {
+    return "none";
+}
+
+const char *ws_tls_cipher(struct ssl_st *tls) {
+    return "none";
+}
+
+const char *ws_tls_error(void) {
+    return "built without TLS";
+}
+
+void ws_tls_close(struct ssl_st *tls) {
+}
+
+#endif
@@ -0,0 +1,89 @@
+/* Simple HTML web server TLS header */
+
+/*
+TLS Overview:
+ -  With a certificate (--cert, --key), every worker also listens on the
+    HTTPS port (-P) with its own SO_REUSEPORT socket, and clients accepted
+    there shake hands (OpenSSL, TLS 1.2 or 1.3) in the loop like any other
+    step, without blocking, before their first request is read
+ -  Resumed handshakes skip the certificate and key exchange: TLS 1.3 and
+    ticket-capable TLS 1.2 clients get a session ticket, sealed with keys
+    every worker shares, and older TLS 1.2 clients a session id kept in a
+    shared cache
+ -  Once the handshake is done, OpenSSL hands the session's keys to the
+    kernel (kTLS) when it can, and every write to the socket becomes a TLS
+    record there: responses go out through sendmsg() and sendfile() as on
+    plain connections, file bodies without ever being copied to user space
+ -  Without kTLS (no tls module, an unsupported cipher, or --no-ktls)
+    responses are encrypted in user space, gathering the header and the
+    start of the body into one record, and files are read through the
+    buffer like with -b
+ -  Clients offering h2 through ALPN get HTTP/2 (see ws-h2.h) unless it is
+    turned off, the rest HTTP/1.1
+ -  Requests are always read through OpenSSL, which reads through the
+    kernel itself when it took over receiving too
+ -  Which of this exists depends on the server being built with OpenSSL
+*/
+
+#ifndef WS_TLS_H
+#define WS_TLS_H
+
+#include <stddef.h>         /* size_t */
+#include <sys/types.h>      /* ssize_t */
+
+struct ssl_st; /* OpenSSL connection, only used through this file */
+
+/* Define misc */
+#define WS_TLS_RECORD      (1<<14) /* Largest plaintext of one TLS record */
+#define WS_TLS_CACHE_SIZE  20480 /* Sessions kept for TLS 1.2 resumption by id */
+#define WS_TLS_TIMEOUT     7200 /* Seconds a session can be resumed for */
+
+/* Returns TRUE if the server was built with TLS */
+int ws_tls_supported(void);
+
+/* Loads a certificate chain and its key (in the same file if key is NULL)
+   into the context every worker shares, asking for kTLS when ktls is TRUE
+   and offering h2 through ALPN when h2 is.
+   Returns 0 or -1 with errno set, printing OpenSSL's reason to stderr */
+int ws_tls_init(const char *cert, const char *key, int ktls, int h2);
+
+/* Frees the shared context */
+void ws_tls_free(void);
+
+/* Starts the server side of a connection on a socket, or returns NULL */
+struct ssl_st *ws_tls_accept(int socket);
+
+/* Continues a connection's handshake. Returns 0 once it is done, or -1
+   with errno set: EAGAIN with the WS_EV_* flag to wait for in want */
+int ws_tls_handshake(struct ssl_st *tls, int *want);
+
+/* Reads decrypted bytes. Returns bytes read, 0 once the peer closed, or -1
+   with errno set: EAGAIN with the WS_EV_* flag to wait for in want */
+ssize_t ws_tls_read(struct ssl_st *tls, char *buf, size_t len, int *want);
+
+/* Encrypts and writes bytes, at most a record at a time. Returns bytes
+   written, or -1 with errno set: EAGAIN with the flag to wait for in want,
+   after which it must be retried with the same bytes */
+ssize_t ws_tls_write(struct ssl_st *tls, const char *buf, size_t len, int *want);
+
+/* Returns TRUE if the kernel encrypts what is written to the socket */
+int ws_tls_ktls(struct ssl_st *tls);
+
+/* Returns TRUE if the handshake resumed an earlier session */
+int ws_tls_resumed(struct ssl_st *tls);
+
+/* Returns TRUE if the client picked HTTP/2 through ALPN */
+int ws_tls_h2(struct ssl_st *tls);
+
+/* Returns the protocol version and cipher agreed, for the log */
+const char *ws_tls_version(struct ssl_st *tls);
+const char *ws_tls_cipher(struct ssl_st *tls);
+
+/* Returns OpenSSL's reason for the last failure on this thread */
+const char *ws_tls_error(void);
+
+/* Sends close_notify if it can without blocking, and frees a connection.
+   The socket is left open */
+void ws_tls_close(struct ssl_st *tls);
+
+#endif